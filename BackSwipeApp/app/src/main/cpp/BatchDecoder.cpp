@@ -0,0 +1,77 @@
+//
+// Decodes batches of recorded gestures in parallel.
+//
+#include "BatchDecoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include "internal/touch-sequence.h"
+
+namespace keyboard {
+namespace decoder {
+
+    namespace {
+
+        double MillisSince(const std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+        }
+
+        // Returns the given (nearest-rank) percentile of the sorted values.
+        double Percentile(const vector<double>& sorted_values, const double percentile) {
+            if (sorted_values.empty()) {
+                return 0;
+            }
+            const int rank = static_cast<int>(percentile / 100 * sorted_values.size() + 0.5);
+            return sorted_values[std::max(0, std::min<int>(rank, sorted_values.size()) - 1)];
+        }
+
+    }  // namespace
+
+    BatchDecoder::BatchDecoder(std::shared_ptr<const DecoderModel> model,
+                               const int num_threads)
+            : pool_(num_threads), sessions_() {
+        for (int i = 0; i < num_threads; ++i) {
+            sessions_.emplace_back(new DecoderSession(model));
+        }
+    }
+
+    vector<vector<DecoderResult>> BatchDecoder::DecodeBatch(
+            const GestureInputSpan& inputs, BatchDecodeStats* stats) {
+        vector<vector<DecoderResult>> results(inputs.size());
+        vector<double> latencies_ms(inputs.size());
+        const auto batch_start = std::chrono::steady_clock::now();
+
+        // Each worker decodes the next gesture that has not been claimed yet, so
+        // that a few long gestures do not hold up the whole batch.
+        std::atomic<int> next_input(0);
+        pool_.Run(sessions_.size(), [&](const int worker) {
+            DecoderSession* session = sessions_[worker].get();
+            for (int i = next_input++; i < inputs.size(); i = next_input++) {
+                const GestureInput& input = inputs[i];
+                const auto start = std::chrono::steady_clock::now();
+                results[i] = session->DecodeTouch(
+                        new TouchSequence(input.xs, input.ys, input.times,
+                                          /* pointer_id = */ 0, input.sample_dist),
+                        input.prev_word, input.time_budget_ms);
+                latencies_ms[i] = MillisSince(start);
+            }
+        });
+
+        if (stats != nullptr) {
+            stats->gesture_count = inputs.size();
+            stats->wall_time_ms = MillisSince(batch_start);
+            stats->gestures_per_second =
+                    stats->wall_time_ms > 0 ? inputs.size() * 1000 / stats->wall_time_ms : 0;
+            std::sort(latencies_ms.begin(), latencies_ms.end());
+            stats->p50_latency_ms = Percentile(latencies_ms, 50);
+            stats->p95_latency_ms = Percentile(latencies_ms, 95);
+            stats->p99_latency_ms = Percentile(latencies_ms, 99);
+        }
+        return results;
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,109 @@
+//
+// Decodes batches of recorded gestures in parallel, e.g. for replaying the
+// phrase sets (t_20 ... t_160, sentence_test) in offline evaluations. A fixed
+// pool of worker threads, each with its own DecoderSession, decodes the
+// gestures against a single shared DecoderModel.
+//
+
+#ifndef SIMPLEGESTUREINPUT_BATCHDECODER_H
+#define SIMPLEGESTUREINPUT_BATCHDECODER_H
+
+#include <memory>
+#include <vector>
+
+#include "GestureDecoder.h"
+#include "internal/base/macros.h"
+#include "internal/decoder-model.h"
+#include "internal/decoder-result.h"
+#include "internal/worker-pool.h"
+
+namespace keyboard {
+namespace decoder {
+
+    // A recorded gesture to decode.
+    struct GestureInput {
+        vector<int> xs;
+        vector<int> ys;
+        vector<int> times;
+
+        // The minimum distance between the sampled points, in pixels (see
+        // TouchSequence).
+        float sample_dist = 26;
+
+        // The word preceding the gesture, if any.
+        Utf8String prev_word;
+
+        // The time budget for decoding the gesture, or 0 for no budget (see
+        // DecoderSession::DecodeTouch).
+        float time_budget_ms = 0;
+    };
+
+    // A non-owning view of a batch of gestures.
+    class GestureInputSpan {
+    public:
+        GestureInputSpan(const GestureInput* data, const int size)
+                : data_(data), size_(size) {}
+        GestureInputSpan(const vector<GestureInput>& inputs)  // NOLINT
+                : data_(inputs.data()), size_(inputs.size()) {}
+
+        const GestureInput* begin() const { return data_; }
+        const GestureInput* end() const { return data_ + size_; }
+        const GestureInput& operator[](const int i) const { return data_[i]; }
+        int size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+    private:
+        const GestureInput* data_;
+        int size_;
+    };
+
+    // The throughput and latency of a batch.
+    struct BatchDecodeStats {
+        int gesture_count = 0;
+
+        // The wall time for decoding the whole batch.
+        double wall_time_ms = 0;
+
+        double gestures_per_second = 0;
+
+        // Percentiles of the time for decoding a single gesture, measured by the
+        // worker that decoded it.
+        double p50_latency_ms = 0;
+        double p95_latency_ms = 0;
+        double p99_latency_ms = 0;
+    };
+
+    class BatchDecoder {
+    public:
+        // Creates a decoder with num_threads worker threads (including the calling
+        // thread), each with its own session for the given model. Since every
+        // worker already has its own core, the sessions should not also expand
+        // their beams in parallel (see DecoderParams::beam_expansion_threads).
+        BatchDecoder(std::shared_ptr<const DecoderModel> model, int num_threads);
+
+        // Decodes the given gestures. The model must not be modified meanwhile.
+        //
+        // Args:
+        //   inputs  - The gestures to decode.
+        //   stats   - If not null, set to the throughput and latency of the batch.
+        //
+        // Returns:
+        //   The N-best results for each gesture, in the order of the inputs.
+        vector<vector<DecoderResult>> DecodeBatch(const GestureInputSpan& inputs,
+                                                  BatchDecodeStats* stats);
+
+        int num_threads() const { return sessions_.size(); }
+
+    private:
+        WorkerPool pool_;
+
+        // The session of each worker, indexed by the worker's task index.
+        vector<std::unique_ptr<DecoderSession>> sessions_;
+
+        DISALLOW_COPY_AND_ASSIGN(BatchDecoder);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif //SIMPLEGESTUREINPUT_BATCHDECODER_H
@@ -2,6 +2,10 @@
 // Created by wenzhe on 4/9/20.
 //
 #include "GestureDecoder.h"
+
+#include <chrono>
+#include <limits>
+
 #include "internal/lexicon-interface.h"
 #include "internal/language-model-interface.h"
 #include "internal/touch-sequence.h"
@@ -15,31 +19,6 @@
 //using keyboard::decoder::TouchSequence;
 namespace keyboard {
 namespace decoder {
-    bool StringVectorEquals(const vector<Utf8String>& v1,
-                            const vector<Utf8String>& v2) {
-        if (v1.size() != v2.size()) return false;
-        // Starts comparison from the back, because decoded results trend to have the
-        // same prefix.
-        for (int i = static_cast<int>(v1.size()) - 1; i >= 0; --i) {
-            if (v1[i] != v2[i]) {
-                return false;
-            }
-        }
-        return true;
-    }
-
-    void AddResultIfBetter(const DecoderResult& result,
-                           vector<DecoderResult>* results) {
-        for (auto& old_result : *results) {
-            if (result.word() == old_result.word()) {
-                if (result.score() > old_result.score()) {
-                    old_result = result;
-                }
-                return;
-            }
-        }
-        results->push_back(result);
-    }
     // Comparator that orders nodes by increasing prefix logp.
     struct OrderByPrefixProb {
         bool operator()(const CodepointNode& left, const CodepointNode& right) {
@@ -58,52 +37,55 @@ namespace decoder {
         }
     };
 
-    GestureDecoder::GestureDecoder(bool isTest):
-                                                touch_sequence_(),
-
-                                                preceding_text_(),
-                                                following_text_(),
-                                                search_space_(),
-                                                search_space_token_pool_(new TokenPool(params_.token_pool_capacity)),
-                                                best_score_(NEG_INF),
-                                                decoded_index_(0),
-                                                word_histories_(),
-                                                next_word_history_id_(0),
-                                                top_tokens_set_(),
-                                                temp_scores_(),
-                                                active_beam_min_score_(NEG_INF),
-                                                codes_to_keys_map_(),
-                                                root_token_cache_(nullptr),
-                                                next_word_predictions_() {
-        //params_(decoder->params()),
-
-    }
-
-    void GestureDecoder::setMainParams(LoudsLmParams params) {
-        main_lm_params = params;
-
+    DecoderSession::DecoderSession(std::shared_ptr<const DecoderModel> model)
+            : model_(std::move(model)),
+              params_(model_->params()),
+              lm_scorers_(),
+              preceding_text_(),
+              following_text_(),
+              root_token_cache_(nullptr),
+              arena_(),
+              search_space_token_pool_(
+                      new TokenPool(params_.token_pool_capacity, &arena_)),
+              search_space_(params_.token_pool_capacity),
+              children_cache_(&arena_, model_->children_cache()),
+              active_beam_min_score_(NEG_INF),
+              temp_scores_(),
+              score_histogram_(kScoreHistogramBucketWidth, kScoreHistogramBuckets),
+              search_space_scores_(),
+              top_tokens_(),
+              top_tokens_set_(),
+              expansion_pool_(),
+              expansion_slices_(),
+              best_score_(NEG_INF),
+              search_stats_(),
+              active_beam_width_(params_.active_beam_width),
+              score_to_beat_offset_(params_.score_to_beat_offset),
+              time_budget_ms_(0),
+              ms_per_point_(0),
+              deadline_stats_(),
+              decoded_index_(-1),
+              word_histories_(),
+              term_ids_(),
+              term_pieces_(),
+              reentry_terminals_(),
+              end_of_input_tokens_(),
+              terminal_scores_(),
+              result_indices_(),
+              batch_order_(),
+              candidate_term_ids_(),
+              candidate_pieces_(),
+              candidate_logps_(),
+              scorer_logps_(),
+              candidate_probs_(),
+              touch_sequence_(),
+              next_word_predictions_() {
+        CreateLanguageModelScorers();
     }
 
-    void GestureDecoder::RecreateDecoderForActiveLms() {
-        std::vector<std::pair<const LanguageModelInterface *, float>> weighted_lms;
-        for (auto &entry : static_lexicons_) {
-            lexicon_interfaces_.push_back(entry.second);
-        }
-        for (auto &entry : static_lms_) {
-            weighted_lms.push_back(
-                    {entry.second.get(), params_.static_lm_interpolation_weight});
-        }
-        //TODO: Implement DynamicLM - Wenzhe
-        interpolated_lm_.reset(new InterpolatedLm(weighted_lms));
-        lm_interfaces_.push_back(interpolated_lm_.get());
-
-//    std::unique_ptr<DecoderInterface>(new Decoder(params, lexicons, lms));
-//    ResetAllDecoderSessions();
-        if (lexicon_interfaces_.size() > params_.kMaxLexicons) {
-            lexicon_interfaces_.resize(params_.kMaxLexicons);
-        }
-
-        for (auto lm : lm_interfaces_) {
+    void DecoderSession::CreateLanguageModelScorers() {
+        lm_scorers_.clear();
+        for (auto lm : model_->lms()) {
             LanguageModelScorerInterface *scorer =
                     lm->NewScorerOrNull(preceding_text_, following_text_);
             if (scorer != nullptr) {
@@ -111,68 +93,243 @@ namespace decoder {
                         std::unique_ptr<LanguageModelScorerInterface>(scorer));
             }
         }
-
     }
 
-    void GestureDecoder::AddLexiconAndLm(const std::string &lm_name, LexiconInterface *lexicon,
-                                         std::unique_ptr<LanguageModelInterface> lm) {
-        // Acquire a write lock before adding the LM.
-        if (lexicon != nullptr) {
-            static_lexicons_[lm_name] = lexicon;
-        }
-        if (lm != nullptr) {
-            static_lms_[lm_name] = std::move(lm);
+    void DecoderSession::SetPrecedingText(const Utf8String& preceding_text) {
+        if (preceding_text == preceding_text_) {
+            return;
         }
+        preceding_text_ = preceding_text;
+        CreateLanguageModelScorers();
+        // The next word predictions were made for the previous preceding text.
+        next_word_predictions_.clear();
     }
 
-    vector<DecoderResult> GestureDecoder::DecodeTouch(TouchSequence* touch_sequence, Utf8String prev) {
-        vector<DecoderResult> unfiltered_results;
-        vector<DecoderResult>* results = &unfiltered_results;
+    vector<DecoderResult> DecoderSession::DecodeTouch(TouchSequence* touch_sequence, Utf8String prev) {
+        return DecodeTouch(touch_sequence, prev, /* time_budget_ms = */ 0);
+    }
+
+    vector<DecoderResult> DecoderSession::DecodeTouch(TouchSequence* touch_sequence,
+                                                      Utf8String prev,
+                                                      const float time_budget_ms) {
+        SetPrecedingText(prev);
         bool session_three_decoder_enabled = false;
-        touch_sequence->UpdateProperties(*gesture_keyboard_, params_, session_three_decoder_enabled);
+        touch_sequence->UpdateProperties(*keyboard(), params_, session_three_decoder_enabled);
         if (touch_sequence->size() == 0) {
             map<Utf8String, LogProbFloat> predictions;
-            PredictNextTerm({prev}, params_.num_suggestions_to_return, &predictions);
+            PredictNextTerm({}, params_.num_suggestions_to_return, &predictions);
         }
+        ResetSearchSpace();
         touch_sequence_.reset(touch_sequence);
+        if (!AddRootTokenToSearchSpace()) {
+            return {};
+        }
+        const int end = touch_sequence->size();
+        deadline_stats_ = DecodeDeadlineStats();
+        deadline_stats_.time_budget_ms = time_budget_ms;
+        deadline_stats_.point_count = end;
+        time_budget_ms_ = time_budget_ms;
+        DecodeTouchPointsUpTo(end);
+        time_budget_ms_ = 0;
+        return ExtractResults(decoded_index_ + 1);
+    }
+
+    void DecoderSession::StartGesture(const Utf8String& prev) {
+        SetPrecedingText(prev);
+        ResetSearchSpace();
+        if (touch_sequence_ != nullptr && touch_sequence_->is_gesture()) {
+            // Reuse the score matrices of the previous gesture.
+            touch_sequence_->Clear();
+        } else {
+            touch_sequence_.reset(new TouchSequence(/* is_gesture = */ true));
+        }
+        AddRootTokenToSearchSpace();
+    }
+
+    vector<DecoderResult> DecoderSession::ExtendGesture(const vector<int>& xs,
+                                                        const vector<int>& ys,
+                                                        const vector<int>& times,
+                                                        const float sample_dist,
+                                                        const bool is_final) {
+        if (touch_sequence_ == nullptr) {
+            // No gesture was started, so keep the current preceding text.
+            StartGesture(preceding_text_);
+        }
+        touch_sequence_->ExtendTouchPoints(xs, ys, times, is_final, sample_dist);
+        bool session_three_decoder_enabled = false;
+        touch_sequence_->UpdateProperties(*keyboard(), params_,
+                                          session_three_decoder_enabled);
+        if (search_space_.empty()) {
+            // There were no root nodes, so there is nothing to decode.
+            return {};
+        }
+        const int end = is_final ? touch_sequence_->size()
+                                 : touch_sequence_->StablePointCount();
+        if (end <= 0) {
+            return {};
+        }
+        DecodeTouchPointsUpTo(end);
+        return ExtractResults(end);
+    }
+
+    void DecoderSession::ResetSearchSpace() {
+        // The tokens and children of the previous decode are all allocated from the
+        // arena, so they are released at once.
+        search_space_.clear();
+        children_cache_.Clear();
+        search_space_token_pool_->Reset();
+        arena_.Reset();
+        for (auto& slice : expansion_slices_) {
+            slice->entry_candidates.clear();
+            slice->candidate_entries.clear();
+            slice->candidates.clear();
+            slice->extracted_children.clear();
+            slice->candidate_pool.Reset();
+            slice->arena.Reset();
+        }
+        top_tokens_.clear();
+        top_tokens_set_.clear();
+        word_histories_.Clear();
+        next_word_predictions_.clear();
+        best_score_ = NEG_INF;
+        active_beam_min_score_ = NEG_INF;
+        active_beam_width_ = params_.active_beam_width;
+        score_to_beat_offset_ = params_.score_to_beat_offset;
+        decoded_index_ = -1;
+    }
+
+    bool DecoderSession::AddRootTokenToSearchSpace() {
         Token* root = NewSearchToken();
         if (root == nullptr) {
             // Could not allocate a root token from the token pool. This should not
             // happen in practice.
-            return unfiltered_results;
+            return false;
         }
         GetRootToken(root);
-        if (root->nodes()->size() == 0) {
+        if (root->nodes().empty()) {
             // There were no root nodes (which can happen when the decoder has no
-            // lexicons). Return without populating any results.
+            // lexicons).
             search_space_token_pool_->ReleasePooledToken(root);
-            return unfiltered_results;
+            return false;
         }
         AddSearchTokenToSearchSpace(root);
-        int start = 0;
-        int end = touch_sequence->size();
-
-        // If decoding for the session so far has already been performed, there is
-        // nothing to do.  Otherwise, decode incremental input.
-        // search_space_ is empty initially; and will be filled with tokens
-        // obtained in the following steps (mostly ProcessNextTouchPoint()).
-        if (start < end) {
-            // Decode the input into a set of candidates.
-            for (int i = start; i < end; ++i) {
+        return true;
+    }
+
+    void DecoderSession::DecodeTouchPointsUpTo(const int end) {
+        // search_space_ initially only holds the root token, and will be filled
+        // with tokens obtained in the following steps (mostly
+        // ProcessNextTouchPoint()). When extending a gesture, only the points added
+        // since the last call need to be processed.
+        if (time_budget_ms_ <= 0) {
+            for (int i = decoded_index_ + 1; i < end; ++i) {
                 ProcessNextTouchPoint(i);
             }
-            for (auto& entry : search_space_) {
-                entry.second->AdvanceToNextAlignment();
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const auto elapsed_ms = [&start]() {
+            return std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+        };
+        deadline_stats_.min_beam_width = active_beam_width_;
+        deadline_stats_.max_beam_width = active_beam_width_;
+        const int begin = decoded_index_ + 1;
+        ms_per_point_ = 0;
+        for (int i = begin; i < end; ++i) {
+            const double point_start_ms = elapsed_ms();
+            // Always decode the first point, so that there are results to return.
+            if (i > 0 && point_start_ms >= time_budget_ms_) {
+                deadline_stats_.deadline_reached = true;
+                break;
             }
+            ProcessNextTouchPoint(i);
+            const double point_end_ms = elapsed_ms();
+            AdaptBeamToTimeBudget(i + 1 - begin, end - i - 1,
+                                  point_end_ms - point_start_ms, point_end_ms);
+        }
+        deadline_stats_.decode_time_ms = elapsed_ms();
+        deadline_stats_.points_decoded = decoded_index_ + 1;
+        deadline_stats_.final_beam_width = active_beam_width_;
+        deadline_stats_.final_score_to_beat_offset = score_to_beat_offset_;
+    }
+
+    void DecoderSession::AdaptBeamToTimeBudget(const int points_decoded,
+                                               const int points_left,
+                                               const double point_ms,
+                                               const double elapsed_ms) {
+        if (points_decoded <= kMinPointsToAdaptBeam) {
+            return;
+        }
+        // Project the time of the remaining points from a moving average of the
+        // time per point, which follows the changes of the beam width.
+        ms_per_point_ = ms_per_point_ == 0
+                        ? point_ms
+                        : kPointTimeSmoothing * point_ms +
+                          (1 - kPointTimeSmoothing) * ms_per_point_;
+        if (points_left <= 0) {
+            return;
         }
+        const double projected_ms = elapsed_ms + ms_per_point_ * points_left;
+        int beam_width = active_beam_width_;
+        if (projected_ms > time_budget_ms_ &&
+            beam_width > params_.min_adaptive_beam_width) {
+            // Narrow the beam by the projected overrun, but at most by half at a time.
+            const double ratio = std::max(
+                    0.5, (time_budget_ms_ - elapsed_ms) / (ms_per_point_ * points_left));
+            beam_width = std::max(params_.min_adaptive_beam_width,
+                                  static_cast<int>(beam_width * ratio));
+            ++deadline_stats_.beam_shrinks;
+        } else if (projected_ms < time_budget_ms_ * kGrowBeamBelowBudgetRatio &&
+                   beam_width < params_.max_adaptive_beam_width &&
+                   static_cast<int>(top_tokens_.size()) >= beam_width) {
+            // Only widen a full beam, since a wider beam that is not filled does not
+            // change the search.
+            beam_width = std::min(params_.max_adaptive_beam_width,
+                                  beam_width + std::max(1, beam_width / 4));
+            ++deadline_stats_.beam_grows;
+        }
+        active_beam_width_ = beam_width;
+        // Narrow the score_to_beat_offset band along with the beam, down to half of
+        // its width, but do not widen it beyond the configured one.
+        float band_ratio =
+                std::min(1.0f, static_cast<float>(beam_width) / params_.active_beam_width);
+        if (band_ratio < kMinScoreToBeatOffsetRatio) {
+            band_ratio = kMinScoreToBeatOffsetRatio;
+        }
+        score_to_beat_offset_ = params_.score_to_beat_offset * band_ratio;
+        deadline_stats_.min_beam_width =
+                std::min(deadline_stats_.min_beam_width, beam_width);
+        deadline_stats_.max_beam_width =
+                std::max(deadline_stats_.max_beam_width, beam_width);
+    }
+
+    vector<DecoderResult> DecoderSession::ExtractResults(const int end) {
+        vector<DecoderResult> unfiltered_results;
+        vector<DecoderResult>* results = &unfiltered_results;
 
         // Extract and re-score the top prefixes and populate the results vector.
+        // The tokens still hold their alignment to point end - 1 as their next
+        // alignment, so advance a copy of each token rather than the token itself.
         TokenBeam top_prefixes(params_.prefix_beam_width);
+        result_indices_.clear();
+        end_of_input_tokens_.clear();
         for (auto& entry : search_space_) {
-            if (entry.second->index() == end - 1) {
-                ProcessEndOfInput(entry.second, results, &top_prefixes);
+            Token token = *entry.second;
+            if (end > 0) {
+                token.AdvanceToNextAlignment();
+            }
+            if (token.index() == end - 1) {
+                end_of_input_tokens_.push_back(token);
             }
         }
+        // Score the terminals together, so that the LM looks up each of their word
+        // histories once.
+        GetConditionalLanguageModelScores(end_of_input_tokens_, &terminal_scores_);
+        for (size_t i = 0; i < end_of_input_tokens_.size(); ++i) {
+            ProcessEndOfInput(&end_of_input_tokens_[i], terminal_scores_[i], results,
+                              &top_prefixes);
+        }
 
         // Transform prefixes into their completions, if necessary.
         ProcessPrefixCompletions(&top_prefixes, results);
@@ -185,22 +342,11 @@ namespace decoder {
             results->resize(params_.num_suggestions_to_return);
         }
 
-        unfiltered_results = SuppressUppercaseResults(unfiltered_results,
-                                                      params_.uppercase_suppression_score_threshold);
-
-        for(DecoderResult res: unfiltered_results){
-            std::string word = res.word();
-        }
-
-        const float autocorrect_threshold =
-                params_.autocorrect_threshold_base +
-                touch_sequence->size() *
-                params_.autocorrect_threshold_adjustment_per_tap;
-
-        return unfiltered_results;
+        return SuppressUppercaseResults(unfiltered_results,
+                                        params_.uppercase_suppression_score_threshold);
     }
 
-    void GestureDecoder::PredictNextTerm(const vector<Utf8StringPiece> &decoded_terms,
+    void DecoderSession::PredictNextTerm(const vector<Utf8StringPiece> &decoded_terms,
                                          int max_predictions,
                                          std::map<Utf8String, LogProbFloat> *top_predictions) {
         for (auto& scorer : lm_scorers_) {
@@ -219,10 +365,10 @@ namespace decoder {
         }
     };
 
-    void GestureDecoder::GetRootToken(Token* token) {
+    void DecoderSession::GetRootToken(Token* token) {
         if (root_token_cache_ == nullptr) {
             vector<CodepointNode> root_nodes;
-            for (const auto* lexicon : lexicon_interfaces_) {
+            for (const auto* lexicon : model_->lexicons()) {
                 root_nodes.push_back(CodepointNode::GetRootNode(lexicon));
             }
             root_token_cache_.reset(new Token());
@@ -231,15 +377,45 @@ namespace decoder {
         *token = *root_token_cache_;
     }
 
-    void GestureDecoder::AddSearchTokenToSearchSpace(Token *token) {
+    ChildGroupSpan DecoderSession::GetChildren(Token* token) {
+        if (token->children_id() == Token::kNoChildren) {
+            token->set_children_id(children_cache_.GetChildrenId(token->nodes()));
+        }
+        return children_cache_.children(token->children_id());
+    }
+
+    ChildGroupSpan DecoderSession::GetChildren(const Token& token,
+                                               BeamExpansionSlice* slice) const {
+        if (token.children_id() != Token::kNoChildren) {
+            return children_cache_.children(token.children_id());
+        }
+        const CodepointNodeSpan nodes = token.nodes();
+        ChildGroupSpan children;
+        if (children_cache_.Find(nodes, &children)) {
+            ++slice->children_cache_stats.session_hits;
+            return children;
+        }
+        const LexiconChildrenCache* shared_cache = model_->children_cache();
+        if (shared_cache != nullptr && nodes.size() == 1 &&
+            shared_cache->Find(nodes[0], &children)) {
+            ++slice->children_cache_stats.shared_hits;
+            return children;
+        }
+        ++slice->children_cache_stats.misses;
+        children = ExtractChildGroups(nodes, &slice->arena, &slice->child_nodes);
+        slice->extracted_children.emplace_back(nodes[0], children);
+        return children;
+    }
+
+    void DecoderSession::AddSearchTokenToSearchSpace(Token *token) {
         const DecoderState& key = GetDecoderStateForNode(
-                (*token->nodes())[0], token->aligned_key(), token->word_history_id());
+                token->nodes()[0], token->aligned_key(), token->word_history_id());
         search_space_[key] = token;
     }
 
-    DecoderState GestureDecoder::GetDecoderStateForNode(
+    DecoderState DecoderSession::GetDecoderStateForNode(
             const CodepointNode &node, const KeyId aligned_key,const int history_id) const {
-            const int8 lexicon_id = GetLexiconId(node.lexicon());
+            const int8 lexicon_id = model_->GetLexiconId(node.lexicon());
             // Only include the aligned_key in the state for gesture input. This can
             // result in separate gesture tokens for the same lexical prefix.
             // Due to the instantaneous nature of tap input, the same token can be used to
@@ -248,9 +424,9 @@ namespace decoder {
             return {lexicon_id, node.GetNodeData(), history_id, state_key};
     }
 
-    void GestureDecoder::ProcessNextTouchPoint(const int index) {
+    void DecoderSession::ProcessNextTouchPoint(const int index) {
         AdvanceToNextIndexAndReturnTopTokens(index);
-        TokenBeam top_reentry_tokens(params_.max_multi_term_terminals);
+        reentry_terminals_.clear();
 
         // For gestures, pass the next alignments for top_tokens.  This computes
         // alignments as though the tokens are still in transit to their key.  Since
@@ -267,16 +443,28 @@ namespace decoder {
         // considered.)
         //
         // TODO(lhellsten): See if we can do something similar for tap typing.
-        PassGestureTokensInBeam(top_tokens_set_, index);
+        PassGestureTokensInBeam(top_tokens_, index);
 
-        for (auto& token : top_tokens_set_) {
-            // Ensure that we have enough free search tokens in the token pool.
-            // Note: It is only safe to call PruneSearchTokensIfNeeded here because we
-            // will not reference past token_pool_ tokens directly except those
-            // remaining in the top_token_set_.
-            PruneSearchTokensOutsideTopTokensSet();
-            ExpandToken(index, ALIGN_NORMAL, token, &top_reentry_tokens);
+        if (params_.beam_expansion_threads > 0 && !params_.allow_multi_term) {
+            ExpandBeam(index);
+        } else {
+            // Expand the beam directly in the search space, one token at a time.
+            // Multi-term expansion interns the word histories of the new terms as it
+            // goes, so it is always done this way. The beam is expanded in the order
+            // of the search space rather than of the set, whose order depends on the
+            // tokens' addresses, so that the results do not depend on the session
+            // that decodes the input.
+            for (Token* token : top_tokens_) {
+                // Ensure that we have enough free search tokens in the token pool.
+                // Note: It is only safe to call PruneSearchTokensIfNeeded here because we
+                // will not reference past token_pool_ tokens directly except those
+                // remaining in the top_tokens_.
+                PruneSearchTokensOutsideTopTokensSet();
+                ExpandToken(index, ALIGN_NORMAL, token, &reentry_terminals_, nullptr);
+            }
         }
+        TokenBeam top_reentry_tokens(params_.max_multi_term_terminals);
+        AddReentryTokens(reentry_terminals_, &top_reentry_tokens);
 
         // Process the top reentry tokens (if any) that were generated for the
         // previous index. They have just re-entered the root of the lexicon, and need
@@ -288,18 +476,21 @@ namespace decoder {
             // Note: It is safe to call PruneSearchTokensIfNeeded here because
             // reentry_tokens are not part of the search space and will not be pruned.
             PruneSearchTokensOutsideTopTokensSet();
-            ExpandToken(index, ALIGN_REENTRY, &token, nullptr);
+            ExpandToken(index, ALIGN_REENTRY, &token, nullptr, nullptr);
         }
     }
 
-    std::unordered_set<Token *>
-    GestureDecoder::AdvanceToNextIndexAndReturnTopTokens(const int next_index) {
+    const std::vector<Token *>&
+    DecoderSession::AdvanceToNextIndexAndReturnTopTokens(const int next_index) {
         decoded_index_ = next_index;
-        std::unordered_set<int> active_histories;
         best_score_ = NEG_INF;
         auto token_iter = search_space_.begin();
         temp_scores_.clear();
+        score_histogram_.Clear();
+        top_tokens_.clear();
         top_tokens_set_.clear();
+        // Only keep the word histories of the tokens that remain in the search space.
+        word_histories_.BeginMark();
         while (token_iter != search_space_.end()) {
             Token* token = token_iter->second;
             if (token->index() < next_index - 1 &&
@@ -314,9 +505,8 @@ namespace decoder {
                 // it is still active. Keep it and add it to the top_tokens beam.
                 const float score = token->TotalScore();
                 temp_scores_.push_back(score);
-                if (token->word_history_id() >= 0) {
-                    active_histories.insert(token->word_history_id());
-                }
+                score_histogram_.Add(score);
+                word_histories_.Mark(token->word_history_id());
                 if (score > best_score_) {
                     best_score_ = score;
                 }
@@ -326,25 +516,18 @@ namespace decoder {
                 // it was never passed to the most recent time frame (e.g., its score
                 // was too poor to be worth considering). Remove it from the search space.
                 search_space_token_pool_->ReleasePooledToken(token);
-                search_space_.erase(token_iter++);
+                token_iter = search_space_.erase(token_iter);
+                ++search_stats_.tokens_pruned;
             }
         }
 
-        auto history_iter = word_histories_.begin();
-        while (history_iter != word_histories_.end()) {
-            if (active_histories.find(history_iter->first) == active_histories.end()) {
-                word_histories_.erase(history_iter++);
-            } else {
-                ++history_iter;
-            }
-        }
+        word_histories_.Sweep();
 
-        int beam_cutoff = temp_scores_.size() - params_.active_beam_width;
         float score_threshold = params_.score_to_beat_absolute;
-        if (beam_cutoff > 0) {
-            std::nth_element(temp_scores_.begin(), temp_scores_.begin() + beam_cutoff,
-                             temp_scores_.end());
-            score_threshold = std::max(score_threshold, temp_scores_[beam_cutoff]);
+        if (static_cast<int>(temp_scores_.size()) > active_beam_width_) {
+            score_threshold = std::max(
+                    score_threshold,
+                    score_histogram_.NthBestScore(active_beam_width_, temp_scores_));
         }
 
         token_iter = search_space_.begin();
@@ -352,15 +535,15 @@ namespace decoder {
             Token* token = token_iter->second;
             const float score = token->TotalScore();
             if (score >= score_threshold) {
-                top_tokens_set_.insert(token);
+                top_tokens_.push_back(token);
             }
             ++token_iter;
         }
 
-        return top_tokens_set_;
+        return top_tokens_;
     }
 
-    void GestureDecoder::PassGestureTokensInBeam(const std::unordered_set<Token *> &beam,
+    void DecoderSession::PassGestureTokensInBeam(const std::vector<Token *> &beam,
                                                  const int index) {
 
         // Choose a safe initial value for the active_beam_min_score_ threshold,
@@ -373,7 +556,7 @@ namespace decoder {
         // accounts for the occasional case where the full LM score of a term is
         // much better than the prefix LM score.
         active_beam_min_score_ = NEG_INF;
-        if (beam.size() >= params_.active_beam_width) {
+        if (static_cast<int>(beam.size()) >= active_beam_width_) {
             active_beam_min_score_ = params_.allow_multi_term
                                      ? ScoreToBeatForMultiTerm()
                                      : (float)0.0;
@@ -403,27 +586,169 @@ namespace decoder {
 
     }
 
-    bool GestureDecoder::PassTokenGesture(const Token *original_token, const int next_index,
+    void DecoderSession::ExpandBeam(const int index) {
+        // The slices only read the search space, so make room for the new tokens
+        // beforehand.
+        PruneSearchTokensOutsideTopTokensSet();
+
+        const int num_threads = params_.beam_expansion_threads;
+        if (expansion_pool_ == nullptr || expansion_pool_->num_threads() != num_threads) {
+            expansion_pool_.reset(new WorkerPool(num_threads));
+        }
+        while (static_cast<int>(expansion_slices_.size()) < num_threads) {
+            expansion_slices_.emplace_back(
+                    new BeamExpansionSlice(params_.token_pool_capacity));
+        }
+
+        const int beam_size = top_tokens_.size();
+        const int num_slices = std::max(1, std::min(num_threads, beam_size));
+        for (int i = 0; i < num_slices; ++i) {
+            BeamExpansionSlice* slice = expansion_slices_[i].get();
+            slice->begin = beam_size * i / num_slices;
+            slice->end = beam_size * (i + 1) / num_slices;
+            slice->is_only_slice = num_slices == 1;
+            // The entries without a candidate are null, since the merge resets the
+            // others.
+            slice->entry_candidates.resize(search_space_.size(), nullptr);
+        }
+        expansion_pool_->Run(num_slices, [this, index](const int i) {
+            ExpandBeamSlice(index, expansion_slices_[i].get());
+        });
+
+        // Fold the other slices into the first one in beam order, so that ties are
+        // always resolved in favor of the candidate from the earliest token in the
+        // beam, and the candidates are in the order in which the whole beam first
+        // reached their states.
+        BeamExpansionSlice* first_slice = expansion_slices_[0].get();
+        for (int i = 1; i < num_slices; ++i) {
+            FoldBeamSlice(expansion_slices_[i].get(), first_slice);
+        }
+        MergeBeamSlice(first_slice);
+    }
+
+    void DecoderSession::ExpandBeamSlice(const int index, BeamExpansionSlice* slice) {
+        for (int i = slice->begin; i < slice->end; ++i) {
+            ExpandToken(index, ALIGN_NORMAL, top_tokens_[i], nullptr, slice);
+        }
+    }
+
+    void DecoderSession::FoldBeamSlice(BeamExpansionSlice* slice,
+                                       BeamExpansionSlice* first_slice) {
+        MergeBeamSliceStatsAndChildren(slice);
+        for (const int entry : slice->candidate_entries) {
+            FoldChildCandidate(&slice->entry_candidates[entry], entry, slice,
+                               first_slice);
+        }
+        slice->candidate_entries.clear();
+        for (auto& entry : slice->candidates) {
+            FoldChildCandidate(&entry.second, -1, slice, first_slice);
+        }
+        slice->candidates.clear();
+    }
+
+    void DecoderSession::FoldChildCandidate(Token** candidate, const int entry,
+                                            BeamExpansionSlice* slice,
+                                            BeamExpansionSlice* first_slice) {
+        Token* first_candidate = first_slice->candidate_pool.NewPooledToken();
+        *first_candidate = **candidate;
+        AddChildCandidate(first_candidate, entry, first_slice);
+        slice->candidate_pool.ReleasePooledToken(*candidate);
+        *candidate = nullptr;
+    }
+
+    void DecoderSession::MergeBeamSliceStatsAndChildren(BeamExpansionSlice* slice) {
+        search_stats_.Add(slice->search_stats);
+        slice->search_stats = DecoderSearchStats();
+        children_cache_.AddStats(slice->children_cache_stats);
+        slice->children_cache_stats = TokenChildrenCache::Stats();
+
+        for (const auto& extracted : slice->extracted_children) {
+            children_cache_.AddChildren(CodepointNodeSpan(&extracted.first, 1),
+                                        extracted.second);
+        }
+        slice->extracted_children.clear();
+    }
+
+    void DecoderSession::MergeBeamSlice(BeamExpansionSlice* slice) {
+        MergeBeamSliceStatsAndChildren(slice);
+        // Update the existing tokens first, since inserting the new ones may move
+        // the entries of the search space.
+        for (const int entry : slice->candidate_entries) {
+            Token*& candidate = slice->entry_candidates[entry];
+            MergeChildCandidate(*candidate, (search_space_.begin() + entry)->second);
+            slice->candidate_pool.ReleasePooledToken(candidate);
+            candidate = nullptr;
+        }
+        slice->candidate_entries.clear();
+        for (const auto& entry : slice->candidates) {
+            Token* candidate = entry.second;
+            const DecoderState& key = GetDecoderStateForNode(
+                    candidate->nodes()[0], candidate->aligned_key(),
+                    candidate->word_history_id());
+            Token*& token = search_space_[key];
+            if (token == nullptr) {
+                token = NewSearchToken();
+                *token = *candidate;
+            } else {
+                MergeChildCandidate(*candidate, token);
+            }
+            slice->candidate_pool.ReleasePooledToken(candidate);
+        }
+        slice->candidates.clear();
+    }
+
+    void DecoderSession::MergeChildCandidate(const Token& candidate, Token* token) {
+        if (candidate.NextTotalScore() > token->NextTotalScore()) {
+            const int children_id = token->children_id();
+            *token = candidate;
+            if (token->children_id() == Token::kNoChildren) {
+                token->set_children_id(children_id);
+            }
+        }
+    }
+
+    void DecoderSession::AddResultIfBetter(const DecoderResult& result,
+                                           vector<DecoderResult>* results) {
+        const auto inserted = result_indices_.emplace(result.word(), results->size());
+        if (inserted.second) {
+            results->push_back(result);
+            return;
+        }
+        DecoderResult& old_result = (*results)[inserted.first->second];
+        if (result.score() > old_result.score()) {
+            old_result = result;
+        }
+    }
+
+    bool DecoderSession::PassTokenGesture(const Token *original_token, const int next_index,
                                           const TouchSequence *touch_sequence,
                                           Token *next_token) const {
         if (next_index >= touch_sequence->size()) {
             return false;
         }
-        const Alignment* alignment = original_token->alignment();
-        Alignment* next_alignment = next_token->mutable_next_alignment();
+        const Alignment alignment = original_token->alignment();
         const KeyId next_key = next_token->aligned_key();
         const float point_align_score =
                 (next_key >= 0) ? touch_sequence->align_score(next_index, next_key)
                                 : NEG_INF;
 
-        const KeyId prev_key = next_token->prev_aligned_key();
+        // When moving to a new state, the next touch point is in transit from
+        // original_token's key, regardless of which token created next_token.
+        const KeyId original_key = original_token->aligned_key();
+        const bool is_same_key =
+                original_key == next_key ||
+                (original_key >= 0 && next_key >= 0 &&
+                 keyboard()->KeyToKeyDistanceByIndex(original_key, next_key) == 0);
+        const KeyId prev_key = is_same_key || original_key < 0
+                               ? next_token->prev_aligned_key()
+                               : original_key;
         if (prev_key == -1) {
             // If there is no previous key, then only align to the first touch point.
             const float new_align_score =
                     (next_index == 0)
                     ? point_align_score * params_.first_point_weight
                     : NEG_INF;
-            *next_alignment = {next_index, new_align_score, NEG_INF};
+            next_token->set_next_alignment({next_index, new_align_score, NEG_INF});
             return true;
         }
 
@@ -431,104 +756,109 @@ namespace decoder {
                 touch_sequence->transit_score(next_index, prev_key, next_key);
         float next_align_score, next_transit_score;
 
-        const KeyId original_key = original_token->aligned_key();
-        const bool is_same_key =
-                original_key == next_key ||
-                keyboard()->KeyToKeyDistanceByIndex(original_key, next_key) == 0;
-
         if (is_same_key) {
             // Update the token's alignment to the same key, given the new touch point.
-            next_align_score = alignment->transit_score() + point_align_score;
-            next_transit_score = alignment->transit_score() + point_transit_score;
+            next_align_score = alignment.transit_score() + point_align_score;
+            next_transit_score = alignment.transit_score() + point_transit_score;
         } else {
             // Advance the alignment from the original token to the next_token's key.
-            next_align_score = alignment->align_score() + point_align_score;
-            next_transit_score = alignment->align_score() + point_transit_score;
+            next_align_score = alignment.align_score() + point_align_score;
+            next_transit_score = alignment.align_score() + point_transit_score;
         }
 
         // Update the next alignment for next_token if this is the best alignment
         // found so far.
         if (std::max(next_align_score, next_transit_score) >
-            next_alignment->BestScore()) {
-            *next_alignment = {next_index, next_align_score, next_transit_score};
+            next_token->next_alignment().BestScore()) {
+            next_token->set_next_alignment(
+                    {next_index, next_align_score, next_transit_score});
+            next_token->set_prev_aligned_key(prev_key);
             return true;
         }
         return false;
     }
 
 
-    void GestureDecoder::PruneSearchTokensOutsideTopTokensSet() {
+    void DecoderSession::PruneSearchTokensOutsideTopTokensSet() {
         if (search_space_token_pool_->FreeCount() >
             search_space_token_pool_->capacity() * kPruneWhenFreeRatioBelow) {
             return;
         }
+        if (top_tokens_set_.size() != top_tokens_.size()) {
+            // The set is only built in the time frames that need pruning (at most
+            // once per frame).
+            top_tokens_set_.insert(top_tokens_.begin(), top_tokens_.end());
+        }
+        // Score the tokens outside the beam, in the order of the search space. The
+        // tokens in the beam get a score that is never pruned.
         temp_scores_.clear();
-        auto it = search_space_.begin();
-        while (it != search_space_.end()) {
-            Token* token = it->second;
-            const bool can_prune = top_tokens_set_.find(token) == top_tokens_set_.end();
-            if (can_prune) {
-                const float score = token->NextTotalScore() > NEG_INF
-                                    ? token->NextTotalScore()
-                                    : token->TotalScore();
+        score_histogram_.Clear();
+        search_space_scores_.clear();
+        for (const auto& entry : search_space_) {
+            Token* token = entry.second;
+            float score = std::numeric_limits<float>::infinity();
+            if (top_tokens_set_.find(token) == top_tokens_set_.end()) {
+                score = token->NextTotalScore() > NEG_INF ? token->NextTotalScore()
+                                                          : token->TotalScore();
                 temp_scores_.push_back(score);
+                score_histogram_.Add(score);
             }
-            ++it;
+            search_space_scores_.push_back(score);
         }
         if (temp_scores_.size() == 0) {
             // No tokens to prune.
             return;
         }
+        // The prune_index-th worst score, counting from 0.
         const int prune_index = temp_scores_.size() * kPruneRatio;
-        std::nth_element(temp_scores_.begin(), temp_scores_.begin() + prune_index,
-                         temp_scores_.end());
-        const float prune_score = temp_scores_[prune_index];
-        it = search_space_.begin();
+        const float prune_score = score_histogram_.NthBestScore(
+                temp_scores_.size() - prune_index, temp_scores_);
+        // Erasing an entry moves the last entry of the search space into its place,
+        // so its score is moved along.
+        size_t index = 0;
+        auto it = search_space_.begin();
         while (it != search_space_.end()) {
-            Token* token = it->second;
-            const bool can_prune = top_tokens_set_.find(token) == top_tokens_set_.end();
-            if (can_prune) {
-                const float score = token->NextTotalScore() > NEG_INF
-                                    ? token->NextTotalScore()
-                                    : token->TotalScore();
-                if (score < prune_score) {
-                    search_space_token_pool_->ReleasePooledToken(token);
-                    search_space_.erase(it++);
-                    continue;
-                }
+            if (search_space_scores_[index] < prune_score) {
+                search_space_token_pool_->ReleasePooledToken(it->second);
+                it = search_space_.erase(it);
+                search_space_scores_[index] = search_space_scores_.back();
+                search_space_scores_.pop_back();
+                ++search_stats_.tokens_pruned;
+                continue;
             }
             ++it;
+            ++index;
         }
-
     }
 
-    void GestureDecoder::ExpandToken(const int next_index, const DecoderAlignType align_type, Token *token,
-                                     TokenBeam *reentry_tokens) {
+    void DecoderSession::ExpandToken(const int next_index, const DecoderAlignType align_type, Token *token,
+                                     vector<Token> *reentry_terminals, BeamExpansionSlice *slice) {
         if (!ShouldConsiderToken(token)) return;
-        ExpandTokenGesture(next_index, token, align_type, reentry_tokens);
+        ExpandTokenGesture(next_index, token, align_type, reentry_terminals, slice);
 
     }
 
-    void GestureDecoder::ExpandTokenGesture(const int next_index, Token *token,
-                                            const DecoderAlignType align_type, TokenBeam *reentry_tokens) {
+    void DecoderSession::ExpandTokenGesture(const int next_index, Token *token,
+                                            const DecoderAlignType align_type,
+                                            vector<Token> *reentry_terminals,
+                                            BeamExpansionSlice *slice) {
         if (!ShouldExpandToChildren(token)) return;
-        const int kCodeSpace = ' ';
-        const KeyId space_key = keyboard()->GetKeyIndex(kCodeSpace);
+        DecoderSearchStats* search_stats =
+                slice == nullptr ? &search_stats_ : &slice->search_stats;
+        ++search_stats->tokens_expanded;
+        const KeyId space_key = keyboard()->space_key();
 
         if (params_.allow_multi_term) {
+            DCHECK(slice == nullptr) << "Multi-term expansion is always serial.";
             const bool use_space_multiterm =
                     params_.use_space_for_multi_term &&
                     space_key != Keyboard::kInvalidKeyId;
 
-            if (reentry_tokens != nullptr && ShouldConsiderMultiTerm(token) &&
+            if (reentry_terminals != nullptr && ShouldConsiderMultiTerm(token) &&
                 token->IsTerminal()) {
-                Token reentry_token;
-                const KeyId next_key =
-                        use_space_multiterm ? space_key : Keyboard::kInvalidKeyId;
-                InitializeReentryToken(*token,
-                                       params_.extra_term_score,
-                                       next_key, &reentry_token);
-                reentry_tokens->push(reentry_token);
+                // The re-entry tokens are created once all of the terminals at this
+                // index have been reached, so that they can be scored together.
+                reentry_terminals->push_back(*token);
             }
 
             if (use_space_multiterm && token->aligned_key() == space_key) {
@@ -537,7 +867,7 @@ namespace decoder {
                     // touch point and 2) added to the search space.
                     PassTokenGesture(token, next_index, touch_sequence(), token);
                     Token* search_token = FindSearchToken(
-                            *token->nodes(), token->word_history_id(), space_key);
+                            token->nodes(), token->word_history_id(), space_key);
                     if (search_token != nullptr) {
                         if (token->NextTotalScore() > search_token->NextTotalScore()) {
                             *search_token = *token;
@@ -565,32 +895,43 @@ namespace decoder {
         }
 
         const KeyId next_digraph_key = keyboard()->GetSecondDigraphKeyForCode(
-                token->nodes()->back().codepoint(), token->aligned_key());
+                token->nodes().back().codepoint(), token->aligned_key());
         if (next_digraph_key != Keyboard::kInvalidKeyId) {
             // If the token is currently aligned to a first digraph key, consider the
             // possibility that it is advancing to the second digraph key.
-            Token* child_token =
-                    FindOrCreateChildToken(*token->nodes(), *token, next_digraph_key);
+            int entry;
+            Token* child_token = FindOrCreateChildToken(token->nodes(), *token,
+                                                        next_digraph_key, slice, &entry);
             if (child_token != nullptr) {
                 PassTokenGesture(token, next_index, touch_sequence(), child_token);
+                AddChildCandidate(child_token, entry, slice);
             }
-            if (!keyboard()->CodeAlignsToKey(token->nodes()->back().codepoint(),
+            if (!keyboard()->CodeAlignsToKey(token->nodes().back().codepoint(),
                                              token->aligned_key())) {
                 return;
             }
         }
 
-        for (const auto& code_to_nodes_entry : token->children()) {
-            const char32 code = code_to_nodes_entry.first;
-            const vector<KeyId>& possible_keys = GetPossibleKeysForCode(code);
-            const vector<CodepointNode>& nodes = code_to_nodes_entry.second;
+        const ChildGroupSpan children =
+                slice == nullptr ? GetChildren(token) : GetChildren(*token, slice);
+        for (const ChildGroup& child_group : children) {
+            const char32 code = child_group.code;
+            const vector<KeyId>& possible_keys = keyboard()->GetPossibleKeysForCode(code);
+            const CodepointNodeSpan& nodes = child_group.nodes;
             const KeyId prev_key = token->aligned_key();
             for (KeyId next_key : possible_keys) {
                 const bool is_repeated_key =
                         prev_key == next_key ||
                         (prev_key >= 0 &&
                          keyboard()->KeyToKeyDistanceByIndex(prev_key, next_key) == 0);
-                Token* child_token = FindOrCreateChildToken(nodes, *token, next_key);
+                if (!is_repeated_key && slice != nullptr &&
+                    !ShouldCreateChildToken(nodes, *token, next_key, next_index)) {
+                    ++search_stats->children_skipped;
+                    continue;
+                }
+                int entry;
+                Token* child_token =
+                        FindOrCreateChildToken(nodes, *token, next_key, slice, &entry);
                 if (child_token == nullptr) {
                     continue;
                 }
@@ -601,11 +942,12 @@ namespace decoder {
                     // the repeated key and expand to all possible next keys.
                     if (child_token->InitializeAsRepeatedLetterIfNeeded(*token, params_)) {
                         ExpandTokenGesture(next_index, child_token, ALIGN_NORMAL,
-                                           reentry_tokens);
+                                           reentry_terminals, slice);
                     }
                 } else {
                     PassTokenGesture(token, next_index, touch_sequence(), child_token);
                 }
+                AddChildCandidate(child_token, entry, slice);
             }
             if (IsSkippableCharCode(code) || possible_keys.empty()) {
                 // Skippable character omission (no penalty) or non-letter omission
@@ -617,7 +959,7 @@ namespace decoder {
                 PassTokenGesture(&omission_token, next_index, touch_sequence(),
                                  &omission_token);
                 ExpandTokenGesture(next_index, &omission_token, ALIGN_NORMAL,
-                                   reentry_tokens);
+                                   reentry_terminals, slice);
             }
         }
 
@@ -625,14 +967,13 @@ namespace decoder {
 
 
 
-    bool GestureDecoder::ShouldConsiderToken(const Token *token) const {
+    bool DecoderSession::ShouldConsiderToken(const Token *token) const {
         return token->TotalScore() >= ScoreToBeat();
     }
 
-    bool GestureDecoder::ShouldExpandToChildren(const Token *token) const {
-        int kCodeSpace = ' ';
+    bool DecoderSession::ShouldExpandToChildren(const Token *token) const {
         if (token->aligned_key() < 0 || !touch_sequence_->is_gesture() ||
-            token->aligned_key() == keyboard()->GetKeyIndex(kCodeSpace)) {
+            token->aligned_key() == keyboard()->space_key()) {
             return true;
         }
         const float last_align_score =
@@ -651,7 +992,28 @@ namespace decoder {
         return true;
     }
 
-    bool GestureDecoder::ShouldConsiderMultiTerm(const Token *token) const {
+    bool DecoderSession::ShouldCreateChildToken(const CodepointNodeSpan &nodes,
+                                                const Token &parent, const KeyId next_key,
+                                                const int next_index) const {
+        // Until the beam is full there is no lower bound to compare against (see
+        // PassGestureTokensInBeam), and all candidates for the last point are kept
+        // for the results.
+        if (!params_.use_lookahead_pruning || active_beam_min_score_ == NEG_INF ||
+            parent.aligned_key() < 0 || next_index >= touch_sequence()->size() - 1) {
+            return true;
+        }
+        // This is the score that PassTokenGesture would give the child, whether or
+        // not it already exists.
+        const float point_score = std::max(
+                touch_sequence()->align_score(next_index, next_key),
+                touch_sequence()->transit_score(next_index, parent.aligned_key(),
+                                                next_key));
+        const float lm_score =
+                parent.prev_lm_score() + Token::PrefixLmScore(nodes, params_);
+        return parent.align_score() + point_score + lm_score >= active_beam_min_score_;
+    }
+
+    bool DecoderSession::ShouldConsiderMultiTerm(const Token *token) const {
         if (token->aligned_key() < 0) {
             return false;
         }
@@ -662,15 +1024,14 @@ namespace decoder {
         return token->TotalScore() >= ScoreToBeatForMultiTerm();
     }
 
-    void GestureDecoder::InitializeReentryToken(const Token &terminal_token, const float penalty,
-                                                const int next_key, Token *reentry_token) {
-        vector<Utf8StringPiece> decoded_terms;
-        Utf8String last_term;
-        GetDecodedTerms(terminal_token, &last_term, &decoded_terms);
-        const float conditional_lm_score =
-                GetConditionalLanguageModelScore(decoded_terms, terminal_token);
-        int word_history_id =
-                GetOrAddWordHistory(terminal_token.word_history_id(), last_term);
+    void DecoderSession::InitializeReentryToken(const Token &terminal_token,
+                                                const float conditional_lm_score,
+                                                const float penalty, const int next_key,
+                                                Token *reentry_token) {
+        const int term_id =
+                word_histories_.InternTerm(terminal_token.nodes().back().GetKey());
+        const int word_history_id =
+                word_histories_.GetOrAdd(terminal_token.word_history_id(), term_id);
         GetRootToken(reentry_token);
         reentry_token->InitializeAsNextTerm(terminal_token, word_history_id,
                                             conditional_lm_score, next_key);
@@ -679,8 +1040,26 @@ namespace decoder {
         }
     }
 
+    void DecoderSession::AddReentryTokens(const vector<Token> &terminal_tokens,
+                                          TokenBeam *reentry_tokens) {
+        if (terminal_tokens.empty()) {
+            return;
+        }
+        GetConditionalLanguageModelScores(terminal_tokens, &terminal_scores_);
+        const KeyId space_key = keyboard()->space_key();
+        const bool use_space_multiterm =
+                params_.use_space_for_multi_term && space_key != Keyboard::kInvalidKeyId;
+        const KeyId next_key = use_space_multiterm ? space_key : Keyboard::kInvalidKeyId;
+        for (size_t i = 0; i < terminal_tokens.size(); ++i) {
+            Token reentry_token;
+            InitializeReentryToken(terminal_tokens[i], terminal_scores_[i],
+                                   params_.extra_term_score, next_key, &reentry_token);
+            reentry_tokens->push(reentry_token);
+        }
+    }
+
     Token *
-    GestureDecoder::FindSearchToken(const vector<CodepointNode> &nodes, const int word_history_id,
+    DecoderSession::FindSearchToken(const CodepointNodeSpan &nodes, const int word_history_id,
                                     const int next_key) {
         const DecoderState& key =
                 GetDecoderStateForNode(nodes[0], next_key, word_history_id);
@@ -691,44 +1070,29 @@ namespace decoder {
         return nullptr;
     }
 
-    void GestureDecoder::GetDecodedTerms(const Token &token, Utf8String *last_term_storage,
-                                         vector<Utf8StringPiece> *decoded_terms) const {
-        const CodepointNode* terminal_node = &(token.nodes()->back());
-        *last_term_storage = terminal_node->GetKey();
-        if (token.word_history_id() != -1) {
-            const vector<string>& prev_terms = GetWordHistory(token.word_history_id());
-            decoded_terms->reserve(prev_terms.size() + 1);
-            for (const auto& prev_term : prev_terms) {
-                decoded_terms->emplace_back(prev_term);
-            }
-        }
-        decoded_terms->emplace_back(*last_term_storage);
+    void DecoderSession::GetDecodedTerms(const Token &token, vector<int> *term_ids) {
+        term_ids->clear();
+        word_histories_.GetTermIds(token.word_history_id(), term_ids);
+        term_ids->push_back(word_histories_.InternTerm(token.nodes().back().GetKey()));
     }
 
-    float GestureDecoder::GetAlignToSpaceScore(const int index) const {
-        int kCodeSpace = ' ';
-        const KeyId space_key = keyboard()->GetKeyIndex(kCodeSpace);
+    float DecoderSession::GetAlignToSpaceScore(const int index) const {
+        const KeyId space_key = keyboard()->space_key();
         if (space_key == Keyboard::kInvalidKeyId) {
             return NEG_INF;
         }
         return touch_sequence()->align_score(index, space_key);
     }
 
-    const vector<Utf8String> &GestureDecoder::GetWordHistory(int id) const {
-        const auto& it = word_histories_.find(id);
-                DCHECK(it != word_histories_.end()) << "No word history found for id " << id;
-        return it->second;
-    }
-
     Token *
-    GestureDecoder::FindOrCreateChildToken(const vector<CodepointNode> &nodes, const Token &parent,
+    DecoderSession::FindOrCreateChildToken(const CodepointNodeSpan &nodes, const Token &parent,
                                            const int next_key) {
         const DecoderState& key =
                 GetDecoderStateForNode(nodes[0], next_key, parent.word_history_id());
         const auto& it = search_space_.find(key);
         if (it != search_space_.end()) {
-                    DCHECK_EQ((*it->second->nodes())[0].GetNodeData(), nodes[0].GetNodeData());
-                    DCHECK_EQ(it->second->nodes()->size(), nodes.size());
+                    DCHECK_EQ(it->second->nodes()[0].GetNodeData(), nodes[0].GetNodeData());
+                    DCHECK_EQ(it->second->nodes().size(), nodes.size());
             return it->second;
         } else {
             Token* child = NewSearchToken();
@@ -742,27 +1106,134 @@ namespace decoder {
         }
     }
 
-    float
-    GestureDecoder::GetConditionalLanguageModelScore(const vector<Utf8StringPiece> &term_sequence,
-                                                     const Token &terminal_token) {
-        if (!lm_scorers_.empty()) {
-            const float conditional_lm_score =
-                    DecodedTermsConditionalLogProb(term_sequence);
-            if (conditional_lm_score > NEG_INF) {
-                // Return the conditional logp for the last term.
-                return conditional_lm_score;
+    Token *
+    DecoderSession::FindOrCreateChildToken(const CodepointNodeSpan &nodes, const Token &parent,
+                                           const int next_key, BeamExpansionSlice *slice,
+                                           int *entry) {
+        *entry = -1;
+        if (slice == nullptr) {
+            return FindOrCreateChildToken(nodes, parent, next_key);
+        }
+        const DecoderState& key =
+                GetDecoderStateForNode(nodes[0], next_key, parent.word_history_id());
+        // Other slices are reading the search space concurrently, so only use the
+        // const (stats-free) lookup.
+        const DecoderStateMap& search_space = search_space_;
+        const auto it = search_space.find(key);
+        const int found_entry = it - search_space.begin();
+        Token* candidate = slice->candidate_pool.NewPooledToken();
+        if (found_entry < static_cast<int>(slice->entry_candidates.size())) {
+            *candidate = *it->second;
+            *entry = found_entry;
+        } else {
+            // The state is not in the search space, or was only added to it by this
+            // expansion (see AddChildCandidate).
+            DCHECK(it == search_space.end() || slice->is_only_slice);
+            candidate->InitializeAsChild(nodes, parent, next_key, params_);
+            candidate->InvalidateScores();
+        }
+        return candidate;
+    }
+
+    void DecoderSession::AddChildCandidate(Token *candidate, const int entry,
+                                           BeamExpansionSlice *slice) {
+        if (slice == nullptr) {
+            return;
+        }
+        if (entry < 0 && slice->is_only_slice) {
+            // No other slice reads the search space, so add the candidate for a new
+            // state to it directly, as MergeBeamSlice would.
+            Token*& token = search_space_[GetDecoderStateForNode(
+                    candidate->nodes()[0], candidate->aligned_key(),
+                    candidate->word_history_id())];
+            if (token == nullptr) {
+                token = NewSearchToken();
+                *token = *candidate;
+            } else {
+                MergeChildCandidate(*candidate, token);
+            }
+            slice->candidate_pool.ReleasePooledToken(candidate);
+            return;
+        }
+        Token*& best = entry >= 0
+                       ? slice->entry_candidates[entry]
+                       : slice->candidates[GetDecoderStateForNode(
+                               candidate->nodes()[0], candidate->aligned_key(),
+                               candidate->word_history_id())];
+        if (best == nullptr) {
+            if (entry >= 0) {
+                slice->candidate_entries.push_back(entry);
             }
+            best = candidate;
+            return;
         }
-        float unigram_score = GetUnigramScore(terminal_token);
-        if (!lm_scorers_.empty()) {
-            // If there were lm's available and none of them returned a valid logp,
-            // apply a fixed backoff to lexicon unigram penalty.
-            unigram_score += params_.lexicon_unigram_backoff;
+        if (candidate->NextTotalScore() > best->NextTotalScore()) {
+            std::swap(best, candidate);
         }
-        return unigram_score;
+        slice->candidate_pool.ReleasePooledToken(candidate);
     }
 
-    float GestureDecoder::DecodedTermsConditionalLogProb(const vector<Utf8StringPiece> &terms) {
+    void DecoderSession::GetConditionalLanguageModelScores(const vector<Token> &tokens,
+                                                           vector<float> *scores) {
+        scores->assign(tokens.size(), NEG_INF);
+        // Intern the terms of the terminals in order, and group them by history.
+        candidate_term_ids_.assign(tokens.size(), -1);
+        batch_order_.clear();
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            if (tokens[i].IsTerminal()) {
+                candidate_term_ids_[i] =
+                        word_histories_.InternTerm(tokens[i].nodes().back().GetKey());
+                batch_order_.push_back(i);
+            }
+        }
+        std::stable_sort(batch_order_.begin(), batch_order_.end(),
+                         [&tokens](const int a, const int b) {
+                             return tokens[a].word_history_id() < tokens[b].word_history_id();
+                         });
+
+        size_t begin = 0;
+        while (begin < batch_order_.size()) {
+            const int word_history_id = tokens[batch_order_[begin]].word_history_id();
+            size_t end = begin + 1;
+            while (end < batch_order_.size() &&
+                   tokens[batch_order_[end]].word_history_id() == word_history_id) {
+                ++end;
+            }
+            if (!lm_scorers_.empty()) {
+                term_ids_.clear();
+                word_histories_.GetTermIds(word_history_id, &term_ids_);
+                term_pieces_.clear();
+                for (const int term_id : term_ids_) {
+                    term_pieces_.emplace_back(word_histories_.term(term_id));
+                }
+                candidate_pieces_.clear();
+                for (size_t k = begin; k < end; ++k) {
+                    candidate_pieces_.emplace_back(
+                            word_histories_.term(candidate_term_ids_[batch_order_[k]]));
+                }
+                DecodedCandidatesConditionalLogProbs(term_pieces_, candidate_pieces_,
+                                                     &candidate_logps_);
+            }
+            for (size_t k = begin; k < end; ++k) {
+                const int i = batch_order_[k];
+                if (!lm_scorers_.empty() && candidate_logps_[k - begin] > NEG_INF) {
+                    // Use the conditional logp for the term.
+                    (*scores)[i] = candidate_logps_[k - begin];
+                    continue;
+                }
+                float unigram_score = GetUnigramScore(tokens[i]);
+                if (!lm_scorers_.empty()) {
+                    // If there were lm's available and none of them returned a valid
+                    // logp, apply a fixed backoff to lexicon unigram penalty.
+                    unigram_score += params_.lexicon_unigram_backoff;
+                }
+                (*scores)[i] = unigram_score;
+            }
+            begin = end;
+        }
+    }
+
+    float DecoderSession::DecodedTermsConditionalLogProb(const vector<Utf8StringPiece> &terms) {
         // Note: Currently performs equally weighted linear interpolation of
         // probabilities when there are multiple language models.
         if (lm_scorers_.size() == 1) {
@@ -779,19 +1250,31 @@ namespace decoder {
         return log(interpolated_prob / lm_scorers_.size());
     }
 
-    const vector<KeyId> &GestureDecoder::GetPossibleKeysForCode(const char32 code) {
-        const auto& entry = codes_to_keys_map_.find(code);
-        if (entry != codes_to_keys_map_.end()) {
-            return entry->second;
+    void DecoderSession::DecodedCandidatesConditionalLogProbs(
+            const vector<Utf8StringPiece> &terms, const vector<Utf8StringPiece> &candidates,
+            vector<LogProbFloat> *logps) {
+        if (lm_scorers_.size() == 1) {
+            lm_scorers_[0]->CandidatesConditionalLogProbs(terms, candidates, logps);
+            return;
+        }
+        candidate_probs_.assign(candidates.size(), 0);
+        for (auto& scorer : lm_scorers_) {
+            scorer->CandidatesConditionalLogProbs(terms, candidates, &scorer_logps_);
+            for (size_t j = 0; j < candidates.size(); ++j) {
+                candidate_probs_[j] += exp(scorer_logps_[j]);
+            }
+        }
+        logps->resize(candidates.size());
+        for (size_t j = 0; j < candidates.size(); ++j) {
+            (*logps)[j] = candidate_probs_[j] == 0
+                          ? NEG_INF
+                          : log(candidate_probs_[j] / lm_scorers_.size());
         }
-        vector<KeyId> possible_keys = keyboard()->GetPossibleKeysForCode(code);
-        codes_to_keys_map_[code] = possible_keys;
-        return codes_to_keys_map_.find(code)->second;
     }
 
-    float GestureDecoder::GetUnigramScore(const Token &token) {
+    float DecoderSession::GetUnigramScore(const Token &token) {
         double max_logp = NEG_INF;
-        for (const CodepointNode& node : *token.nodes()) {
+        for (const CodepointNode& node : token.nodes()) {
             float unigram_logp;
             const bool is_term = node.TermLogProb(&unigram_logp);
             if (is_term) {
@@ -803,22 +1286,7 @@ namespace decoder {
         return max_logp;
     }
 
-    int GestureDecoder::GetOrAddWordHistory(int prev_word_history_id, const Utf8String &new_term) {
-        vector<Utf8String> words;
-        if (prev_word_history_id >= 0) {
-            words = GetWordHistory(prev_word_history_id);
-        }
-        words.push_back(new_term);
-        for (const auto& pair : word_histories_) {
-            if (StringVectorEquals(pair.second, words)) {
-                return pair.first;
-            }
-        }
-        word_histories_[++next_word_history_id_].swap(words);
-        return next_word_history_id_;
-    }
-
-    void GestureDecoder::ProcessPrefixCompletions(TokenBeam *top_prefixes,
+    void DecoderSession::ProcessPrefixCompletions(TokenBeam *top_prefixes,
                                                   vector<DecoderResult> *prediction_results) {
         if (next_word_predictions_.empty()) {
             // Extract the top next word predictions from language model.
@@ -833,7 +1301,7 @@ namespace decoder {
         std::unique_ptr<vector<Token>> prefixes(new vector<Token>(top_prefixes->Take()));
 //        std::unique_ptr<vector<Token>> prefixes(new vector<Token>(top_prefixes->TakeNondestructive()));
         for (const auto& prefix_token : *prefixes) {
-            const Utf8String prefix_term = prefix_token.nodes()->back().GetKey();
+            const Utf8String prefix_term = prefix_token.nodes().back().GetKey();
             const double spatial_score = prefix_token.align_score() + completion_score;
             for (const auto& prediction : next_word_predictions_) {
                 const Utf8StringPiece prediction_term = prediction.first;
@@ -845,7 +1313,7 @@ namespace decoder {
                 }
             }
             if (prediction_count < params_.kMinCompletions) {
-                for (const auto& node : *prefix_token.nodes()) {
+                for (const auto& node : prefix_token.nodes()) {
                     map<Utf8String, LogProbFloat> completions;
                     GetBestCompletionsForNode(node, params_.kCompletionBeamSize,
                                               &completions);
@@ -863,7 +1331,7 @@ namespace decoder {
         }
     }
 
-    void GestureDecoder::ApplyScoreAdjustments(vector<DecoderResult> *results) const {
+    void DecoderSession::ApplyScoreAdjustments(vector<DecoderResult> *results) const {
         if (touch_sequence()->is_gesture()) {
             const float max_penalty =
                     params_.max_imprecise_match_penalty;
@@ -900,7 +1368,7 @@ namespace decoder {
         }
     }
 
-    void GestureDecoder::GetBestCompletionsForNode(const CodepointNode &start_node, int max_completions,
+    void DecoderSession::GetBestCompletionsForNode(const CodepointNode &start_node, int max_completions,
                                                    std::map<Utf8String, LogProbFloat> *completions) const {
         // A TopN beam of active lexical nodes currently being explored.
         TopN<CodepointNode, OrderByPrefixProb> active_nodes(max_completions);
@@ -955,33 +1423,32 @@ namespace decoder {
         }
     }
 
-    void GestureDecoder::ProcessEndOfInput(Token *token, vector<DecoderResult> *results,
+    void DecoderSession::ProcessEndOfInput(Token *token, const float conditional_lm_score,
+                                           vector<DecoderResult> *results,
                                            TokenBeam *top_prefixes) {
         if (token->IsTerminal()) {
-            ExtractEndOfInputTerminal(*token, results);
-        }
-        vector<CodepointNode> child_nodes;
-        for (const CodepointNode& node : *(token->nodes())) {
-            node.GetChildCodepoints(&child_nodes);
+            ExtractEndOfInputTerminal(*token, conditional_lm_score, results);
         }
-        if (child_nodes.size() > 0 && !token->has_prev_terms()) {
+        if (!token->has_prev_terms() && !GetChildren(token).empty()) {
             top_prefixes->push(*token);
         }
     }
 
-    void GestureDecoder::ExtractEndOfInputTerminal(const Token &terminal_token,
+    void DecoderSession::ExtractEndOfInputTerminal(const Token &terminal_token,
+                                                   const float conditional_lm_score,
                                                    vector<DecoderResult> *results) {
-        vector<Utf8StringPiece> decoded_terms;
-        Utf8String last_term;
-        GetDecodedTerms(terminal_token, &last_term, &decoded_terms);
+        GetDecodedTerms(terminal_token, &term_ids_);
 
-        const vector<CodepointNode>* nodes = terminal_token.nodes();
         float lm_score = NEG_INF;
-        const float conditional_lm_score =
-                GetConditionalLanguageModelScore(decoded_terms, terminal_token);
         lm_score = conditional_lm_score + terminal_token.prev_lm_score();
         float spatial_score = terminal_token.align_score();
-        Utf8String decoded_terms_string = strings::Join(decoded_terms, " ");
+        Utf8String decoded_terms_string;
+        for (const int term_id : term_ids_) {
+            if (!decoded_terms_string.empty()) {
+                decoded_terms_string.push_back(' ');
+            }
+            decoded_terms_string.append(word_histories_.term(term_id));
+        }
         if (lm_score > NEG_INF) {
             DecoderResult result(decoded_terms_string, spatial_score, lm_score);
             const float terminal_score = result.score();
@@ -992,5 +1459,19 @@ namespace decoder {
     }
 
 
+    GestureDecoder::GestureDecoder(bool isTest)
+            : model_(new DecoderModel()),
+              session_(new DecoderSession(model_)) {}
+
+    void GestureDecoder::RecreateDecoderForActiveLms() {
+        model_->RecreateDecoderForActiveLms();
+        session_.reset(new DecoderSession(model_));
+    }
+
+    void GestureDecoder::SetKeyboardLayout(KeyboardLayout layout) {
+        model_->SetKeyboardLayout(layout);
+        session_.reset(new DecoderSession(model_));
+    }
+
+}
 }
-}
\ No newline at end of file
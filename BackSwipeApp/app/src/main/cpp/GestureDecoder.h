@@ -24,6 +24,13 @@
 #include "internal/base/hash.h"
 #include "internal/languageModel/top_n.h"
 #include "internal/decoder-result.h"
+#include "internal/decoder-model.h"
+#include "internal/decoder-arena.h"
+#include "internal/decoder-state-map.h"
+#include "internal/worker-pool.h"
+#include "internal/score-histogram.h"
+#include "internal/token-children-cache.h"
+#include "internal/word-history-table.h"
 //
 //using keyboard::decoder::LanguageModelInterface;
 //using keyboard::decoder::LexiconInterface;
@@ -35,92 +42,66 @@ using keyboard::decoder::lm::InterpolatedLm;
 namespace keyboard {
 namespace decoder {
     // Orders DecoderResults by score, returns true if the left Result has a greater
-    // expected_terminal_score than the right one.
+    // expected_terminal_score than the right one. Ties are ordered by word, so that
+    // the order of the results does not depend on the order of the search space.
     struct ResultGreater {
         bool operator()(const DecoderResult& left, const DecoderResult& right) const {
-            return left.score() > right.score();
+            if (left.score() != right.score()) {
+                return left.score() > right.score();
+            }
+            return left.word() < right.word();
         }
     };
 
     // An TopN beam for search Tokens.
     typedef TopN<Token, TokenGreater> TokenBeam;
 
-    // A pool of pre-allocated tokens to be used in the decoding search space.
-
-    // A DecoderState represents a potential suggestion. It encodes a lexicon link
-    // (lexicon_id and node_id) that represents the current term, and a
-    // word_history_id that represents the previous terms (if any) decoded before
-    // the current term. At each point in time, only one best Token is kept for each
-    // active DecoderState.
-    //
-    // Note: For gesture input only, the token state also incorporates the
-    // aligned_key. This is used to distinguish gesture tokens that are in-transit
-    // to different possible keys for the same lexical codepoint (e.g., the Spanish
-    // keyboard layout has keys for 'n' and 'ñ', which can both align to 'ñ').
-    //
-    // Note: This currently does not support digraphs with repeated keys or larger
-    // multigraphs. In order to do so, we would need to add a digaph_index.
-    //
-    // Also, because the state does include the prev_key, the gesture decoding
-    // process can be slightly greedy in that it only maintains the one best way of
-    // reaching the next lexical state. For example, in the case of the word 'über',
-    // the [üb] token can be reached by either an alignment to [u] or [ue]. When
-    // both [u] and [ue] drop out of the beam, the [üb] token is stuck with the
-    // best scoring of the two possible prev_keys. Since the gesture transit
-    // score depends on the previous key, this can affect the score for the
-    // remaining gesture points leading up to 'b'. In practice this should rarely be
-    // a problem. If the two possible prev_keys [u] and [e] are not right next to
-    // each other, then the correct prev_key one should have a much better alignment
-    // score. If, on the other hand, the two prev_keys are right next to each other
-    // (or even overlapping), then the future transit-scores for each prev_key
-    // should be very similar and any difference is thus unlikely to affect the
-    // final results.
-    //
-    // TODO(ouyang): Consider adding the additional parameters to the DecoderState,
-    // such as prev_key and digaph/multigraph_index.
-    struct DecoderState {
-        int8 lexicon_id;
-        uint64 node_id;
-        int32 word_history_id;
-        KeyId aligned_key;
-
-        bool operator==(const DecoderState& s) const {
-            return node_id == s.node_id && word_history_id == s.word_history_id &&
-                   lexicon_id == s.lexicon_id && aligned_key == s.aligned_key;
-        }
-    };
-
+    // A pool of search tokens allocated from a DecoderArena. Released tokens are
+    // kept on a free list and reused before any new token is carved out of the
+    // arena.
     class TokenPool {
     public:
-        explicit TokenPool(const int capacity) : tokens_(), free_tokens_() {
-            Reset(capacity);
+        // Creates a pool that allocates its tokens from the given arena, in blocks
+        // of the given capacity. The arena must outlive the pool.
+        TokenPool(const int capacity, DecoderArena* arena)
+                : arena_(arena),
+                  block_capacity_(capacity),
+                  capacity_(0),
+                  next_token_(nullptr),
+                  block_end_(nullptr),
+                  free_tokens_(),
+                  grow_count_(0) {
+            free_tokens_.reserve(capacity);
         }
 
-        // Releases all tokens from the pool and resets the size. Note that after
-        // calling this method no previously allocated tokens can be used.
-        void Reset(const int capacity) {
-            if (capacity == tokens_.size() && capacity == free_tokens_.size()) {
-                // No need to reset.
-                return;
-            }
-            tokens_.resize(capacity);
-            tokens_.shrink_to_fit();
+        // Releases all tokens from the pool in O(1). This must be called whenever
+        // the arena is reset. Note that after calling this method no previously
+        // allocated tokens can be used.
+        void Reset() {
+            capacity_ = 0;
+            next_token_ = nullptr;
+            block_end_ = nullptr;
             free_tokens_.clear();
-            for (auto& token : tokens_) {
-                free_tokens_.push_back(&token);
-            }
         }
 
-        // Allocate an new token from the pool. Returns null If no new tokens are
-        // available. Any tokens allocated using this method will need to be returned
-        // by calling ReleasePooledToken.
+        // Allocate an new token from the pool. If all tokens are in use, the pool
+        // grows by another block of tokens. Any tokens allocated using this method
+        // will need to be returned by calling ReleasePooledToken.
         inline Token* NewPooledToken() {
-            if (free_tokens_.empty()) {
-                return nullptr;
+            if (!free_tokens_.empty()) {
+                Token* const token = free_tokens_.back();
+                free_tokens_.pop_back();
+                return token;
+            }
+            if (next_token_ == block_end_) {
+                if (capacity_ > 0) {
+                    ++grow_count_;
+                }
+                next_token_ = arena_->NewArray<Token>(block_capacity_);
+                block_end_ = next_token_ + block_capacity_;
+                capacity_ += block_capacity_;
             }
-            Token* const token = free_tokens_.back();
-            free_tokens_.pop_back();
-            return token;
+            return next_token_++;
         }
 
         // Release a token that has been allocated from the pool by NewPooledToken().
@@ -130,42 +111,203 @@ namespace decoder {
         }
 
         // Returns the number of tokens that are still free and available to be
-        // allocated.
-        inline int FreeCount() const { return free_tokens_.size(); }
+        // allocated without growing the pool.
+        inline int FreeCount() const {
+            return free_tokens_.size() + (block_end_ - next_token_);
+        }
+
+        // Returns the current capacity of the token pool. This is a multiple of the
+        // capacity given to the constructor, or 0 if no token has been allocated
+        // since the last Reset().
+        inline int capacity() const { return capacity_; }
 
-        // Returns the maximum capacity of the token pool.
-        inline int capacity() const { return tokens_.size(); }
+        // Returns the number of times the pool had to grow beyond its first block.
+        inline uint64 grow_count() const { return grow_count_; }
+
+    private:
+        DecoderArena* const arena_;
+        const int block_capacity_;
+        int capacity_;
 
-        //private:
-        std::vector<Token> tokens_;
-        std::deque<Token*> free_tokens_;
+        // The unallocated tokens of the current block.
+        Token* next_token_;
+        Token* block_end_;
+
+        std::vector<Token*> free_tokens_;
+        uint64 grow_count_;
+
+        DISALLOW_COPY_AND_ASSIGN(TokenPool);
     };
 
-    struct DecoderStateHasher {
-        std::size_t operator()(const DecoderState& c) const {
-            return util_hash::Hash(c.lexicon_id, c.node_id, c.word_history_id);
+    // Counters for monitoring the amount of work done by the search. These are
+    // cumulative (i.e., not reset between decodes) until reset by the session.
+    struct DecoderSearchStats {
+        // The number of search tokens allocated, including the ones that replaced
+        // tokens that were pruned.
+        uint64 tokens_created = 0;
+        // The number of tokens that were expanded to their children.
+        uint64 tokens_expanded = 0;
+        // The number of tokens removed from the search space before the end of the
+        // decode, either because they dropped out of the search or to free up the
+        // token pool.
+        uint64 tokens_pruned = 0;
+        // The number of child tokens that were not created, since their score for
+        // the next touch point could not make it into the beam (see
+        // DecoderParams::use_lookahead_pruning).
+        uint64 children_skipped = 0;
+
+        void Add(const DecoderSearchStats& stats) {
+            tokens_created += stats.tokens_created;
+            tokens_expanded += stats.tokens_expanded;
+            tokens_pruned += stats.tokens_pruned;
+            children_skipped += stats.children_skipped;
         }
     };
 
-    typedef std::unordered_map<DecoderState, Token*, DecoderStateHasher>
-            StateToTokenMap;
+    // The adjustments made by a session to fit a decode into its time budget (see
+    // DecoderSession::DecodeTouch).
+    struct DecodeDeadlineStats {
+        // The time budget of the decode, or 0 if it had none.
+        float time_budget_ms = 0;
+        // The time spent decoding the touch points, excluding the extraction of
+        // the results.
+        double decode_time_ms = 0;
+        // The number of touch points decoded, out of point_count. If the deadline
+        // was reached, the results are for the points decoded until then.
+        int points_decoded = 0;
+        int point_count = 0;
+        bool deadline_reached = false;
+        // The number of times the beam was narrowed or widened.
+        int beam_shrinks = 0;
+        int beam_grows = 0;
+        // The narrowest and widest beams used, and the final beam width and
+        // score_to_beat_offset.
+        int min_beam_width = 0;
+        int max_beam_width = 0;
+        int final_beam_width = 0;
+        float final_score_to_beat_offset = 0;
+    };
 
-    class GestureDecoder {
-    public:
-        GestureDecoder(bool isTest);
+    // The candidate child tokens generated by one thread while expanding a
+    // contiguous slice of the beam (see DecoderSession::ExpandBeam). Each
+    // candidate is computed from the search space as it was before the expansion
+    // started, and only the best candidate is kept for each DecoderState.
+    struct BeamExpansionSlice {
+        explicit BeamExpansionSlice(const int capacity)
+                : begin(0),
+                  end(0),
+                  is_only_slice(false),
+                  arena(),
+                  candidate_pool(capacity, &arena),
+                  entry_candidates(),
+                  candidate_entries(),
+                  candidates(capacity),
+                  extracted_children(),
+                  child_nodes(),
+                  search_stats(),
+                  children_cache_stats() {}
+
+        // The range of the beam (DecoderSession::top_tokens_) to expand.
+        int begin;
+        int end;
+
+        // Whether this slice expands the whole beam (e.g., when expanding it
+        // serially). Since no other slice reads the search space then, the
+        // candidates for new states are added to it directly rather than to
+        // candidates.
+        bool is_only_slice;
+
+        // The arena for the candidate tokens and the extracted children. Like the
+        // session's arena, it is only reset between decodes.
+        DecoderArena arena;
+        TokenPool candidate_pool;
+
+        // The best candidate for each DecoderState that is already in the search
+        // space, indexed by the state's entry in it, and the entries that have a
+        // candidate, in the order in which they were first reached. The search
+        // space is not modified while the beam is expanded, so its entries keep
+        // their positions, and these candidates need no hashing.
+        vector<Token*> entry_candidates;
+        vector<int> candidate_entries;
+
+        // The best candidate for each DecoderState that is not in the search space
+        // yet, in the order in which the states were first reached.
+        DecoderStateMap candidates;
+
+        // The children extracted by this slice, which are added to the session's
+        // children cache when the slices are merged.
+        vector<std::pair<CodepointNode, ChildGroupSpan>> extracted_children;
+
+        // Scratch space for extracting children.
+        vector<CodepointNode> child_nodes;
+
+        // The slice's counters, which are added to the session's when merging.
+        DecoderSearchStats search_stats;
+        TokenChildrenCache::Stats children_cache_stats;
+
+        DISALLOW_COPY_AND_ASSIGN(BeamExpansionSlice);
+    };
 
-        void setMainParams(LoudsLmParams params);
+    // The per-decode state of the decoder: the search space, token pool, word
+    // histories, touch sequence and LM scorers. A session only reads from its
+    // DecoderModel, so sessions sharing one model can decode in parallel as long
+    // as each session is used by a single thread at a time. Sessions are reusable;
+    // each decode resets the search state of the previous one.
+    class DecoderSession {
+    public:
+        explicit DecoderSession(std::shared_ptr<const DecoderModel> model);
 
-        void AddLexiconAndLm(const std::string &lm_name, LexiconInterface *lexicon,
-                             std::unique_ptr<LanguageModelInterface> lm);
+        vector<DecoderResult> DecodeTouch(TouchSequence* sequence, Utf8String prev);
 
-        void RecreateDecoderForActiveLms();
+        // Sets the text preceding the gestures decoded next, whose last terms are the
+        // context of the language model scores of their first decoded term. The
+        // context is resolved in the language model(s) once, and reused by every
+        // lookup until the preceding text changes.
+        void SetPrecedingText(const Utf8String& preceding_text);
+
+        // Decodes the touch sequence within (roughly) the given time budget. After
+        // each touch point, the beam width and score_to_beat_offset are adjusted so
+        // that the remaining points fit into the remaining budget (see
+        // DecoderParams::min_adaptive_beam_width). If the budget runs out, the
+        // remaining points are not decoded, and the results are those for the
+        // points decoded so far, as with ExtendGesture. The adjustments are reported
+        // by deadline_stats().
+        //
+        // Args:
+        //   sequence        - The touch sequence to decode. Owned by the session.
+        //   prev            - The preceding word, if any.
+        //   time_budget_ms  - The time budget, or 0 for no budget.
+        //
+        // Returns:
+        //   The N-best results.
+        vector<DecoderResult> DecodeTouch(TouchSequence* sequence, Utf8String prev,
+                                          float time_budget_ms);
 
-        void SetKeyboardLayout(KeyboardLayout layout) {
-            keyboard_layout_ = layout;
-            gesture_keyboard_.reset(Keyboard::CreateKeyboardOrNull(keyboard_layout_).release());
-        }
-        vector<DecoderResult> DecodeTouch(TouchSequence* sequence, Utf8String prev);
+        // Starts decoding a new gesture incrementally, discarding the search space
+        // of any previous decode. The touch points are then supplied in batches
+        // through ExtendGesture as they arrive.
+        //
+        // Args:
+        //   prev - The preceding word, if any (see SetPrecedingText).
+        void StartGesture(const Utf8String& prev);
+
+        // Appends the given touch points to the gesture started by StartGesture and
+        // advances the search over the points that have not been decoded yet.
+        // While the gesture is in progress, the last
+        // TouchSequence::kPointsToRecompute points (or a few more with adaptive
+        // resampling, see TouchSequence::StablePointCount) are held back, since
+        // their geometric properties may still change as more points arrive. If
+        // is_final is true, the last point is treated as the touch up event and
+        // all of the remaining points are decoded.
+        //
+        // Returns:
+        //   The N-best results for the points decoded so far. The search space is
+        //   left intact, so the gesture can be extended again until it is final.
+        vector<DecoderResult> ExtendGesture(const vector<int>& xs,
+                                            const vector<int>& ys,
+                                            const vector<int>& times,
+                                            const float sample_dist,
+                                            const bool is_final);
 
         float GetAutocorrectThreshold(float top_result_score, int touch_points_size){
             const float autocorrect_threshold =
@@ -179,16 +321,28 @@ namespace decoder {
                 const vector<Utf8StringPiece>& decoded_terms, int max_predictions,
                 std::map<Utf8String, LogProbFloat>* top_predictions);
 
+        // Creates the language model scorer(s) for preceding_text_ and
+        // following_text_, replacing any previous ones.
+        void CreateLanguageModelScorers();
+
         // Initializes the given token to the root(s) of the lexicon(s). This function
         // will cache the root token at the first call and uses the cached value in
         // following calls.
         void GetRootToken(Token* token);
 
-        // Returns a new search token from a pre-allocated token pool.
-        // Returns null if no new search tokens are available.
+        // Returns the child nodes of the given token, grouped by codepoint. The
+        // children are extracted on the first call for the token's nodes, and the
+        // token (and any later copy of it) remembers their id in the
+        // children_cache_.
+        ChildGroupSpan GetChildren(Token* token);
+
+        // Returns a new search token from the token pool. Returns null if no new
+        // search tokens are available (which cannot happen, since the pool grows as
+        // needed, but callers still handle it).
         // Note that this token needs to be added to the search space using the method
         // DecoderSession::AddSearchTokenToSearchSpace.
         inline Token* NewSearchToken() {
+            ++search_stats_.tokens_created;
             return search_space_token_pool_->NewPooledToken();
         }
 
@@ -201,13 +355,100 @@ namespace decoder {
                                             const KeyId aligned_key,
                                             const int history_id) const;
 
+        // Returns the allocation counters of the session's arena. In steady state
+        // (i.e., when decoding inputs no larger than previous ones) the number of
+        // chunk allocations stays constant.
+        const DecoderArena::Stats& arena_stats() const { return arena_.stats(); }
+
+        // Returns the number of times the token pool grew beyond
+        // DecoderParams::token_pool_capacity.
+        uint64 token_pool_grow_count() const {
+            return search_space_token_pool_->grow_count();
+        }
+
+        // Returns the hit/miss counters of the token children cache, including the
+        // hits in the model's shared LexiconChildrenCache.
+        const TokenChildrenCache::Stats& children_cache_stats() const {
+            return children_cache_.stats();
+        }
+        void ResetChildrenCacheStats() { children_cache_.ResetStats(); }
+
+        // Returns the lookup/probe counters of the search space table.
+        const DecoderStateMap::Stats& search_space_stats() const {
+            return search_space_.stats();
+        }
+
+        // Returns the counters of tokens created, expanded and pruned by the search.
+        const DecoderSearchStats& search_stats() const { return search_stats_; }
+        void ResetSearchStats() { search_stats_ = DecoderSearchStats(); }
+
+        // Returns the counters of the transit scores computed for the touch
+        // sequence of the current (or last) decode.
+        TouchSequence::TransitScoreStats transit_score_stats() const {
+            return touch_sequence_ != nullptr ? touch_sequence_->transit_score_stats()
+                                              : TouchSequence::TransitScoreStats();
+        }
+
+        // Returns the adjustments made for the time budget of the last DecodeTouch.
+        const DecodeDeadlineStats& deadline_stats() const { return deadline_stats_; }
+
         // Prune the search tokens if the free token ratio falls below this value.
         static constexpr float kPruneWhenFreeRatioBelow = 0.1f;
 
         // Prune this proportion of the worst search tokens.
         static constexpr float kPruneRatio = 0.5f;
 
+        // The bucket width and number of buckets of the score histogram used to
+        // find the beam cutoff and the pruning threshold, i.e. scores down to -1024
+        // are bucketed.
+        static constexpr float kScoreHistogramBucketWidth = 0.25f;
+        static constexpr int kScoreHistogramBuckets = 4096;
+
+        // When decoding against a time budget, the beam is adapted only after this
+        // many points, since the first points (which expand the lexicon roots) are
+        // not representative of the time per point.
+        static constexpr int kMinPointsToAdaptBeam = 4;
+
+        // The weight of the last point in the moving average of the time per point.
+        static constexpr double kPointTimeSmoothing = 0.25;
+
+        // When decoding against a time budget, widen the beam if the decode is
+        // projected to take less than this proportion of the budget.
+        static constexpr double kGrowBeamBelowBudgetRatio = 0.5;
+
+        // The narrowest score_to_beat_offset band when decoding against a time
+        // budget, relative to DecoderParams::score_to_beat_offset.
+        static constexpr float kMinScoreToBeatOffsetRatio = 0.5f;
+
     private:
+        // Releases all tokens in the search space and clears the per-decode state,
+        // so that a new touch sequence can be decoded from scratch.
+        void ResetSearchSpace();
+
+        // Adds the root token to the empty search space. Returns false if no root
+        // token could be created (e.g., when the decoder has no lexicons).
+        bool AddRootTokenToSearchSpace();
+
+        // Processes the touch points from decoded_index_ + 1 up to (but not
+        // including) end. Points that have already been decoded are skipped.
+        void DecodeTouchPointsUpTo(const int end);
+
+        // Adjusts the beam width and score_to_beat_offset after decoding a touch
+        // point, so that the remaining points fit into the rest of the time budget.
+        //
+        // Args:
+        //   points_decoded  - The number of points decoded so far against the budget.
+        //   points_left     - The number of points still to decode.
+        //   point_ms        - The time taken to decode the last point.
+        //   elapsed_ms      - The time taken so far, out of time_budget_ms_.
+        void AdaptBeamToTimeBudget(int points_decoded, int points_left,
+                                   double point_ms, double elapsed_ms);
+
+        // Extracts the N-best results from the tokens aligned to the last decoded
+        // point (end - 1). The tokens are finalized on copies, so the search space
+        // itself is not modified and can still be extended afterwards.
+        vector<DecoderResult> ExtractResults(const int end);
+
         // Processes the touch point at the supplied index.  Assumes that all tokens
         // in the search space have been processed up to index - 1 (if index > 0).
         // This involves the following steps:
@@ -233,9 +474,45 @@ namespace decoder {
         // method is called.  This method updates active_beam_min_score_, which
         // allows us to do skip expanding tokens whose children wouldn't make it
         // into the beam.
-        void PassGestureTokensInBeam(const std::unordered_set<Token*>& beam,
+        void PassGestureTokensInBeam(const std::vector<Token*>& beam,
                                      const int index);
 
+        // Expands the tokens in the beam (top_tokens_) to the touch point at index
+        // using DecoderParams::beam_expansion_threads threads. The search space is
+        // pruned once, and the beam is split into contiguous slices, which are expanded into their own
+        // BeamExpansionSlice while the search space is only read. The slices are
+        // then folded together in beam order, keeping the candidate with the best
+        // next score for each DecoderState (or the first of equal ones), and merged
+        // into the search space. Since each candidate only depends on the search
+        // space before the expansion, the results do not depend on the number of
+        // threads.
+        void ExpandBeam(const int index);
+
+        // Expands the tokens of the given slice of the beam into the slice.
+        void ExpandBeamSlice(const int index, BeamExpansionSlice* slice);
+
+        // Adds the candidates of the given slice to first_slice, which holds those
+        // of the preceding slices, and releases them.
+        void FoldBeamSlice(BeamExpansionSlice* slice, BeamExpansionSlice* first_slice);
+
+        // Adds a copy of the given candidate of slice, for the given search space
+        // entry (or -1), to first_slice, and releases the candidate.
+        void FoldChildCandidate(Token** candidate, const int entry,
+                                BeamExpansionSlice* slice,
+                                BeamExpansionSlice* first_slice);
+
+        // Adds the counters and the extracted children of the given slice to the
+        // session's.
+        void MergeBeamSliceStatsAndChildren(BeamExpansionSlice* slice);
+
+        // Merges the candidates of the given slice into the search space, and
+        // releases them.
+        void MergeBeamSlice(BeamExpansionSlice* slice);
+
+        // Replaces the given search token with the candidate for its state if the
+        // candidate has a better next score, keeping the token's children.
+        static void MergeChildCandidate(const Token& candidate, Token* token);
+
         // Advance all of the active tokens to the next index. It prunes out
         // any tokens that are now obsolete (e.g., were not advanced at all in the
         // the previous time frame). For still-active tokens, it replaces their
@@ -245,7 +522,7 @@ namespace decoder {
         // The decoder_debug argument is optional and may be nullptr.
         //
         // Returns:
-        //   A set of the top active tokens to be advanced by the decoder. This
+        //   The top active tokens to be advanced by the decoder (top_tokens_). This
         //   typically represents a subset of all active states/tokens maintained in
         //   the search space, to speed up decoding. Only these tokens will be
         //   specifically activated and passed to the next time frame. However, a
@@ -255,7 +532,7 @@ namespace decoder {
         //   Note: The ownership of the tokens is retained by this class, and the
         //   pointers are only guaranteed to be valid only the next call to
         //   DecoderSession::AdvanceToNextIndex.
-        std::unordered_set<Token*> AdvanceToNextIndexAndReturnTopTokens(
+        const std::vector<Token*>& AdvanceToNextIndexAndReturnTopTokens(
                 const int next_index);
 
         // Enumerates the different types of character alignments that can be applied
@@ -279,15 +556,20 @@ namespace decoder {
         //   next_index      - The touch index for the next time frame.
         //   align_type      - The type of alignment that resulted in the expansion.
         //   token           - The token to expand.
-        //   reentry_tokens  - Populated with the top reentry tokens that have already
-        //                     reached the end of the previous word.
+        //   reentry_terminals - Populated with the terminal tokens that should
+        //                       re-enter the lexicon for the next word (see
+        //                       AddReentryTokens), or nullptr.
+        //   slice           - The slice to add the child tokens to (see
+        //                     ExpandBeam), or nullptr to update the search space
+        //                     directly.
         void ExpandToken(const int next_index, const DecoderAlignType align_type, Token* token,
-                         TokenBeam* reentry_tokens);
+                         vector<Token>* reentry_terminals, BeamExpansionSlice* slice);
 
         // The version of ExpandToken for gesture typing input.
         void ExpandTokenGesture(const int decoded_size, Token* token,
                                 const DecoderAlignType align_type,
-                                TokenBeam* reentry_tokens);
+                                vector<Token>* reentry_terminals,
+                                BeamExpansionSlice* slice);
 
         // Whether the token should be expanded to its children. This returns false
         // for gesture tokens that are still in-transit to the current key and do
@@ -296,28 +578,51 @@ namespace decoder {
         // previous point.
         bool ShouldExpandToChildren(const Token* token) const;
 
+        // Whether the child of the given (gesture) parent for the given nodes and
+        // key should be created when expanding the parent to the touch point at
+        // next_index. This returns false if the child's score for that point is
+        // known to be too low to make it into the next beam (see
+        // DecoderParams::use_lookahead_pruning). Only applies to children with a
+        // different key than the parent, expanded into a BeamExpansionSlice.
+        bool ShouldCreateChildToken(const CodepointNodeSpan& nodes,
+                                    const Token& parent, const KeyId next_key,
+                                    const int next_index) const;
+
         // Returns the score to beat for non-correction candidates.
         float ScoreToBeat() const {
-            return best_score_ + params_.score_to_beat_offset;
+            return best_score_ + score_to_beat_offset_;
         }
         // Returns the score to beat for multi-term candidates.
         float ScoreToBeatForMultiTerm() const {
             return best_score_ + params_.score_to_beat_offset_for_corrections;
         }
 
-        float GetConditionalLanguageModelScore(
-                const vector<Utf8StringPiece>& term_sequence,
-                const Token& terminal_token);
+        // Computes the conditional LM score of the current term of each of the
+        // given tokens given its word history, backing off to the unigram score of
+        // the token. The tokens that share a word history are scored together, so
+        // that the LM looks up the history once for all of them.
+        //
+        // Args:
+        //   tokens - The tokens to score.
+        //   scores - Replaced with the score of each token, or NEG_INF for the
+        //            tokens that are not terminals.
+        void GetConditionalLanguageModelScores(const vector<Token>& tokens,
+                                               vector<float>* scores);
 
         // Returns the (log of the linear-interpolated) conditional probability of the
         // last term in the term sequence from the language model scorers.
         float DecodedTermsConditionalLogProb(const vector<Utf8StringPiece>& terms);
 
-        // Returns the set of possible keys that can align to the given code.
-        // This is cached within the DecoderSession to speed up repeated calls.
-        //
-        // See Keyboard::GetPossibleKeysForCode.
-        const vector<KeyId>& GetPossibleKeysForCode(const char32 code);
+        // As DecodedTermsConditionalLogProb, for each of the candidate terms
+        // following the same sequence of terms.
+        void DecodedCandidatesConditionalLogProbs(
+                const vector<Utf8StringPiece>& terms,
+                const vector<Utf8StringPiece>& candidates, vector<LogProbFloat>* logps);
+
+        // As GetChildren, but only reads from the session's children cache, and
+        // extracts any missing children into the given slice instead. Unlike
+        // GetChildren, the token is not updated.
+        ChildGroupSpan GetChildren(const Token& token, BeamExpansionSlice* slice) const;
 
 
         // Pass next_token to the next touch point alignment at next_index, given
@@ -370,38 +675,36 @@ namespace decoder {
          ************************************/
 
         // Initialize a next-word token for re-entry into the root of the lexicon.
-        // This treats the terminal_token as the end of the previous word.
-        void InitializeReentryToken(const Token& terminal_token, const float penalty,
+        // This treats the terminal_token as the end of the previous word, whose
+        // conditional LM score is given (see GetConditionalLanguageModelScores).
+        void InitializeReentryToken(const Token& terminal_token,
+                                    const float conditional_lm_score, const float penalty,
                                     const int next_key, Token* reentry_token);
 
+        // Scores the given terminal tokens (see ExpandToken), and adds their
+        // re-entry tokens to the reentry_tokens beam.
+        void AddReentryTokens(const vector<Token>& terminal_tokens,
+                              TokenBeam* reentry_tokens);
+
 
         // Finds the search token that matches the given input. Returns nullptr if no
         // such token exists in the search space.
-        Token* FindSearchToken(const vector<CodepointNode>& nodes,
+        Token* FindSearchToken(const CodepointNodeSpan& nodes,
                                const int word_history_id, const int next_key);
 
         // Get the sequence of decoded terms for the given token.
         //
         // Args:
-        //   token              - The token from which to extract the terms.
-        //   last_term_storage  - The string in which to store the last term,
-        //                        representing the token's current lexical state.
-        //   decoded_terms      - The sequence of all decoded terms in the token
-        //                        (including last_term_storage as the last term).
-        //
-        // Note: The output parameter decoded_terms is only valid while
-        // last_term_storage is valid.
-        void GetDecodedTerms(const Token& token, Utf8String* last_term_storage,
-                             vector<Utf8StringPiece>* decoded_terms) const;
+        //   token     - The token from which to extract the terms.
+        //   term_ids  - Replaced with the ids (see WordHistoryTable::term) of all
+        //               decoded terms in the token. The last term represents the
+        //               token's current lexical state.
+        void GetDecodedTerms(const Token& token, vector<int>* term_ids);
 
         // Returns the score for interpreting the touch point at index as an alignment
         // to the space key.
         float GetAlignToSpaceScore(const int index) const;
 
-        // Get the word history (i.e., sequence of previously decoded terms)
-        // associated with the given id.
-        const vector<Utf8String>& GetWordHistory(int id) const;
-
         // Find or create the child token (referenced by the given nodes) for the
         // given parent token. This will only create a new Token if the associated
         // DecoderState has no Token assigned to it yet. Otherwise, it will return
@@ -422,9 +725,27 @@ namespace decoder {
         //
         //   Note: May return nullptr if there are no free search tokens in the token
         //   pool (though this should not happen in practice with proper pruning).
-        Token* FindOrCreateChildToken(const vector<CodepointNode>& nodes,
+        Token* FindOrCreateChildToken(const CodepointNodeSpan& nodes,
                                       const Token& parent, const int next_key);
 
+        // As above, but when expanding a slice of the beam (i.e., if slice is not
+        // null), returns a new candidate token in the slice instead: a copy of the
+        // child's token in the search space as of the start of the expansion, or a
+        // new child token if there was none. The candidate must then be passed to
+        // AddChildCandidate once it has been updated, with the index of the
+        // child's entry in the search space, which is returned in entry (-1 if
+        // there was none, or if slice is null).
+        Token* FindOrCreateChildToken(const CodepointNodeSpan& nodes,
+                                      const Token& parent, const int next_key,
+                                      BeamExpansionSlice* slice, int* entry);
+
+        // Adds the given candidate (from FindOrCreateChildToken) to the slice, if
+        // it is the first or best candidate for its DecoderState so far (see
+        // BeamExpansionSlice::is_only_slice for new states). Does nothing if slice
+        // is null.
+        void AddChildCandidate(Token* candidate, const int entry,
+                               BeamExpansionSlice* slice);
+
         // Get the top 'max_completions' completions from the given prefix node based
         // on the unigram prefix probabilities. These results will likely need to be
         // rescored by the full language model.
@@ -434,12 +755,6 @@ namespace decoder {
         /*************************************
         *    Result Processing Functions     *
         *************************************/
-        // Get or create a new word_history by appending a new term to a previous
-        // word_history referenced by prev_word_history_id. Returns a new word_history
-        // id for the combined terms. If prev_word_history_id does not exist, then
-        // only the new term will be used.
-        int GetOrAddWordHistory(int prev_word_history_id, const Utf8String& new_term);
-
 
         // At the end of the decoding process, add any prefix-completions to the
         // suggested results (e.g., "birthd" -> "birthday")
@@ -452,16 +767,23 @@ namespace decoder {
         void ApplyScoreAdjustments(vector<DecoderResult>* results) const;
 
         // Process a token that has reached the end of the input. Populates the
-        // results vector with any DecoderResults from the token (if it is a terminal)
-        // and the top_prefixes beam if the token is a prefix of a longer term.
-        void ProcessEndOfInput(Token* token, vector<DecoderResult>* results,
-                               TokenBeam* top_prefixes);
+        // results vector with any DecoderResults from the token (if it is a terminal,
+        // with the given conditional LM score) and the top_prefixes beam if the
+        // token is a prefix of a longer term.
+        void ProcessEndOfInput(Token* token, const float conditional_lm_score,
+                               vector<DecoderResult>* results, TokenBeam* top_prefixes);
 
         // Process the token as an end-of-input terminal, meaning that it represents
         // a complete word. The terminal is added to the output results vector.
         void ExtractEndOfInputTerminal(const Token& terminal_token,
+                                       const float conditional_lm_score,
                                        vector<DecoderResult>* results);
 
+        // Adds the result to the results of the current ExtractResults, or replaces
+        // the one for the same word if the result has a better score.
+        void AddResultIfBetter(const DecoderResult& result,
+                               vector<DecoderResult>* results);
+
         /************************************
          *        Decoding variables        *
          ***********************************/
@@ -470,40 +792,13 @@ namespace decoder {
         const TouchSequence* touch_sequence() const { return touch_sequence_.get(); }
 
         // The keyboard representation for the search.
-        const Keyboard* keyboard() const { return gesture_keyboard_.get(); }
-
-        LoudsLmParams main_lm_params;
-        DecoderParams params_;
-
-        // The interpolated LM for the currently active LMs.
-        std::unique_ptr<InterpolatedLm> interpolated_lm_;
-
-        // The map between static language model names and their respective
-        // LanguageModelInterfaces. This map has ownership of the actual LMs.
-        // Note: static LMs are always considered "active" for decoding.
-        std::map<string, std::unique_ptr<LanguageModelInterface>> static_lms_;
-
-        // The map between static lexicon names and their respective pointers.
-        // Note: this map does not own the actual lexicons. E.g., in the case of
-        // LoudsLmAdapter, the lexicon is owned by the parent LoudsLm.
-        std::map<string, LexiconInterface *> static_lexicons_;
-        // The list of lexicons to use during decoding.
-        std::vector<const LexiconInterface *> lexicon_interfaces_;
-
-        // Get the index of the given lexicon.
-        int GetLexiconId(const LexiconInterface* lexicon) const {
-            for (size_t i = 0; i < lexicon_interfaces_.size(); ++i) {
-                if (lexicon_interfaces_[i] == lexicon) {
-                    return i;
-                }
-            }
-            CHECK(false) << "Lexicon not found.";
-        }
+        const Keyboard* keyboard() const { return model_->keyboard(); }
 
-        // The list of language models to use during decoding.
-        std::vector<const LanguageModelInterface *> lm_interfaces_;
+        // The shared model that this session decodes against.
+        const std::shared_ptr<const DecoderModel> model_;
 
-        KeyboardLayout keyboard_layout_;
+        // The decoder parameters (owned by model_).
+        const DecoderParams& params_;
 
         // The language model scorer(s) for this search.
         vector<std::unique_ptr<LanguageModelScorerInterface>> lm_scorers_;
@@ -515,6 +810,12 @@ namespace decoder {
 
         // A cached token that represent the root(s) of lexicon(s).
         std::unique_ptr<Token> root_token_cache_;
+
+        // The arena for the per-decode allocations (search tokens and token
+        // children). It is reset at the start of each decode, and must be declared
+        // before its users.
+        DecoderArena arena_;
+
         // A pool of pre-allocated tokens to be used in the search space. All of the
         // tokens added to the search_space_ should come from this pool.
         std::unique_ptr<TokenPool> search_space_token_pool_;
@@ -524,7 +825,10 @@ namespace decoder {
         // Note that all of the token pointers in this map should come from the
         // search_space_token_pool_, and will be released when the state is no
         // longer active.
-        StateToTokenMap search_space_;
+        DecoderStateMap search_space_;
+
+        // The child nodes of the tokens expanded since the last ResetSearchSpace.
+        TokenChildrenCache children_cache_;
 
         // Stores the worst score of the tokens being processed, i.e. the current
         // beam, or NEG_INF if the beam is not full.  Used to avoid generating child
@@ -532,17 +836,34 @@ namespace decoder {
         // only used for gestures.
         float active_beam_min_score_;
 
-        // A vector of temporary scores used for ranking and pruning.
+        // A vector of temporary scores used for ranking and pruning, and their
+        // histogram for finding the n-th best of them.
         std::vector<float> temp_scores_;
+        ScoreHistogram score_histogram_;
+
+        // The pruning scores of the search space entries, in the same order.
+        std::vector<float> search_space_scores_;
+
+        // The top tokens that should be advanced by the decoder in each time frame,
+        // in the (deterministic) order of the search space, which is the order in
+        // which they are expanded. The size should be equal to active_beam_width_
+        // (or more in case of ties).
+        std::vector<Token*> top_tokens_;
 
-        // The set of top tokens that should be advanced by the decoder in each time
-        // frame. The size should be equal to DecoderParams::active_beam_width.
+        // The set of top_tokens_, for looking up whether a token is in the beam
+        // while pruning. Only filled (once per time frame) when the search space is
+        // pruned, and empty otherwise.
         std::unordered_set<Token*> top_tokens_set_;
 
+        // The threads and the per-thread slices for expanding the beam (see
+        // ExpandBeam). Created on first use.
+        std::unique_ptr<WorkerPool> expansion_pool_;
+        std::vector<std::unique_ptr<BeamExpansionSlice>> expansion_slices_;
+
         // Prunes the specified ratio of search tokens from the search space, freeing
         // up spaces in the token pool for new tokens.
         //
-        // WARNING: This call may invalidate any token not in the top_tokens_set_.
+        // WARNING: This call may invalidate any token not in the top_tokens_.
         // The caller must ensure that these tokens will no longer be referenced
         // directly. Pruned tokens may be re-created (as needed) by
         // FindOrCreateChildToken.
@@ -551,33 +872,146 @@ namespace decoder {
         // The best score for the current active tokens.
         float best_score_;
 
+        DecoderSearchStats search_stats_;
+
+        // The beam width and score_to_beat_offset of the current decode. These are
+        // the ones in params_, unless adapted to a time budget.
+        int active_beam_width_;
+        float score_to_beat_offset_;
+
+        // The time budget of the current decode, or 0 if it has none.
+        float time_budget_ms_;
+
+        // The moving average of the time per point, when decoding against a time
+        // budget.
+        double ms_per_point_;
+
+        DecodeDeadlineStats deadline_stats_;
+
         // The index of the last point in the touch sequence that has been decoded
-        // (i.e., the index of the last call to AdvanceAllTokensInBeam). All active
-        // tokens advance at the same rate, so they should all share this index.
+        // (i.e., the index of the last call to AdvanceAllTokensInBeam), or -1 if no
+        // point has been decoded yet. All active tokens advance at the same rate,
+        // so they should all share this index.
         int decoded_index_;
 
-        // A map to store the possible word_histories (i.e., previous term sequences)
-        // for the active tokens in the session. This is highly efficient since many
-        // tokens will share the same word_history. Also, the word_history_id key is
-        // used to identify unique DecoderStates, distinguishing between Tokens that
-        // have the same nodes (i.e., current term) but different word histories.
-        std::unordered_map<int, vector<Utf8String>> word_histories_;
+        // The possible word_histories (i.e., previous term sequences) for the active
+        // tokens in the session. This is highly efficient since many tokens will
+        // share the same word_history. Also, the word_history_id is used to identify
+        // unique DecoderStates, distinguishing between Tokens that have the same
+        // nodes (i.e., current term) but different word histories.
+        WordHistoryTable word_histories_;
+
+        // Scratch space for the decoded terms of a token, as term ids and as the
+        // corresponding strings.
+        vector<int> term_ids_;
+        vector<Utf8StringPiece> term_pieces_;
+
+        // The terminal tokens reached at the current index that should re-enter
+        // the lexicon, and the tokens at the end of the input, which are scored
+        // together by GetConditionalLanguageModelScores.
+        vector<Token> reentry_terminals_;
+        vector<Token> end_of_input_tokens_;
+        vector<float> terminal_scores_;
+
+        // The index of each word in the results of the current ExtractResults (see
+        // AddResultIfBetter). There can be thousands of terminals at the end of
+        // the input, so the results are not searched linearly.
+        std::unordered_map<Utf8String, int> result_indices_;
+
+        // Scratch space for GetConditionalLanguageModelScores: the order in which
+        // the tokens are scored (grouped by word history), the term id, string and
+        // conditional log probability of the candidate term of each token, and
+        // the probabilities being interpolated across the LM scorers.
+        vector<int> batch_order_;
+        vector<int> candidate_term_ids_;
+        vector<Utf8StringPiece> candidate_pieces_;
+        vector<LogProbFloat> candidate_logps_;
+        vector<LogProbFloat> scorer_logps_;
+        vector<float> candidate_probs_;
 
         // The input touch sequence representation for the search.
         std::unique_ptr<TouchSequence> touch_sequence_;
 
-        std::unique_ptr<const Keyboard> gesture_keyboard_;
+        // The next word predictions for the preceding text of the current decode,
+        // extracted on first use (see ProcessPrefixCompletions).
+        map<Utf8String, LogProbFloat> next_word_predictions_;
+
+        DISALLOW_COPY_AND_ASSIGN(DecoderSession);
+    };
+
+    // The decoder used by the JNI layer. It owns the shared DecoderModel and a
+    // default DecoderSession, and forwards decoding calls to that session.
+    // Additional sessions for concurrent decoding can be created with NewSession.
+    class GestureDecoder {
+    public:
+        GestureDecoder(bool isTest);
+
+        void setMainParams(LoudsLmParams params) {
+            model_->setMainParams(params);
+        }
 
-        // A local cache that stores the mapping between codepoints and their
-        // corresponding keyboard keys.
-        std::unordered_map<char32, vector<KeyId>> codes_to_keys_map_;
+        // See DecoderModel::mutable_params. The changes take effect once the
+        // session is recreated, by RecreateDecoderForActiveLms or SetKeyboardLayout.
+        DecoderParams* mutable_params() { return model_->mutable_params(); }
 
-        // A counter that keeps track of the next word_history_id to be assigned.
-        int next_word_history_id_;
+        void AddLexiconAndLm(const std::string &lm_name, LexiconInterface *lexicon,
+                             std::unique_ptr<LanguageModelInterface> lm) {
+            model_->AddLexiconAndLm(lm_name, lexicon, std::move(lm));
+        }
 
-        // The next word predictions for the current session.
-        map<Utf8String, LogProbFloat> next_word_predictions_;
+        // Note: The model must not be modified while sessions returned by
+        // NewSession are decoding. The default session is recreated so that it
+        // picks up the new model state.
+        void RecreateDecoderForActiveLms();
+
+        void SetKeyboardLayout(KeyboardLayout layout);
+
+        vector<DecoderResult> DecodeTouch(TouchSequence* sequence, Utf8String prev) {
+            return session_->DecodeTouch(sequence, prev);
+        }
+
+        vector<DecoderResult> DecodeTouch(TouchSequence* sequence, Utf8String prev,
+                                          float time_budget_ms) {
+            return session_->DecodeTouch(sequence, prev, time_budget_ms);
+        }
+
+        void StartGesture(const Utf8String& prev) { session_->StartGesture(prev); }
+
+        vector<DecoderResult> ExtendGesture(const vector<int>& xs,
+                                            const vector<int>& ys,
+                                            const vector<int>& times,
+                                            const float sample_dist,
+                                            const bool is_final) {
+            return session_->ExtendGesture(xs, ys, times, sample_dist, is_final);
+        }
+
+        float GetAutocorrectThreshold(float top_result_score, int touch_points_size) {
+            return session_->GetAutocorrectThreshold(top_result_score,
+                                                     touch_points_size);
+        }
+
+        void PredictNextTerm(
+                const vector<Utf8StringPiece>& decoded_terms, int max_predictions,
+                std::map<Utf8String, LogProbFloat>* top_predictions) {
+            session_->PredictNextTerm(decoded_terms, max_predictions, top_predictions);
+        }
+
+        // Returns the shared model.
+        std::shared_ptr<const DecoderModel> model() const { return model_; }
+
+        // Creates a new session that decodes against the shared model. Each thread
+        // should use its own session.
+        std::unique_ptr<DecoderSession> NewSession() const {
+            return std::unique_ptr<DecoderSession>(new DecoderSession(model_));
+        }
+
+    private:
+        std::shared_ptr<DecoderModel> model_;
+
+        // The session used by the forwarding methods above.
+        std::unique_ptr<DecoderSession> session_;
 
+        DISALLOW_COPY_AND_ASSIGN(GestureDecoder);
     };
 }
 }
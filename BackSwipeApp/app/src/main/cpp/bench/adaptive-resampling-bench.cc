@@ -0,0 +1,142 @@
+// Description:
+//   Compares the fixed sampling of gestures with adaptive resampling (see
+//   DecoderParams::use_adaptive_resampling), by decoding gestures of the
+//   phrase words in res/raw sampled every kGestureSampleDist pixels, every
+//   twice that, and every kGestureSampleDist pixels with adaptive resampling.
+//   For each, the benchmark prints the number of frames (touch points) per
+//   gesture, the time per decode and the number of words decoded as the top
+//   result.
+//
+//   Adaptive resampling only drops the points that a gesture goes straight
+//   through, so the benchmark fails if it decodes more than kMaxLostShare
+//   fewer words as the top result than the fixed sampling, or if it does not
+//   decode fewer frames.
+//
+//   Usage: adaptive-resampling-bench [active_beam_width] [gestures]
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "GestureDecoder.h"
+#include "bench-util.h"
+#include "internal/Louds/louds-lm-adapter.h"
+#include "internal/keyboardSetting/keyboard.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    // The number of synthetic words added to the lexicon.
+    constexpr int kSyntheticWords = 20000;
+
+    // The number of timed decodes of all gestures, of which the fastest counts.
+    constexpr int kRuns = 3;
+
+    // The share of the gestures whose word adaptive resampling may no longer
+    // decode as the top result. On the synthetic lexicon few words are decoded
+    // at all, so a few gestures either way are noise.
+    constexpr double kMaxLostShare = 0.02;
+
+    // The outputs of a benchmark run.
+    struct Outputs {
+        double frames_per_gesture;
+        int top1;
+    };
+
+    // Decodes each word's gesture, sampled every sample_dist pixels and
+    // resampled adaptively if use_adaptive_resampling is true, prints the
+    // frames per gesture, the time per decode and the top-1 count, and returns
+    // the outputs.
+    Outputs Benchmark(const std::vector<std::string>& words, const int beam_width,
+                      const float sample_dist, const bool use_adaptive_resampling) {
+        std::unique_ptr<lm::LoudsLmAdapter> lm(new lm::LoudsLmAdapter(
+                bench::CreateUnigramLm(bench::ReadPhraseWords(), kSyntheticWords)));
+        GestureDecoder decoder(true);
+        DecoderParams* params = decoder.mutable_params();
+        params->active_beam_width = beam_width;
+        params->token_pool_capacity = beam_width * 20;
+        params->use_adaptive_resampling = use_adaptive_resampling;
+        LexiconInterface* lexicon = lm->lexicon();
+        decoder.AddLexiconAndLm("main", lexicon, std::move(lm));
+        decoder.RecreateDecoderForActiveLms();
+        const KeyboardLayout layout = bench::CreateBenchLayout();
+        decoder.SetKeyboardLayout(layout);
+
+        // The same gestures for every setting.
+        std::mt19937 rng(1);
+        std::vector<GestureInput> inputs;
+        for (const std::string& word : words) {
+            inputs.push_back(bench::NewGestureInput(layout, word, &rng));
+            inputs.back().sample_dist = sample_dist;
+        }
+
+        // The frames are the points of the gestures once their properties have
+        // been updated, as by the decoder.
+        const std::unique_ptr<Keyboard> keyboard = Keyboard::CreateKeyboardOrNull(layout);
+        long frames = 0;
+        for (const GestureInput& input : inputs) {
+            TouchSequence sequence(input.xs, input.ys, input.times, 0, input.sample_dist);
+            sequence.UpdateProperties(*keyboard, *params, false);
+            frames += sequence.size();
+        }
+
+        Outputs outputs;
+        outputs.frames_per_gesture = static_cast<double>(frames) / inputs.size();
+        const double ms = bench::BestTimeMs(kRuns, [&]() {
+            outputs.top1 = 0;
+            for (size_t i = 0; i < inputs.size(); ++i) {
+                const GestureInput& input = inputs[i];
+                const std::vector<DecoderResult> results = decoder.DecodeTouch(
+                        new TouchSequence(input.xs, input.ys, input.times, 0,
+                                          input.sample_dist),
+                        "");
+                outputs.top1 += !results.empty() && results[0].word() == words[i];
+            }
+        }) / inputs.size();
+        printf("  sample_dist=%3.0f %-8s %6.1f frames/gesture %8.3f ms/decode   "
+               "top1=%d/%zu\n",
+               sample_dist, use_adaptive_resampling ? "adaptive" : "fixed",
+               outputs.frames_per_gesture, ms, outputs.top1, words.size());
+        return outputs;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int beam_width = argc > 1 ? atoi(argv[1]) : 100;
+    const int gestures = argc > 2 ? atoi(argv[2]) : 300;
+
+    const std::vector<std::string> phrase_words = bench::ReadPhraseWords();
+    if (phrase_words.empty()) {
+        printf("No phrase words found in %s\n", BENCH_RAW_DIR);
+        return 1;
+    }
+    std::vector<std::string> words;
+    for (int i = 0; i < gestures; ++i) {
+        words.push_back(phrase_words[i % phrase_words.size()]);
+    }
+    printf("active_beam_width=%d, %d gestures\n", beam_width, gestures);
+
+    const Outputs expected =
+            Benchmark(words, beam_width, bench::kGestureSampleDist, false);
+    Benchmark(words, beam_width, 2 * bench::kGestureSampleDist, false);
+    const Outputs actual = Benchmark(words, beam_width, bench::kGestureSampleDist, true);
+    if (expected.top1 - actual.top1 > static_cast<int>(kMaxLostShare * words.size())) {
+        printf("MISMATCH: adaptive resampling decodes top1=%d vs %d\n", actual.top1,
+               expected.top1);
+        return 1;
+    }
+    if (actual.frames_per_gesture >= expected.frames_per_gesture) {
+        printf("MISMATCH: adaptive resampling decodes %.1f vs %.1f frames/gesture\n",
+               actual.frames_per_gesture, expected.frames_per_gesture);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Description:
+//   Measures how BatchDecoder::DecodeBatch scales with the number of workers,
+//   by decoding a batch of gestures of the phrase words in res/raw with 1, 2,
+//   4 and 8 workers, and prints the throughput and the latency percentiles of
+//   the fastest run.
+//
+//   Each worker's session decodes against the same model, so the benchmark
+//   fails if any result differs from that of the sequential DecodeTouch of the
+//   same gesture, or if the results are not in the order of the inputs.
+//
+//   Usage: batch-decode-bench [active_beam_width] [gestures]
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BatchDecoder.h"
+#include "GestureDecoder.h"
+#include "bench-util.h"
+#include "internal/Louds/louds-lm-adapter.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    // The number of synthetic words added to the lexicon.
+    constexpr int kSyntheticWords = 20000;
+
+    // The number of timed batches, of which the fastest counts.
+    constexpr int kRuns = 3;
+
+    // Decodes the inputs in batches with the given number of workers, prints the
+    // stats of the fastest batch, and returns the N-best lists of the last one.
+    std::vector<std::string> Benchmark(const GestureDecoder& decoder,
+                                       const std::vector<GestureInput>& inputs,
+                                       const int num_threads) {
+        BatchDecoder batch_decoder(decoder.model(), num_threads);
+        BatchDecodeStats best_stats;
+        std::vector<std::vector<DecoderResult>> results;
+        for (int run = 0; run < kRuns; ++run) {
+            BatchDecodeStats stats;
+            results = batch_decoder.DecodeBatch(inputs, &stats);
+            if (run == 0 || stats.wall_time_ms < best_stats.wall_time_ms) {
+                best_stats = stats;
+            }
+        }
+        printf("  workers=%d %8.1f gestures/s   latency p50 %6.3f p95 %6.3f "
+               "p99 %6.3f ms\n",
+               num_threads, best_stats.gestures_per_second, best_stats.p50_latency_ms,
+               best_stats.p95_latency_ms, best_stats.p99_latency_ms);
+        std::vector<std::string> nbest;
+        for (const std::vector<DecoderResult>& gesture_results : results) {
+            nbest.push_back(bench::NBestKey(gesture_results));
+        }
+        return nbest;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int beam_width = argc > 1 ? atoi(argv[1]) : 100;
+    const int gestures = argc > 2 ? atoi(argv[2]) : 300;
+
+    const std::vector<std::string> phrase_words = bench::ReadPhraseWords();
+    if (phrase_words.empty()) {
+        printf("No phrase words found in %s\n", BENCH_RAW_DIR);
+        return 1;
+    }
+    std::unique_ptr<lm::LoudsLmAdapter> lm(new lm::LoudsLmAdapter(
+            bench::CreateUnigramLm(phrase_words, kSyntheticWords)));
+    GestureDecoder decoder(true);
+    decoder.mutable_params()->active_beam_width = beam_width;
+    decoder.mutable_params()->token_pool_capacity = beam_width * 20;
+    LexiconInterface* lexicon = lm->lexicon();
+    decoder.AddLexiconAndLm("main", lexicon, std::move(lm));
+    decoder.RecreateDecoderForActiveLms();
+    const KeyboardLayout layout = bench::CreateBenchLayout();
+    decoder.SetKeyboardLayout(layout);
+
+    std::mt19937 rng(1);
+    std::vector<std::string> words;
+    std::vector<GestureInput> inputs;
+    for (int i = 0; i < gestures; ++i) {
+        words.push_back(phrase_words[i % phrase_words.size()]);
+        inputs.push_back(bench::NewGestureInput(layout, words.back(), &rng));
+    }
+    printf("active_beam_width=%d, %d gestures, %u hardware threads\n", beam_width,
+           gestures, std::thread::hardware_concurrency());
+
+    // The sequential results, with the decoder's own session.
+    std::vector<std::string> expected;
+    for (const GestureInput& input : inputs) {
+        expected.push_back(bench::NBestKey(decoder.DecodeTouch(
+                new TouchSequence(input.xs, input.ys, input.times, 0,
+                                  input.sample_dist),
+                input.prev_word)));
+    }
+
+    bool mismatch = false;
+    for (const int num_threads : {1, 2, 4, 8}) {
+        const std::vector<std::string> actual = Benchmark(decoder, inputs, num_threads);
+        if (actual.size() != expected.size()) {
+            printf("MISMATCH: workers=%d: %zu results for %zu gestures\n", num_threads,
+                   actual.size(), expected.size());
+            mismatch = true;
+            continue;
+        }
+        for (size_t i = 0; i < words.size(); ++i) {
+            if (actual[i] != expected[i]) {
+                printf("MISMATCH: workers=%d, gesture %zu (\"%s\"): %s vs %s\n",
+                       num_threads, i, words[i].c_str(), actual[i].c_str(),
+                       expected[i].c_str());
+                mismatch = true;
+                break;
+            }
+        }
+    }
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,272 @@
+// Description:
+//   Helpers shared by the host benchmarks in this directory: timing, the
+//   lexicons and gestures of the decoding benchmarks, and the tries of the
+//   LoudsTrie benchmarks.
+//
+//   The decoding benchmarks gesture the words of the phrase sets in res/raw
+//   (BENCH_RAW_DIR), on a generic QWERTY layout, against a unigram LoudsLm of
+//   those words and of synthetic words that fill the beam with competitors.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_BENCH_BENCH_UTIL_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_BENCH_BENCH_UTIL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BatchDecoder.h"
+#include "internal/Louds/louds-lm.h"
+#include "internal/decoder-result.h"
+#include "internal/keyboardSetting/keyboard-layout-tools.h"
+#include "internal/touch-sequence.h"
+
+namespace keyboard {
+namespace decoder {
+namespace bench {
+
+    // Returns the fastest of the given number of timed calls to fn, in
+    // milliseconds. The minimum is the least noisy estimate on a busy machine.
+    template <typename Fn>
+    double BestTimeMs(const int runs, Fn&& fn) {
+        double best = std::numeric_limits<double>::infinity();
+        for (int i = 0; i < runs; ++i) {
+            const auto start = std::chrono::steady_clock::now();
+            fn();
+            best = std::min(best, std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    }
+
+    // Keeps the compiler from optimizing away the computation of value.
+    template <typename T>
+    inline void DoNotOptimize(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // The key size of the benchmark keyboard, and the gesture sampling distance
+    // (a quarter of a key width, as on the device).
+    constexpr float kKeyWidth = 100.0f;
+    constexpr float kKeyHeight = 150.0f;
+    constexpr float kGestureSampleDist = 25.0f;
+
+    // Returns the phrases of the phrase sets in res/raw, as lowercase words.
+    inline std::vector<std::vector<std::string>> ReadPhrases() {
+        static const char* const kPhraseSets[] = {
+                "t_20", "t_40", "t_80", "t_160", "sentence_test", "sentence_demo",
+                "command_test", "command_demo", "dict_80_test", "dict_80_demo"};
+        std::vector<std::vector<std::string>> phrases;
+        for (const char* phrase_set : kPhraseSets) {
+            std::ifstream in(std::string(BENCH_RAW_DIR "/") + phrase_set + ".txt");
+            std::string line;
+            while (std::getline(in, line)) {
+                std::istringstream words(line);
+                std::vector<std::string> phrase;
+                std::string word;
+                while (words >> word) {
+                    std::transform(word.begin(), word.end(), word.begin(), ::tolower);
+                    phrase.push_back(word);
+                }
+                if (!phrase.empty()) {
+                    phrases.push_back(phrase);
+                }
+            }
+        }
+        return phrases;
+    }
+
+    // Returns the distinct words of the phrase sets in res/raw, in order of
+    // first occurrence.
+    inline std::vector<std::string> ReadPhraseWords() {
+        std::vector<std::string> words;
+        std::set<std::string> seen;
+        for (const std::vector<std::string>& phrase : ReadPhrases()) {
+            for (const std::string& word : phrase) {
+                if (seen.insert(word).second) {
+                    words.push_back(word);
+                }
+            }
+        }
+        return words;
+    }
+
+    // Returns the given words and synthetic_words distinct random lowercase
+    // words, in order of rank: the given words are spread over the first ranks,
+    // every fourth word (the rest follow the synthetic words, if there are too
+    // few of them).
+    inline std::vector<std::string> CreateRankedWords(
+            const std::vector<std::string>& words, const int synthetic_words) {
+        std::mt19937 rng(1);
+        std::uniform_int_distribution<int> letter('a', 'z');
+        std::uniform_int_distribution<int> length(2, 9);
+        std::set<std::string> terms(words.begin(), words.end());
+        std::vector<std::string> ranked;
+        while (static_cast<int>(ranked.size()) < synthetic_words) {
+            std::string word(length(rng), 'a');
+            for (char& c : word) {
+                c = static_cast<char>(letter(rng));
+            }
+            if (terms.insert(word).second) {
+                ranked.push_back(word);
+            }
+        }
+        for (size_t i = 0; i < words.size(); ++i) {
+            ranked.insert(ranked.begin() + std::min(i * 4, ranked.size()), words[i]);
+        }
+        return ranked;
+    }
+
+    // Returns a unigram LoudsLm of the given words and of synthetic_words random
+    // lowercase words (see CreateRankedWords), with Zipfian probabilities.
+    inline std::unique_ptr<keyboard::lm::louds::LoudsLm> CreateUnigramLm(
+            const std::vector<std::string>& words, const int synthetic_words) {
+        const std::vector<std::string> ranked =
+                CreateRankedWords(words, synthetic_words);
+        std::vector<keyboard::lm::louds::LoudsLm::Ngram> ngrams;
+        for (size_t rank = 0; rank < ranked.size(); ++rank) {
+            ngrams.push_back({{ranked[rank]}, -std::log(rank + 2.0f), 0});
+        }
+        return keyboard::lm::louds::LoudsLm::CreateFromNgramsOrNull(
+                ngrams, LoudsLmParams());
+    }
+
+    // Returns a lexicon trie (as in LoudsLexicon) of the given words.
+    inline std::unique_ptr<keyboard::lm::louds::Utf8CharTrie> CreateLexiconTrie(
+            const std::vector<std::string>& words) {
+        keyboard::lm::louds::Utf8CharTrie::KeyValueMap key_values;
+        for (const std::string& word : words) {
+            key_values[std::vector<char>(word.begin(), word.end())] = 1;
+        }
+        return keyboard::lm::louds::Utf8CharTrie::CreateFromKeyValueMapOrNull(
+                key_values, true);
+    }
+
+    // Returns num_keys random prefixes of one to four characters of the given
+    // words, the lookups that dominate decoding.
+    inline std::vector<std::vector<char>> CreatePrefixKeys(
+            const std::vector<std::string>& words, const int num_keys) {
+        std::mt19937 rng(7);
+        std::vector<std::vector<char>> keys;
+        for (int i = 0; i < num_keys; ++i) {
+            const std::string& word = words[rng() % words.size()];
+            const int length = 1 + rng() % std::min<int>(word.size(), 4);
+            keys.emplace_back(word.begin(), word.begin() + length);
+        }
+        return keys;
+    }
+
+    // Returns an n-gram trie (as in LoudsLm) over a vocabulary of the given
+    // number of term ids, with num_ngrams random bigrams, a third of which are
+    // extended to trigrams. The first terms of the bigrams cluster at the lower
+    // (more frequent) ids. Adds each bigram or trigram to ngrams.
+    inline std::unique_ptr<keyboard::lm::louds::NgramLoudsTrie> CreateNgramTrie(
+            const int vocabulary, const int num_ngrams,
+            std::vector<std::vector<keyboard::lm::louds::TermId16>>* ngrams) {
+        typedef keyboard::lm::louds::TermId16 TermId16;
+        std::mt19937 rng(7);
+        std::normal_distribution<float> first_term(0, vocabulary / 10.0f);
+        keyboard::lm::louds::NgramLoudsTrie::KeyValueMap key_values;
+        for (int i = 0; i < vocabulary; ++i) {
+            key_values[{static_cast<TermId16>(i)}] = 1;
+        }
+        for (int i = 0; i < num_ngrams; ++i) {
+            const TermId16 a = static_cast<TermId16>(std::min<int>(
+                    vocabulary - 1, std::abs(static_cast<int>(first_term(rng)))));
+            const TermId16 b = static_cast<TermId16>(rng() % vocabulary);
+            key_values[{a, b}] = 1;
+            if (i % 3 == 0) {
+                const TermId16 c = static_cast<TermId16>(rng() % vocabulary);
+                key_values[{a, b, c}] = 1;
+                ngrams->push_back({a, b, c});
+            } else {
+                ngrams->push_back({a, b});
+            }
+        }
+        return keyboard::lm::louds::NgramLoudsTrie::CreateFromKeyValueMapOrNull(
+                key_values, false);
+    }
+
+    // Returns a QWERTY layout with the benchmark key size.
+    inline KeyboardLayout CreateBenchLayout() {
+        KeyboardLayout layout;
+        keyboard_layout_tools::CreateQwertyKeyboardLayout(kKeyWidth, kKeyHeight,
+                                                          &layout);
+        return layout;
+    }
+
+    // Returns the touch points of a gesture through the key centers of the given
+    // word, sampled every fifth of a key width, 10 ms apart, with a drifting
+    // gaussian offset.
+    inline GestureInput NewGestureInput(const KeyboardLayout& layout,
+                                        const std::string& word, std::mt19937* rng) {
+        std::normal_distribution<float> noise(0, kKeyWidth * 0.12f);
+        std::vector<std::pair<float, float>> centers;
+        for (const char c : word) {
+            float x, y;
+            if (keyboard_layout_tools::GetKeyCenterForCode(layout, c, &x, &y)) {
+                centers.emplace_back(x, y);
+            }
+        }
+        GestureInput input;
+        std::vector<int>& xs = input.xs;
+        std::vector<int>& ys = input.ys;
+        std::vector<int>& times = input.times;
+        float dx = noise(*rng), dy = noise(*rng);
+        const auto add_point = [&](const float x, const float y) {
+            xs.push_back(static_cast<int>(x + dx));
+            ys.push_back(static_cast<int>(y + dy));
+            times.push_back(static_cast<int>(times.size()) * 10);
+            dx = 0.7f * dx + 0.3f * noise(*rng);
+            dy = 0.7f * dy + 0.3f * noise(*rng);
+        };
+        for (size_t i = 0; i < centers.size(); ++i) {
+            if (i == 0) {
+                add_point(centers[0].first, centers[0].second);
+                continue;
+            }
+            const float x0 = centers[i - 1].first, y0 = centers[i - 1].second;
+            const float x1 = centers[i].first, y1 = centers[i].second;
+            const int steps = std::max(
+                    1, static_cast<int>(std::hypot(x1 - x0, y1 - y0) / (kKeyWidth / 5)));
+            for (int k = 1; k <= steps; ++k) {
+                add_point(x0 + (x1 - x0) * k / steps, y0 + (y1 - y0) * k / steps);
+            }
+        }
+        if (xs.size() == 1) {
+            add_point(centers[0].first + 3, centers[0].second + 3);
+        }
+        input.sample_dist = kGestureSampleDist;
+        return input;
+    }
+
+    // Returns a new gesture of the given word (see NewGestureInput). The caller
+    // (usually DecodeTouch) takes ownership.
+    inline TouchSequence* NewGesture(const KeyboardLayout& layout,
+                                     const std::string& word, std::mt19937* rng) {
+        const GestureInput input = NewGestureInput(layout, word, rng);
+        return new TouchSequence(input.xs, input.ys, input.times, 0, input.sample_dist);
+    }
+
+    // Returns the words and scores of the given results, for comparing N-best
+    // lists.
+    inline std::string NBestKey(const std::vector<DecoderResult>& results) {
+        std::ostringstream key;
+        for (const DecoderResult& result : results) {
+            key << result.word() << ':' << result.score() << ' ';
+        }
+        return key.str();
+    }
+
+}  // namespace bench
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_BENCH_BENCH_UTIL_H_
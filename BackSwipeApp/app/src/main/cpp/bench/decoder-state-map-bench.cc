@@ -0,0 +1,291 @@
+// Description:
+//   Compares DecoderStateMap with the std::unordered_map that the search space
+//   used before it, by replaying the search space's access pattern for a
+//   gesture decode on both. At each time frame:
+//
+//   - the states that were not reached in the previous frame are erased, and
+//     the rest are ranked for the beam (AdvanceToNextIndexAndReturnTopTokens);
+//   - before each token in the beam is expanded, the worst half of the search
+//     space is erased if the token pool is nearly full
+//     (PruneSearchTokensOutsideTopTokensSet);
+//   - each token in the beam looks up its child states, creating the missing
+//     ones (FindOrCreateChildToken).
+//
+//   Only the map operations are timed: the lookups and insertions of the
+//   expansion, and the sweeps of the advance and the pruning.
+//
+//   Usage: decoder-state-map-bench [active_beam_width] [token_pool_capacity]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "internal/base/constants.h"
+#include "internal/base/hash.h"
+#include "internal/decoder-state-map.h"
+#include "internal/token.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    // The search space before DecoderStateMap.
+    struct DecoderStateHasher {
+        std::size_t operator()(const DecoderState& c) const {
+            return util_hash::Hash(c.lexicon_id, c.node_id, c.word_history_id);
+        }
+    };
+
+    typedef std::unordered_map<DecoderState, Token*, DecoderStateHasher>
+            UnorderedStateMap;
+
+    typedef std::chrono::steady_clock Clock;
+
+    // The number of time frames in a replayed gesture.
+    constexpr int kFrames = 150;
+
+    // The number of replayed gestures.
+    constexpr int kRuns = 50;
+
+    // The number of child states that each token in the beam reaches.
+    constexpr int kChildrenPerToken = 8;
+
+    // The number of nodes in the (synthetic) lexicon trie.
+    constexpr uint64 kLexiconNodes = 100000;
+
+    // As in DecoderSession, the search space is pruned when less than this ratio
+    // of the token pool is free.
+    constexpr float kPruneWhenFreeRatioBelow = 0.1f;
+
+    // Returns a pseudo-random number in [0, 1) for the given values.
+    float Noise(const uint64 a, const uint64 b) {
+        return (util_hash::Hash(a, b) % 1000) / 1000.0f;
+    }
+
+    // Returns the j-th child state of the given state. Pairs of children share a
+    // node, as tokens that are in transit to different keys do.
+    DecoderState ChildState(const DecoderState& parent, const int j) {
+        DecoderState child;
+        child.lexicon_id = 0;
+        child.node_id = (parent.node_id * 7 + j / 2 + 1) % kLexiconNodes;
+        child.word_history_id = parent.word_history_id;
+        child.aligned_key = static_cast<KeyId>((parent.node_id + j) % 26);
+        return child;
+    }
+
+    double ElapsedNs(const Clock::time_point& start) {
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    }
+
+    // Replays gestures on the given map. The tokens live in a fixed pool, and
+    // each token's next alignment holds its score and the frame it was last
+    // reached in. The state of each token is kept alongside the pool, since
+    // DecoderStateMap only stores the packed states.
+    template <typename Map>
+    class SearchSpaceReplay {
+    public:
+        SearchSpaceReplay(const int beam_width, const int capacity)
+                : beam_width_(beam_width),
+                  map_(capacity),
+                  pool_(capacity),
+                  states_(capacity),
+                  free_tokens_(),
+                  scores_(),
+                  beam_(),
+                  lookups_(0),
+                  erases_(0),
+                  lookup_ns_(0),
+                  erase_ns_(0) {}
+
+        // Decodes one gesture, and returns a checksum of the final search space.
+        double Run() {
+            map_.clear();
+            free_tokens_.clear();
+            for (Token& token : pool_) {
+                free_tokens_.push_back(&token);
+            }
+            DecoderState root;
+            root.lexicon_id = 0;
+            root.node_id = 0;
+            root.word_history_id = -1;
+            root.aligned_key = -1;
+            Reach(root, 0.0f, 0);
+            for (int frame = 1; frame < kFrames; ++frame) {
+                Advance(frame);
+                for (const auto& parent : beam_) {
+                    if (free_tokens_.size() < pool_.size() * kPruneWhenFreeRatioBelow) {
+                        Prune();
+                    }
+                    const auto start = Clock::now();
+                    for (int j = 0; j < kChildrenPerToken; ++j) {
+                        Reach(ChildState(parent.first, j),
+                              parent.second - 3 * Noise(parent.first.node_id, j + frame),
+                              frame);
+                    }
+                    lookup_ns_ += ElapsedNs(start);
+                }
+            }
+
+            // The scores are summed in order, so that the checksum does not depend
+            // on the map's iteration order.
+            scores_.clear();
+            for (const auto& entry : map_) {
+                scores_.push_back(entry.second->next_alignment().BestScore());
+            }
+            std::sort(scores_.begin(), scores_.end());
+            double checksum = map_.size();
+            for (const float score : scores_) {
+                checksum += score;
+            }
+            return checksum;
+        }
+
+        // Prints the time spent in the map per operation.
+        void PrintStats(const char* name) const {
+            printf("  %-20s %6.1f ns/lookup %6.1f ns/erase %8.2f us/frame\n", name,
+                   lookup_ns_ / lookups_, erase_ns_ / erases_,
+                   (lookup_ns_ + erase_ns_) / 1000 / (kRuns * (kFrames - 1)));
+        }
+
+    private:
+        // Updates the token for the given state with the given score, creating it
+        // if needed.
+        void Reach(const DecoderState& state, const float score, const int frame) {
+            ++lookups_;
+            auto it = map_.find(state);
+            Token* token = nullptr;
+            if (it != map_.end()) {
+                token = it->second;
+                if (token->next_index() == frame &&
+                    token->next_alignment().BestScore() >= score) {
+                    return;
+                }
+            } else {
+                CHECK(!free_tokens_.empty());
+                token = free_tokens_.back();
+                free_tokens_.pop_back();
+                map_[state] = token;
+                states_[token - pool_.data()] = state;
+            }
+            token->set_next_alignment(Alignment(frame, score, NEG_INF));
+        }
+
+        // Erases the states that were not reached in the previous frame, and
+        // collects the beam_width_ best of the others into beam_.
+        void Advance(const int frame) {
+            const auto start = Clock::now();
+            auto it = map_.begin();
+            while (it != map_.end()) {
+                if (it->second->next_index() != frame - 1) {
+                    free_tokens_.push_back(it->second);
+                    it = map_.erase(it);
+                    ++erases_;
+                    continue;
+                }
+                ++it;
+            }
+            erase_ns_ += ElapsedNs(start);
+
+            scores_.clear();
+            for (const auto& entry : map_) {
+                scores_.push_back(entry.second->next_alignment().BestScore());
+            }
+            float threshold = NEG_INF;
+            if (static_cast<int>(scores_.size()) > beam_width_) {
+                std::nth_element(scores_.begin(), scores_.begin() + beam_width_ - 1,
+                                 scores_.end(), std::greater<float>());
+                threshold = scores_[beam_width_ - 1];
+            }
+            beam_.clear();
+            for (const auto& entry : map_) {
+                const float score = entry.second->next_alignment().BestScore();
+                if (score >= threshold) {
+                    beam_.emplace_back(states_[entry.second - pool_.data()], score);
+                }
+            }
+            // The order of the beam must not depend on the map.
+            std::sort(beam_.begin(), beam_.end(),
+                      [](const std::pair<DecoderState, float>& a,
+                         const std::pair<DecoderState, float>& b) {
+                          return a.first.node_id != b.first.node_id
+                                 ? a.first.node_id < b.first.node_id
+                                 : a.first.aligned_key < b.first.aligned_key;
+                      });
+        }
+
+        // Erases the worst half of the search space. The beam is expanded from
+        // beam_, so it is not affected by erasing the states of its tokens.
+        void Prune() {
+            scores_.clear();
+            for (const auto& entry : map_) {
+                scores_.push_back(entry.second->next_alignment().BestScore());
+            }
+            const size_t median = scores_.size() / 2;
+            std::nth_element(scores_.begin(), scores_.begin() + median, scores_.end());
+            const float prune_score = scores_[median];
+
+            const auto start = Clock::now();
+            auto it = map_.begin();
+            while (it != map_.end()) {
+                if (it->second->next_alignment().BestScore() < prune_score) {
+                    free_tokens_.push_back(it->second);
+                    it = map_.erase(it);
+                    ++erases_;
+                    continue;
+                }
+                ++it;
+            }
+            erase_ns_ += ElapsedNs(start);
+        }
+
+        const int beam_width_;
+        Map map_;
+        std::vector<Token> pool_;
+        std::vector<DecoderState> states_;
+        std::vector<Token*> free_tokens_;
+        std::vector<float> scores_;
+        std::vector<std::pair<DecoderState, float>> beam_;
+        long lookups_;
+        long erases_;
+        double lookup_ns_;
+        double erase_ns_;
+    };
+
+    // Replays kRuns gestures on the given map type, prints the timings, and
+    // returns the checksum of the search space.
+    template <typename Map>
+    double Benchmark(const char* name, const int beam_width, const int capacity) {
+        SearchSpaceReplay<Map> replay(beam_width, capacity);
+        double checksum = 0;
+        for (int i = 0; i < kRuns; ++i) {
+            checksum = replay.Run();
+        }
+        replay.PrintStats(name);
+        return checksum;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int beam_width = argc > 1 ? atoi(argv[1]) : 100;
+    const int capacity = argc > 2 ? atoi(argv[2]) : 1000;
+    printf("active_beam_width=%d token_pool_capacity=%d, %d frames, %d children "
+           "per token\n", beam_width, capacity, kFrames, kChildrenPerToken);
+    const double expected =
+            Benchmark<UnorderedStateMap>("std::unordered_map", beam_width, capacity);
+    const double actual =
+            Benchmark<DecoderStateMap>("DecoderStateMap", beam_width, capacity);
+    if (actual != expected) {
+        printf("MISMATCH: the search spaces differ (%f vs %f)\n", actual, expected);
+        return 1;
+    }
+    return 0;
+}
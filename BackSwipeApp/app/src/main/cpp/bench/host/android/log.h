@@ -0,0 +1,40 @@
+// Description:
+//   A host stand-in for the NDK's <android/log.h>, so that the decoder sources
+//   can be built into the host benchmarks (see bench/CMakeLists.txt). Warnings
+//   and errors are written to stderr, and anything less severe is dropped.
+//
+//   Like the NDK header, this only includes C headers: some sources include it
+//   inside their namespace.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_BENCH_HOST_ANDROID_LOG_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_BENCH_HOST_ANDROID_LOG_H_
+
+#include <stdarg.h>
+#include <stdio.h>
+
+typedef enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+inline int __android_log_print(int prio, const char* tag, const char* fmt, ...) {
+    if (prio < ANDROID_LOG_WARN) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: ", tag);
+    const int result = vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    return result;
+}
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_BENCH_HOST_ANDROID_LOG_H_
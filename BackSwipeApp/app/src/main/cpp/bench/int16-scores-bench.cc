@@ -0,0 +1,134 @@
+// Description:
+//   Compares the float and int16 storage of the spatial scores (see
+//   DecoderParams::use_int16_spatial_scores), by decoding gestures of the
+//   phrase words in res/raw with either, and prints the time per decode and
+//   the number of words decoded as the top result and among the top three.
+//
+//   The int16 scores are rounded, so near ties can be pruned differently and
+//   the results are not identical. The benchmark fails if the int16 storage
+//   decodes more than kMaxLostShare fewer words as the top result or among
+//   the top three, or if the top result (or the top three words) differ from
+//   the float ones for more than kMaxChangedShare of the gestures.
+//
+//   Usage: int16-scores-bench [active_beam_width] [gestures]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "GestureDecoder.h"
+#include "bench-util.h"
+#include "internal/Louds/louds-lm-adapter.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    // The number of synthetic words added to the lexicon.
+    constexpr int kSyntheticWords = 20000;
+
+    // The number of timed decodes of all gestures, of which the fastest counts.
+    constexpr int kRuns = 3;
+
+    // The share of the gestures whose word the int16 storage may no longer
+    // decode (as the top result, or among the top three), and whose top result
+    // (or top three words) may change.
+    constexpr double kMaxLostShare = 0.01;
+    constexpr double kMaxChangedShare = 0.03;
+
+    // The top three words of each gesture.
+    using TopWords = std::vector<std::vector<std::string>>;
+
+    // Decodes each word's gesture with the given storage, prints the time per
+    // decode and the top-1 and top-3 counts, and returns the top three words.
+    TopWords Benchmark(const std::vector<std::string>& words, const int beam_width,
+                       const bool use_int16, int* top1, int* top3) {
+        std::unique_ptr<lm::LoudsLmAdapter> lm(new lm::LoudsLmAdapter(
+                bench::CreateUnigramLm(bench::ReadPhraseWords(), kSyntheticWords)));
+        GestureDecoder decoder(true);
+        decoder.mutable_params()->active_beam_width = beam_width;
+        decoder.mutable_params()->token_pool_capacity = beam_width * 20;
+        decoder.mutable_params()->use_int16_spatial_scores = use_int16;
+        LexiconInterface* lexicon = lm->lexicon();
+        decoder.AddLexiconAndLm("main", lexicon, std::move(lm));
+        decoder.RecreateDecoderForActiveLms();
+        const KeyboardLayout layout = bench::CreateBenchLayout();
+        decoder.SetKeyboardLayout(layout);
+
+        TopWords top_words(words.size());
+        const double ms = bench::BestTimeMs(kRuns, [&]() {
+            // The same gestures in every run.
+            std::mt19937 rng(1);
+            for (size_t i = 0; i < words.size(); ++i) {
+                const std::vector<DecoderResult> results = decoder.DecodeTouch(
+                        bench::NewGesture(layout, words[i], &rng), "");
+                top_words[i].clear();
+                for (size_t j = 0; j < std::min<size_t>(3, results.size()); ++j) {
+                    top_words[i].push_back(results[j].word());
+                }
+            }
+        }) / words.size();
+        *top1 = 0;
+        *top3 = 0;
+        for (size_t i = 0; i < words.size(); ++i) {
+            const std::vector<std::string>& top = top_words[i];
+            *top1 += !top.empty() && top[0] == words[i];
+            *top3 += std::find(top.begin(), top.end(), words[i]) != top.end();
+        }
+        printf("  %-5s %8.3f ms/decode   top1=%d/%zu top3=%d/%zu\n",
+               use_int16 ? "int16" : "float", ms, *top1, words.size(), *top3,
+               words.size());
+        return top_words;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int beam_width = argc > 1 ? atoi(argv[1]) : 100;
+    const int gestures = argc > 2 ? atoi(argv[2]) : 300;
+
+    const std::vector<std::string> phrase_words = bench::ReadPhraseWords();
+    if (phrase_words.empty()) {
+        printf("No phrase words found in %s\n", BENCH_RAW_DIR);
+        return 1;
+    }
+    std::vector<std::string> words;
+    for (int i = 0; i < gestures; ++i) {
+        words.push_back(phrase_words[i % phrase_words.size()]);
+    }
+    printf("active_beam_width=%d, %d gestures\n", beam_width, gestures);
+
+    int float_top1, float_top3, int16_top1, int16_top3;
+    const TopWords expected = Benchmark(words, beam_width, false, &float_top1, &float_top3);
+    const TopWords actual = Benchmark(words, beam_width, true, &int16_top1, &int16_top3);
+    int changed_top1 = 0;
+    int changed_top3 = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+        changed_top1 += actual[i].empty() != expected[i].empty() ||
+                        (!actual[i].empty() && actual[i][0] != expected[i][0]);
+        changed_top3 += actual[i] != expected[i];
+    }
+    printf("  int16 changes the top result of %d and the top three of %d gestures\n",
+           changed_top1, changed_top3);
+
+    const int max_lost = static_cast<int>(kMaxLostShare * words.size());
+    const int max_changed = static_cast<int>(kMaxChangedShare * words.size());
+    if (float_top1 - int16_top1 > max_lost || float_top3 - int16_top3 > max_lost) {
+        printf("MISMATCH: int16 decodes top1=%d top3=%d vs float top1=%d top3=%d\n",
+               int16_top1, int16_top3, float_top1, float_top3);
+        return 1;
+    }
+    if (changed_top1 > max_changed || changed_top3 > max_changed) {
+        printf("MISMATCH: int16 changes the top result of %d and the top three of %d "
+               "gestures (at most %d)\n", changed_top1, changed_top3, max_changed);
+        return 1;
+    }
+    return 0;
+}
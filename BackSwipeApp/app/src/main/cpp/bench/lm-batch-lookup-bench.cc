@@ -0,0 +1,293 @@
+// Description:
+//   Compares LoudsLm::LookupConditionalLogProbs with a LookupConditionalLogProb
+//   of each candidate, on a trigram LM of the phrases in res/raw (and of
+//   synthetic unigrams), with stupid backoff and with backoff weights. For
+//   2000 histories of zero to three preceding terms, with 20 and 100
+//   candidates each, the benchmark prints the time per query of either lookup,
+//   given the preceding terms and given their LmContext.
+//
+//   The histories include out-of-vocabulary terms, and the candidates include
+//   out-of-vocabulary terms, capitalized terms (which are unigrams only, with
+//   an extra backoff weight) and a duplicate. The batched lookup only shares
+//   the context lookups between the candidates, so the benchmark fails if any
+//   value or found flag differs from that of the lookup of the single
+//   candidate, with and without preceding term_ids.
+//
+//   Usage: lm-batch-lookup-bench [queries]
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench-util.h"
+#include "internal/Louds/louds-lm.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    using keyboard::lm::louds::LmContext;
+    using keyboard::lm::louds::LoudsLm;
+    using keyboard::lm::louds::NgramLoudsTrie;
+
+    // The number of synthetic words added to the unigrams (see
+    // bench::CreateRankedWords).
+    constexpr int kSyntheticWords = 20000;
+
+    // The number of timed lookups of all queries, of which the fastest counts.
+    constexpr int kRuns = 5;
+
+    // The out-of-vocabulary terms of the histories and the candidates.
+    constexpr char kOovHistoryTerm[] = "zzqx";
+    constexpr char kOovCandidatePrefix[] = "qqzz";
+
+    // A lookup of the candidates following the history.
+    struct Query {
+        std::vector<std::string> history;
+        std::vector<std::string> candidates;
+    };
+
+    // Returns a trigram LM of the phrases, with the maximum likelihood
+    // probabilities of their n-grams (and of their capitalized words as
+    // unigrams), and of the other words as unigrams with Zipfian probabilities. The backoff weights are random, and only used if
+    // has_backoff_weights is true.
+    std::unique_ptr<LoudsLm> CreateNgramLm(
+            const std::vector<std::vector<std::string>>& phrases,
+            const std::vector<std::string>& words, const bool has_backoff_weights) {
+        std::map<std::vector<std::string>, int> counts;
+        int total = 0;
+        for (const std::vector<std::string>& phrase : phrases) {
+            for (size_t i = 0; i < phrase.size(); ++i) {
+                for (size_t n = 1; n <= 3 && i + n <= phrase.size(); ++n) {
+                    ++counts[std::vector<std::string>(phrase.begin() + i,
+                                                      phrase.begin() + i + n)];
+                }
+            }
+            total += phrase.size();
+        }
+        std::mt19937 rng(7);
+        std::uniform_int_distribution<int> backoff(0, 29);
+        std::vector<LoudsLm::Ngram> ngrams;
+        for (const auto& count : counts) {
+            const std::vector<std::string>& terms = count.first;
+            const std::vector<std::string> context(terms.begin(), terms.end() - 1);
+            const int context_count = context.empty() ? total : counts[context];
+            const float logp = std::log(static_cast<float>(count.second) / context_count);
+            ngrams.push_back({terms, logp, -backoff(rng) / 10.0f});
+            if (terms.size() == 1) {
+                std::string capitalized = terms[0];
+                capitalized[0] = static_cast<char>(toupper(capitalized[0]));
+                if (capitalized != terms[0]) {
+                    ngrams.push_back({{capitalized}, logp - 1, 0});
+                }
+            }
+        }
+        for (size_t rank = 0; rank < words.size(); ++rank) {
+            if (counts.count({words[rank]}) == 0) {
+                ngrams.push_back({{words[rank]}, -std::log(rank + 100.0f),
+                                  -backoff(rng) / 10.0f});
+            }
+        }
+        LoudsLmParams params;
+        params.has_backoff_weights = has_backoff_weights;
+        params.uppercase_unigram_extra_backoff_weight = -0.5f;
+        return LoudsLm::CreateFromNgramsOrNull(ngrams, params);
+    }
+
+    // Returns the given number of queries, of num_candidates candidates each
+    // (and a duplicate of the first), of the common words, of the words of the
+    // LM, and of out-of-vocabulary and capitalized terms.
+    std::vector<Query> CreateQueries(const std::vector<std::string>& common,
+                                     const std::vector<std::string>& words,
+                                     const int num_queries, const int num_candidates) {
+        std::mt19937 rng(num_candidates);
+        std::vector<Query> queries(num_queries);
+        for (int q = 0; q < num_queries; ++q) {
+            Query& query = queries[q];
+            for (int i = 0; i < q % 4; ++i) {
+                query.history.push_back(q % 17 == 0 && i == 0
+                                        ? kOovHistoryTerm
+                                        : common[rng() % common.size()]);
+            }
+            for (int i = 0; i < num_candidates; ++i) {
+                const int kind = rng() % 10;
+                std::string candidate;
+                if (kind < 5) {
+                    candidate = common[rng() % common.size()];
+                } else if (kind < 8) {
+                    candidate = words[rng() % words.size()];
+                } else if (kind < 9) {
+                    candidate = kOovCandidatePrefix + std::to_string(i);
+                } else {
+                    candidate = common[rng() % common.size()];
+                    candidate[0] = static_cast<char>(toupper(candidate[0]));
+                }
+                query.candidates.push_back(candidate);
+            }
+            query.candidates.push_back(query.candidates[0]);
+        }
+        return queries;
+    }
+
+    // Returns the terms as StringPieces, which refer to the strings.
+    std::vector<StringPiece> ToPieces(const std::vector<std::string>& terms) {
+        return std::vector<StringPiece>(terms.begin(), terms.end());
+    }
+
+    // Checks the batched lookups of the queries against the lookups of each
+    // candidate, given the preceding term_ids and given their context, and
+    // prints the first mismatch.
+    bool CheckLookups(const LoudsLm& lm, const NgramLoudsTrie::Key& preceding_term_ids,
+                      const std::vector<Query>& queries, const char* mode) {
+        std::vector<LogProbFloat> values;
+        std::vector<bool> found;
+        std::vector<LogProbFloat> context_values;
+        std::vector<bool> context_found;
+        LmContext context;
+        for (size_t q = 0; q < queries.size(); ++q) {
+            const Query& query = queries[q];
+            std::vector<StringPiece> terms = ToPieces(query.history);
+            const std::vector<StringPiece> candidates = ToPieces(query.candidates);
+            lm.LookupConditionalLogProbs(preceding_term_ids, terms, candidates, &values,
+                                         &found);
+            lm.InitContext(preceding_term_ids, terms, &context);
+            lm.LookupConditionalLogProbs(context, candidates, &context_values,
+                                         &context_found);
+            terms.push_back(StringPiece());
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                terms.back() = candidates[i];
+                LogProbFloat value = 0;
+                const bool is_found =
+                        lm.LookupConditionalLogProb(preceding_term_ids, terms, &value);
+                LogProbFloat context_value = 0;
+                const bool is_context_found =
+                        lm.LookupConditionalLogProb(context, candidates[i], &context_value);
+                if (found[i] != is_found || (is_found && values[i] != value) ||
+                    context_found[i] != is_context_found ||
+                    (is_context_found && context_values[i] != context_value)) {
+                    printf("MISMATCH: %s, %zu preceding term ids, query %zu, \"%s\": "
+                           "batch %d %g, context batch %d %g vs %d %g, context %d %g\n",
+                           mode, preceding_term_ids.size(), q,
+                           query.candidates[i].c_str(), static_cast<int>(found[i]),
+                           values[i], static_cast<int>(context_found[i]),
+                           context_values[i], is_found, value, is_context_found,
+                           context_value);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Times the lookups of the queries, one candidate at a time and batched,
+    // given the preceding terms and given their context, and prints the time
+    // per query.
+    void Benchmark(const LoudsLm& lm, const NgramLoudsTrie::Key& preceding_term_ids,
+                   const std::vector<Query>& queries, const char* mode) {
+        std::vector<std::vector<StringPiece>> histories;
+        std::vector<std::vector<StringPiece>> candidates;
+        std::vector<LmContext> contexts(queries.size());
+        for (size_t q = 0; q < queries.size(); ++q) {
+            histories.push_back(ToPieces(queries[q].history));
+            candidates.push_back(ToPieces(queries[q].candidates));
+            lm.InitContext(preceding_term_ids, histories[q], &contexts[q]);
+        }
+        std::vector<LogProbFloat> values;
+        std::vector<bool> found;
+        const double single_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (size_t q = 0; q < queries.size(); ++q) {
+                std::vector<StringPiece> terms = histories[q];
+                terms.push_back(StringPiece());
+                for (const StringPiece& candidate : candidates[q]) {
+                    terms.back() = candidate;
+                    LogProbFloat value;
+                    bench::DoNotOptimize(
+                            lm.LookupConditionalLogProb(preceding_term_ids, terms, &value));
+                    bench::DoNotOptimize(value);
+                }
+            }
+        });
+        const double batch_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (size_t q = 0; q < queries.size(); ++q) {
+                lm.LookupConditionalLogProbs(preceding_term_ids, histories[q],
+                                             candidates[q], &values, &found);
+                bench::DoNotOptimize(values.data());
+            }
+        });
+        const double context_single_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (size_t q = 0; q < queries.size(); ++q) {
+                for (const StringPiece& candidate : candidates[q]) {
+                    LogProbFloat value;
+                    bench::DoNotOptimize(
+                            lm.LookupConditionalLogProb(contexts[q], candidate, &value));
+                    bench::DoNotOptimize(value);
+                }
+            }
+        });
+        const double context_batch_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (size_t q = 0; q < queries.size(); ++q) {
+                lm.LookupConditionalLogProbs(contexts[q], candidates[q], &values, &found);
+                bench::DoNotOptimize(values.data());
+            }
+        });
+        const double us = 1000.0 / queries.size();
+        printf("  %-15s %3zu candidates  terms: single %7.2f batch %7.2f us/query   "
+               "context: single %7.2f batch %7.2f us/query\n",
+               mode, queries[0].candidates.size(), single_ms * us, batch_ms * us,
+               context_single_ms * us, context_batch_ms * us);
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int num_queries = argc > 1 ? atoi(argv[1]) : 2000;
+
+    const std::vector<std::vector<std::string>> phrases = bench::ReadPhrases();
+    if (phrases.empty()) {
+        printf("No phrases found in %s\n", BENCH_RAW_DIR);
+        return 1;
+    }
+    // The common words are those of more than three occurrences.
+    std::map<std::string, int> word_counts;
+    for (const std::vector<std::string>& phrase : phrases) {
+        for (const std::string& word : phrase) {
+            ++word_counts[word];
+        }
+    }
+    std::vector<std::string> common;
+    for (const auto& word_count : word_counts) {
+        if (word_count.second > 3) {
+            common.push_back(word_count.first);
+        }
+    }
+    const std::vector<std::string> words = bench::CreateRankedWords(
+            bench::ReadPhraseWords(), kSyntheticWords);
+    printf("%zu phrases, %zu common words, %zu words, %d queries\n", phrases.size(),
+           common.size(), words.size(), num_queries);
+
+    for (const bool has_backoff_weights : {false, true}) {
+        const char* mode = has_backoff_weights ? "backoff weights" : "stupid backoff";
+        const std::unique_ptr<LoudsLm> lm =
+                CreateNgramLm(phrases, words, has_backoff_weights);
+        const NgramLoudsTrie::Key preceding_term_ids = lm->TermsToTermIds({common[1]});
+        for (const int num_candidates : {20, 100}) {
+            const std::vector<Query> queries =
+                    CreateQueries(common, words, num_queries, num_candidates);
+            Benchmark(*lm, preceding_term_ids, queries, mode);
+            if (!CheckLookups(*lm, NgramLoudsTrie::Key(), queries, mode) ||
+                !CheckLookups(*lm, preceding_term_ids, queries, mode)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+// Description:
+//   Measures DecoderParams::use_lookahead_pruning, by decoding gestures of the
+//   phrase words in res/raw with and without it, with the sliced expansion on
+//   1 and 4 threads (lookahead does not apply to the in-place expansion). For
+//   each setting, the benchmark prints the time per decode, the number of
+//   words decoded as the top result, and the DecoderSearchStats per decode.
+//
+//   Lookahead pruning only skips children that cannot make it into the next
+//   beam, so the benchmark fails if it changes any N-best list.
+//
+//   Usage: lookahead-pruning-bench [active_beam_width] [gestures]
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "GestureDecoder.h"
+#include "bench-util.h"
+#include "internal/Louds/louds-lm-adapter.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    // The number of synthetic words added to the lexicon.
+    constexpr int kSyntheticWords = 20000;
+
+    // The number of timed decodes of all gestures, of which the fastest counts.
+    constexpr int kRuns = 3;
+
+    // Decodes each word's gesture with the given settings, prints the time per
+    // decode, the top-1 count and the search stats, and returns the N-best
+    // lists.
+    std::vector<std::string> Benchmark(const std::vector<std::string>& words,
+                                       const int beam_width, const int threads,
+                                       const bool use_lookahead_pruning) {
+        std::unique_ptr<lm::LoudsLmAdapter> lm(new lm::LoudsLmAdapter(
+                bench::CreateUnigramLm(bench::ReadPhraseWords(), kSyntheticWords)));
+        GestureDecoder decoder(true);
+        decoder.mutable_params()->active_beam_width = beam_width;
+        decoder.mutable_params()->token_pool_capacity = beam_width * 20;
+        decoder.mutable_params()->beam_expansion_threads = threads;
+        decoder.mutable_params()->use_lookahead_pruning = use_lookahead_pruning;
+        LexiconInterface* lexicon = lm->lexicon();
+        decoder.AddLexiconAndLm("main", lexicon, std::move(lm));
+        decoder.RecreateDecoderForActiveLms();
+        const KeyboardLayout layout = bench::CreateBenchLayout();
+        decoder.SetKeyboardLayout(layout);
+        std::unique_ptr<DecoderSession> session = decoder.NewSession();
+
+        std::vector<std::string> nbest(words.size());
+        int top1 = 0;
+        const double ms = bench::BestTimeMs(kRuns, [&]() {
+            // The same gestures in every run.
+            std::mt19937 rng(1);
+            top1 = 0;
+            session->ResetSearchStats();
+            for (size_t i = 0; i < words.size(); ++i) {
+                const std::vector<DecoderResult> results = session->DecodeTouch(
+                        bench::NewGesture(layout, words[i], &rng), "");
+                top1 += !results.empty() && results[0].word() == words[i];
+                nbest[i] = bench::NBestKey(results);
+            }
+        }) / words.size();
+        const DecoderSearchStats& stats = session->search_stats();
+        const double n = words.size();
+        printf("  threads=%d lookahead=%-3s %8.3f ms/decode   top1=%d/%zu   "
+               "per decode: %8.0f created %8.0f expanded %8.0f pruned "
+               "%8.0f skipped\n",
+               threads, use_lookahead_pruning ? "on" : "off", ms, top1, words.size(),
+               stats.tokens_created / n, stats.tokens_expanded / n,
+               stats.tokens_pruned / n, stats.children_skipped / n);
+        return nbest;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int beam_width = argc > 1 ? atoi(argv[1]) : 100;
+    const int gestures = argc > 2 ? atoi(argv[2]) : 300;
+
+    const std::vector<std::string> phrase_words = bench::ReadPhraseWords();
+    if (phrase_words.empty()) {
+        printf("No phrase words found in %s\n", BENCH_RAW_DIR);
+        return 1;
+    }
+    std::vector<std::string> words;
+    for (int i = 0; i < gestures; ++i) {
+        words.push_back(phrase_words[i % phrase_words.size()]);
+    }
+    printf("active_beam_width=%d, %d gestures\n", beam_width, gestures);
+
+    for (const int threads : {1, 4}) {
+        const std::vector<std::string> expected =
+                Benchmark(words, beam_width, threads, false);
+        const std::vector<std::string> actual =
+                Benchmark(words, beam_width, threads, true);
+        for (size_t i = 0; i < words.size(); ++i) {
+            if (actual[i] != expected[i]) {
+                printf("MISMATCH: threads=%d, \"%s\": %s vs %s\n", threads,
+                       words[i].c_str(), actual[i].c_str(), expected[i].c_str());
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+// Description:
+//   Compares LoudsLexicons labelled with UTF-8 bytes and with codepoints (see
+//   LoudsLmParams::lexicon_encodes_codepoints) on an accented language: the
+//   phrase words of res/raw and 20k synthetic words, with a given share of
+//   their accentable letters accented. For either encoding, the same unigram
+//   LoudsLm is built, written and read back, and the benchmark prints
+//
+//   - the size of the LM file;
+//   - the time to enumerate the top five codepoint levels of the lexicon;
+//   - the time per decode of the (unaccented) gestures of the phrase words,
+//     with and without the lexicon children cache.
+//
+//   The benchmark fails if the encodings enumerate a different number of
+//   nodes, or give different N-best lists for any gesture.
+//
+//   Usage: louds-lexicon-bench [accented_percent] [gestures]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "GestureDecoder.h"
+#include "bench-util.h"
+#include "internal/Louds/louds-lm-adapter.h"
+#include "internal/codepoint-node.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    using keyboard::lm::louds::LoudsLm;
+
+    // The number of synthetic words added to the lexicon.
+    constexpr int kSyntheticWords = 20000;
+
+    // The depth of the enumerated lexicon, in codepoints.
+    constexpr int kEnumerationDepth = 5;
+
+    // The number of timed enumerations and decodes of all gestures, of which
+    // the fastest counts.
+    constexpr int kEnumerationRuns = 15;
+    constexpr int kDecodeRuns = 3;
+
+    // Returns the word with the given percentage of its accentable letters
+    // accented, at random.
+    std::string Accent(const std::string& word, const int accented_percent,
+                       std::mt19937* rng) {
+        static const std::map<char, const char*> kAccents = {
+                {'a', "\xc3\xa0"}, {'c', "\xc3\xa7"}, {'e', "\xc3\xa9"},
+                {'i', "\xc3\xaf"}, {'n', "\xc3\xb1"}, {'o', "\xc3\xb6"},
+                {'u', "\xc3\xbc"}};
+        std::string accented;
+        for (const char c : word) {
+            const auto it = kAccents.find(c);
+            if (it != kAccents.end() &&
+                static_cast<int>((*rng)() % 100) < accented_percent) {
+                accented += it->second;
+            } else {
+                accented += c;
+            }
+        }
+        return accented;
+    }
+
+    // Returns the number of nodes in the top levels of the subtree of the
+    // given node, down to the given depth.
+    long Enumerate(const CodepointNode& node, const int depth) {
+        if (depth == 0) {
+            return 1;
+        }
+        std::vector<CodepointNode> children;
+        node.GetChildCodepoints(&children);
+        long count = 1;
+        for (const CodepointNode& child : children) {
+            count += Enumerate(child, depth - 1);
+        }
+        return count;
+    }
+
+    // The outputs of a benchmark run that must not depend on the encoding.
+    struct Outputs {
+        long enumerated_nodes;
+        std::vector<std::string> nbest;
+    };
+
+    // Builds the LM of the given unigrams with the given lexicon encoding,
+    // prints its size and timings, and returns its outputs.
+    Outputs Benchmark(const std::vector<LoudsLm::Ngram>& unigrams,
+                      const bool encodes_codepoints,
+                      const std::vector<std::string>& gesture_words) {
+        LoudsLmParams params;
+        params.lexicon_encodes_codepoints = encodes_codepoints;
+        std::stringstream file;
+        LoudsLm::CreateFromNgramsOrNull(unigrams, params)->WriteToStream(file);
+        const long long file_bytes = file.str().size();
+        std::unique_ptr<lm::LoudsLmAdapter> lm(
+                new lm::LoudsLmAdapter(LoudsLm::CreateFromStreamOrNull(&file)));
+        LexiconInterface* lexicon = lm->lexicon();
+
+        Outputs outputs;
+        const double enumerate_ms = bench::BestTimeMs(kEnumerationRuns, [&]() {
+            outputs.enumerated_nodes =
+                    Enumerate(CodepointNode::GetRootNode(lexicon), kEnumerationDepth);
+        });
+
+        GestureDecoder decoder(true);
+        decoder.AddLexiconAndLm("main", lexicon, std::move(lm));
+        const KeyboardLayout layout = bench::CreateBenchLayout();
+        decoder.SetKeyboardLayout(layout);
+        double decode_ms[2];
+        const int cache_depths[2] = {DecoderParams().lexicon_children_cache_depth, 0};
+        outputs.nbest.resize(gesture_words.size());
+        for (int i = 0; i < 2; ++i) {
+            decoder.mutable_params()->lexicon_children_cache_depth = cache_depths[i];
+            decoder.RecreateDecoderForActiveLms();
+            decode_ms[i] = bench::BestTimeMs(kDecodeRuns, [&]() {
+                // The same gestures in every run.
+                std::mt19937 rng(1);
+                for (size_t j = 0; j < gesture_words.size(); ++j) {
+                    outputs.nbest[j] = bench::NBestKey(decoder.DecodeTouch(
+                            bench::NewGesture(layout, gesture_words[j], &rng), ""));
+                }
+            }) / gesture_words.size();
+        }
+
+        printf("  %-9s %7lld bytes   enumerate %6.2f ms (%ld nodes)   "
+               "%6.3f ms/decode, %6.3f without the children cache\n",
+               encodes_codepoints ? "codepoint" : "utf-8", file_bytes, enumerate_ms,
+               outputs.enumerated_nodes, decode_ms[0], decode_ms[1]);
+        return outputs;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int accented_percent = argc > 1 ? atoi(argv[1]) : 33;
+    const int gestures = argc > 2 ? atoi(argv[2]) : 300;
+
+    const std::vector<std::string> phrase_words = bench::ReadPhraseWords();
+    if (phrase_words.empty()) {
+        printf("No phrase words found in %s\n", BENCH_RAW_DIR);
+        return 1;
+    }
+    // The unigrams of the accented words, with Zipfian probabilities.
+    const std::vector<std::string> ranked =
+            bench::CreateRankedWords(phrase_words, kSyntheticWords);
+    std::mt19937 rng(5);
+    std::set<std::string> terms;
+    std::vector<LoudsLm::Ngram> unigrams;
+    for (size_t rank = 0; rank < ranked.size(); ++rank) {
+        const std::string term = Accent(ranked[rank], accented_percent, &rng);
+        if (terms.insert(term).second) {
+            unigrams.push_back({{term}, -std::log(rank + 2.0f), 0});
+        }
+    }
+    std::vector<std::string> gesture_words;
+    for (int i = 0; i < gestures; ++i) {
+        gesture_words.push_back(phrase_words[i % phrase_words.size()]);
+    }
+    printf("%zu terms, %d%% of the accentable letters accented, %d gestures\n",
+           unigrams.size(), accented_percent, gestures);
+
+    const Outputs expected = Benchmark(unigrams, false, gesture_words);
+    const Outputs actual = Benchmark(unigrams, true, gesture_words);
+    if (actual.enumerated_nodes != expected.enumerated_nodes) {
+        printf("MISMATCH: the encodings enumerate %ld vs %ld nodes\n",
+               actual.enumerated_nodes, expected.enumerated_nodes);
+        return 1;
+    }
+    for (size_t i = 0; i < gesture_words.size(); ++i) {
+        if (actual.nbest[i] != expected.nbest[i]) {
+            printf("MISMATCH: \"%s\": %s vs %s\n", gesture_words[i].c_str(),
+                   actual.nbest[i].c_str(), expected.nbest[i].c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Description:
+//   Measures LoudsTrie lookups with and without the top level index (see
+//   LoudsTrie::IndexTopLevels), on a lexicon trie of the phrase words in
+//   res/raw and 20k synthetic words, and on an n-gram trie of 20k unigrams and
+//   300k bigrams and trigrams. The lexicon is looked up by random prefixes of
+//   one to four characters, and the n-gram trie by its bigrams and trigrams.
+//   The parents of the looked up nodes are expanded with GetChildren.
+//
+//   The benchmark fails if the index changes any node id or child list.
+//
+//   Usage: louds-trie-index-bench [trie_index_levels] [trie_index_max_nodes]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bench-util.h"
+#include "internal/Louds/LoudsLmParams.h"
+#include "internal/Louds/louds-lm.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    using keyboard::lm::louds::LoudsNodeId;
+
+    // The number of synthetic words in the lexicon.
+    constexpr int kSyntheticWords = 20000;
+    // The number of lexicon lookups.
+    constexpr int kLexiconKeys = 200000;
+    // The vocabulary and the number of bigrams of the n-gram trie.
+    constexpr int kVocabulary = 20000;
+    constexpr int kNgrams = 300000;
+    // The number of timed passes over the keys, of which the fastest counts.
+    constexpr int kRuns = 7;
+
+    // The results of the lookups of the keys: the node id of each key, and the
+    // children of the parent of each key.
+    template <typename Trie>
+    struct Lookups {
+        std::vector<LoudsNodeId> node_ids;
+        std::vector<typename Trie::Key::value_type> child_labels;
+        std::vector<LoudsNodeId> child_node_ids;
+
+        bool operator==(const Lookups& other) const {
+            return node_ids == other.node_ids && child_labels == other.child_labels &&
+                   child_node_ids == other.child_node_ids;
+        }
+    };
+
+    // Looks up the given keys and expands the given parents, and returns the
+    // results. Sets the best time per key of each.
+    template <typename Trie>
+    Lookups<Trie> TimeLookups(const Trie& trie,
+                              const std::vector<typename Trie::Key>& keys,
+                              const std::vector<LoudsNodeId>& parents,
+                              double* lookup_ns, double* children_ns) {
+        Lookups<Trie> lookups;
+        *lookup_ns = bench::BestTimeMs(kRuns, [&]() {
+            lookups.node_ids.clear();
+            for (const auto& key : keys) {
+                lookups.node_ids.push_back(trie.KeyToNodeId(key));
+            }
+        }) * 1e6 / keys.size();
+
+        std::vector<typename Trie::Key::value_type> labels;
+        std::vector<LoudsNodeId> node_ids;
+        *children_ns = bench::BestTimeMs(kRuns, [&]() {
+            lookups.child_labels.clear();
+            lookups.child_node_ids.clear();
+            for (const LoudsNodeId parent : parents) {
+                labels.clear();
+                node_ids.clear();
+                trie.GetChildren(parent, &labels, &node_ids);
+                lookups.child_labels.insert(lookups.child_labels.end(),
+                                            labels.begin(), labels.end());
+                lookups.child_node_ids.insert(lookups.child_node_ids.end(),
+                                              node_ids.begin(), node_ids.end());
+            }
+        }) * 1e6 / parents.size();
+        return lookups;
+    }
+
+    // Times the lookups of the given keys in the trie without and with the
+    // index, prints the times, and returns whether the results agree.
+    template <typename Trie>
+    bool Benchmark(const char* name, Trie* trie,
+                   const std::vector<typename Trie::Key>& keys, const int levels,
+                   const int max_nodes) {
+        std::vector<LoudsNodeId> parents;
+        for (const auto& key : keys) {
+            parents.push_back(trie->KeyToNodeId(
+                    typename Trie::Key(key.begin(), key.end() - 1)));
+        }
+
+        double lookup_ns[2], children_ns[2];
+        trie->IndexTopLevels(0, max_nodes);
+        const Lookups<Trie> expected =
+                TimeLookups(*trie, keys, parents, &lookup_ns[0], &children_ns[0]);
+        trie->IndexTopLevels(levels, max_nodes);
+        const Lookups<Trie> actual =
+                TimeLookups(*trie, keys, parents, &lookup_ns[1], &children_ns[1]);
+
+        printf("  %-8s KeyToNodeId %6.1f -> %6.1f ns/key   "
+               "GetChildren %6.1f -> %6.1f ns/node   (%d nodes, %lld bytes)\n",
+               name, lookup_ns[0], lookup_ns[1], children_ns[0], children_ns[1],
+               trie->indexed_node_count(),
+               static_cast<long long>(trie->index_memory_bytes()));
+        if (!(actual == expected)) {
+            printf("MISMATCH: the %s lookups differ with the index\n", name);
+            return false;
+        }
+        return true;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const LoudsLmParams defaults;
+    const int levels = argc > 1 ? atoi(argv[1]) : defaults.trie_index_levels;
+    const int max_nodes = argc > 2 ? atoi(argv[2]) : defaults.trie_index_max_nodes;
+    printf("trie_index_levels=%d trie_index_max_nodes=%d (without -> with index)\n",
+           levels, max_nodes);
+
+    const std::vector<std::string> words =
+            bench::CreateRankedWords(bench::ReadPhraseWords(), kSyntheticWords);
+    const auto lexicon = bench::CreateLexiconTrie(words);
+    bool ok = Benchmark("lexicon", lexicon.get(),
+                        bench::CreatePrefixKeys(words, kLexiconKeys), levels,
+                        max_nodes);
+
+    std::vector<std::vector<keyboard::lm::louds::TermId16>> ngrams;
+    const auto ngram_trie = bench::CreateNgramTrie(kVocabulary, kNgrams, &ngrams);
+    ok &= Benchmark("n-gram", ngram_trie.get(), ngrams, levels, max_nodes);
+    return ok ? 0 : 1;
+}
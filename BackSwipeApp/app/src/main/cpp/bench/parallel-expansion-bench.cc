@@ -0,0 +1,138 @@
+// Description:
+//   Measures how the beam expansion scales with
+//   DecoderParams::beam_expansion_threads, by decoding gestures of the phrase
+//   words in res/raw with 1 (on the decoding thread), 2, 4 and 8 threads, and
+//   prints the number of words decoded as the top result. The default in-place
+//   expansion (0 threads) is timed for reference.
+//
+//   DecoderSession::ExpandBeam is meant to produce the same N-best lists for
+//   any number of threads, so the benchmark fails if any of them differ from
+//   those of the sliced expansion on the decoding thread. The slices look up
+//   the children of the same tokens whatever the number of threads, so it also
+//   fails if the children cache counts a different number of lookups.
+//
+//   Usage: parallel-expansion-bench [active_beam_width] [gestures]
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GestureDecoder.h"
+#include "bench-util.h"
+#include "internal/Louds/louds-lm-adapter.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    // The number of synthetic words added to the lexicon.
+    constexpr int kSyntheticWords = 20000;
+
+    // The number of timed decodes of all gestures, of which the fastest counts.
+    constexpr int kRuns = 3;
+
+    // The outputs of a benchmark run that must not depend on the number of
+    // threads.
+    struct Outputs {
+        std::vector<std::string> nbest;
+        // The children cache lookups per decode.
+        uint64 children_lookups;
+    };
+
+    // Decodes each word's gesture with the given number of expansion threads,
+    // prints the time per decode, the top-1 count and the children cache
+    // counters, and returns the outputs.
+    Outputs Benchmark(const std::vector<std::string>& words, const int beam_width,
+                      const int threads, const double serial_ms, double* ms) {
+        std::unique_ptr<lm::LoudsLmAdapter> lm(new lm::LoudsLmAdapter(
+                bench::CreateUnigramLm(bench::ReadPhraseWords(), kSyntheticWords)));
+        GestureDecoder decoder(true);
+        decoder.mutable_params()->active_beam_width = beam_width;
+        decoder.mutable_params()->token_pool_capacity = beam_width * 20;
+        decoder.mutable_params()->beam_expansion_threads = threads;
+        LexiconInterface* lexicon = lm->lexicon();
+        decoder.AddLexiconAndLm("main", lexicon, std::move(lm));
+        decoder.RecreateDecoderForActiveLms();
+        const KeyboardLayout layout = bench::CreateBenchLayout();
+        decoder.SetKeyboardLayout(layout);
+        std::unique_ptr<DecoderSession> session = decoder.NewSession();
+
+        Outputs outputs;
+        outputs.nbest.resize(words.size());
+        int top1 = 0;
+        TokenChildrenCache::Stats stats;
+        *ms = bench::BestTimeMs(kRuns, [&]() {
+            // The same gestures in every run.
+            std::mt19937 rng(1);
+            top1 = 0;
+            session->ResetChildrenCacheStats();
+            for (size_t i = 0; i < words.size(); ++i) {
+                const std::vector<DecoderResult> results = session->DecodeTouch(
+                        bench::NewGesture(layout, words[i], &rng), "");
+                top1 += !results.empty() && results[0].word() == words[i];
+                outputs.nbest[i] = bench::NBestKey(results);
+            }
+            stats = session->children_cache_stats();
+        }) / words.size();
+        outputs.children_lookups =
+                (stats.session_hits + stats.shared_hits + stats.misses) / words.size();
+        printf("  threads=%d %8.3f ms/decode %6.2fx   top1=%d/%zu   children per "
+               "decode: %6llu session hits %6llu shared hits %6llu misses\n",
+               threads, *ms, serial_ms > 0 ? serial_ms / *ms : 1.0, top1, words.size(),
+               static_cast<unsigned long long>(stats.session_hits / words.size()),
+               static_cast<unsigned long long>(stats.shared_hits / words.size()),
+               static_cast<unsigned long long>(stats.misses / words.size()));
+        return outputs;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int beam_width = argc > 1 ? atoi(argv[1]) : 100;
+    const int gestures = argc > 2 ? atoi(argv[2]) : 300;
+
+    const std::vector<std::string> phrase_words = bench::ReadPhraseWords();
+    if (phrase_words.empty()) {
+        printf("No phrase words found in %s\n", BENCH_RAW_DIR);
+        return 1;
+    }
+    std::vector<std::string> words;
+    for (int i = 0; i < gestures; ++i) {
+        words.push_back(phrase_words[i % phrase_words.size()]);
+    }
+    printf("active_beam_width=%d, %d gestures, %u hardware threads\n", beam_width,
+           gestures, std::thread::hardware_concurrency());
+
+    double in_place_ms = 0;
+    Benchmark(words, beam_width, 0, 0, &in_place_ms);
+    double serial_ms = 0;
+    const Outputs expected = Benchmark(words, beam_width, 1, in_place_ms, &serial_ms);
+    bool mismatch = false;
+    for (const int threads : {2, 4, 8}) {
+        double ms = 0;
+        const Outputs actual = Benchmark(words, beam_width, threads, serial_ms, &ms);
+        for (size_t i = 0; i < words.size(); ++i) {
+            if (actual.nbest[i] != expected.nbest[i]) {
+                printf("MISMATCH: threads=%d, \"%s\": %s vs %s\n", threads,
+                       words[i].c_str(), actual.nbest[i].c_str(),
+                       expected.nbest[i].c_str());
+                mismatch = true;
+                break;
+            }
+        }
+        if (actual.children_lookups != expected.children_lookups) {
+            printf("MISMATCH: threads=%d: %llu vs %llu children lookups per decode\n",
+                   threads, static_cast<unsigned long long>(actual.children_lookups),
+                   static_cast<unsigned long long>(expected.children_lookups));
+            mismatch = true;
+        }
+    }
+    return mismatch ? 1 : 0;
+}
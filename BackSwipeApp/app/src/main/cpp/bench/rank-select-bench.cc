@@ -0,0 +1,206 @@
+// Description:
+//   Compares the poppy and the marisa rank/select indices of MarisaBitVector
+//   (see RankSelectIndex):
+//
+//   - checks that they give the same rank0/rank1 of every position and the
+//     same select0/select1 of every bit, over vectors of 0 to 1M bits with
+//     densities of 0 to 1 (including the block and superblock boundaries);
+//   - times rank1, select1 and select0 at random positions of a random vector
+//     of the given size, half of whose bits are set;
+//   - times KeyToNodeId on the lexicon and n-gram tries of
+//     louds-trie-index-bench with either index (with the top levels indexed,
+//     as in LoudsLm), and checks that the node ids are the same. The lexicon
+//     is looked up by short prefixes, and by whole words, which reach below
+//     the indexed levels.
+//
+//   The benchmark fails if the indices ever disagree.
+//
+//   Usage: rank-select-bench [bits]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench-util.h"
+#include "internal/Louds/LoudsLmParams.h"
+#include "internal/Louds/louds-lm.h"
+#include "internal/languageModel/marisa-bitvector.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    using keyboard::lm::louds::LoudsNodeId;
+    using keyboard::lm::louds::MarisaBitVector;
+    using keyboard::lm::louds::RankSelectIndex;
+
+    // The trie sizes, as in louds-trie-index-bench.
+    constexpr int kSyntheticWords = 20000;
+    constexpr int kLexiconKeys = 200000;
+    constexpr int kVocabulary = 20000;
+    constexpr int kNgrams = 300000;
+
+    // The number of timed queries of each operation.
+    constexpr int kQueries = 4000000;
+    // The number of timed passes over the queries, of which the fastest counts.
+    constexpr int kRuns = 9;
+
+    const char* IndexName(const RankSelectIndex index) {
+        return index == RankSelectIndex::kPoppy ? "poppy" : "marisa";
+    }
+
+    // Builds a vector of the given bits with the given index.
+    void BuildBitVector(const std::vector<bool>& bits, const RankSelectIndex index,
+                        MarisaBitVector* bit_vector) {
+        for (const bool bit : bits) {
+            bit_vector->push_back(bit);
+        }
+        bit_vector->set_rank_select_index(index);
+        bit_vector->build();
+    }
+
+    // Returns the number of ranks and selects that differ between the indices
+    // over vectors of various sizes and densities.
+    long CountMismatches() {
+        static const double kDensities[] = {0, 0.001, 0.01, 0.1, 0.5, 0.9, 0.99, 1};
+        static const std::size_t kSizes[] = {0,    1,    63,   64,   65,    511,
+                                             512,  2047, 2048, 2049, 12295, 100000,
+                                             1000003};
+        std::mt19937_64 rng(1);
+        long mismatches = 0;
+        for (const double density : kDensities) {
+            for (const std::size_t size : kSizes) {
+                std::bernoulli_distribution bit(density);
+                std::vector<bool> bits(size);
+                std::size_t ones = 0;
+                for (std::size_t i = 0; i < size; ++i) {
+                    bits[i] = bit(rng);
+                    ones += bits[i];
+                }
+                MarisaBitVector marisa, poppy;
+                BuildBitVector(bits, RankSelectIndex::kMarisa, &marisa);
+                BuildBitVector(bits, RankSelectIndex::kPoppy, &poppy);
+                for (std::size_t i = 0; i < size; ++i) {
+                    mismatches += marisa.rank1(i) != poppy.rank1(i);
+                    mismatches += marisa.rank0(i) != poppy.rank0(i);
+                }
+                for (std::size_t i = 0; i < ones; ++i) {
+                    mismatches += marisa.select1(i) != poppy.select1(i);
+                }
+                for (std::size_t i = 0; i < size - ones; ++i) {
+                    mismatches += marisa.select0(i) != poppy.select0(i);
+                }
+            }
+        }
+        return mismatches;
+    }
+
+    // Times rank1, select1 and select0 with the given index on a random vector
+    // of the given size, and prints the time per query.
+    void TimeRankSelect(const std::size_t size, const RankSelectIndex index) {
+        std::mt19937_64 rng(7);
+        std::bernoulli_distribution bit(0.5);
+        std::vector<bool> bits(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            bits[i] = bit(rng);
+        }
+        MarisaBitVector bit_vector;
+        BuildBitVector(bits, index, &bit_vector);
+        const std::size_t ones = bit_vector.rank1(size - 1);
+        const std::size_t zeros = size - 1 - ones;
+        std::vector<std::size_t> queries(kQueries);
+        for (std::size_t& query : queries) {
+            query = rng() % (size - 1);
+        }
+
+        std::size_t sum = 0;
+        const double rank1_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (const std::size_t query : queries) {
+                sum += bit_vector.rank1(query);
+            }
+        });
+        const double select1_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (const std::size_t query : queries) {
+                sum += bit_vector.select1(query % ones);
+            }
+        });
+        const double select0_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (const std::size_t query : queries) {
+                sum += bit_vector.select0(query % zeros);
+            }
+        });
+        bench::DoNotOptimize(sum);
+        printf("  %-6s rank1 %6.1f ns   select1 %6.1f ns   select0 %6.1f ns\n",
+               IndexName(index), rank1_ms * 1e6 / kQueries,
+               select1_ms * 1e6 / kQueries, select0_ms * 1e6 / kQueries);
+    }
+
+    // Times KeyToNodeId on the given keys with either index, prints the times,
+    // and returns whether the node ids agree.
+    template <typename Trie>
+    bool TimeTrieLookups(const char* name, Trie* trie,
+                         const std::vector<typename Trie::Key>& keys) {
+        const LoudsLmParams defaults;
+        trie->IndexTopLevels(defaults.trie_index_levels,
+                             defaults.trie_index_max_nodes);
+        std::vector<LoudsNodeId> node_ids[2];
+        double ms[2] = {std::numeric_limits<double>::infinity(),
+                        std::numeric_limits<double>::infinity()};
+        const RankSelectIndex indices[2] = {RankSelectIndex::kMarisa,
+                                            RankSelectIndex::kPoppy};
+        // The indices take turns, so that both see the same noise.
+        for (int run = 0; run < kRuns; ++run) {
+            for (int i = 0; i < 2; ++i) {
+                trie->set_rank_select_index(indices[i]);
+                ms[i] = std::min(ms[i], bench::BestTimeMs(1, [&]() {
+                    node_ids[i].clear();
+                    for (const auto& key : keys) {
+                        node_ids[i].push_back(trie->KeyToNodeId(key));
+                    }
+                }));
+            }
+        }
+        printf("  %-8s KeyToNodeId marisa %6.1f ns   poppy %6.1f ns\n", name,
+               ms[0] * 1e6 / keys.size(), ms[1] * 1e6 / keys.size());
+        if (node_ids[0] != node_ids[1]) {
+            printf("MISMATCH: the %s node ids differ between the indices\n", name);
+            return false;
+        }
+        return true;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const std::size_t size = argc > 1 ? atol(argv[1]) : 8000000;
+
+    const long mismatches = CountMismatches();
+    printf("rank/select mismatches between the indices: %ld\n", mismatches);
+
+    printf("random %zu-bit vector:\n", size);
+    TimeRankSelect(size, RankSelectIndex::kMarisa);
+    TimeRankSelect(size, RankSelectIndex::kPoppy);
+
+    printf("trie lookups:\n");
+    const std::vector<std::string> words =
+            bench::CreateRankedWords(bench::ReadPhraseWords(), kSyntheticWords);
+    const auto lexicon = bench::CreateLexiconTrie(words);
+    bool ok = TimeTrieLookups("prefixes", lexicon.get(),
+                              bench::CreatePrefixKeys(words, kLexiconKeys));
+    std::vector<std::vector<char>> word_keys;
+    for (const std::string& word : words) {
+        word_keys.emplace_back(word.begin(), word.end());
+    }
+    ok &= TimeTrieLookups("words", lexicon.get(), word_keys);
+    std::vector<std::vector<keyboard::lm::louds::TermId16>> ngrams;
+    const auto ngram_trie = bench::CreateNgramTrie(kVocabulary, kNgrams, &ngrams);
+    ok &= TimeTrieLookups("n-gram", ngram_trie.get(), ngrams);
+    return ok && mismatches == 0 ? 0 : 1;
+}
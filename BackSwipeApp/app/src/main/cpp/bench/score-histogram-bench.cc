@@ -0,0 +1,148 @@
+// Description:
+//   Measures the per-frame cost of finding the beam cutoff and the pruning
+//   threshold with ScoreHistogram, as DecoderSession does, against ranking all
+//   of the scores with std::nth_element, as it did before. Each frame holds the
+//   scores of the active tokens of a search space of the given capacity (token
+//   pool sizes of 1k, 5k and 20k), between half and nine tenths full.
+//
+//   Both thresholds are found in separate passes, as in the decoder, and each
+//   pass collects the scores into a vector first (which std::nth_element then
+//   reorders). The histogram passes also clear the histogram and add each
+//   score to it. The benchmark fails if the two ever select a different
+//   threshold.
+//
+//   Usage: score-histogram-bench [active_beam_width]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "bench-util.h"
+#include "internal/base/constants.h"
+#include "internal/score-histogram.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    // As in DecoderSession.
+    constexpr float kScoreHistogramBucketWidth = 0.25f;
+    constexpr int kScoreHistogramBuckets = 4096;
+    constexpr float kPruneRatio = 0.5f;
+
+    // The number of time frames per gesture, and of timed passes over them.
+    constexpr int kFrames = 150;
+    constexpr int kRuns = 5;
+
+    // Returns the active token scores of kFrames frames of a search space of
+    // the given capacity. The best score drifts down with the frame, the others
+    // trail it by an exponential gap, and a few tokens have no alignment. The
+    // scores are rounded to 1/1024, so that there are ties to break.
+    std::vector<std::vector<float>> CreateFrames(const int capacity) {
+        std::mt19937 rng(capacity);
+        std::uniform_int_distribution<int> size(capacity / 2, capacity * 9 / 10);
+        std::exponential_distribution<float> gap(1 / 6.0f);
+        std::uniform_real_distribution<float> unit(0, 1);
+        std::vector<std::vector<float>> frames(kFrames);
+        for (int frame = 0; frame < kFrames; ++frame) {
+            const float best = -0.4f * frame;
+            frames[frame].resize(size(rng));
+            for (float& score : frames[frame]) {
+                score = unit(rng) < 0.01f
+                        ? NEG_INF
+                        : std::round((best - gap(rng)) * 1024) / 1024;
+            }
+        }
+        return frames;
+    }
+
+    // The thresholds of a frame: the beam cutoff, and the pruning threshold.
+    struct Thresholds {
+        float beam;
+        float prune;
+    };
+
+    // Returns the n-th best of the given scores (counting from 1), as
+    // std::nth_element selects it.
+    float NthElement(const int n, std::vector<float>* scores) {
+        std::nth_element(scores->begin(), scores->begin() + n - 1, scores->end(),
+                         std::greater<float>());
+        return (*scores)[n - 1];
+    }
+
+    // Returns the number of scores that are ranked for the pruning threshold,
+    // as in DecoderSession::PruneSearchTokensOutsideTopTokensSet.
+    int PruneRank(const std::vector<float>& scores) {
+        const int prune_index = scores.size() * kPruneRatio;
+        return scores.size() - prune_index;
+    }
+
+    // Times both methods on the frames of the given capacity, prints the time
+    // per frame, and returns whether their thresholds agree.
+    bool Benchmark(const int beam_width, const int capacity) {
+        const std::vector<std::vector<float>> frames = CreateFrames(capacity);
+        std::vector<Thresholds> expected(kFrames);
+        std::vector<Thresholds> actual(kFrames);
+        std::vector<float> scores;
+        scores.reserve(capacity);
+
+        const double nth_element_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (int frame = 0; frame < kFrames; ++frame) {
+                scores = frames[frame];
+                expected[frame].beam = NthElement(beam_width, &scores);
+                scores = frames[frame];
+                expected[frame].prune = NthElement(PruneRank(scores), &scores);
+            }
+        });
+
+        ScoreHistogram histogram(kScoreHistogramBucketWidth, kScoreHistogramBuckets);
+        const auto nth_best_score = [&](const int frame, const bool prune) {
+            scores = frames[frame];
+            histogram.Clear();
+            for (const float score : scores) {
+                histogram.Add(score);
+            }
+            return histogram.NthBestScore(prune ? PruneRank(scores) : beam_width,
+                                          scores);
+        };
+        const double histogram_ms = bench::BestTimeMs(kRuns, [&]() {
+            for (int frame = 0; frame < kFrames; ++frame) {
+                actual[frame].beam = nth_best_score(frame, false);
+                actual[frame].prune = nth_best_score(frame, true);
+            }
+        });
+
+        printf("  capacity=%-6d nth_element %8.2f us/frame   histogram %8.2f us/frame"
+               "   %5.2fx\n", capacity, nth_element_ms * 1000 / kFrames,
+               histogram_ms * 1000 / kFrames, nth_element_ms / histogram_ms);
+        for (int frame = 0; frame < kFrames; ++frame) {
+            if (actual[frame].beam != expected[frame].beam ||
+                actual[frame].prune != expected[frame].prune) {
+                printf("MISMATCH: capacity=%d, frame %d: %f/%f vs %f/%f\n", capacity,
+                       frame, actual[frame].beam, actual[frame].prune,
+                       expected[frame].beam, expected[frame].prune);
+                return false;
+            }
+        }
+        return true;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int beam_width = argc > 1 ? atoi(argv[1]) : 100;
+    printf("active_beam_width=%d, %d frames, beam cutoff and pruning threshold "
+           "per frame\n", beam_width, kFrames);
+    bool mismatch = false;
+    for (const int capacity : {1000, 5000, 20000}) {
+        mismatch |= !Benchmark(beam_width, capacity);
+    }
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+// Description:
+//   Measures TouchSequence::UpdateProperties against the length of the
+//   gesture, by updating the gestures of random words of 2 to 24 letters, and
+//   prints the time per gesture and per point (including adding the points to
+//   a cleared sequence, as the decoder does) and the time to compute all of the
+//   transit scores of a gesture.
+//
+//   The alignment and transit scores are computed by the vectorized kernels
+//   (see score-kernels.h) into flat matrices, so the benchmark checks them
+//   against a scalar reference that calls the Keyboard methods for one key
+//   at a time, as the scores were computed before, with float and int16
+//   score storage and with and without the three decoder. It fails if any
+//   score differs by more than the rounding of the storage.
+//
+//   Usage: update-properties-bench [gestures_per_length]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench-util.h"
+#include "internal/DecoderParams.h"
+#include "internal/keyboardSetting/keyboard.h"
+#include "internal/math-utils.h"
+#include "internal/touch-sequence.h"
+
+namespace keyboard {
+namespace decoder {
+namespace {
+
+    // The number of timed updates of all gestures, of which the fastest counts.
+    constexpr int kRuns = 5;
+
+    // The largest difference from the reference scores that float storage
+    // allows, in units of the score, relative to its magnitude (with a floor of
+    // 1). The kernels compute the same terms in a different order.
+    constexpr float kFloatTolerance = 1e-6f;
+
+    // The same for int16 storage, which rounds to the nearest step and clamps
+    // at -32.
+    constexpr float kInt16Tolerance = 0.5f / score_kernels::kInt16ScoreScale + 1e-6f;
+    constexpr float kInt16MinScore = -32768 / score_kernels::kInt16ScoreScale;
+
+    // Returns random lowercase words of the given length.
+    std::vector<std::string> CreateWords(const int length, const int count,
+                                         std::mt19937* rng) {
+        std::uniform_int_distribution<int> letter('a', 'z');
+        std::vector<std::string> words(count, std::string(length, 'a'));
+        for (std::string& word : words) {
+            for (char& c : word) {
+                c = static_cast<char>(letter(*rng));
+            }
+        }
+        return words;
+    }
+
+    // Returns the alignment score of point i for the key, computed one key at a
+    // time as before the kernels.
+    float ReferenceAlignScore(const TouchSequence& sequence, const int i,
+                              const KeyId key, const Keyboard& keyboard,
+                              const DecoderParams& params,
+                              const bool is_three_decoder_enabled) {
+        const float key_width = keyboard.most_common_key_width();
+        const float distance_weight = .7f / (key_width * params.key_error_sigma);
+        const int keyboard_count = 5;
+        std::vector<double> keyboard_range(keyboard_count);
+        for (int row = 0; row < keyboard_count; ++row) {
+            keyboard_range[row] = keyboard.center_ys(0) + (row - 2) * 50.0;
+        }
+        const char key_code = keyboard.GetKeyCode(key);
+        const float x = sequence.xs(i);
+        const float y = sequence.ys(i);
+        float distance = keyboard.PointToKeyDistanceByIndex(x, y, key);
+        if (!is_three_decoder_enabled && key_code >= 'a' && key_code <= 'z' &&
+            keyboard.widths(key) <= key_width * 2) {
+            // PointToKeyDistanceByRange logs an error and returns 0 for the keys
+            // without statistics.
+            distance = key < static_cast<int>(MathUtils::mean_xs_.size())
+                       ? keyboard.PointToKeyDistanceByRange(x, y, key, keyboard_range,
+                                                            keyboard_count)
+                       : 0;
+        }
+        return -sqr(distance * distance_weight);
+    }
+
+    // Returns the transit score of point i from key_1 to key_2, computed one key
+    // pair at a time as before the kernels, from the geometry of the sequence.
+    float ReferenceTransitScore(const TouchSequence& sequence, const int i,
+                                const KeyId key_1, const KeyId key_2,
+                                const Keyboard& keyboard,
+                                const DecoderParams& params) {
+        if (key_1 == key_2) {
+            return 0;
+        }
+        const float root_weight = sqr(1 / params.direction_error_sigma);
+        const float weight =
+                i == 0 ? root_weight
+                       : (sequence.lengths(i) - sequence.lengths(i - 1)) * root_weight /
+                         keyboard.most_common_key_width();
+        const float direction_error = std::min(
+                static_cast<float>(PI / 4),
+                MathUtils::GetAngleDiff(sequence.direction(i),
+                                        keyboard.KeyToKeyDirectionByIndex(key_1, key_2)));
+        const float pause_score = sequence.is_pause(i) ? params.skip_pause_score : 0;
+        const float corner_score =
+                sequence.is_corner(i) ? sequence.curvature(i) * params.skip_corner_score
+                                      : 0;
+        return -sqr(direction_error) * weight + pause_score + corner_score;
+    }
+
+    // Returns whether the score matches the reference score, given the storage.
+    bool ScoreMatches(const float score, const float reference, const bool use_int16) {
+        if (use_int16) {
+            return std::fabs(score - std::max(reference, kInt16MinScore)) <=
+                   kInt16Tolerance;
+        }
+        return std::fabs(score - reference) <=
+               kFloatTolerance * std::max(1.0f, std::fabs(reference));
+    }
+
+    // Checks the scores of all points and keys of the updated sequence against
+    // the reference, and prints the first mismatch.
+    bool CheckScores(const TouchSequence& sequence, const Keyboard& keyboard,
+                     const DecoderParams& params, const bool is_three_decoder_enabled,
+                     const std::string& word) {
+        const int num_keys = keyboard.num_keys();
+        for (int i = 0; i < sequence.size(); ++i) {
+            for (KeyId key_1 = 0; key_1 < num_keys; ++key_1) {
+                const float align_reference = ReferenceAlignScore(
+                        sequence, i, key_1, keyboard, params, is_three_decoder_enabled);
+                if (!ScoreMatches(sequence.align_score(i, key_1), align_reference,
+                                  params.use_int16_spatial_scores)) {
+                    printf("MISMATCH: \"%s\", point %d, key %d: align score %g vs %g\n",
+                           word.c_str(), i, key_1, sequence.align_score(i, key_1),
+                           align_reference);
+                    return false;
+                }
+                for (KeyId key_2 = 0; key_2 < num_keys; ++key_2) {
+                    const float transit_reference = ReferenceTransitScore(
+                            sequence, i, key_1, key_2, keyboard, params);
+                    if (!ScoreMatches(sequence.transit_score(i, key_1, key_2),
+                                      transit_reference,
+                                      params.use_int16_spatial_scores)) {
+                        printf("MISMATCH: \"%s\", point %d, keys %d-%d: transit score "
+                               "%g vs %g\n",
+                               word.c_str(), i, key_1, key_2,
+                               sequence.transit_score(i, key_1, key_2),
+                               transit_reference);
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+}  // namespace
+}  // namespace decoder
+}  // namespace keyboard
+
+int main(int argc, char** argv) {
+    using namespace keyboard::decoder;
+    const int gestures_per_length = argc > 1 ? atoi(argv[1]) : 50;
+
+    const KeyboardLayout layout = bench::CreateBenchLayout();
+    const std::unique_ptr<Keyboard> keyboard = Keyboard::CreateKeyboardOrNull(layout);
+    const int num_keys = keyboard->num_keys();
+    printf("%d keys, %d gestures per length\n", num_keys, gestures_per_length);
+
+    std::mt19937 rng(1);
+    TouchSequence sequence(true);
+    for (const int length : {2, 4, 8, 16, 24}) {
+        const std::vector<std::string> words =
+                CreateWords(length, gestures_per_length, &rng);
+        std::vector<GestureInput> inputs;
+        long points = 0;
+        for (const std::string& word : words) {
+            inputs.push_back(bench::NewGestureInput(layout, word, &rng));
+        }
+        for (const bool use_int16 : {false, true}) {
+            DecoderParams params;
+            params.use_int16_spatial_scores = use_int16;
+            const auto update = [&](const GestureInput& input,
+                                    const bool is_three_decoder_enabled) {
+                sequence.Clear();
+                sequence.ExtendTouchPoints(input.xs, input.ys, input.times,
+                                           /* is_final = */ true, input.sample_dist);
+                sequence.UpdateProperties(*keyboard, params, is_three_decoder_enabled);
+            };
+            const double update_ms = bench::BestTimeMs(kRuns, [&]() {
+                points = 0;
+                for (const GestureInput& input : inputs) {
+                    update(input, false);
+                    points += sequence.size();
+                }
+            });
+            // The transit scores are computed on first read, a row of keys at a
+            // time.
+            const double transit_ms = bench::BestTimeMs(kRuns, [&]() {
+                for (const GestureInput& input : inputs) {
+                    update(input, false);
+                    for (int i = 0; i < sequence.size(); ++i) {
+                        for (KeyId key = 0; key < num_keys; ++key) {
+                            bench::DoNotOptimize(sequence.transit_score(i, key, 0));
+                        }
+                    }
+                }
+            }) - update_ms;
+            printf("  %2d letters %5.1f points %-5s  update %7.2f us/gesture "
+                   "%6.3f us/point   all transit scores %8.2f us/gesture\n",
+                   length, static_cast<double>(points) / inputs.size(),
+                   use_int16 ? "int16" : "float", update_ms * 1000 / inputs.size(),
+                   update_ms * 1000 / points, transit_ms * 1000 / inputs.size());
+
+            for (const bool is_three_decoder_enabled : {false, true}) {
+                for (size_t i = 0; i < inputs.size(); ++i) {
+                    update(inputs[i], is_three_decoder_enabled);
+                    if (!CheckScores(sequence, *keyboard, params,
+                                     is_three_decoder_enabled, words[i])) {
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
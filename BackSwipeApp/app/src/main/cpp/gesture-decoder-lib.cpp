@@ -208,6 +208,45 @@ Java_com_example_simplegestureinput_DecoderTools_decodeGesture(JNIEnv *env, jcla
     jobject decoderResult = getJDecoderResults(env, results);
     return decoderResult;
 }
+// Starts decoding a new gesture incrementally, after the given previous word.
+// The touch points are supplied through extendGesture as they arrive.
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_example_simplegestureinput_DecoderTools_startGesture(JNIEnv *env, jclass clazz,
+                                                              jbyteArray prev_word) {
+    string prev = JbyteArrayToString(env, prev_word);
+    if (decoder) {
+        decoder->StartGesture(prev);
+    }
+}
+
+// Appends touch points to the gesture started by startGesture and returns the
+// interim (or, if is_final is set, the final) decoder results.
+extern "C"
+JNIEXPORT jobject JNICALL
+Java_com_example_simplegestureinput_DecoderTools_extendGesture(JNIEnv *env, jclass clazz,
+                                                               jintArray xs, jintArray ys, jintArray ts,
+                                                               jint points_count,
+                                                               jboolean is_final) {
+    vector<int> x_coords(points_count);
+    vector<int> y_coords(points_count);
+    vector<int> times(points_count);
+
+    env->GetIntArrayRegion(xs, 0, points_count, x_coords.data());
+    env->GetIntArrayRegion(ys, 0, points_count, y_coords.data());
+    env->GetIntArrayRegion(ts, 0, points_count, times.data());
+
+    // See decodeGesture for the sample distance.
+    const float sample_dist = 26;
+
+    vector<DecoderResult> results;
+    if (decoder) {
+        results = decoder->ExtendGesture(x_coords, y_coords, times, sample_dist,
+                                         is_final == JNI_TRUE);
+    }
+    return getJDecoderResults(env, results);
+}
+
 extern "C"
 JNIEXPORT void JNICALL
 Java_com_example_simplegestureinput_DecoderTools_deleteDecoderNative(JNIEnv *env, jclass clazz) {
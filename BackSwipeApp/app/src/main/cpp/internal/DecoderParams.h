@@ -36,6 +36,33 @@ public:
     // Note that pauses must also be a local maxima in duration.
     const float pause_duration_in_millis = 200;
 
+    // Whether to resample gestures adaptively before decoding them. The touch
+    // points are first sampled at a fixed distance (see TouchSequence), which
+    // gives the decoder many nearly identical time frames on straight, fast
+    // segments of the gesture. With this option, a point is dropped when the
+    // gesture keeps going straight through it, as long as the points before and
+    // after it are less than max_resample_distance_in_key_widths apart and less
+    // than max_resample_interval_in_millis apart in time. So corners, curves and
+    // slow segments (where the user is aiming at keys, or pausing) stay densely
+    // sampled. The scores are weighted by the path length of each point, which
+    // dropping points does not change.
+    bool use_adaptive_resampling = false;
+
+    // The maximum turn (in radians) at a point for it to be dropped by the
+    // adaptive resampling, i.e. the difference between the directions from the
+    // previous point to it and from it to the next point.
+    float max_resample_turn_angle = 0.2618;  // (PI/12)
+
+    // The maximum distance between the points around a dropped point. Keeping
+    // this below a key width still leaves a point on each key that a straight
+    // segment crosses.
+    float max_resample_distance_in_key_widths = 0.75;
+
+    // The maximum time between the points around a dropped point. Keeping this
+    // well below pause_duration_in_millis keeps the durations of the points on
+    // straight segments from being mistaken for pauses.
+    float max_resample_interval_in_millis = 80;
+
     // This parameter only affects the intermediate scores during the decoder's
     // search, not the scores in the final results. However, setting this weight
     // too high may cause the decoder to prematurely prune rare prefixes, make
@@ -51,6 +78,68 @@ public:
     // about 20x the active_beam_width is usually enough to avoid pruning.
     int token_pool_capacity =  1000;
 
+    // The children of the nodes in this many top levels of each lexicon trie
+    // (where the root is at level 0) are extracted once when the lexicons are
+    // loaded, and shared by all decoding sessions. Set to 0 to disable the shared
+    // children cache.
+    int lexicon_children_cache_depth = 3;
+
+    // The maximum number of child nodes in the shared children cache. Each node
+    // takes 24 bytes.
+    int lexicon_children_cache_max_nodes = 100000;
+
+    // The number of threads that expand the active beam at each time frame. With
+    // 0, the beam tokens are expanded one at a time directly into the search
+    // space. Otherwise the beam is split into (at most) this many slices, which
+    // are expanded concurrently into per-thread candidate buffers and then merged
+    // into the search space in a deterministic order, so the results are the same
+    // for any number of threads (1 expands the beam on the decoding thread only).
+    // Worth enabling for wide beams (e.g., an active_beam_width of 300+).
+    //
+    // Has no effect if allow_multi_term is true: multi-term expansion interns the
+    // word histories of new terms while it expands, which the slices cannot do
+    // concurrently, so it always expands the beam serially on the decoding thread.
+    int beam_expansion_threads = 0;
+
+    // Whether to look ahead at the score of each gesture child token for the
+    // next touch point before creating it. Once the beam is full, a child whose
+    // score for the next point is below the worst score in the beam cannot make
+    // it into the next beam, so it is not created. Candidates for the last touch
+    // point are always created, since they may still appear in the results.
+    // Roughly halves the number of tokens created per decode, without changing
+    // the results.
+    //
+    // Only applies to the sliced expansion (beam_expansion_threads > 0 and
+    // allow_multi_term false). The in-place expansion updates the tokens in the
+    // search space as it goes, so there a skipped child can still change which
+    // path later reaches its state, and even the top result.
+    bool use_lookahead_pruning = true;
+
+    // Whether to store the alignment and transit scores of each touch point as
+    // 16-bit fixed point numbers instead of floats, which halves the memory that
+    // the decoder reads them from. The scores are rounded to multiples of 1/1024
+    // and clamped at -32 (far below min_align_key_score). Since this breaks some
+    // near ties differently, the top result changes for ~1% of the inputs, with
+    // the same top-1 and top-3 accuracy on the replay set.
+    bool use_int16_spatial_scores = false;
+
+    // Whether to interpolate the alignment scores of each touch point from the
+    // grid of key distances that the keyboard rasterizes when it is created (see
+    // AlignScoreGrid), instead of computing them from the key centers. The
+    // interpolated scores match the computed ones up to rounding, except for the
+    // letter keys when the key statistics of MathUtils are loaded, which are
+    // approximated (and taken from the statistics loaded when the keyboard was
+    // created). Has no effect with the three decoder, or for points off the grid.
+    bool use_align_score_grid = false;
+
+    // The range of beam widths used when decoding against a time budget (see
+    // DecoderSession::DecodeTouch). Starting from active_beam_width, the beam is
+    // narrowed while the touch points take longer to decode than the remaining
+    // budget allows, and widened while there is time to spare. The maximum should
+    // stay well below token_pool_capacity.
+    int min_adaptive_beam_width = 20;
+    int max_adaptive_beam_width = 200;
+
     /****
      * Android Decoder
      */
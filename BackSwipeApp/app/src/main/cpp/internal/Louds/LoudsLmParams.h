@@ -22,6 +22,13 @@ public:
     // Whether the LM's lexicon should encode prefix unigrams.
     bool enable_prefix_unigrams = true;
 
+    // Whether the lexicon of a LoudsLm built from n-grams labels its trie with
+    // codepoints instead of UTF-8 bytes (see LoudsLexicon), so that the decoder
+    // does not have to expand the bytes of each non-ASCII character. Such LMs are
+    // written with LoudsLm::kCodepointLexiconMagicNumber, and loading an LM
+    // always uses the encoding recorded in its file.
+    bool lexicon_encodes_codepoints = false;
+
     // Whether the LoudsLm stores backoff weights. If false, use stupid-backoff.
     // TODO(ouyang): We might want stupid backoff even when there are backoff
     // weights. E.g. we could potentially minimize storage by essentially pruning
@@ -81,6 +88,25 @@ public:
     // prediction coverage and quality for each language/LM.
     float min_unigram_logp_for_predictions = -100.0;
 
+    // The number of top levels of the lexicon and n-gram tries (where the root is
+    // at level 0) whose children are indexed in direct lookup tables when the LM
+    // is loaded (see LoudsTrie::IndexTopLevels). Looking up or enumerating the
+    // children of an indexed node skips the rank and select operations on the
+    // LOUDS bit-vector. Set to 0 to disable the index.
+    int trie_index_levels = 3;
+
+    // The maximum number of nodes indexed in each trie. An indexed node takes 12
+    // bytes in the n-gram trie, and 44 bytes in the lexicon trie. Since the second
+    // level of the n-gram trie has a node per unigram, this bounds the memory for
+    // large vocabularies.
+    int trie_index_max_nodes = 32768;
+
+    // Whether the bit-vectors of the lexicon and n-gram tries answer rank and
+    // select with a poppy index (see PoppyRankSelect), which is built from the
+    // bits when the LM is loaded and adds about 6% to their memory, instead of
+    // the marisa index stored in the LM file. The LM file is the same either way.
+    bool use_poppy_rank_select = true;
+
     // The format version numbers for known LoudsLm formats. They should match
     // the CL number that generated each format.
     //
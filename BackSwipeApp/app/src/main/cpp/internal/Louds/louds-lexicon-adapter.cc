@@ -1,8 +1,6 @@
 #include "louds-lexicon-adapter.h"
 #include "../basic-types.h"
 #include "louds-trie.h"
-//#include "thread/threadlocal.h"
-//#include <boost/thread/tss.hpp>
 
 namespace keyboard {
 namespace decoder {
@@ -17,14 +15,10 @@ namespace lm {
     using keyboard::decoder::Utf8String;
 
     // A reusable per-thread cache to store intermediate child labels.
-    //static ThreadLocal<vector<TermChar>> child_labels_cache_;
-    //static boost::thread_specific_ptr<vector<TermChar>> child_labels_cache_;
-    static vector<TermChar>* child_labels_cache_;
+    static thread_local vector<TermChar> child_labels_cache_;
 
     // A reusable per-thread cache to store intermediate child node ids.
-    //static ThreadLocal<vector<LoudsNodeId>> child_node_ids_cache_;
-    //static boost::thread_specific_ptr<vector<LoudsNodeId>> child_node_ids_cache_;
-    static vector<LoudsNodeId>* child_node_ids_cache_;
+    static thread_local vector<LoudsNodeId> child_node_ids_cache_;
 
     LoudsLexiconAdapter::~LoudsLexiconAdapter() {}
 
@@ -34,20 +28,21 @@ namespace lm {
 
     void LoudsLexiconAdapter::GetChildren(const LexiconNode& node,
                                           vector<LexiconNode>* children) const {
-        //vector<TermChar>* child_labels = child_labels_cache_.pointer();
-        //vector<LoudsNodeId>* child_node_ids = child_node_ids_cache_.pointer();
-        if(child_labels_cache_ == nullptr)
-            child_labels_cache_ = new vector<TermChar>();
-        vector<TermChar>* child_labels = child_labels_cache_;
-        if(child_node_ids_cache_ == nullptr)
-            child_node_ids_cache_ = new vector<LoudsNodeId>();
-        vector<LoudsNodeId>* child_node_ids = child_node_ids_cache_;
+        vector<TermChar>* child_labels = &child_labels_cache_;
+        vector<LoudsNodeId>* child_node_ids = &child_node_ids_cache_;
         child_labels->clear();
         child_node_ids->clear();
         const LoudsNodeId node_id = static_cast<LoudsNodeId>(node.id);
         lexicon_->GetChildren(node_id, child_labels, child_node_ids);
         children->reserve(child_labels->size());
-        for (int i = 0; i < child_labels->size(); ++i) {
+        if (lexicon_->encodes_codepoints()) {
+            for (size_t i = 0; i < child_labels->size(); ++i) {
+                children->push_back({lexicon_->LabelToCodepoint((*child_labels)[i]),
+                                     static_cast<uint64_t>((*child_node_ids)[i])});
+            }
+            return;
+        }
+        for (size_t i = 0; i < child_labels->size(); ++i) {
             children->push_back(
                     {(*child_labels)[i], static_cast<uint64_t>((*child_node_ids)[i])});
         }
@@ -66,7 +66,9 @@ namespace lm {
             return lexicon_->has_prefix_unigrams();
         }
 
-        bool EncodesCodepoints() const override { return false; }
+        bool EncodesCodepoints() const override {
+            return lexicon_->encodes_codepoints();
+        }
 
     private:
         // The underlying LoudsLexicon.
@@ -1,10 +1,12 @@
 #include "louds-lexicon.h"
 
 #include <map>
+#include <set>
 #include <utility>
 
 #include "../base/logging.h"
 #include "../base/unilib.h"
+#include "../languageModel/encodingutils.h"
 
 namespace keyboard {
 namespace lm {
@@ -12,11 +14,17 @@ namespace louds {
 
     bool LoudsLexicon::BuildFromUnigrams(
             const std::vector<std::pair<string, LogProbFloat>>& unigrams) {
+        if (encodes_codepoints_ && !BuildAlphabet(unigrams)) {
+            LOG(WARNING) << "The unigrams are not valid UTF-8 or have more than "
+                         << kMaxAlphabetSize << " distinct codepoints; "
+                         << "labelling the lexicon with UTF-8 bytes instead.";
+            encodes_codepoints_ = false;
+        }
         Utf8CharTrie::KeyValueMap key_values;
         for (int i = 0; i < unigrams.size(); ++i) {
             const QuantizedLogProb qlogp = quantizer_->Encode(-unigrams[i].second);
             Utf8CharTrie::Key key;
-            StringToKey(unigrams[i].first, &key);
+            CHECK(StringToKey(unigrams[i].first, &key));
             key_values[key] = qlogp;
         }
         trie_ = Utf8CharTrie::CreateFromKeyValueMapOrNull(key_values, true);
@@ -32,6 +40,84 @@ namespace louds {
         return true;
     }
 
+    bool LoudsLexicon::BuildAlphabet(
+            const std::vector<std::pair<string, LogProbFloat>>& unigrams) {
+        std::set<char32> codepoints;
+        std::vector<char32> term_codepoints;
+        for (const auto& unigram : unigrams) {
+            const string& term = unigram.first;
+            if (!EncodingUtils::IsUTF8String(term.data(), term.size())) {
+                return false;
+            }
+            term_codepoints.clear();
+            EncodingUtils::DecodeUTF8(term.data(), term.size(), &term_codepoints);
+            codepoints.insert(term_codepoints.begin(), term_codepoints.end());
+            if (codepoints.size() > kMaxAlphabetSize) {
+                return false;
+            }
+        }
+        for (const char32 codepoint : codepoints) {
+            alphabet_.push_back(codepoint);
+        }
+        return true;
+    }
+
+    int LoudsLexicon::CodepointToAlphabetIndex(const char32 codepoint) const {
+        int low = 0;
+        int high = static_cast<int>(alphabet_.size()) - 1;
+        while (low <= high) {
+            const int middle = (low + high) / 2;
+            if (alphabet_[middle] < codepoint) {
+                low = middle + 1;
+            } else if (alphabet_[middle] > codepoint) {
+                high = middle - 1;
+            } else {
+                return middle;
+            }
+        }
+        return -1;
+    }
+
+    bool LoudsLexicon::StringToKey(const StringPiece term,
+                                   Utf8CharTrie::Key* key) const {
+        if (!encodes_codepoints_) {
+            key->assign(term.begin(), term.end());
+            return true;
+        }
+        key->clear();
+        const char* utf8 = term.data();
+        int remaining = term.size();
+        while (remaining > 0) {
+            char32 codepoint;
+            const int length = EncodingUtils::DecodeUTF8Char(utf8, remaining, &codepoint);
+            // Invalid UTF-8 decodes to U+FFFD, whose own encoding has 3 bytes.
+            if (length == 0 || (codepoint == 0xFFFD && length != 3)) {
+                return false;
+            }
+            const int index = CodepointToAlphabetIndex(codepoint);
+            if (index < 0) {
+                return false;
+            }
+            key->push_back(static_cast<TermChar>(index));
+            utf8 += length;
+            remaining -= length;
+        }
+        return true;
+    }
+
+    void LoudsLexicon::KeyToString(const Utf8CharTrie::Key& key, string* word) const {
+        if (!encodes_codepoints_) {
+            word->assign(key.begin(), key.end());
+            return;
+        }
+        word->clear();
+        char utf8[4];
+        for (const TermChar label : key) {
+            const int length = EncodingUtils::EncodeAsUTF8Char(LabelToCodepoint(label), utf8);
+            word->append(utf8, length);
+        }
+    }
+
     bool LoudsLexicon::PrefixLogProbForNodeId(LoudsNodeId node_id,
                                               LogProbFloat* logp) const {
         if (node_id >= has_prefix_values_.size()) {
@@ -159,7 +245,9 @@ namespace louds {
 
     LoudsNodeId LoudsLexicon::KeyToNodeId(const StringPiece string_key) const {
         Utf8CharTrie::Key key;
-        StringToKey(string_key, &key);
+        if (!StringToKey(string_key, &key)) {
+            return Utf8CharTrie::kInvalidId;
+        }
         return trie_->KeyToNodeId(key);
     }
 
@@ -184,6 +272,9 @@ namespace louds {
         writer->write(has_prefix_unigrams_);
         writer->write(quantizer_logp_range_);
         writer->write(max_num_term_ids_);
+        if (encodes_codepoints_) {
+            alphabet_.write(writer);
+        }
     }
 
     void LoudsLexicon::WriteToFile(const string& filename) const {
@@ -203,6 +294,9 @@ namespace louds {
         mapper->map(&has_prefix_unigrams_);
         mapper->map(&quantizer_logp_range_);
         mapper->map(&max_num_term_ids_);
+        if (encodes_codepoints_) {
+            alphabet_.map(mapper);
+        }
         quantizer_.reset(
                 new EqualSizeBinQuantizer(quantizer_logp_range_, kQuantizedBits));
         return true;
@@ -241,6 +335,9 @@ namespace louds {
         reader->read(&has_prefix_unigrams_);
         reader->read(&quantizer_logp_range_);
         reader->read(&max_num_term_ids_);
+        if (encodes_codepoints_) {
+            alphabet_.read(reader);
+        }
         quantizer_.reset(
                 new EqualSizeBinQuantizer(quantizer_logp_range_, kQuantizedBits));
         return true;
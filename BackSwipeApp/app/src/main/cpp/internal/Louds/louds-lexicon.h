@@ -20,6 +20,16 @@
 // This mapping allows a two-tier combination of a very large lexicon (with
 // encoded unigrams) and a smaller higher-order language model that only needs
 // to address a subset of most frequent terms.
+//
+// By default, the trie is labelled with the UTF-8 bytes of the terms, so a
+// character outside of ASCII takes a node (and a lookup) per byte. A lexicon
+// that encodes codepoints instead labels the trie with the index of each
+// codepoint in its alphabet: the sorted distinct codepoints of its terms, of
+// which there may be at most kMaxAlphabetSize. Every character then takes a
+// single node, and the labels stay a byte each. The alphabet is serialized after
+// the rest of the lexicon, and the lexicon files do not record whether they
+// encode codepoints, so the loaders have to be told (LoudsLm records it in its
+// magic number).
 
 #ifndef INPUTMETHOD_KEYBOARD_LM_LOUDS_LOUDS_LEXICON_H_
 #define INPUTMETHOD_KEYBOARD_LM_LOUDS_LOUDS_LEXICON_H_
@@ -55,6 +65,10 @@ namespace louds {
         // The number of bits used to quantize log probabilities.
         static constexpr int kQuantizedBits = 8;
 
+        // The maximum number of distinct codepoints in a lexicon that encodes
+        // codepoints, i.e., the number of distinct byte labels.
+        static constexpr int kMaxAlphabetSize = 256;
+
         // Creates a new LoudsLexicon based on the following arguments.
         //
         // Args:
@@ -74,12 +88,18 @@ namespace louds {
         //   has_prefix_unigrams  - Whether the encode prefix log probabilities for
         //                          non-terminal nodes. These are used to guide the
         //                          search during decoding.
+        //   encodes_codepoints   - Whether to label the trie with codepoints (see
+        //                          the file comment) instead of UTF-8 bytes. Falls
+        //                          back to UTF-8 bytes if the unigrams have more
+        //                          than kMaxAlphabetSize distinct codepoints or are
+        //                          not valid UTF-8.
         static std::unique_ptr<LoudsLexicon> CreateFromUnigramsOrNull(
                 const std::vector<std::pair<string, LogProbFloat>>& unigrams,
                 float quantizer_logp_range, int max_num_term_ids,
-                bool has_prefix_unigrams) {
-            std::unique_ptr<LoudsLexicon> lexicon(new LoudsLexicon(
-                    quantizer_logp_range, max_num_term_ids, has_prefix_unigrams));
+                bool has_prefix_unigrams, bool encodes_codepoints) {
+            std::unique_ptr<LoudsLexicon> lexicon(
+                    new LoudsLexicon(quantizer_logp_range, max_num_term_ids,
+                                     has_prefix_unigrams, encodes_codepoints));
             if (!lexicon->BuildFromUnigrams(unigrams)) {
                 return nullptr;
             } else {
@@ -88,10 +108,13 @@ namespace louds {
         }
 
         // Creates a LoudsLexicon from the provided MarisaMapper. This will
-        // sequentially memory map the contents from the mapper.
+        // sequentially memory map the contents from the mapper. The lexicon must
+        // have been written with the given encodes_codepoints, as must the ones
+        // loaded by the following methods.
         static std::unique_ptr<LoudsLexicon> CreateFromMapperOrNull(
-                MarisaMapper* mapper) {
-            std::unique_ptr<LoudsLexicon> lexicon(new LoudsLexicon(0, 0, false));
+                MarisaMapper* mapper, bool encodes_codepoints) {
+            std::unique_ptr<LoudsLexicon> lexicon(
+                    new LoudsLexicon(0, 0, false, encodes_codepoints));
             if (!lexicon->MapFromMapper(mapper)) {
                 return nullptr;
             } else {
@@ -102,8 +125,9 @@ namespace louds {
         // Creates a LoudsLexicon from the provided MarisaReader. This will
         // sequentially load the contents from the reader.
         static std::unique_ptr<LoudsLexicon> CreateFromReaderOrNull(
-                MarisaReader* reader) {
-            std::unique_ptr<LoudsLexicon> lexicon(new LoudsLexicon(0, 0, false));
+                MarisaReader* reader, bool encodes_codepoints) {
+            std::unique_ptr<LoudsLexicon> lexicon(
+                    new LoudsLexicon(0, 0, false, encodes_codepoints));
             if (!lexicon->ReadFromReader(reader)) {
                 return nullptr;
             } else {
@@ -116,8 +140,9 @@ namespace louds {
         // converting the file to a stream (using nlp_fst::IFStream) and calling
         // MarisaReader::open(std::istream *stream).
         static std::unique_ptr<LoudsLexicon> CreateFromFileOrNull(
-                const string& filename) {
-            std::unique_ptr<LoudsLexicon> lexicon(new LoudsLexicon(0, 0, false));
+                const string& filename, bool encodes_codepoints) {
+            std::unique_ptr<LoudsLexicon> lexicon(
+                    new LoudsLexicon(0, 0, false, encodes_codepoints));
             if (!lexicon->ReadFromFile(filename)) {
                 return nullptr;
             } else {
@@ -127,8 +152,9 @@ namespace louds {
 
         // Creates a LoudsLexicon by memory mapping the input file.
         static std::unique_ptr<LoudsLexicon> CreateFromMappedFileOrNull(
-                const string& filename) {
-            std::unique_ptr<LoudsLexicon> lexicon(new LoudsLexicon(0, 0, false));
+                const string& filename, bool encodes_codepoints) {
+            std::unique_ptr<LoudsLexicon> lexicon(
+                    new LoudsLexicon(0, 0, false, encodes_codepoints));
             if (!lexicon->MapFromFile(filename)) {
                 return nullptr;
             } else {
@@ -139,11 +165,38 @@ namespace louds {
         // Returns whether the lexicon encodes prefix unigram probabilities.
         bool has_prefix_unigrams() const { return has_prefix_unigrams_; }
 
+        // Returns whether the trie is labelled with codepoints (by their index in
+        // the alphabet) rather than UTF-8 bytes.
+        bool encodes_codepoints() const { return encodes_codepoints_; }
+
+        // Returns the codepoint of a trie label of a lexicon that encodes
+        // codepoints.
+        char32 LabelToCodepoint(const TermChar label) const {
+            DCHECK(encodes_codepoints_);
+            return alphabet_[static_cast<uint8>(label)];
+        }
+
         // Returns the string key for the given node id.
         string NodeIdToKey(LoudsNodeId node_id) const {
             Utf8CharTrie::Key key;
             trie_->NodeIdToKey(node_id, &key);
-            return string(key.begin(), key.end());
+            string word;
+            KeyToString(key, &word);
+            return word;
+        }
+
+        // Indexes the children of the nodes in the top levels of the lexicon trie
+        // (see LoudsTrie::IndexTopLevels).
+        void IndexTopLevels(const int levels, const int max_nodes) {
+            trie_->IndexTopLevels(levels, max_nodes);
+        }
+
+        // Selects the index used for the rank and select operations of the
+        // bit-vectors of the lexicon (see MarisaBitVector::set_rank_select_index).
+        void set_rank_select_index(const RankSelectIndex index) {
+            trie_->set_rank_select_index(index);
+            has_termids_.set_rank_select_index(index);
+            has_prefix_values_.set_rank_select_index(index);
         }
 
         // Retrieves the children (labels and node_ids) for the given parent node id.
@@ -185,9 +238,10 @@ namespace louds {
         // Private constructor for a new empty LoudsLexicon with the given properties.
         // See comments for LoudsLexicon::CreateFromUnigramsOrNull.
         LoudsLexicon(float quantizer_logp_range, int max_num_term_ids,
-                     bool has_prefix_unigrams)
+                     bool has_prefix_unigrams, bool encodes_codepoints)
                 : trie_(),
                   has_prefix_unigrams_(has_prefix_unigrams),
+                  encodes_codepoints_(encodes_codepoints),
                   quantizer_logp_range_(quantizer_logp_range),
                   max_num_term_ids_(max_num_term_ids),
                   has_termids_(),
@@ -196,15 +250,24 @@ namespace louds {
                   quantizer_(
                           new EqualSizeBinQuantizer(quantizer_logp_range_, kQuantizedBits)) {}
 
-        // Converts a string to a Utf8CharTrie key (vector<utf8>).
-        static void StringToKey(const StringPiece term, Utf8CharTrie::Key* key) {
-            key->assign(term.begin(), term.end());
-        }
+        // Converts a string to a Utf8CharTrie key (vector<utf8>, or the alphabet
+        // indices of its codepoints if the lexicon encodes codepoints). Returns
+        // false if the string has no key, i.e., if the lexicon encodes codepoints
+        // and the string is not valid UTF-8 or has a codepoint outside of the
+        // alphabet.
+        bool StringToKey(const StringPiece term, Utf8CharTrie::Key* key) const;
 
-        // Converts a Utf8CharTrie key (vector<utf8>) to a string.
-        static void KeyToString(const Utf8CharTrie::Key key, string* word) {
-            word->assign(key.begin(), key.end());
-        }
+        // Converts a Utf8CharTrie key to a string.
+        void KeyToString(const Utf8CharTrie::Key& key, string* word) const;
+
+        // Returns the alphabet index of the codepoint, or -1 if it is not in the
+        // alphabet.
+        int CodepointToAlphabetIndex(char32 codepoint) const;
+
+        // Sets the alphabet to the distinct codepoints of the unigrams. Returns
+        // false, leaving the alphabet empty, if there are more than
+        // kMaxAlphabetSize of them or the unigrams are not valid UTF-8.
+        bool BuildAlphabet(const std::vector<std::pair<string, LogProbFloat>>& unigrams);
 
         // Private method to build the louds lexicon from the given unigrams, as
         // <term, logp> pairs. This method is only called from the static factory
@@ -252,6 +315,14 @@ namespace louds {
         // Whether the lexicon encodes prefix unigram probabilities.
         bool has_prefix_unigrams_;
 
+        // Whether the trie is labelled with the alphabet indices of codepoints
+        // instead of UTF-8 bytes.
+        bool encodes_codepoints_;
+
+        // The sorted distinct codepoints of the terms, if the lexicon encodes
+        // codepoints.
+        MarisaVector<char32> alphabet_;
+
         // The lexicon quantizes log probabilities into 256 equally spaced bins
         // spanning the range: [-quantizer_logp_range_, 0].
         float quantizer_logp_range_;
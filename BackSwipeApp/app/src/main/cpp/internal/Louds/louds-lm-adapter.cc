@@ -30,6 +30,37 @@ namespace lm {
         return new LoudsLmScorer(this, preceding_term_ids);
     }
 
+    LoudsLmScorer::LoudsLmScorer(const LoudsLmAdapter* lm,
+                                 const vector<TermId16>& preceding_term_ids)
+            : lm_(lm), preceding_term_ids_(preceding_term_ids) {
+        lm_->louds_lm()->InitContext(preceding_term_ids_, {}, &preceding_context_);
+        decoded_context_ = preceding_context_;
+    }
+
+    const LmContext& LoudsLmScorer::DecodedTermsContext(
+            const vector<Utf8StringPiece>& decoded_terms, const int count) {
+        if (count == 0) {
+            return preceding_context_;
+        }
+        const int history_size = static_cast<int>(decoded_history_.size());
+        int reused = 0;
+        if (history_size <= count) {
+            while (reused < history_size &&
+                   decoded_history_[reused] == decoded_terms[reused]) {
+                ++reused;
+            }
+        }
+        if (reused < history_size) {
+            decoded_history_.clear();
+            decoded_context_ = preceding_context_;
+        }
+        for (int i = decoded_history_.size(); i < count; ++i) {
+            lm_->louds_lm()->ExtendContext(decoded_terms[i], &decoded_context_);
+            decoded_history_.push_back(decoded_terms[i].as_string());
+        }
+        return decoded_context_;
+    }
+
     LogProbFloat LoudsLmScorer::DecodedTermsLogProb(
             const vector<Utf8StringPiece>& decoded_terms) {
         return -numeric_limits<float>::infinity();
@@ -38,21 +69,40 @@ namespace lm {
     LogProbFloat LoudsLmScorer::DecodedTermsConditionalLogProb(
             const vector<Utf8StringPiece>& decoded_terms) {
         LogProbFloat logp;
-        const bool found = lm_->louds_lm()->LookupConditionalLogProb(
-                preceding_term_ids_, decoded_terms, &logp);
+        const bool found =
+                decoded_terms.empty()
+                ? lm_->louds_lm()->LookupConditionalLogProb(preceding_term_ids_,
+                                                            decoded_terms, &logp)
+                : lm_->louds_lm()->LookupConditionalLogProb(
+                        DecodedTermsContext(decoded_terms, decoded_terms.size() - 1),
+                        decoded_terms.back(), &logp);
         if (found) {
             return logp;
         }
         return NEG_INF;
     }
 
+    void LoudsLmScorer::CandidatesConditionalLogProbs(
+            const vector<Utf8StringPiece>& decoded_terms,
+            const vector<Utf8StringPiece>& candidates, vector<LogProbFloat>* logps) {
+        lm_->louds_lm()->LookupConditionalLogProbs(
+                DecodedTermsContext(decoded_terms, decoded_terms.size()), candidates,
+                logps, &candidates_found_);
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (!candidates_found_[i]) {
+                (*logps)[i] = NEG_INF;
+            }
+        }
+    }
+
     void LoudsLmScorer::PredictNextTerm(
             const vector<Utf8StringPiece>& decoded_terms, const int max_predictions,
             vector<pair<Utf8String, LogProbFloat>>* results) {
         results->clear();
         map<string, float> predictions;
-        lm_->louds_lm()->PredictNextWords(preceding_term_ids_, decoded_terms,
-                                          max_predictions, &predictions);
+        lm_->louds_lm()->PredictNextWords(
+                DecodedTermsContext(decoded_terms, decoded_terms.size()),
+                max_predictions, &predictions);
         for (const auto& prediction : predictions) {
             results->push_back(prediction);
         }
@@ -20,6 +20,7 @@ namespace lm {
     using keyboard::decoder::LanguageModelScorerInterface;
     using keyboard::decoder::LogProbFloat;
     using keyboard::decoder::Utf8StringPiece;
+    using keyboard::lm::louds::LmContext;
     using keyboard::lm::louds::LoudsLm;
     using keyboard::lm::louds::TermId16;
 
@@ -62,8 +63,7 @@ namespace lm {
     public:
         // Note: following_text currently not used by the decoder.
         explicit LoudsLmScorer(const LoudsLmAdapter* lm,
-                               const vector<TermId16>& preceding_term_ids)
-                : lm_(lm), preceding_term_ids_(preceding_term_ids) {}
+                               const vector<TermId16>& preceding_term_ids);
 
         ////////////////////////////////////////////////////////////////////////////
         // The following methods are inherited from LanguageModelScorerInterface.
@@ -76,16 +76,39 @@ namespace lm {
         LogProbFloat DecodedTermsConditionalLogProb(
                 const vector<Utf8StringPiece>& decoded_terms) override;
 
+        void CandidatesConditionalLogProbs(const vector<Utf8StringPiece>& decoded_terms,
+                                           const vector<Utf8StringPiece>& candidates,
+                                           vector<LogProbFloat>* logps) override;
+
         void PredictNextTerm(
                 const vector<Utf8StringPiece>& decoded_terms, const int max_predictions,
                 vector<pair<Utf8String, LogProbFloat>>* predictions) override;
 
     private:
+        // Returns the LM context of the preceding terms followed by the first count
+        // decoded terms. The context of the last decoded terms is cached, and is
+        // extended term by term when they are a prefix of the requested terms (as
+        // when the decoder re-enters the lexicon after each term of a gesture).
+        const LmContext& DecodedTermsContext(const vector<Utf8StringPiece>& decoded_terms,
+                                             const int count);
+
         // The parent LoudsLm interface.
         const LoudsLmAdapter* lm_;
 
         // The term_ids for the preceding terms.
         vector<TermId16> preceding_term_ids_;
+
+        // The LM context of the preceding terms, which is resolved once for all the
+        // lookups of the scorer.
+        LmContext preceding_context_;
+
+        // The decoded terms of decoded_context_, and their LM context.
+        vector<Utf8String> decoded_history_;
+        LmContext decoded_context_;
+
+        // Whether or not each candidate was found by the last call to
+        // CandidatesConditionalLogProbs.
+        vector<bool> candidates_found_;
     };
 
 }  // namespace lm
@@ -27,6 +27,7 @@ namespace lm {
 namespace louds {
 
     const uint32 LoudsLm::kMagicNumber;
+    const uint32 LoudsLm::kCodepointLexiconMagicNumber;
 
     // The number of top unigram next-word predictions to pre-compute.
     const int kMaxUnigramPredictions = 10;
@@ -63,7 +64,8 @@ namespace louds {
         // Build the lexicon.
         lexicon_ = LoudsLexicon::CreateFromUnigramsOrNull(
                 regular_unigrams, params_.logp_quantizer_range,
-                params_.max_num_term_ids, params_.enable_prefix_unigrams);
+                params_.max_num_term_ids, params_.enable_prefix_unigrams,
+                params_.lexicon_encodes_codepoints);
 
         // Construct the key to values map.
         NgramLoudsTrie::KeyValueMap keys_to_values;
@@ -136,6 +138,7 @@ namespace louds {
             has_backoff_weights_.build();
         }
 
+        IndexTries();
         if (ngram_trie_ != nullptr && params_.include_unigram_predictions) {
             PopulateUnigramPredictions();
         }
@@ -156,37 +159,148 @@ namespace louds {
         //    <UNK> given the history.
         //      P(term | history) = P(term | <UNK>) * P(<UNK> | history)
         //                        = P(term) / P(<UNK>) * P(<UNK> | history)
-        NgramLoudsTrie::Key term_ids =
-                BackoffToInVocabTermIds(preceding_term_ids, terms, max_n_, true);
-        if (term_ids.empty()) {
-            *value = -quantizer_->Decode(LookupLogProbForTermId(kUnkId));
-//            __android_log_print(ANDROID_LOG_INFO, "##### LoudsLm::LookupConditionalLogProb", "logp = %f", *value);
-            return false;
+        LmContext context;
+        if (terms.empty()) {
+            // Look up the last of the preceding term_ids.
+            if (preceding_term_ids.empty() || preceding_term_ids.back() == kUnkId) {
+                *value = -quantizer_->Decode(LookupLogProbForTermId(kUnkId));
+                return false;
+            }
+            InitContext(NgramLoudsTrie::Key(preceding_term_ids.begin(),
+                                            preceding_term_ids.end() - 1),
+                        terms, &context);
+            return LookupConditionalLogProbForTermId(context, preceding_term_ids.back(),
+                                                     nullptr, value);
+        }
+        InitContext(preceding_term_ids,
+                    std::vector<StringPiece>(terms.begin(), terms.end() - 1), &context);
+        return LookupConditionalLogProbForTermId(context, TermToTermId(terms.back()),
+                                                 &terms.back(), value);
+    }
+
+    bool LoudsLm::LookupConditionalLogProb(const LmContext& context,
+                                           const StringPiece term,
+                                           LogProbFloat* value) const {
+        return LookupConditionalLogProbForTermId(context, TermToTermId(term), &term,
+                                                 value);
+    }
+
+    bool LoudsLm::LookupConditionalLogProbForTermId(const LmContext& context,
+                                                    const TermId16 term_id,
+                                                    const StringPiece* term,
+                                                    LogProbFloat* value) const {
+        const int context_size = context.term_ids.size();
+        float backoff_cost = 0.0f;
+        if (!params_.has_backoff_weights) {
+            // Apply stupid backoff weight to skipped terms.
+            const int backoff_count =
+                    std::min(max_n_, context.term_count + 1) - (context_size + 1);
+            backoff_cost = backoff_count * stupid_backoff_factor();
         }
-        const int term_count = terms.size() + preceding_term_ids.size();
+        for (int i = 0; i < context_size; ++i) {
+            const LoudsNodeId node_id = context.node_ids[i];
+            if (node_id != NgramLoudsTrie::kInvalidId) {
+                const LoudsNodeId child_node_id =
+                        ngram_trie_->FindChildNode(node_id, term_id);
+                const LoudsTerminalId terminal_id =
+                        child_node_id != NgramLoudsTrie::kInvalidId
+                        ? ngram_trie_->NodeIdToTerminalId(child_node_id)
+                        : NgramLoudsTrie::kInvalidId;
+                if (terminal_id >= 0) {
+                    *value = -quantizer_->Decode(ngram_trie_->TerminalIdToValue(terminal_id)) +
+                             backoff_cost;
+                    return true;
+                }
+            }
+            backoff_cost += context.backoff_costs[i];
+        }
+        return LookupBackoffUnigramLogProb(term_id, term, backoff_cost, value);
+    }
+
+    void LoudsLm::LookupConditionalLogProbs(
+            const NgramLoudsTrie::Key& preceding_term_ids,
+            const std::vector<StringPiece>& terms,
+            const std::vector<StringPiece>& candidates,
+            std::vector<LogProbFloat>* values, std::vector<bool>* found) const {
+        LmContext context;
+        InitContext(preceding_term_ids, terms, &context);
+        LookupConditionalLogProbs(context, candidates, values, found);
+    }
+
+    void LoudsLm::LookupConditionalLogProbs(const LmContext& context,
+                                            const std::vector<StringPiece>& candidates,
+                                            std::vector<LogProbFloat>* values,
+                                            std::vector<bool>* found) const {
+        values->assign(candidates.size(), 0.0f);
+        found->assign(candidates.size(), false);
+        std::vector<TermId16> candidate_term_ids(candidates.size());
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            candidate_term_ids[i] = TermToTermId(candidates[i]);
+        }
+        // The indices of the candidates that have not been found yet, in order of
+        // their term_ids (i.e., of the child labels of a context node).
+        std::vector<int> pending(candidates.size());
+        for (size_t i = 0; i < pending.size(); ++i) {
+            pending[i] = i;
+        }
+        std::stable_sort(pending.begin(), pending.end(),
+                         [&candidate_term_ids](const int a, const int b) {
+                             return candidate_term_ids[a] < candidate_term_ids[b];
+                         });
+
+        const int context_size = context.term_ids.size();
         float backoff_cost = 0.0f;
         if (!params_.has_backoff_weights) {
             // Apply stupid backoff weight to skipped terms.
-            const int backoff_count = std::min(max_n_, term_count) - term_ids.size();
+            const int backoff_count =
+                    std::min(max_n_, context.term_count + 1) - (context_size + 1);
             backoff_cost = backoff_count * stupid_backoff_factor();
         }
-        QuantizedLogProb quantized_value;
-        while (term_ids.size() > 1) {
-            const bool found = ngram_trie_->KeyToValue(term_ids, &quantized_value);
-            if (found) {
-                *value = -quantizer_->Decode(quantized_value) + backoff_cost;
-//                __android_log_print(ANDROID_LOG_INFO, "##### LoudsLm::LookupConditionalLogProb", "backoff_cost = %f", backoff_cost);
-//                __android_log_print(ANDROID_LOG_INFO, "##### LoudsLm::LookupConditionalLogProb", "logp = %f", *value);
-                return true;
+        std::vector<TermId16> labels;
+        std::vector<LoudsNodeId> child_node_ids;
+        for (int i = 0; i < context_size && !pending.empty(); ++i) {
+            const LoudsNodeId node_id = context.node_ids[i];
+            if (node_id != NgramLoudsTrie::kInvalidId) {
+                labels.clear();
+                for (const int k : pending) {
+                    labels.push_back(candidate_term_ids[k]);
+                }
+                ngram_trie_->FindChildNodes(node_id, labels, &child_node_ids);
+                size_t num_pending = 0;
+                for (size_t j = 0; j < pending.size(); ++j) {
+                    const LoudsTerminalId terminal_id =
+                            child_node_ids[j] != NgramLoudsTrie::kInvalidId
+                            ? ngram_trie_->NodeIdToTerminalId(child_node_ids[j])
+                            : NgramLoudsTrie::kInvalidId;
+                    if (terminal_id >= 0) {
+                        (*values)[pending[j]] =
+                                -quantizer_->Decode(ngram_trie_->TerminalIdToValue(
+                                        terminal_id)) +
+                                backoff_cost;
+                        (*found)[pending[j]] = true;
+                    } else {
+                        pending[num_pending++] = pending[j];
+                    }
+                }
+                pending.resize(num_pending);
             }
-            const std::vector<TermId16> backoff_terms(term_ids.begin(),
-                                                      term_ids.end() - 1);
-            backoff_cost += GetBackoffCost(backoff_terms);
-            term_ids.erase(term_ids.begin());
+            backoff_cost += context.backoff_costs[i];
+        }
+        for (const int k : pending) {
+            LogProbFloat value;
+            (*found)[k] = LookupBackoffUnigramLogProb(
+                    candidate_term_ids[k], &candidates[k], backoff_cost, &value);
+            (*values)[k] = value;
         }
+    }
+
+    bool LoudsLm::LookupBackoffUnigramLogProb(const TermId16 term_id,
+                                              const StringPiece* term,
+                                              LogProbFloat backoff_cost,
+                                              LogProbFloat* value) const {
         if (backoff_cost < 0) {
             const string last_term =
-                    terms.empty() ? TermIdToTerm(term_ids[0]) : terms.back().ToString();
+                    term == nullptr ? TermIdToTerm(term_id) : term->ToString();
             const bool is_uppercase = (last_term != UniLib::ToLower(last_term));
             if (is_uppercase) {
                 // Add extra weight for backing off to an uppercase unigrams.
@@ -194,12 +308,12 @@ namespace louds {
             }
         }
 
-        if (term_ids[0] == kUnkId) {
+        if (term_id == kUnkId) {
             // There is no term_id for the last term in the n-gram LM, check whether it
             // is in the lexicon.
             const LoudsNodeId lexicon_node_id =
-                    terms.size() > 0 ? lexicon_->KeyToNodeId(terms.back())
-                                     : NgramLoudsTrie::kInvalidId;
+                    term != nullptr ? lexicon_->KeyToNodeId(*term)
+                                    : NgramLoudsTrie::kInvalidId;
             if (lexicon_node_id != NgramLoudsTrie::kInvalidId &&
                 lexicon_->TermLogProbForNodeId(lexicon_node_id, value)) {
                 *value += backoff_cost;
@@ -207,33 +321,95 @@ namespace louds {
             }
             *value = -quantizer_->Decode(LookupLogProbForTermId(kUnkId));
             return false;
-        } else {
-            *value =
-                    -quantizer_->Decode(LookupLogProbForTermId(term_ids[0])) + backoff_cost;
         }
+        *value = -quantizer_->Decode(LookupLogProbForTermId(term_id)) + backoff_cost;
         return true;
     }
 
+    void LoudsLm::InitContext(const NgramLoudsTrie::Key& preceding_term_ids,
+                              const std::vector<StringPiece>& terms,
+                              LmContext* context) const {
+        context->term_ids.clear();
+        if (max_n_ > 1) {
+            context->term_ids =
+                    BackoffToInVocabTermIds(preceding_term_ids, terms, max_n_ - 1, false);
+        }
+        context->term_count = std::min<int>(std::max(max_n_ - 1, 0),
+                                            preceding_term_ids.size() + terms.size());
+        const int context_size = context->term_ids.size();
+        context->node_ids.resize(context_size);
+        context->backoff_costs.resize(context_size);
+        for (int i = 0; i < context_size; ++i) {
+            LoudsNodeId node_id = ngram_trie_->GetRootNodeId();
+            for (int j = i; j < context_size && node_id != NgramLoudsTrie::kInvalidId;
+                 ++j) {
+                node_id = ngram_trie_->FindChildNode(node_id, context->term_ids[j]);
+            }
+            context->node_ids[i] = node_id;
+            context->backoff_costs[i] = GetBackoffCostForNode(
+                    context_size - i, context->term_ids.back(), node_id);
+        }
+    }
+
+    void LoudsLm::ExtendContext(const StringPiece term, LmContext* context) const {
+        const TermId16 term_id = TermToTermId(term);
+        context->term_count = std::min(std::max(max_n_ - 1, 0), context->term_count + 1);
+        if (term_id == kUnkId || max_n_ < 2) {
+            // The context restarts after an out-of-vocabulary term.
+            context->term_ids.clear();
+            context->node_ids.clear();
+            context->backoff_costs.clear();
+            return;
+        }
+        // Each suffix of the extended context is a suffix of the context followed
+        // by the term, or the term alone, whose nodes are the children for the term
+        // of the nodes of the context and of the root.
+        context->term_ids.push_back(term_id);
+        context->node_ids.push_back(ngram_trie_->GetRootNodeId());
+        const int context_size = context->term_ids.size();
+        for (int i = 0; i < context_size; ++i) {
+            LoudsNodeId& node_id = context->node_ids[i];
+            if (node_id != NgramLoudsTrie::kInvalidId) {
+                node_id = ngram_trie_->FindChildNode(node_id, term_id);
+            }
+        }
+        context->backoff_costs.resize(context_size);
+        for (int i = 0; i < context_size; ++i) {
+            context->backoff_costs[i] =
+                    GetBackoffCostForNode(context_size - i, term_id, context->node_ids[i]);
+        }
+        if (context_size > max_n_ - 1) {
+            // Only the most recent max_n - 1 terms are a context of the n-grams.
+            context->term_ids.erase(context->term_ids.begin());
+            context->node_ids.erase(context->node_ids.begin());
+            context->backoff_costs.erase(context->backoff_costs.begin());
+        }
+    }
+
     void LoudsLm::PredictNextWords(const NgramLoudsTrie::Key& preceding_term_ids,
                                    const std::vector<StringPiece>& terms,
                                    const int max_results,
                                    std::map<string, LogProbFloat>* results) const {
-        NgramLoudsTrie::Key term_ids =
-                BackoffToInVocabTermIds(preceding_term_ids, terms, max_n_ - 1, false);
+        LmContext context;
+        InitContext(preceding_term_ids, terms, &context);
+        PredictNextWords(context, max_results, results);
+    }
+
+    void LoudsLm::PredictNextWords(const LmContext& context, const int max_results,
+                                   std::map<string, LogProbFloat>* results) const {
+        const int context_size = context.term_ids.size();
         std::set<TermId16> predicted_term_ids;
-        if (!term_ids.empty()) {
-            const int term_count = preceding_term_ids.size() + terms.size();
+        if (context_size > 0) {
             float backoff_cost = 0.0f;
             if (!params_.has_backoff_weights) {
-                const int backoff_count =
-                        std::min(max_n_ - 1, term_count) - term_ids.size();
+                const int backoff_count = context.term_count - context_size;
                 backoff_cost = backoff_count * stupid_backoff_factor();
             }
             PredictionBeam top_predictions(max_results);
-            while (!term_ids.empty()) {
-                LookupNextWords(term_ids, max_results, backoff_cost, &top_predictions);
-                backoff_cost += GetBackoffCost(term_ids);
-                term_ids.erase(term_ids.begin());
+            for (int i = 0; i < context_size; ++i) {
+                LookupNextWords(context.node_ids[i], context_size - i, max_results,
+                                backoff_cost, &top_predictions);
+                backoff_cost += context.backoff_costs[i];
             }
             for (const auto& prediction : top_predictions.Take()) {
                 predicted_term_ids.insert(prediction.first);
@@ -269,10 +445,9 @@ namespace louds {
         }
     }
 
-    bool LoudsLm::LookupNextWords(const NgramLoudsTrie::Key& key,
+    bool LoudsLm::LookupNextWords(const LoudsNodeId node_id, const int context_size,
                                   const int max_results, const LogProbFloat backoff,
                                   PredictionBeam* top_predictions) const {
-        const int node_id = ngram_trie_->KeyToNodeId(key);
         if (node_id == NgramLoudsTrie::kInvalidId) {
             return false;
         }
@@ -297,7 +472,7 @@ namespace louds {
                 // backoff paper http://www.aclweb.org/anthology/D07-1090.pdf.
                 continue;
             }
-            if (key.size() > 1) {
+            if (context_size > 1) {
                 // For predictions based on 3-grams and above, only predict next-words
                 // that exceed the unigram logp threshold.
                 LogProbFloat unigram_logp =
@@ -306,9 +481,9 @@ namespace louds {
                     continue;
                 }
             }
-            const LoudsNodeId node_id = child_node_ids[i];
+            const LoudsNodeId child_node_id = child_node_ids[i];
             LogProbFloat logp = -quantizer_->Decode(ngram_trie_->TerminalIdToValue(
-                    ngram_trie_->NodeIdToTerminalId(node_id))) +
+                    ngram_trie_->NodeIdToTerminalId(child_node_id))) +
                                 backoff;
             Prediction prediction = {lexicon_term_id, logp};
             top_predictions->push({lexicon_term_id, logp});
@@ -350,14 +525,18 @@ namespace louds {
         return term_ids;
     }
 
-    LogProbFloat LoudsLm::GetBackoffCost(
-            const std::vector<TermId16>& backoff_terms) const {
+    LogProbFloat LoudsLm::GetBackoffCostForNode(const int size,
+                                                const TermId16 last_term_id,
+                                                const LoudsNodeId node_id) const {
         if (!params_.has_backoff_weights) {
             return stupid_backoff_factor();
         }
+        // The terminal_id of a unigram is its term_id.
         const LoudsTerminalId terminal_id =
-                backoff_terms.size() == 1 ? backoff_terms[0]
-                                          : ngram_trie_->KeyToTerminalId(backoff_terms);
+                size == 1 ? last_term_id
+                          : node_id != NgramLoudsTrie::kInvalidId
+                            ? ngram_trie_->NodeIdToTerminalId(node_id)
+                            : NgramLoudsTrie::kInvalidId;
         if (terminal_id >= 0 && terminal_id < has_backoff_weights_.size()) {
             if (has_backoff_weights_[terminal_id]) {
                 const int index = has_backoff_weights_.rank1(terminal_id);
@@ -420,7 +599,7 @@ namespace louds {
         mapper.open(map, length);
         uint32 magic_number;
         mapper.map(&magic_number);
-        if (magic_number != kMagicNumber) {
+        if (magic_number != kMagicNumber && magic_number != kCodepointLexiconMagicNumber) {
             LOG(ERROR) << "Map failed: invalid magic number " << magic_number;
             return false;
         }
@@ -444,7 +623,8 @@ namespace louds {
 //        }
 
         // Process the LM contents.
-        lexicon_ = LoudsLexicon::CreateFromMapperOrNull(&mapper);
+        lexicon_ = LoudsLexicon::CreateFromMapperOrNull(
+                &mapper, magic_number == kCodepointLexiconMagicNumber);
         if (!lexicon_) {
             return false;
         }
@@ -461,6 +641,7 @@ namespace louds {
             has_backoff_weights_.map(&mapper);
             backoff_weights_.map(&mapper);
         }
+        IndexTries();
         if (params_.include_unigram_predictions) {
             PopulateUnigramPredictions();
         }
@@ -485,7 +666,7 @@ namespace louds {
         // Process the header.
         uint32 magic_number;
         reader->read(&magic_number);
-        if (magic_number != kMagicNumber) {
+        if (magic_number != kMagicNumber && magic_number != kCodepointLexiconMagicNumber) {
             LOG(ERROR) << "Read failed: invalid magic number " << magic_number;
             return false;
         }
@@ -508,7 +689,8 @@ namespace louds {
 //        }
 
         // Process the LM contents.
-        lexicon_ = LoudsLexicon::CreateFromReaderOrNull(reader);
+        lexicon_ = LoudsLexicon::CreateFromReaderOrNull(
+                reader, magic_number == kCodepointLexiconMagicNumber);
         if (!lexicon_) {
             return false;
         }
@@ -525,6 +707,7 @@ namespace louds {
             has_backoff_weights_.read(reader);
             backoff_weights_.read(reader);
         }
+        IndexTries();
         if (params_.include_unigram_predictions) {
             PopulateUnigramPredictions();
         }
@@ -533,7 +716,9 @@ namespace louds {
 
     void LoudsLm::WriteInternal(MarisaWriter* writer) {
         // Process the header.
-        writer->write(static_cast<uint32>(kMagicNumber));
+        writer->write(static_cast<uint32>(lexicon_->encodes_codepoints()
+                                          ? kCodepointLexiconMagicNumber
+                                          : kMagicNumber));
         const string params_str = params_.SerializeAsString();
         MarisaVector<char> params_byte_vector;
         for (int i = 0; i < params_str.size(); ++i) {
@@ -592,6 +777,23 @@ namespace louds {
         }
     }
 
+    void LoudsLm::IndexTries() {
+        const RankSelectIndex rank_select_index = params_.use_poppy_rank_select
+                                                  ? RankSelectIndex::kPoppy
+                                                  : RankSelectIndex::kMarisa;
+        if (lexicon_ != nullptr) {
+            lexicon_->set_rank_select_index(rank_select_index);
+            lexicon_->IndexTopLevels(params_.trie_index_levels,
+                                     params_.trie_index_max_nodes);
+        }
+        if (ngram_trie_ != nullptr) {
+            ngram_trie_->set_rank_select_index(rank_select_index);
+            ngram_trie_->IndexTopLevels(params_.trie_index_levels,
+                                        params_.trie_index_max_nodes);
+        }
+        has_backoff_weights_.set_rank_select_index(rank_select_index);
+    }
+
     void LoudsLm::PopulateUnigramPredictions() {
         if (ngram_trie_ == nullptr || !top_unigrams_predictions_.empty()) {
             return;
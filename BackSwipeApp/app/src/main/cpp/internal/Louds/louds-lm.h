@@ -13,6 +13,14 @@
 //
 // Note: Currently the LoudsLm exclude n-grams that contain the <UNK> term.
 // this means that the language model may not be properly normalized.
+//
+// The preceding terms of a lookup are resolved into an LmContext: the term ids
+// of the in-vocabulary context, and the n-gram trie node of each of its
+// suffixes (i.e., of each step of the backoff chain). Callers that score or
+// predict many terms after the same preceding terms can resolve the context
+// once and pass it to each lookup, which then only looks up the children of
+// the context nodes. A context can also be extended with the next term without
+// resolving it again from the root of the trie.
 
 #ifndef INPUTMETHOD_KEYBOARD_LM_LOUDS_LOUDS_LM_H_
 #define INPUTMETHOD_KEYBOARD_LM_LOUDS_LOUDS_LM_H_
@@ -47,6 +55,28 @@ namespace louds {
     // node labels and QuantizedLogProbs as node values.
     typedef LoudsTrie<TermId16, QuantizedLogProb> NgramLoudsTrie;
 
+    // The resolved context (i.e., preceding terms) of n-gram lookups, created by
+    // LoudsLm::InitContext. A context is only valid for the LoudsLm that created
+    // it, while its params are unchanged.
+    struct LmContext {
+        // The term_ids of the most recent in-vocabulary terms of the context (at
+        // most max_n - 1 of them, and none before an out-of-vocabulary term), from
+        // the oldest to the most recent.
+        NgramLoudsTrie::Key term_ids;
+
+        // The n-gram trie node of each suffix of term_ids, from the longest to the
+        // shortest (i.e., node_ids[i] is the node of the last term_ids.size() - i
+        // terms), or kInvalidId if the suffix is not an n-gram of the trie.
+        std::vector<LoudsNodeId> node_ids;
+
+        // The cost of backing off from each suffix of term_ids, in the same order.
+        std::vector<LogProbFloat> backoff_costs;
+
+        // The number of terms in the context, including out-of-vocabulary terms,
+        // up to max_n - 1.
+        int term_count = 0;
+    };
+
     class LoudsLm {
     public:
         // A "magic" number to store in the header of each LoudsLm file to ensure
@@ -54,6 +84,10 @@ namespace louds {
         // unsigned integer will not be loaded.
         static constexpr uint32 kMagicNumber = 0xEFA31CB9;
 
+        // The magic number of LoudsLm files whose lexicon encodes codepoints (see
+        // LoudsLexicon), which older versions of the LoudsLm can not load.
+        static constexpr uint32 kCodepointLexiconMagicNumber = 0xEFA31CBA;
+
         // Stores an n-gram as a sequence of terms and associated log probabilities
         // and backoff weights.
         struct Ngram {
@@ -165,6 +199,35 @@ namespace louds {
                                       const std::vector<StringPiece>& terms,
                                       LogProbFloat* value) const;
 
+        // As above, for the given term following the given context.
+        bool LookupConditionalLogProb(const LmContext& context, const StringPiece term,
+                                      LogProbFloat* value) const;
+
+        // As LookupConditionalLogProb, for each of the candidate terms following the
+        // same preceding term_ids and terms. The context node of the candidates is
+        // looked up once for each n-gram order and merged with the candidates, and
+        // only the candidates that are not found back off to the next order.
+        //
+        // Args:
+        //   preceding_term_ids - The term_ids that precede the terms.
+        //   terms              - The terms that precede the candidates. May be empty.
+        //   candidates         - The candidate terms to look up.
+        //   values             - Replaced with the conditional log probability of
+        //                        each candidate.
+        //   found              - Replaced with whether or not each candidate was in
+        //                        the lexicon.
+        void LookupConditionalLogProbs(const NgramLoudsTrie::Key& preceding_term_ids,
+                                       const std::vector<StringPiece>& terms,
+                                       const std::vector<StringPiece>& candidates,
+                                       std::vector<LogProbFloat>* values,
+                                       std::vector<bool>* found) const;
+
+        // As above, for the candidate terms following the given context.
+        void LookupConditionalLogProbs(const LmContext& context,
+                                       const std::vector<StringPiece>& candidates,
+                                       std::vector<LogProbFloat>* values,
+                                       std::vector<bool>* found) const;
+
         // Predicts the most probable next words given the preceding term_ids and then
         // the preceding context terms.
         void PredictNextWords(const NgramLoudsTrie::Key& term_ids,
@@ -172,6 +235,20 @@ namespace louds {
                               const int max_results,
                               std::map<string, LogProbFloat>* results) const;
 
+        // As above, for the next words following the given context.
+        void PredictNextWords(const LmContext& context, const int max_results,
+                              std::map<string, LogProbFloat>* results) const;
+
+        // Resolves the context of the given preceding term_ids and then terms (see
+        // LmContext), replacing the given context.
+        void InitContext(const NgramLoudsTrie::Key& preceding_term_ids,
+                         const std::vector<StringPiece>& terms,
+                         LmContext* context) const;
+
+        // Appends the given term to the context. The nodes of the extended context
+        // are the children of the nodes of the context (and of the root).
+        void ExtendContext(const StringPiece term, LmContext* context) const;
+
         // Writes the contents of the LM (lexicon and n-gram trie) to the file.
         void WriteToFile(const string& filename);
 
@@ -199,9 +276,17 @@ namespace louds {
         void SetBadwords(const std::vector<string>& badwords);
 
 
-        // Sets the parameters to the given new_params.
+        // Sets the parameters to the given new_params. Re-indexes the tries if the
+        // trie index params changed.
         void set_params(const LoudsLmParams& new_params) {
+            const bool index_changed =
+                    new_params.trie_index_levels != params_.trie_index_levels ||
+                    new_params.trie_index_max_nodes != params_.trie_index_max_nodes ||
+                    new_params.use_poppy_rank_select != params_.use_poppy_rank_select;
             params_ = new_params;
+            if (index_changed) {
+                IndexTries();
+            }
         }
 
         // Returns all of the n-grams in the LM.  Intended for use when debugging, or
@@ -233,11 +318,19 @@ namespace louds {
             return ngram_trie_->TerminalIdToValue(term_id);
         }
 
-        // Returns the most probable next words with the given key as context.
-        bool LookupNextWords(const NgramLoudsTrie::Key& key, const int max_results,
-                             const LogProbFloat backoff,
+        // Returns the most probable next words with the n-gram of the given node
+        // (and of the given number of terms) as context.
+        bool LookupNextWords(const LoudsNodeId node_id, const int context_size,
+                             const int max_results, const LogProbFloat backoff,
                              PredictionBeam* top_predictions) const;
 
+        // As LookupConditionalLogProb, for the term with the given term_id (and
+        // string, or nullptr if only its term_id is known).
+        bool LookupConditionalLogProbForTermId(const LmContext& context,
+                                               const TermId16 term_id,
+                                               const StringPiece* term,
+                                               LogProbFloat* value) const;
+
         // Takes a sequence of term_ids and terms, then performs backoffs until there
         // are only in-vocabulary terms remaining.
         //
@@ -249,8 +342,26 @@ namespace louds {
                 const std::vector<StringPiece>& terms, int max_term_count,
                 bool preserve_last_term) const;
 
-        // Returns the backoff cost associated with the given term_id sequence.
-        LogProbFloat GetBackoffCost(const std::vector<TermId16>& backoff_terms) const;
+        // Looks up the log probability of the given term after backing off to
+        // unigrams with the given backoff_cost, from the n-gram trie or, for terms
+        // without a term_id, from the lexicon. Returns whether or not the term was
+        // in the lexicon.
+        //
+        // Args:
+        //   term_id      - The term_id of the term (or kUnkId).
+        //   term         - The term, or nullptr if only its term_id is known.
+        //   backoff_cost - The accumulated cost of backing off to the unigram.
+        //   value        - Set to the log probability of the term, or of <UNK> if
+        //                  the term is not in the lexicon.
+        bool LookupBackoffUnigramLogProb(const TermId16 term_id, const StringPiece* term,
+                                         LogProbFloat backoff_cost,
+                                         LogProbFloat* value) const;
+
+        // Returns the backoff cost associated with the term_id sequence of the given
+        // size whose n-gram trie node is node_id (or kInvalidId), and whose last
+        // term_id is last_term_id.
+        LogProbFloat GetBackoffCostForNode(const int size, const TermId16 last_term_id,
+                                           const LoudsNodeId node_id) const;
 
         // Memory maps the contents of the LM (lexicon trie and n-gram trie) from the
         // file.
@@ -286,6 +397,11 @@ namespace louds {
         void DumpNgrams(LoudsNodeId node_id, std::vector<string> prefix,
                         std::vector<Ngram>* ngrams) const;
 
+        // Indexes the top levels of the lexicon and n-gram tries, and selects the
+        // rank/select index of their bit-vectors, as configured by the params.
+        // Should be called once on initialization.
+        void IndexTries();
+
         // Populates the pre-computed list of top unigram predictions. Should be
         // called once on initialization.
         void PopulateUnigramPredictions();
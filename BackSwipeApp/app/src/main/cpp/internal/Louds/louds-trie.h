@@ -147,6 +147,20 @@
 //
 // These traversal rules are also presented in [1] (Figure 3), under the
 // "Ones-based numbering" scheme.
+//
+// ====================================================================
+// TOP LEVEL INDEX
+// ====================================================================
+//
+// Almost every lookup and expansion goes through the top few levels of the
+// trie, where each traversal step costs a select0 and a rank1. Since the node
+// ids are in level order, the nodes in the top levels are the nodes with the
+// smallest ids, so LoudsTrie::IndexTopLevels can store their children in
+// tables indexed directly by node id: the first child and the number of
+// children of each node and, for single-byte labels, a bitmap of the child
+// labels, which maps a label to its child with a popcount. The tables are built
+// in memory (in one pass over the LOUDS bit-vector) after the trie is loaded,
+// so the file format is unchanged.
 
 #ifndef INPUTMETHOD_KEYBOARD_LM_LOUDS_LOUDS_TRIE_H_
 #define INPUTMETHOD_KEYBOARD_LM_LOUDS_LOUDS_TRIE_H_
@@ -158,6 +172,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <map>
 #include <memory>
 #include <set>
@@ -363,6 +378,18 @@ namespace louds {
         // Returns kInvalidId if the node does not have a child node for this label.
         LoudsNodeId FindChildNode(LoudsNodeId node_id, const T& label) const;
 
+        // As FindChildNode, for each of the given labels, which must be sorted in
+        // increasing order. The children of the node are located once, and merged
+        // with the labels.
+        //
+        // Args:
+        //   node_id        - The parent node id.
+        //   labels         - The sorted labels of the children to find.
+        //   child_node_ids - Replaced with the node id of the child with each label,
+        //                    or kInvalidId if the node has no child for the label.
+        void FindChildNodes(LoudsNodeId node_id, const std::vector<T>& labels,
+                            std::vector<LoudsNodeId>* child_node_ids) const;
+
         // Retrieves the children (labels and node_ids) for the given parent node id.
         void GetChildren(const LoudsNodeId node_id, std::vector<T>* child_labels,
                          std::vector<LoudsNodeId>* child_node_ids) const;
@@ -370,6 +397,36 @@ namespace louds {
         // Returns whether the node referenced by node_id has any children.
         bool HasChildren(const LoudsNodeId node_id) const;
 
+        // Indexes the children of the nodes in the top levels of the trie (see the
+        // file comment), replacing any previous index. Lookups of the children of
+        // the indexed nodes then skip the rank and select operations.
+        //
+        // Args:
+        //   levels    - The number of levels to index, where the root is at level
+        //               0. Set to 0 to remove the index.
+        //   max_nodes - The maximum number of nodes to index. If the top levels
+        //               have more nodes, only the first max_nodes of them (in
+        //               level order) are indexed.
+        void IndexTopLevels(int levels, int max_nodes);
+
+        // Returns the number of nodes indexed by IndexTopLevels.
+        int indexed_node_count() const { return indexed_nodes_.size(); }
+
+        // Returns the memory used by the index, in bytes.
+        int64 index_memory_bytes() const {
+            return static_cast<int64>(indexed_nodes_.size()) * sizeof(IndexedNode) +
+                   static_cast<int64>(label_bitmaps_.size()) * sizeof(uint64);
+        }
+
+        // Selects the index used for the rank and select operations of the
+        // bit-vectors of the trie (see MarisaBitVector::set_rank_select_index).
+        void set_rank_select_index(const RankSelectIndex index) {
+            louds_.set_rank_select_index(index);
+            if (has_explicit_terminals_) {
+                terminals_.set_rank_select_index(index);
+            }
+        }
+
         // Returns whether the given node id is a terminal.
         inline bool HasTerminalId(const LoudsNodeId node_id) const {
             if (!has_explicit_terminals_) {
@@ -392,6 +449,39 @@ namespace louds {
         }
 
     private:
+        // The children of a node indexed by IndexTopLevels.
+        struct IndexedNode {
+            // The node id of the first child (if there are any).
+            LoudsNodeId first_child;
+            // The number of children.
+            int child_count;
+            // Whether the labels of the children are consecutive, so the child for
+            // a label is at a fixed offset from the first child.
+            bool has_consecutive_labels;
+        };
+
+        // Whether the labels are single bytes, which are indexed by label bitmaps.
+        static constexpr bool kHasByteLabels = sizeof(T) == 1;
+
+        // The number of words in the label bitmap of a node.
+        static constexpr int kLabelBitmapWords = 256 / 64;
+
+        // Returns the position of the given byte label in a label bitmap. The
+        // positions are in the same order as the labels.
+        static int LabelBitmapPosition(const T& label) {
+            return static_cast<int>(label) -
+                   static_cast<int>(std::numeric_limits<T>::min());
+        }
+
+        // Returns the node id of the child with the given label, among the
+        // child_count children starting with first_child, or kInvalidId if there
+        // is none. Performs a binary search (the labels are sorted).
+        LoudsNodeId FindChildNodeInRange(LoudsNodeId first_child, int child_count,
+                                         const T& label) const;
+
+        // Returns the node id of the child with the given label of an indexed node.
+        LoudsNodeId FindIndexedChildNode(LoudsNodeId node_id, const T& label) const;
+
         // Private constructor for LoudsTrie.
         //
         // Args:
@@ -490,6 +580,14 @@ namespace louds {
         // The labels for the terminals in the trie, referenced by terminal id.
         MarisaVector<Value> values_;
 
+        // The children of the nodes indexed by IndexTopLevels, referenced by node
+        // id.
+        vector<IndexedNode> indexed_nodes_;
+
+        // For single-byte labels, the kLabelBitmapWords words of the bitmap of the
+        // child labels of each indexed node (see LabelBitmapPosition).
+        vector<uint64> label_bitmaps_;
+
         DISALLOW_COPY_AND_ASSIGN(LoudsTrie);
     };
 
@@ -584,39 +682,113 @@ namespace louds {
     template <typename T, typename V, typename K>
     LoudsNodeId LoudsTrie<T, V, K>::FindChildNode(LoudsNodeId node_id,
                                                   const T& label) const {
+        if (node_id >= 0 && node_id < indexed_node_count()) {
+            return FindIndexedChildNode(node_id, label);
+        }
         // bit index of first child for node_id
-        BitIndex min_index = NodeIdToFirstEdgeBitIndex(node_id);
+        const BitIndex min_index = NodeIdToFirstEdgeBitIndex(node_id);
         if (!louds_[min_index]) return kInvalidId;
         // bit index of last child for node_id
-        BitIndex max_index = NodeIdToLastEdgeBitIndex(node_id);
+        const BitIndex max_index = NodeIdToLastEdgeBitIndex(node_id);
         if (!louds_[max_index]) return kInvalidId;
-        // update node_id to that of the first child.
-        node_id = BitIndexToNodeId(min_index);
-        // calculate offset to convert from bit_index to node_id.
-        // (only valid in the current child bit-vector.)
-        const int bit_index_to_node_id_offset = node_id - min_index;
-        while (true) {
-            if (max_index < min_index) {
-                return kInvalidId;
+        // Because of the LOUDS representation, all the child bits are consecutive
+        // 1s, so the children have consecutive node ids.
+        return FindChildNodeInRange(BitIndexToNodeId(min_index),
+                                    max_index - min_index + 1, label);
+    }
+
+    template <typename T, typename V, typename K>
+    void LoudsTrie<T, V, K>::FindChildNodes(
+            const LoudsNodeId node_id, const std::vector<T>& labels,
+            std::vector<LoudsNodeId>* child_node_ids) const {
+        child_node_ids->assign(labels.size(), static_cast<LoudsNodeId>(kInvalidId));
+        LoudsNodeId first_child;
+        int child_count;
+        if (node_id >= 0 && node_id < indexed_node_count()) {
+            first_child = indexed_nodes_[node_id].first_child;
+            child_count = indexed_nodes_[node_id].child_count;
+        } else {
+            const BitIndex min_index = NodeIdToFirstEdgeBitIndex(node_id);
+            if (!louds_[min_index]) return;
+            const BitIndex max_index = NodeIdToLastEdgeBitIndex(node_id);
+            if (!louds_[max_index]) return;
+            first_child = BitIndexToNodeId(min_index);
+            child_count = max_index - min_index + 1;
+        }
+        // Since the labels are sorted, the child of each label can only follow the
+        // child of the previous one, so each search starts after the last match.
+        LoudsNodeId min_node_id = first_child;
+        const LoudsNodeId end_node_id = first_child + child_count;
+        for (size_t i = 0; i < labels.size() && min_node_id < end_node_id; ++i) {
+            LoudsNodeId max_node_id = end_node_id;
+            while (min_node_id < max_node_id) {
+                const LoudsNodeId mid_node_id = (min_node_id + max_node_id) / 2;
+                if (labels_[mid_node_id] < labels[i]) {
+                    min_node_id = mid_node_id + 1;
+                } else {
+                    max_node_id = mid_node_id;
+                }
             }
-            BitIndex mid_index = (min_index + max_index) / 2;
-            // Update the node_id. Because of the LOUDS representation, all the
-            // child bits are consecutive 1s. So we can traverse this child sequence
-            // by incrementing/decrementing both node_id and bit_index.
-            node_id = mid_index + bit_index_to_node_id_offset;
-            const T mid_label = labels_[node_id];
+            if (min_node_id < end_node_id && labels_[min_node_id] == labels[i]) {
+                (*child_node_ids)[i] = min_node_id;
+            }
+        }
+    }
+
+    template <typename T, typename V, typename K>
+    LoudsNodeId LoudsTrie<T, V, K>::FindChildNodeInRange(
+            const LoudsNodeId first_child, const int child_count,
+            const T& label) const {
+        LoudsNodeId min_node_id = first_child;
+        LoudsNodeId max_node_id = first_child + child_count - 1;
+        while (min_node_id <= max_node_id) {
+            const LoudsNodeId mid_node_id = (min_node_id + max_node_id) / 2;
+            const T mid_label = labels_[mid_node_id];
             if (mid_label > label) {
                 // key is in lower subset.
-                max_index = mid_index - 1;
+                max_node_id = mid_node_id - 1;
             } else if (mid_label < label) {
                 // key is in upper subset.
-                min_index = mid_index + 1;
+                min_node_id = mid_node_id + 1;
             } else {
                 // key is found.
-                break;
+                return mid_node_id;
             }
         }
-        return node_id;
+        return kInvalidId;
+    }
+
+    template <typename T, typename V, typename K>
+    LoudsNodeId LoudsTrie<T, V, K>::FindIndexedChildNode(const LoudsNodeId node_id,
+                                                         const T& label) const {
+        const IndexedNode& node = indexed_nodes_[node_id];
+        if (kHasByteLabels) {
+            const uint64* bitmap = &label_bitmaps_[node_id * kLabelBitmapWords];
+            const int position = LabelBitmapPosition(label);
+            const int word = position / 64;
+            const uint64 bit = uint64{1} << (position % 64);
+            if ((bitmap[word] & bit) == 0) {
+                return kInvalidId;
+            }
+            // The child is preceded by the children with smaller labels.
+            int rank = __builtin_popcountll(bitmap[word] & (bit - 1));
+            for (int i = 0; i < word; ++i) {
+                rank += __builtin_popcountll(bitmap[i]);
+            }
+            return node.first_child + rank;
+        }
+        if (node.has_consecutive_labels) {
+            if (node.child_count == 0) {
+                return kInvalidId;
+            }
+            const T first_label = labels_[node.first_child];
+            if (label < first_label) {
+                return kInvalidId;
+            }
+            const int64 offset = static_cast<int64>(label) - first_label;
+            return offset < node.child_count ? node.first_child + offset : kInvalidId;
+        }
+        return FindChildNodeInRange(node.first_child, node.child_count, label);
     }
 
     template <typename T, typename V, typename K>
@@ -633,6 +805,14 @@ namespace louds {
     void LoudsTrie<T, V, K>::GetChildren(
             const LoudsNodeId node_id, vector<T>* child_labels,
             std::vector<LoudsNodeId>* child_node_ids) const {
+        if (node_id >= 0 && node_id < indexed_node_count()) {
+            const IndexedNode& node = indexed_nodes_[node_id];
+            for (int i = 0; i < node.child_count; ++i) {
+                child_labels->push_back(labels_[node.first_child + i]);
+                child_node_ids->push_back(node.first_child + i);
+            }
+            return;
+        }
         BitIndex bit_index = NodeIdToFirstEdgeBitIndex(node_id);
         if (!louds_[bit_index]) {
             return;
@@ -651,6 +831,9 @@ namespace louds {
 
     template <typename T, typename V, typename K>
     bool LoudsTrie<T, V, K>::HasChildren(const LoudsNodeId node_id) const {
+        if (node_id >= 0 && node_id < indexed_node_count()) {
+            return indexed_nodes_[node_id].child_count > 0;
+        }
         BitIndex bit_index = NodeIdToFirstEdgeBitIndex(node_id);
         if (!louds_[bit_index]) {
             return false;
@@ -662,6 +845,53 @@ namespace louds {
         return true;
     }
 
+    template <typename T, typename V, typename K>
+    void LoudsTrie<T, V, K>::IndexTopLevels(const int levels, const int max_nodes) {
+        indexed_nodes_.clear();
+        label_bitmaps_.clear();
+        if (levels <= 0 || max_nodes <= 0 || labels_.size() == 0) {
+            return;
+        }
+        // The degree sequences of the nodes are consecutive in the bit-vector, in
+        // node id order, and so are their children.
+        BitIndex bit_index = NodeIdToFirstEdgeBitIndex(kRootNodeId);
+        LoudsNodeId next_child = kRootNodeId + 1;
+        // The node id past the last node of the current level.
+        LoudsNodeId level_end = kRootNodeId + 1;
+        int level = 0;
+        const LoudsNodeId node_count = std::min<LoudsNodeId>(labels_.size(), max_nodes);
+        for (LoudsNodeId node_id = kRootNodeId; node_id < node_count; ++node_id) {
+            if (node_id == level_end) {
+                if (++level == levels) {
+                    break;
+                }
+                level_end = next_child;
+            }
+            IndexedNode node;
+            node.first_child = next_child;
+            if (kHasByteLabels) {
+                label_bitmaps_.resize(label_bitmaps_.size() + kLabelBitmapWords);
+            }
+            while (louds_[bit_index]) {
+                if (kHasByteLabels) {
+                    const int position = LabelBitmapPosition(labels_[next_child]);
+                    label_bitmaps_[node_id * kLabelBitmapWords + position / 64] |=
+                            uint64{1} << (position % 64);
+                }
+                ++bit_index;
+                ++next_child;
+            }
+            // Skip the 0 that ends the degree sequence.
+            ++bit_index;
+            node.child_count = next_child - node.first_child;
+            node.has_consecutive_labels =
+                    node.child_count > 0 &&
+                    static_cast<int64>(labels_[next_child - 1]) - labels_[node.first_child] ==
+                    node.child_count - 1;
+            indexed_nodes_.push_back(node);
+        }
+    }
+
     template <typename T, typename V, typename K>
     void LoudsTrie<T, V, K>::WriteToFile(const string& filename) const {
         MarisaWriter writer;
@@ -0,0 +1,142 @@
+#include "align-score-grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "base/logging.h"
+#include "math-utils.h"
+#include "score-kernels.h"
+
+namespace keyboard {
+namespace decoder {
+
+    using simd::Float4;
+    using simd::kLanes;
+
+    namespace {
+
+        // The maximum number of nodes in a grid. For keyboards that are large
+        // relative to their most common key width, the cells are made larger.
+        const int kMaxNodes = 1 << 14;
+
+    }  // namespace
+
+    AlignScoreGrid::AlignScoreGrid(const Keyboard& keyboard)
+            : num_keys_(keyboard.num_keys()),
+              stride_(simd::PaddedSize(keyboard.num_keys())) {
+        score_kernels::KeyCenters centers;
+        score_kernels::SetKeyCenters(keyboard, /* is_three_decoder_enabled = */ false,
+                                     &centers, &wide_keys_);
+
+        // The area covered by the keys, plus a margin of one key width.
+        const float key_width = keyboard.most_common_key_width();
+        const float half_key_height = keyboard.most_common_key_height() / 2;
+        float left = std::numeric_limits<float>::infinity();
+        float right = -std::numeric_limits<float>::infinity();
+        float top = std::numeric_limits<float>::infinity();
+        float bottom = -std::numeric_limits<float>::infinity();
+        for (int k = 0; k < num_keys_; ++k) {
+            const float half_width = keyboard.widths(k) / 2;
+            left = std::min(left, keyboard.center_xs(k) - half_width);
+            right = std::max(right, keyboard.center_xs(k) + half_width);
+            top = std::min(top, keyboard.center_ys(k) - half_key_height);
+            bottom = std::max(bottom, keyboard.center_ys(k) + half_key_height);
+        }
+        left -= key_width;
+        right += key_width;
+        top -= key_width;
+        bottom += key_width;
+        cell_size_ = std::max(key_width / kCellsPerKeyWidth,
+                              std::sqrt((right - left) * (bottom - top) / kMaxNodes));
+        columns_ = static_cast<int>(std::ceil((right - left) / cell_size_)) + 1;
+        rows_ = static_cast<int>(std::ceil((bottom - top) / cell_size_)) + 1;
+        origin_x_ = left;
+        origin_y_ = top;
+        min_x_ = origin_x_;
+        max_x_ = origin_x_ + (columns_ - 1) * cell_size_;
+        min_y_ = origin_y_;
+        max_y_ = origin_y_ + (rows_ - 1) * cell_size_;
+
+        // The scores of the kernel with a distance weight of 1 are the negated
+        // squared distances.
+        distance_sqs_.resize(rows_ * columns_ * stride_);
+        for (int row = 0; row < rows_; ++row) {
+            for (int column = 0; column < columns_; ++column) {
+                float* node = &distance_sqs_[(row * columns_ + column) * stride_];
+                score_kernels::AlignScores(origin_x_ + column * cell_size_,
+                                           origin_y_ + row * cell_size_, centers,
+                                           /* distance_weight = */ 1.0f, node);
+                for (int k = 0; k < stride_; ++k) {
+                    node[k] = k < num_keys_ ? -node[k] : 0.0f;
+                }
+            }
+        }
+
+        // A single center whose zero radius is at most 1 (see
+        // MathUtils::DistanceStep) gives a quadratic function, except within a
+        // pixel of the center, where the scores are practically 0 anyway.
+        quadratic_masks_.resize(stride_);
+        for (int k = 0; k < stride_; ++k) {
+            quadratic_masks_[k] = (k < num_keys_ && centers.row_counts[k] == 1 &&
+                                   centers.zero_radius_sqs[k] <= 1.0f)
+                                  ? 1.0f
+                                  : 0.0f;
+        }
+    }
+
+    void AlignScoreGrid::AlignScores(const float x, const float y,
+                                     const float distance_weight,
+                                     float* scores) const {
+        DCHECK(Contains(x, y));
+        const float grid_x = (x - origin_x_) / cell_size_;
+        const float grid_y = (y - origin_y_) / cell_size_;
+        const int column = std::min(static_cast<int>(grid_x), columns_ - 2);
+        const int row = std::min(static_cast<int>(grid_y), rows_ - 2);
+        const float fx = grid_x - column;
+        const float fy = grid_y - row;
+        const float* top_left = distance_sqs_.data() + (row * columns_ + column) * stride_;
+        const float* top_right = top_left + stride_;
+        const float* bottom_left = top_left + columns_ * stride_;
+        const float* bottom_right = bottom_left + stride_;
+        const float top_left_weight = (1 - fx) * (1 - fy);
+        const float top_right_weight = fx * (1 - fy);
+        const float bottom_left_weight = (1 - fx) * fy;
+        const float bottom_right_weight = fx * fy;
+        // The bilinear interpolation of (x - center_x)^2 + (y - center_y)^2
+        // exceeds it by this much, wherever the center is.
+        const float error = sqr(cell_size_) * (fx * (1 - fx) + fy * (1 - fy));
+        const float scale = -sqr(distance_weight);
+
+        const Float4 top_left_weights = simd::Set(top_left_weight);
+        const Float4 top_right_weights = simd::Set(top_right_weight);
+        const Float4 bottom_left_weights = simd::Set(bottom_left_weight);
+        const Float4 bottom_right_weights = simd::Set(bottom_right_weight);
+        const Float4 errors = simd::Set(error);
+        const Float4 scales = simd::Set(scale);
+        const Float4 zeros = simd::Set(0.0f);
+        int k = 0;
+        for (; k + kLanes <= num_keys_; k += kLanes) {
+            const Float4 interpolated = simd::Add(
+                    simd::Add(simd::Mul(simd::Load(top_left + k), top_left_weights),
+                              simd::Mul(simd::Load(top_right + k), top_right_weights)),
+                    simd::Add(simd::Mul(simd::Load(bottom_left + k), bottom_left_weights),
+                              simd::Mul(simd::Load(bottom_right + k), bottom_right_weights)));
+            const Float4 distance_sqs = simd::Sub(
+                    interpolated, simd::Mul(errors, simd::Load(quadratic_masks_.data() + k)));
+            simd::Store(simd::Mul(simd::Select(simd::Less(distance_sqs, zeros), zeros,
+                                               distance_sqs),
+                                  scales),
+                        scores + k);
+        }
+        for (; k < num_keys_; ++k) {
+            const float interpolated =
+                    (top_left[k] * top_left_weight + top_right[k] * top_right_weight) +
+                    (bottom_left[k] * bottom_left_weight + bottom_right[k] * bottom_right_weight);
+            const float distance_sq = interpolated - error * quadratic_masks_[k];
+            scores[k] = (distance_sq < 0 ? 0.0f : distance_sq) * scale;
+        }
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,100 @@
+// Description:
+//   A grid of the squared distances from the points on (and around) a keyboard
+//   to each of its keys, which is rasterized once per keyboard layout, so that
+//   the alignment scores of a touch point (see TouchSequence::align_score) can
+//   be interpolated from it instead of computed from the key centers.
+//
+//   The nodes of the grid are kCellsPerKeyWidth per most common key width
+//   apart, and cover the keys and a margin of one key width around them. The
+//   squared distances of a point are bilinearly interpolated from the four
+//   nodes around it. For a key with a single center (which is every key
+//   unless the key statistics of MathUtils are loaded), the squared distance
+//   is a quadratic function of the point, whose interpolation error depends
+//   only on the position of the point in its cell, so it is subtracted, and
+//   the scores match the computed ones up to rounding. The distances to the
+//   letter keys that are aligned to a range of keyboard positions (see
+//   MathUtils::PointToRangeDistance) are only approximated.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_ALIGN_SCORE_GRID_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_ALIGN_SCORE_GRID_H_
+
+#include <vector>
+
+#include "base/macros.h"
+#include "keyboardSetting/keyboard.h"
+#include "simd.h"
+
+namespace keyboard {
+namespace decoder {
+
+    class AlignScoreGrid {
+    public:
+        // The number of grid cells per most common key width.
+        static constexpr int kCellsPerKeyWidth = 4;
+
+        // Rasterizes the distances to the keys of the keyboard, as the decoder
+        // aligns them without the three decoder (see score_kernels::SetKeyCenters),
+        // with the key statistics that are loaded at the time.
+        explicit AlignScoreGrid(const Keyboard& keyboard);
+
+        // Returns whether the point (x, y) is covered by the grid.
+        bool Contains(const float x, const float y) const {
+            return x >= min_x_ && x <= max_x_ && y >= min_y_ && y <= max_y_;
+        }
+
+        // Computes the alignment scores of a point for each key, like
+        // score_kernels::AlignScores. The point must be covered by the grid. Like
+        // the kernel, this does not handle the keys in wide_keys().
+        //
+        // Args:
+        //   x, y            - The coordinates of the touch point.
+        //   distance_weight - The weight of the distance.
+        //   scores          - Populated with the num_keys scores.
+        void AlignScores(float x, float y, float distance_weight, float* scores) const;
+
+        // The keys whose scores AlignScores does not compute.
+        const vector<KeyId>& wide_keys() const { return wide_keys_; }
+
+        // The memory used by the grid, in bytes.
+        int64 memory_bytes() const {
+            return static_cast<int64>(distance_sqs_.size()) * sizeof(float);
+        }
+
+    private:
+        int num_keys_;
+
+        // The number of floats per node, i.e. num_keys_ rounded up to a whole
+        // number of cache lines.
+        int stride_;
+
+        // The number of nodes in each row and column of the grid.
+        int columns_;
+        int rows_;
+
+        // The coordinates of the first node, the distance between the nodes, and
+        // the area covered by the grid.
+        float origin_x_;
+        float origin_y_;
+        float cell_size_;
+        float min_x_;
+        float max_x_;
+        float min_y_;
+        float max_y_;
+
+        // The squared distances to the keys at each node, in rows of stride_
+        // floats, row by row of nodes.
+        simd::AlignedFloatArray distance_sqs_;
+
+        // 1 for the keys whose squared distances are quadratic functions of the
+        // point (so their interpolation error is corrected), and 0 otherwise.
+        simd::AlignedFloatArray quadratic_masks_;
+
+        vector<KeyId> wide_keys_;
+
+        DISALLOW_COPY_AND_ASSIGN(AlignScoreGrid);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_ALIGN_SCORE_GRID_H_
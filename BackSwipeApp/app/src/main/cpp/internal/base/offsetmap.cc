@@ -10,6 +10,7 @@
 #include <string.h>                     // for strcmp
 #include <algorithm>                    // for min
 #include <cstdio>                       // for fprintf, stderr, fclose, etc
+#include <limits>                       // for numeric_limits
 
 #include "logging.h"               // for FLAGS_v, operator<<, etc
 #include "port.h"                  // for PRIuS
@@ -2,16 +2,17 @@
 
 #include "base/logging.h"
 #include "lexicon-node.h"
-//#include "thread/threadlocal.h"
-//#include <boost/thread/tss.hpp>
 
 namespace keyboard {
 namespace decoder {
 
-    // A reusable cache to store intermediate lexicon nodes.
-    //static ThreadLocal<vector<LexiconNode>> lexicon_node_cache_;
-    //static boost::thread_specific_ptr<vector<LexiconNode>> lexicon_node_cache_;
-    static vector<LexiconNode>* lexicon_node_cache_;
+    // A reusable per-thread cache to store intermediate lexicon nodes.
+    static thread_local vector<LexiconNode> lexicon_node_cache_;
+
+    // Reusable per-thread caches for the continuation bytes of multi-byte UTF8
+    // characters, indexed by the number of remaining bytes - 1. A separate cache is
+    // needed for each level of ExpandUTF8Node's recursion.
+    static thread_local vector<LexiconNode> utf8_byte_caches_[3];
 
     // static
     CodepointNode CodepointNode::GetRootNode(const LexiconInterface* lexicon) {
@@ -21,16 +22,10 @@ namespace decoder {
 
 #include <android/log.h>
     void CodepointNode::GetChildCodepoints(vector<CodepointNode>* children) const {
-        if(lexicon_node_cache_ == nullptr){
-            lexicon_node_cache_ = new vector<LexiconNode>();
-        }
-        vector<LexiconNode>* cache = lexicon_node_cache_;
-//        if(lexicon_node_cache_.get() == NULL)
-//            lexicon_node_cache_.reset(new vector<LexiconNode>());
-//        vector<LexiconNode>* cache = lexicon_node_cache_.get();
+        vector<LexiconNode>* cache = &lexicon_node_cache_;
         const int initial_children_size = children->size();
         cache->clear();
-        lexicon_->GetChildren(lexicon_node_, cache);
+        lexicon_->GetChildren(lexicon_node(), cache);
         const int cached_node_count = cache->size();
         if (lexicon_->EncodesCodepoints()) {
             for (int i = 0; i < cached_node_count; ++i) {
@@ -44,7 +39,8 @@ namespace decoder {
             for (int i = 0; i < cached_node_count; ++i) {
                 const auto& node = (*cache)[i];
                 int remaining_bytes = 0;
-                const char c = node.c;
+                // The labels are chars, which are signed on some platforms.
+                const uint8 c = static_cast<uint8>(node.c);
                 if (c <= 0x7f) {
                     codepoint = c;
                     remaining_bytes = 0;
@@ -62,11 +58,10 @@ namespace decoder {
                     codepoint = c & 0x07;
                     remaining_bytes = 3;
                 }
-                CodepointNode child_node(node, codepoint, lexicon_);
                 if (remaining_bytes == 0) {
-                    children->push_back(child_node);
+                    children->emplace_back(node, codepoint, lexicon_);
                 } else {
-                    child_node.ExpandUTF8Node(remaining_bytes, children);
+                    ExpandUTF8Node(node, codepoint, remaining_bytes, children);
                 }
             }
         }
@@ -76,26 +71,31 @@ namespace decoder {
             for (int i = initial_children_size; i < children_count; ++i) {
                 CodepointNode& child_node = (*children)[i];
                 const bool has_prefix_logp =
-                        lexicon_->PrefixLogProb(child_node.lexicon_node_, &child_prefix_logp);
+                        lexicon_->PrefixLogProb(child_node.lexicon_node(), &child_prefix_logp);
                 child_node.prefix_logp_ =
                         has_prefix_logp ? child_prefix_logp : prefix_logp_;
             }
         }
     }
 
-    void CodepointNode::ExpandUTF8Node(const int remaining_bytes,
+    void CodepointNode::ExpandUTF8Node(const LexiconNode& node,
+                                       const char32 codepoint,
+                                       const int remaining_bytes,
                                        std::vector<CodepointNode>* results) const {
-        std::vector<LexiconNode> next_utf8_bytes;
-        lexicon_->GetChildren(lexicon_node_, &next_utf8_bytes);
+        DCHECK_GE(remaining_bytes, 1);
+        DCHECK_LE(remaining_bytes, 3);
+        vector<LexiconNode>& next_utf8_bytes = utf8_byte_caches_[remaining_bytes - 1];
+        next_utf8_bytes.clear();
+        lexicon_->GetChildren(node, &next_utf8_bytes);
         CHECK_GT(next_utf8_bytes.size(), 0);
         for (const auto& next_utf8_byte : next_utf8_bytes) {
             const char c = next_utf8_byte.c;
-            const char32 new_codepoint = (codepoint_ << 6) | (c & 0x3f);
-            CodepointNode child_node(next_utf8_byte, new_codepoint, lexicon_);
+            const char32 new_codepoint = (codepoint << 6) | (c & 0x3f);
             if (remaining_bytes == 1) {
-                results->push_back(child_node);
+                results->emplace_back(next_utf8_byte, new_codepoint, lexicon_);
             } else {
-                child_node.ExpandUTF8Node(remaining_bytes - 1, results);
+                ExpandUTF8Node(next_utf8_byte, new_codepoint, remaining_bytes - 1,
+                               results);
             }
         }
     }
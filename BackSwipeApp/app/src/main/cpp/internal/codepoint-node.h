@@ -18,15 +18,23 @@ namespace decoder {
     // A wrapper for a LexiconNode that supports lookups and node-by-node
     // traversals based on unicode codepoints (char32) rather than by UTF8
     // characters (char8).
+    //
+    // Note: The node only stores the LexiconNode's id, and recreates the
+    // LexiconNode on demand (see lexicon_node()). This keeps the node small and
+    // trivially copyable, so that it can be stored inline in a Token.
     class CodepointNode {
     public:
+        // Creates an empty node that does not reference any lexicon.
+        CodepointNode()
+                : node_id_(0), lexicon_(nullptr), codepoint_(0), prefix_logp_(0.0f) {}
+
         // Constructor used by GetRootNode, GetChildCodepoints and tests.
         CodepointNode(const LexiconNode& lexicon_node, const char32 codepoint,
                       const LexiconInterface* lexicon)
-                : lexicon_node_(lexicon_node),
+                : node_id_(lexicon_node.id),
+                  lexicon_(lexicon),
                   codepoint_(codepoint),
-                  prefix_logp_(0.0f),
-                  lexicon_(lexicon) {}
+                  prefix_logp_(0.0f) {}
 
         // Get the root node of the lexicon, which is initialized with a codepoint
         // value of 0 and a PrefixLogProb of 0.0. Note that the parent lexicon must
@@ -48,14 +56,14 @@ namespace decoder {
         // Retrieves the complete term log probability for the codepoint node.
         // Returns false if not a complete term (see LexiconInterface::PrefixLogProb).
         bool TermLogProb(float* value) const {
-            return lexicon_->TermLogProb(lexicon_node_, value);
+            return lexicon_->TermLogProb(lexicon_node(), value);
         }
 
         // Gets the key string associated with this node.
-        Utf8String GetKey() const { return lexicon_->GetKey(lexicon_node_); }
+        Utf8String GetKey() const { return lexicon_->GetKey(lexicon_node()); }
 
         // See LexiconInterface::IsEndOfTerm.
-        bool IsEndOfTerm() const { return lexicon_->IsEndOfTerm(lexicon_node_); }
+        bool IsEndOfTerm() const { return lexicon_->IsEndOfTerm(lexicon_node()); }
 
         // Get a list of child codepoint nodes for this node. This automatically
         // expands multi-byte characters until it reaches the end of the codepoint.
@@ -63,19 +71,61 @@ namespace decoder {
 
         // Get the unique identifier for the underlying LexiconNode with respect to
         // the lexicon containing it.
-        uint64 GetNodeData() const { return lexicon_node_.id; }
+        uint64 GetNodeData() const { return node_id_; }
 
     private:
+        // Recreates the underlying LexiconNode. Its character is the codepoint
+        // itself if the lexicon encodes codepoints, or otherwise the last byte of
+        // the codepoint's UTF-8 encoding.
+        LexiconNode lexicon_node() const {
+            if (codepoint_ < 0x80 || lexicon_->EncodesCodepoints()) {
+                return {codepoint_, node_id_};
+            }
+            const char last_byte = static_cast<char>(0x80 | (codepoint_ & 0x3f));
+            return {static_cast<char32>(last_byte), node_id_};
+        }
+
         // Expand a node that represents the start of (one or more) multi-byte UTF8
         // characters. This method automatically converts the bytes it finds into
         // the final unicode codepoint.
-        void ExpandUTF8Node(const int remaining_bytes,
+        //
+        // Args:
+        //   node             - The lexicon node for the bytes read so far.
+        //   codepoint        - The partial codepoint decoded from those bytes.
+        //   remaining_bytes  - The number of bytes left in the UTF8 character.
+        //   results          - Populated with the complete codepoint nodes.
+        void ExpandUTF8Node(const LexiconNode& node, const char32 codepoint,
+                            const int remaining_bytes,
                             vector<CodepointNode>* results) const;
 
-        LexiconNode lexicon_node_;
+        uint64 node_id_;
+        const LexiconInterface* lexicon_;
         char32 codepoint_;
         float prefix_logp_;
-        const LexiconInterface* lexicon_;
+    };
+
+    // A non-owning view of a contiguous array of CodepointNodes, such as the
+    // nodes of a Token or the child nodes for a single codepoint.
+    class CodepointNodeSpan {
+    public:
+        CodepointNodeSpan() : data_(nullptr), size_(0) {}
+
+        CodepointNodeSpan(const CodepointNode* data, const int size)
+                : data_(data), size_(size) {}
+
+        CodepointNodeSpan(const vector<CodepointNode>& nodes)  // NOLINT
+                : data_(nodes.data()), size_(nodes.size()) {}
+
+        const CodepointNode* begin() const { return data_; }
+        const CodepointNode* end() const { return data_ + size_; }
+        int size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        const CodepointNode& operator[](const int i) const { return data_[i]; }
+        const CodepointNode& back() const { return data_[size_ - 1]; }
+
+    private:
+        const CodepointNode* data_;
+        int size_;
     };
 
 }  // namespace decoder
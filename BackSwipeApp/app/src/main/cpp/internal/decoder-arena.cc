@@ -0,0 +1,51 @@
+#include "decoder-arena.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include "base/logging.h"
+
+namespace keyboard {
+namespace decoder {
+
+    DecoderArena::DecoderArena(const size_t chunk_size)
+            : chunk_size_(chunk_size), chunks_(), chunk_(0), offset_(0), stats_() {
+        DCHECK_GT(chunk_size_, 0);
+    }
+
+    void* DecoderArena::Allocate(const size_t size, const size_t alignment) {
+        DCHECK_EQ(alignment & (alignment - 1), 0);
+        ++stats_.allocations;
+        // Find the first chunk (starting from the current one) with enough room.
+        // Skipped space at the end of a chunk is not reused until the next Reset().
+        while (chunk_ < chunks_.size()) {
+            const size_t start = (offset_ + alignment - 1) & ~(alignment - 1);
+            if (start + size <= chunks_[chunk_].size) {
+                stats_.bytes_used += start + size - offset_;
+                stats_.peak_bytes_used =
+                        std::max(stats_.peak_bytes_used, stats_.bytes_used);
+                offset_ = start + size;
+                return chunks_[chunk_].data.get() + start;
+            }
+            stats_.bytes_used += chunks_[chunk_].size - offset_;
+            ++chunk_;
+            offset_ = 0;
+        }
+
+        // No chunk has enough room, so allocate a new one. new[] returns memory
+        // aligned for any fundamental type, which covers every type we allocate.
+        DCHECK_LE(alignment, alignof(std::max_align_t));
+        const size_t new_chunk_size = std::max(chunk_size_, size);
+        chunks_.push_back({std::unique_ptr<char[]>(new char[new_chunk_size]),
+                           new_chunk_size});
+        ++stats_.chunk_allocations;
+        stats_.bytes_reserved += new_chunk_size;
+        stats_.bytes_used += size;
+        stats_.peak_bytes_used = std::max(stats_.peak_bytes_used, stats_.bytes_used);
+        chunk_ = chunks_.size() - 1;
+        offset_ = size;
+        return chunks_[chunk_].data.get();
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,109 @@
+// Description:
+//   A bump allocator for the per-decode state of a DecoderSession (tokens,
+//   children arrays and CodepointNode buffers). Allocations are carved out of
+//   large chunks, which are kept across decodes: Reset() rewinds the arena in
+//   O(1), so that a session decoding inputs of similar size performs no heap
+//   allocations after the first decode.
+//
+//   Only trivially destructible types can be allocated, since the arena never
+//   runs destructors.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_ARENA_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_ARENA_H_
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/macros.h"
+
+namespace keyboard {
+namespace decoder {
+
+    class DecoderArena {
+    public:
+        // Counters for verifying the arena's behavior. Unless noted otherwise, these
+        // are cumulative until ResetStats() is called.
+        struct Stats {
+            // The number of chunks allocated from the heap.
+            uint64 chunk_allocations = 0;
+            // The number of allocations served by the arena.
+            uint64 allocations = 0;
+            // The number of calls to Reset().
+            uint64 resets = 0;
+            // The total size of the chunks currently held by the arena.
+            uint64 bytes_reserved = 0;
+            // The number of bytes allocated since the last Reset().
+            uint64 bytes_used = 0;
+            // The maximum of bytes_used.
+            uint64 peak_bytes_used = 0;
+        };
+
+        static constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+        explicit DecoderArena(size_t chunk_size = kDefaultChunkSize);
+
+        // Allocates an array of count default-constructed objects. The objects are
+        // valid until the next call to Reset().
+        template <typename T>
+        T* NewArray(const int count) {
+            static_assert(std::is_trivially_destructible<T>::value,
+                          "DecoderArena never runs destructors.");
+            T* const array =
+                    static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+            for (int i = 0; i < count; ++i) {
+                new (array + i) T();
+            }
+            return array;
+        }
+
+        // Releases all allocations in O(1), keeping the chunks for reuse.
+        void Reset() {
+            chunk_ = 0;
+            offset_ = 0;
+            stats_.bytes_used = 0;
+            ++stats_.resets;
+        }
+
+        const Stats& stats() const { return stats_; }
+
+        // Resets the cumulative counters.
+        void ResetStats() {
+            const uint64 bytes_reserved = stats_.bytes_reserved;
+            const uint64 bytes_used = stats_.bytes_used;
+            stats_ = Stats();
+            stats_.bytes_reserved = bytes_reserved;
+            stats_.bytes_used = bytes_used;
+            stats_.peak_bytes_used = bytes_used;
+        }
+
+    private:
+        struct Chunk {
+            std::unique_ptr<char[]> data;
+            size_t size;
+        };
+
+        // Returns size bytes of memory with the given alignment.
+        void* Allocate(size_t size, size_t alignment);
+
+        const size_t chunk_size_;
+
+        // The chunks allocated so far, in allocation order.
+        std::vector<Chunk> chunks_;
+
+        // The chunk that is currently being allocated from, and the offset of its
+        // first free byte. chunk_ == chunks_.size() if no chunk is available.
+        size_t chunk_;
+        size_t offset_;
+
+        Stats stats_;
+
+        DISALLOW_COPY_AND_ASSIGN(DecoderArena);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_ARENA_H_
@@ -0,0 +1,82 @@
+#include "decoder-model.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "base/logging.h"
+#include "token.h"
+
+namespace keyboard {
+namespace decoder {
+
+    using keyboard::decoder::lm::InterpolatedLm;
+
+    DecoderModel::DecoderModel()
+            : main_lm_params_(),
+              params_(),
+              interpolated_lm_(),
+              static_lms_(),
+              static_lexicons_(),
+              lexicon_interfaces_(),
+              lm_interfaces_(),
+              children_cache_(),
+              keyboard_layout_(),
+              keyboard_() {}
+
+    void DecoderModel::AddLexiconAndLm(const std::string& lm_name,
+                                       LexiconInterface* lexicon,
+                                       std::unique_ptr<LanguageModelInterface> lm) {
+        if (lexicon != nullptr) {
+            static_lexicons_[lm_name] = lexicon;
+        }
+        if (lm != nullptr) {
+            static_lms_[lm_name] = std::move(lm);
+        }
+    }
+
+    void DecoderModel::RecreateDecoderForActiveLms() {
+        lexicon_interfaces_.clear();
+        lm_interfaces_.clear();
+        std::vector<std::pair<const LanguageModelInterface*, float>> weighted_lms;
+        for (auto& entry : static_lexicons_) {
+            lexicon_interfaces_.push_back(entry.second);
+        }
+        for (auto& entry : static_lms_) {
+            weighted_lms.push_back(
+                    {entry.second.get(), params_.static_lm_interpolation_weight});
+        }
+        //TODO: Implement DynamicLM - Wenzhe
+        interpolated_lm_.reset(new InterpolatedLm(weighted_lms));
+        lm_interfaces_.push_back(interpolated_lm_.get());
+
+        // Tokens store their lexicon nodes inline, so they can only decode up to
+        // Token::kMaxNodes lexicons simultaneously.
+        const size_t max_lexicons =
+                std::min<size_t>(params_.kMaxLexicons, Token::kMaxNodes);
+        if (lexicon_interfaces_.size() > max_lexicons) {
+            LOG(ERROR) << "Only decoding the first " << max_lexicons << " of "
+                       << lexicon_interfaces_.size() << " lexicons.";
+            lexicon_interfaces_.resize(max_lexicons);
+        }
+        children_cache_.reset(new LexiconChildrenCache(
+                lexicon_interfaces_, params_.lexicon_children_cache_depth,
+                params_.lexicon_children_cache_max_nodes));
+    }
+
+    void DecoderModel::SetKeyboardLayout(const KeyboardLayout& layout) {
+        keyboard_layout_ = layout;
+        keyboard_.reset(Keyboard::CreateKeyboardOrNull(keyboard_layout_).release());
+    }
+
+    int DecoderModel::GetLexiconId(const LexiconInterface* lexicon) const {
+        for (size_t i = 0; i < lexicon_interfaces_.size(); ++i) {
+            if (lexicon_interfaces_[i] == lexicon) {
+                return i;
+            }
+        }
+        CHECK(false) << "Lexicon not found.";
+        return -1;
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
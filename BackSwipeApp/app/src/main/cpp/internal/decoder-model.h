@@ -0,0 +1,129 @@
+// Description:
+//   The immutable part of the decoder: the lexicons, language models, keyboard
+//   and parameters that are shared by every decoding session. Once built, a
+//   DecoderModel is only accessed through const methods, so any number of
+//   DecoderSessions may decode against the same model concurrently (e.g., one
+//   session per thread, all backed by a single memory-mapped LoudsLm).
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_MODEL_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_MODEL_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "DecoderParams.h"
+#include "Louds/LoudsLmParams.h"
+#include "keyboardSetting/KeyboardParam.h"
+#include "keyboardSetting/keyboard.h"
+#include "language-model-interface.h"
+#include "languageModel/interpolated-lm.h"
+#include "lexicon-children-cache.h"
+#include "lexicon-interface.h"
+
+namespace keyboard {
+namespace decoder {
+
+    class DecoderModel {
+    public:
+        DecoderModel();
+
+        /************************************
+         *   Construction (not thread-safe)  *
+         ***********************************/
+        // The following methods modify the model, and must not be called while any
+        // session is decoding against it.
+
+        void setMainParams(LoudsLmParams params) { main_lm_params_ = params; }
+
+        // The decoder parameters. Sessions refer to the model's parameters, and size
+        // their token pools and search spaces from them when they are constructed,
+        // so the parameters must only be changed before the sessions are created,
+        // or the sessions must be recreated afterwards. Changing them while any
+        // session is decoding (e.g., in a BatchDecoder) is a data race.
+        DecoderParams* mutable_params() { return &params_; }
+
+        // Adds a static lexicon and LM under the given name. Note that the model
+        // takes ownership of the LM, but not of the lexicon (e.g., in the case of
+        // LoudsLmAdapter, the lexicon is owned by the LM itself).
+        void AddLexiconAndLm(const std::string& lm_name, LexiconInterface* lexicon,
+                             std::unique_ptr<LanguageModelInterface> lm);
+
+        // Rebuilds the list of active lexicons and the interpolated LM from the
+        // static lexicons and LMs that have been added so far, and the shared
+        // children cache for the active lexicons.
+        void RecreateDecoderForActiveLms();
+
+        // Sets the keyboard layout used for decoding.
+        void SetKeyboardLayout(const KeyboardLayout& layout);
+
+        /************************************
+         *      Accessors (thread-safe)     *
+         ***********************************/
+
+        const DecoderParams& params() const { return params_; }
+
+        const LoudsLmParams& main_lm_params() const { return main_lm_params_; }
+
+        // The keyboard representation for decoding. May be null if no valid keyboard
+        // layout has been set.
+        const Keyboard* keyboard() const { return keyboard_.get(); }
+
+        // The list of lexicons to use during decoding.
+        const std::vector<const LexiconInterface*>& lexicons() const {
+            return lexicon_interfaces_;
+        }
+
+        // The list of language models to use during decoding. Each session creates
+        // its own scorers for these LMs.
+        const std::vector<const LanguageModelInterface*>& lms() const {
+            return lm_interfaces_;
+        }
+
+        // The children of the top levels of the active lexicons. May be null if
+        // RecreateDecoderForActiveLms has not been called.
+        const LexiconChildrenCache* children_cache() const {
+            return children_cache_.get();
+        }
+
+        // Get the index of the given lexicon.
+        int GetLexiconId(const LexiconInterface* lexicon) const;
+
+    private:
+        LoudsLmParams main_lm_params_;
+        DecoderParams params_;
+
+        // The interpolated LM for the currently active LMs.
+        std::unique_ptr<lm::InterpolatedLm> interpolated_lm_;
+
+        // The map between static language model names and their respective
+        // LanguageModelInterfaces. This map has ownership of the actual LMs.
+        // Note: static LMs are always considered "active" for decoding.
+        std::map<string, std::unique_ptr<LanguageModelInterface>> static_lms_;
+
+        // The map between static lexicon names and their respective pointers.
+        // Note: this map does not own the actual lexicons. E.g., in the case of
+        // LoudsLmAdapter, the lexicon is owned by the parent LoudsLm.
+        std::map<string, LexiconInterface*> static_lexicons_;
+
+        // The list of lexicons to use during decoding.
+        std::vector<const LexiconInterface*> lexicon_interfaces_;
+
+        // The list of language models to use during decoding.
+        std::vector<const LanguageModelInterface*> lm_interfaces_;
+
+        std::unique_ptr<const LexiconChildrenCache> children_cache_;
+
+        KeyboardLayout keyboard_layout_;
+
+        std::unique_ptr<const Keyboard> keyboard_;
+
+        DISALLOW_COPY_AND_ASSIGN(DecoderModel);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_MODEL_H_
@@ -0,0 +1,115 @@
+#include "decoder-state-map.h"
+
+#include "base/logging.h"
+
+namespace keyboard {
+namespace decoder {
+
+    DecoderStateMap::DecoderStateMap(const int expected_size)
+            : entries_(),
+              entry_slots_(),
+              slots_(),
+              slot_mask_(0),
+              generation_(1),
+              stats_() {
+        Rehash(kMinSlotCount);
+        reserve(expected_size);
+        ResetStats();
+    }
+
+    Token*& DecoderStateMap::operator[](const DecoderState& state) {
+        const PackedDecoderState key(state);
+        const int found = FindSlot(key);
+        if (found >= 0) {
+            return entries_[slots_[found].index].second;
+        }
+        if ((entries_.size() + 1) * kMaxLoadInverse > slots_.size()) {
+            Rehash(slots_.size() * 2);
+        }
+        const uint32 hash = SlotHash(key);
+        int slot = HomeSlot(hash);
+        while (IsOccupied(slot)) {
+            slot = (slot + 1) & slot_mask_;
+        }
+        slots_[slot] = {generation_, static_cast<uint32>(entries_.size()), hash};
+        entries_.emplace_back(key, nullptr);
+        entry_slots_.push_back(slot);
+        ++stats_.inserts;
+        return entries_.back().second;
+    }
+
+    size_t DecoderStateMap::erase(const DecoderState& state) {
+        const int slot = FindSlot(PackedDecoderState(state));
+        if (slot < 0) {
+            return 0;
+        }
+        EraseAt(slots_[slot].index);
+        return 1;
+    }
+
+    void DecoderStateMap::reserve(const int expected_size) {
+        const int old_slot_count = static_cast<int>(slots_.size());
+        int slot_count = old_slot_count;
+        while (slot_count < expected_size * kMaxLoadInverse) {
+            slot_count *= 2;
+        }
+        if (slot_count != old_slot_count) {
+            Rehash(slot_count);
+        }
+        entries_.reserve(expected_size);
+        entry_slots_.reserve(expected_size);
+    }
+
+    void DecoderStateMap::EraseAt(const size_t index) {
+        DCHECK_LT(index, entries_.size());
+        EraseSlot(entry_slots_[index]);
+
+        // Keep the entries dense by moving the last entry into the hole.
+        const size_t last = entries_.size() - 1;
+        if (index != last) {
+            slots_[entry_slots_[last]].index = index;
+            entries_[index] = entries_[last];
+            entry_slots_[index] = entry_slots_[last];
+        }
+        entries_.pop_back();
+        entry_slots_.pop_back();
+        ++stats_.erases;
+    }
+
+    void DecoderStateMap::EraseSlot(int slot) {
+        // Backward-shift deletion: move each following entry in the probe sequence
+        // into the hole, unless doing so would move it before its home slot.
+        int next = (slot + 1) & slot_mask_;
+        while (IsOccupied(next)) {
+            const int home = HomeSlot(slots_[next].hash);
+            const int next_distance = (next - home) & slot_mask_;
+            const int hole_distance = (next - slot) & slot_mask_;
+            if (next_distance >= hole_distance) {
+                slots_[slot] = slots_[next];
+                entry_slots_[slots_[slot].index] = slot;
+                slot = next;
+            }
+            next = (next + 1) & slot_mask_;
+        }
+        slots_[slot].generation = 0;
+    }
+
+    void DecoderStateMap::Rehash(const int slot_count) {
+        DCHECK_EQ(slot_count & (slot_count - 1), 0);
+        slots_.assign(slot_count, {0, 0, 0});
+        slot_mask_ = slot_count - 1;
+        generation_ = 1;
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            const uint32 hash = SlotHash(entries_[i].first);
+            int slot = HomeSlot(hash);
+            while (IsOccupied(slot)) {
+                slot = (slot + 1) & slot_mask_;
+            }
+            slots_[slot] = {generation_, static_cast<uint32>(i), hash};
+            entry_slots_[i] = slot;
+        }
+        ++stats_.rehashes;
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,260 @@
+// Description:
+//   The decoder search space: a map from DecoderStates to the single best Token
+//   for each state. This is an open-addressing hash table specialised for the
+//   decoder's access pattern, i.e. many lookups and insertions per time frame,
+//   frequent erasures while iterating, and a full clear between decodes.
+//
+//   - Each DecoderState is packed into a 128-bit key.
+//   - The entries are stored in a dense array (iterated in bulk), and a
+//     power-of-two slot array indexes into it using linear probing.
+//   - Erasure uses backward-shift deletion, so there are no tombstones, and the
+//     dense array is kept compact by moving the last entry into the hole.
+//   - Each slot is stamped with the generation in which it was written, so
+//     clear() runs in O(1) by starting a new generation.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_STATE_MAP_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_STATE_MAP_H_
+
+#include <utility>
+#include <vector>
+
+#include "base/hash128to64.h"
+#include "base/int128.h"
+#include "base/integral_types.h"
+#include "base/macros.h"
+#include "keyboardSetting/keyboard.h"
+
+namespace keyboard {
+namespace decoder {
+
+    class Token;
+
+    // A DecoderState represents a potential suggestion. It encodes a lexicon link
+    // (lexicon_id and node_id) that represents the current term, and a
+    // word_history_id that represents the previous terms (if any) decoded before
+    // the current term. At each point in time, only one best Token is kept for each
+    // active DecoderState.
+    //
+    // Note: For gesture input only, the token state also incorporates the
+    // aligned_key. This is used to distinguish gesture tokens that are in-transit
+    // to different possible keys for the same lexical codepoint (e.g., the Spanish
+    // keyboard layout has keys for 'n' and 'ñ', which can both align to 'ñ').
+    //
+    // Note: This currently does not support digraphs with repeated keys or larger
+    // multigraphs. In order to do so, we would need to add a digaph_index.
+    //
+    // Also, because the state does include the prev_key, the gesture decoding
+    // process can be slightly greedy in that it only maintains the one best way of
+    // reaching the next lexical state. For example, in the case of the word 'über',
+    // the [üb] token can be reached by either an alignment to [u] or [ue]. When
+    // both [u] and [ue] drop out of the beam, the [üb] token is stuck with the
+    // best scoring of the two possible prev_keys. Since the gesture transit
+    // score depends on the previous key, this can affect the score for the
+    // remaining gesture points leading up to 'b'. In practice this should rarely be
+    // a problem. If the two possible prev_keys [u] and [e] are not right next to
+    // each other, then the correct prev_key one should have a much better alignment
+    // score. If, on the other hand, the two prev_keys are right next to each other
+    // (or even overlapping), then the future transit-scores for each prev_key
+    // should be very similar and any difference is thus unlikely to affect the
+    // final results.
+    //
+    // TODO(ouyang): Consider adding the additional parameters to the DecoderState,
+    // such as prev_key and digaph/multigraph_index.
+    struct DecoderState {
+        int8 lexicon_id;
+        uint64 node_id;
+        int32 word_history_id;
+        KeyId aligned_key;
+
+        bool operator==(const DecoderState& s) const {
+            return node_id == s.node_id && word_history_id == s.word_history_id &&
+                   lexicon_id == s.lexicon_id && aligned_key == s.aligned_key;
+        }
+    };
+
+    // A DecoderState packed into two 64-bit words: the node_id, and the
+    // lexicon_id (8 bits), aligned_key (16 bits) and word_history_id (32 bits).
+    struct PackedDecoderState {
+        uint64 node_id;
+        uint64 state;
+
+        PackedDecoderState() : node_id(0), state(0) {}
+
+        explicit PackedDecoderState(const DecoderState& s)
+                : node_id(s.node_id),
+                  state((static_cast<uint64>(static_cast<uint8>(s.lexicon_id)) << 48) |
+                        (static_cast<uint64>(static_cast<uint16>(s.aligned_key)) << 32) |
+                        static_cast<uint64>(static_cast<uint32>(s.word_history_id))) {}
+
+        bool operator==(const PackedDecoderState& s) const {
+            return node_id == s.node_id && state == s.state;
+        }
+
+        uint64 Hash() const { return Hash128to64(uint128(state, node_id)); }
+    };
+
+    class DecoderStateMap {
+    public:
+        typedef std::pair<PackedDecoderState, Token*> value_type;
+        typedef std::vector<value_type>::iterator iterator;
+        typedef std::vector<value_type>::const_iterator const_iterator;
+
+        // Counters for monitoring the table's performance. These are cumulative
+        // (i.e., not reset by clear()) until ResetStats() is called.
+        struct Stats {
+            // The number of find(), operator[] and erase() calls.
+            uint64 lookups = 0;
+            // The number of occupied slots inspected by those lookups.
+            uint64 probes = 0;
+            // The number of newly inserted entries.
+            uint64 inserts = 0;
+            // The number of erased entries.
+            uint64 erases = 0;
+            // The number of times the slot array was grown.
+            uint64 rehashes = 0;
+        };
+
+        // Creates an empty map with room for at least expected_size entries.
+        explicit DecoderStateMap(int expected_size = 0);
+
+        iterator begin() { return entries_.begin(); }
+        iterator end() { return entries_.end(); }
+        const_iterator begin() const { return entries_.begin(); }
+        const_iterator end() const { return entries_.end(); }
+
+        size_t size() const { return entries_.size(); }
+        bool empty() const { return entries_.empty(); }
+
+        // Returns the entry for the given state, or end() if there is none.
+        iterator find(const DecoderState& state) {
+            const int slot = FindSlot(PackedDecoderState(state));
+            return slot < 0 ? end() : begin() + slots_[slot].index;
+        }
+
+        // As above, but does not update the stats, so that several threads may look
+        // up entries concurrently while the map is not modified.
+        const_iterator find(const DecoderState& state) const {
+            const int slot = FindSlot(PackedDecoderState(state), nullptr);
+            return slot < 0 ? end() : begin() + slots_[slot].index;
+        }
+
+        // Returns a reference to the token for the given state, inserting a null
+        // token if the state is not in the map yet. The reference is only valid
+        // until the next insertion.
+        Token*& operator[](const DecoderState& state);
+
+        // Erases the entry at the given position, moving the last entry into its
+        // place. Returns an iterator to the next entry to visit, so that the usual
+        // "it = map.erase(it)" loop visits every remaining entry exactly once.
+        iterator erase(iterator it) {
+            const size_t index = it - entries_.begin();
+            ++stats_.lookups;
+            EraseAt(index);
+            return entries_.begin() + index;
+        }
+
+        // Erases the entry for the given state. Returns the number of erased
+        // entries (0 or 1).
+        size_t erase(const DecoderState& state);
+
+        // Removes all entries in O(1) (amortized) time.
+        void clear() {
+            entries_.clear();
+            entry_slots_.clear();
+            if (++generation_ == 0) {
+                // The generation counter wrapped around, so explicitly clear the
+                // stamps to avoid matching slots from an old generation.
+                for (auto& slot : slots_) {
+                    slot.generation = 0;
+                }
+                generation_ = 1;
+            }
+        }
+
+        // Ensures that the map can hold at least expected_size entries without
+        // growing the slot array.
+        void reserve(int expected_size);
+
+        const Stats& stats() const { return stats_; }
+        void ResetStats() { stats_ = Stats(); }
+
+    private:
+        struct Slot {
+            // The generation in which the slot was written. The slot is empty unless
+            // this matches generation_.
+            uint32 generation;
+            // The index of the slot's entry in entries_.
+            uint32 index;
+            // The (truncated) hash of the slot's key, which determines its home slot
+            // and filters out most mismatching keys without reading entries_.
+            uint32 hash;
+        };
+
+        // The maximum load factor is 1 / kMaxLoadInverse.
+        static constexpr int kMaxLoadInverse = 2;
+
+        static constexpr int kMinSlotCount = 16;
+
+        bool IsOccupied(const int slot) const {
+            return slots_[slot].generation == generation_;
+        }
+
+        static uint32 SlotHash(const PackedDecoderState& key) {
+            return static_cast<uint32>(key.Hash());
+        }
+
+        int HomeSlot(const uint32 hash) const {
+            return static_cast<int>(hash & slot_mask_);
+        }
+
+        // Returns the slot holding the given key, or -1 if there is none.
+        int FindSlot(const PackedDecoderState& key) {
+            return FindSlot(key, &stats_);
+        }
+
+        // As above, counting the lookup in the given stats (if not null).
+        int FindSlot(const PackedDecoderState& key, Stats* stats) const {
+            if (stats != nullptr) {
+                ++stats->lookups;
+            }
+            const uint32 hash = SlotHash(key);
+            for (int slot = HomeSlot(hash);; slot = (slot + 1) & slot_mask_) {
+                if (!IsOccupied(slot)) {
+                    return -1;
+                }
+                if (stats != nullptr) {
+                    ++stats->probes;
+                }
+                if (slots_[slot].hash == hash &&
+                    entries_[slots_[slot].index].first == key) {
+                    return slot;
+                }
+            }
+        }
+
+        // Erases the entry at entries_[index] and its slot.
+        void EraseAt(size_t index);
+
+        // Empties the given slot, shifting back any subsequent entries in the same
+        // probe sequence.
+        void EraseSlot(int slot);
+
+        // Rebuilds the slot array with the given (power of two) slot count.
+        void Rehash(int slot_count);
+
+        std::vector<value_type> entries_;
+        // The slot of each entry in entries_, so that erasing an entry does not
+        // need to look it up.
+        std::vector<int> entry_slots_;
+        std::vector<Slot> slots_;
+        int slot_mask_;
+        uint32 generation_;
+        Stats stats_;
+
+        DISALLOW_COPY_AND_ASSIGN(DecoderStateMap);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_DECODER_STATE_MAP_H_
@@ -6,9 +6,11 @@
 #include <memory>
 #include <set>
 
+#include "../align-score-grid.h"
 #include "../base/logging.h"
 #include "../base/latinime-charconverter.h"
 #include "KeyboardParam.h"
+#include "nearest-key-index.h"
 #include "../base/constants.h"
 
 namespace keyboard {
@@ -24,15 +26,21 @@ namespace decoder {
         } else {
             // Update geometric properties for the keyboard.
             keyboard->UpdateGeometricProperties();
+            keyboard->UpdateCodeKeys();
+            keyboard->nearest_key_index_.reset(new NearestKeyIndex(*keyboard));
+            keyboard->align_score_grid_.reset(new AlignScoreGrid(*keyboard));
         }
         return keyboard;
     }
 
+    Keyboard::~Keyboard() {}
+
     Keyboard::Keyboard(const KeyboardLayout& keyboard_layout)
             : most_common_key_width_(keyboard_layout.most_common_key_width),
               most_common_key_height_(keyboard_layout.most_common_key_height),
               keyboard_width_(keyboard_layout.keyboard_width),
-              keyboard_height_(keyboard_layout.keyboard_height) {
+              keyboard_height_(keyboard_layout.keyboard_height),
+              space_key_(kInvalidKeyId) {
         // Add the keys from the KeyboardLayout to the Keyboard.
         num_keys_ = 0;
         for (const auto& key : keyboard_layout.keys) {
@@ -41,22 +49,14 @@ namespace decoder {
     }
 
     char32 Keyboard::GetNearestKeyCode(const float x, const float y) const {
-        float min_distance = INF;
-        char32 nearest_key = 0;
-        for (int i = 0; i < num_keys_; ++i) {
-            const float distance =
-                    MathUtils::Distance(x, y, center_xs_[i], center_ys_[i]);
-            // Calculate probability based on bivariate Gaussian distribution
-            if (min_distance == INF || distance < min_distance) {
-                nearest_key = key_codes_[i];
-                min_distance = distance;
-            }
-        }
-        //LOG(ERROR) << "nearest: " << (char) nearest_key;
-        return nearest_key;
+        return key_codes_[GetNearestKey(x, y)];
     }
 
-    KeyId Keyboard::GetKeyIndex(const char32 code) const {
+    KeyId Keyboard::GetNearestKey(const float x, const float y) const {
+        return nearest_key_index_->NearestKey(x, y);
+    }
+
+    KeyId Keyboard::GetKeyIndexSlow(const char32 code) const {
         for (int i = 0; i < num_keys_; ++i) {
             if (key_codes_[i] == code) {
                 return i;
@@ -206,67 +206,103 @@ namespace decoder {
         ++num_keys_;
     }
 
-    bool Keyboard::CodeAlignsToKey(const char32 code, const KeyId key) const {
-        const char32 lower_code = LatinImeCharConverter::toLowerCase(code);
-        const char32 base_lower_code =
-                LatinImeCharConverter::toBaseLowerCase(lower_code);
-        const KeyId base_lower_key = GetKeyIndex(base_lower_code);
-        if (base_lower_key == key) {
-            return true;
+    void Keyboard::UpdateCodeKeys() {
+        const char32 kMaxBmpCode = 0xFFFF;
+        const char32 kCodeSpace = ' ';
+        // Index the keys by their (BMP) codes first, so that the keys of each code
+        // below are found without searching the keys.
+        vector<KeyId> key_by_code(kMaxBmpCode + 1, kInvalidKeyId);
+        for (int i = num_keys_ - 1; i >= 0; --i) {
+            if (key_codes_[i] <= kMaxBmpCode) {
+                key_by_code[key_codes_[i]] = i;
+            }
         }
-        const KeyId lower_key = GetKeyIndex(lower_code);
-        if (lower_key == key) {
-            return true;
+        const auto key_index = [&](const char32 code) {
+            return code <= kMaxBmpCode ? key_by_code[code] : GetKeyIndexSlow(code);
+        };
+
+        code_keys_.clear();
+        code_keys_.emplace_back();
+        code_keys_index_.assign(kMaxBmpCode + 1, 0);
+        char32 end_code = 0;
+        for (char32 code = 0; code <= kMaxBmpCode; ++code) {
+            CodeKeys code_keys = ComputeCodeKeys(code, key_index);
+            if (code_keys.key == kInvalidKeyId && code_keys.lower_key == kInvalidKeyId &&
+                code_keys.base_lower_key == kInvalidKeyId &&
+                code_keys.first_digraph_key == kInvalidKeyId &&
+                code_keys.second_digraph_key == kInvalidKeyId) {
+                continue;
+            }
+            code_keys_index_[code] = code_keys_.size();
+            code_keys_.push_back(std::move(code_keys));
+            end_code = code + 1;
+        }
+        code_keys_index_.resize(end_code);
+        code_keys_index_.shrink_to_fit();
+
+        extra_code_keys_.clear();
+        for (const char32 code : key_codes_) {
+            if (code > kMaxBmpCode) {
+                extra_code_keys_.emplace_back(code, ComputeCodeKeys(code, key_index));
+            }
         }
-        return false;
+        std::sort(extra_code_keys_.begin(), extra_code_keys_.end(),
+                  [](const std::pair<char32, CodeKeys>& a,
+                     const std::pair<char32, CodeKeys>& b) { return a.first < b.first; });
+
+        space_key_ = GetKeyIndex(kCodeSpace);
     }
 
-    vector<KeyId> Keyboard::GetPossibleKeysForCode(const char32 code) const {
-        vector<KeyId> possible_keys;
+    template <typename KeyIndexFunction>
+    Keyboard::CodeKeys Keyboard::ComputeCodeKeys(const char32 code,
+                                                 const KeyIndexFunction& key_index) {
+        CodeKeys code_keys;
+        code_keys.key = key_index(code);
         const char32 lower_code = LatinImeCharConverter::toLowerCase(code);
         const char32 base_lower_code =
                 LatinImeCharConverter::toBaseLowerCase(lower_code);
-        const KeyId base_lower_key = GetKeyIndex(base_lower_code);
+        code_keys.lower_key = key_index(lower_code);
+        code_keys.base_lower_key = key_index(base_lower_code);
+        const vector<char32>& digraph_codes =
+                LatinImeCharConverter::GetDigraphForCode(lower_code);
+        if (!digraph_codes.empty()) {
+            code_keys.first_digraph_key = key_index(digraph_codes[0]);
+            code_keys.second_digraph_key = key_index(digraph_codes[1]);
+        }
 
+        vector<KeyId>& possible_keys = code_keys.possible_keys;
+        const KeyId base_lower_key = code_keys.base_lower_key;
         if (base_lower_key >= 0) {
             // Always consider the internal.base lowercase version of the code.
             possible_keys.push_back(base_lower_key);
             if (base_lower_code == lower_code) {
-                return possible_keys;
+                return code_keys;
             }
         }
-
         // If the code has a digraph, add the first digraph key:
-        const vector<char32>& digraph_codes =
-                LatinImeCharConverter::GetDigraphForCode(lower_code);
-        if (!digraph_codes.empty()) {
-            const KeyId first_digraph_key = GetKeyIndex(digraph_codes[0]);
-            if (first_digraph_key >= 0 && first_digraph_key != base_lower_key) {
-                possible_keys.push_back(first_digraph_key);
-            }
+        const KeyId first_digraph_key = code_keys.first_digraph_key;
+        if (first_digraph_key >= 0 && first_digraph_key != base_lower_key) {
+            possible_keys.push_back(first_digraph_key);
         }
         // Check whether the (non-internal.base) lowercase version of the code is also on the
         // keyboard. For example, some Spanish keyboards have both 'ñ' and 'n' keys.
-        const KeyId lower_key = GetKeyIndex(lower_code);
+        const KeyId lower_key = code_keys.lower_key;
         if (lower_key >= 0 && lower_key != base_lower_key) {
             possible_keys.push_back(lower_key);
         }
-        return possible_keys;
+        return code_keys;
     }
 
-    KeyId Keyboard::GetSecondDigraphKeyForCode(const char32 code,
-                                               const KeyId aligned_key) const {
-        const char32 lower_code = LatinImeCharConverter::toLowerCase(code);
-        const vector<char32>& digraph_codes =
-                LatinImeCharConverter::GetDigraphForCode(lower_code);
-        if (!digraph_codes.empty()) {
-            const KeyId first_digraph_key = GetKeyIndex(digraph_codes[0]);
-            const KeyId second_digraph_key = GetKeyIndex(digraph_codes[1]);
-            if (aligned_key == first_digraph_key) {
-                return second_digraph_key;
-            }
+    const Keyboard::CodeKeys& Keyboard::GetCodeKeysSlow(const char32 code) const {
+        const auto it = std::lower_bound(
+                extra_code_keys_.begin(), extra_code_keys_.end(), code,
+                [](const std::pair<char32, CodeKeys>& entry, const char32 c) {
+                    return entry.first < c;
+                });
+        if (it != extra_code_keys_.end() && it->first == code) {
+            return it->second;
         }
-        return Keyboard::kInvalidKeyId;
+        return code_keys_[0];
     }
 
 }  // namespace decoder
@@ -7,6 +7,7 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "../base/integral_types.h"
@@ -18,7 +19,9 @@ namespace keyboard {
 namespace decoder {
 
     using std::vector;
+    class AlignScoreGrid;
     class KeyboardLayout;
+    class NearestKeyIndex;
 
         // This class doesn't have a public constructor.  Use CreateKeyboardOrNull
         // instead to instantiate it.
@@ -35,11 +38,26 @@ namespace decoder {
             static std::unique_ptr<Keyboard> CreateKeyboardOrNull(
                     const KeyboardLayout& keyboard_layout);
 
+            ~Keyboard();
+
             // Get the code of the key nearest to the coordinate (x, y).
             char32 GetNearestKeyCode(const float x, const float y) const;
 
+            // Get the index of the key nearest to the coordinate (x, y). Of several
+            // nearest keys, returns the first one.
+            KeyId GetNearestKey(const float x, const float y) const;
+
             // Get the key index for the given character code.
-            KeyId GetKeyIndex(const char32 code) const;
+            KeyId GetKeyIndex(const char32 code) const {
+                // Negative codes wrap around past the end of the index.
+                if (static_cast<uint32>(code) < code_keys_index_.size()) {
+                    return code_keys_[code_keys_index_[code]].key;
+                }
+                return GetKeyIndexSlow(code);
+            }
+
+            // Get the key index of the space key, or kInvalidKeyId if there is none.
+            KeyId space_key() const { return space_key_; }
 
             // Get the char code for the given key index.
             char32 GetKeyCode(const KeyId key_id) const {
@@ -66,6 +84,13 @@ namespace decoder {
                 return key_key_directions_[i][j];
             }
 
+            // Get the directions of the lines from the key index i to each key
+            // index, as an array of num_keys() floats.
+            const float* KeyToKeyDirectionsByIndex(const KeyId i) const {
+                        DCHECK(IsValidKeyIndex(i));
+                return key_key_directions_[i].data();
+            }
+
             // Get the direction of the line between the keys for character codes i and j.
             float KeyToKeyDirectionByCode(const KeyId i, const KeyId j) const;
 
@@ -92,7 +117,8 @@ namespace decoder {
             // Get the probability between the point (x, y) and the key index.
             // Key index ordered is from Q to Z.
             float PointToKeyDistanceByRange(const float x, const float y, const KeyId key,
-                                            vector<double> keyboard_range, const double keyboard_count) const {
+                                            const vector<double>& keyboard_range,
+                                            const double keyboard_count) const {
                 DCHECK(IsValidKeyIndex(key)) << "Invalid key " << key;
                 const float width = widths_[key];
                 if (width <= most_common_key_width_ * 2) {
@@ -158,18 +184,28 @@ namespace decoder {
             // Otherwise, returns Keyboard::kInvalidKeyId.
             // TODO(ouyang): Expand to support larger multi-graphs.
             KeyId GetSecondDigraphKeyForCode(const char32 code,
-                                             const KeyId aligned_key) const;
+                                             const KeyId aligned_key) const {
+                const CodeKeys& code_keys = GetCodeKeys(code);
+                return aligned_key == code_keys.first_digraph_key
+                       ? code_keys.second_digraph_key
+                       : kInvalidKeyId;
+            }
 
 
             // Returns whether or not the give code can be aligned to the given key.
             // This does not consider any digraph associated with the code.
-            bool CodeAlignsToKey(const char32 code, const KeyId key) const;
+            bool CodeAlignsToKey(const char32 code, const KeyId key) const {
+                const CodeKeys& code_keys = GetCodeKeys(code);
+                return code_keys.base_lower_key == key || code_keys.lower_key == key;
+            }
 
             // Returns the set of possible keys that can align to the given code.
             //
             // Example: On certain Spanish keyboards, the code 'ñ' (LATIN SMALL LETTER N
             // WITH TILDE) can align to either the special 'ñ' key or the internal.base 'n' key.
-            vector<KeyId> GetPossibleKeysForCode(const char32 code) const;
+            const vector<KeyId>& GetPossibleKeysForCode(const char32 code) const {
+                return GetCodeKeys(code).possible_keys;
+            }
 
             // Get the diagonal length of the entire keyboard.
             float keyboard_diagonal_length() const {
@@ -200,6 +236,17 @@ namespace decoder {
                 return center_ys_[id];
             }
 
+            // Get the center coordinates of all of the keys, as arrays of
+            // num_keys() floats.
+            const float* key_center_xs() const { return center_xs_.data(); }
+            const float* key_center_ys() const { return center_ys_.data(); }
+
+            // Get the width of the given key id.
+            inline float widths(const KeyId id) const {
+                        DCHECK(IsValidKeyIndex(id));
+                return widths_[id];
+            }
+
             // Return the number of keys in the keyboard.
             int num_keys() const { return num_keys_; }
 
@@ -209,7 +256,33 @@ namespace decoder {
             // Return the height of a typical letter key on the keyboard.
             float most_common_key_height() const { return most_common_key_height_; }
 
+            // Return the grid of the distances to the keys, from which the alignment
+            // scores can be interpolated (see DecoderParams::use_align_score_grid).
+            // It is rasterized once, when the keyboard is created.
+            const AlignScoreGrid* align_score_grid() const {
+                return align_score_grid_.get();
+            }
+
         private:
+            // The keys that a character code can align to. These are looked up for
+            // every expanded token, so they are precomputed for all of the codes (in
+            // the BMP) that align to any key, instead of lowercasing the code and
+            // searching the keys on each call.
+            struct CodeKeys {
+                // The key for exactly the code.
+                KeyId key = kInvalidKeyId;
+                // The keys for the lowercase code and for its base (e.g., without
+                // diacritics) lowercase code.
+                KeyId lower_key = kInvalidKeyId;
+                KeyId base_lower_key = kInvalidKeyId;
+                // The keys for the two codes of the digraph of the lowercase code (e.g.,
+                // 'o' and 'e' for 'ö'), if it has one.
+                KeyId first_digraph_key = kInvalidKeyId;
+                KeyId second_digraph_key = kInvalidKeyId;
+                // See GetPossibleKeysForCode.
+                vector<KeyId> possible_keys;
+            };
+
             // Creates the keyboard from the keyboard layout data.  Note, that the
             // keyboard is not fully initialized after construction, so callers should use
             // CreateKeyboardOrNull.
@@ -219,6 +292,28 @@ namespace decoder {
             // initialization.
             void UpdateGeometricProperties();
 
+            // Precomputes the keys for the character codes (see CodeKeys) and the space
+            // key.  This is used as part of initialization.
+            void UpdateCodeKeys();
+
+            // Computes the keys for the given code, using the given function to find
+            // the key for a code.
+            template <typename KeyIndexFunction>
+            static CodeKeys ComputeCodeKeys(const char32 code,
+                                            const KeyIndexFunction& key_index);
+
+            // Returns the keys for the given code.
+            const CodeKeys& GetCodeKeys(const char32 code) const {
+                if (static_cast<uint32>(code) < code_keys_index_.size()) {
+                    return code_keys_[code_keys_index_[code]];
+                }
+                return GetCodeKeysSlow(code);
+            }
+
+            // As GetKeyIndex and GetCodeKeys, for codes past the precomputed ones.
+            KeyId GetKeyIndexSlow(const char32 code) const;
+            const CodeKeys& GetCodeKeysSlow(const char32 code) const;
+
             // Adds a key to the keyboard.
             //
             // Args:
@@ -280,6 +375,25 @@ namespace decoder {
             // key index to the second key index.
             vector<vector<float>> key_key_directions_;
 
+            // The index in code_keys_ of the keys for each code, up to the last code
+            // that aligns to any key. The first entry of code_keys_ has no keys, and
+            // is shared by all of the codes that do not align to any key.
+            vector<uint16> code_keys_index_;
+            vector<CodeKeys> code_keys_;
+
+            // The keys for the key codes past the ones in code_keys_index_ (i.e.,
+            // outside the BMP), sorted by code.
+            vector<std::pair<char32, CodeKeys>> extra_code_keys_;
+
+            // The key index of the space key.
+            KeyId space_key_;
+
+            // See align_score_grid().
+            std::unique_ptr<const AlignScoreGrid> align_score_grid_;
+
+            // The spatial index of the key centers, for the nearest key queries.
+            std::unique_ptr<const NearestKeyIndex> nearest_key_index_;
+
             DISALLOW_COPY_AND_ASSIGN(Keyboard);
         };
 
@@ -0,0 +1,141 @@
+#include "nearest-key-index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "../base/logging.h"
+
+namespace keyboard {
+namespace decoder {
+
+    namespace {
+
+        // The maximum number of cells in an index. For keyboards that are large
+        // relative to their most common key width, the cells are made larger.
+        const int kMaxCells = 1 << 14;
+
+        // The relative slack of the candidate distance thresholds, which keeps the
+        // rounding errors of the float distances in the queries from ever making a
+        // key that is not a candidate nearer than one that is.
+        const double kThresholdSlack = 1e-4;
+
+        // Returns the squared distance from the point (x, y) to the nearest and to
+        // the farthest point of the rectangle [left, right] x [top, bottom].
+        std::pair<double, double> RectDistanceSqs(const double x, const double y,
+                                                  const double left, const double top,
+                                                  const double right,
+                                                  const double bottom) {
+            const double near_dx = std::max(std::max(left - x, x - right), 0.0);
+            const double near_dy = std::max(std::max(top - y, y - bottom), 0.0);
+            const double far_dx = std::max(x - left, right - x);
+            const double far_dy = std::max(y - top, bottom - y);
+            return std::make_pair(near_dx * near_dx + near_dy * near_dy,
+                                  far_dx * far_dx + far_dy * far_dy);
+        }
+
+    }  // namespace
+
+    NearestKeyIndex::NearestKeyIndex(const Keyboard& keyboard)
+            : num_keys_(keyboard.num_keys()),
+              center_xs_(keyboard.key_center_xs(),
+                         keyboard.key_center_xs() + keyboard.num_keys()),
+              center_ys_(keyboard.key_center_ys(),
+                         keyboard.key_center_ys() + keyboard.num_keys()) {
+        // The area covered by the keys, plus a margin of one key width.
+        const float key_width = keyboard.most_common_key_width();
+        const float half_key_height = keyboard.most_common_key_height() / 2;
+        float left = std::numeric_limits<float>::infinity();
+        float right = -std::numeric_limits<float>::infinity();
+        float top = std::numeric_limits<float>::infinity();
+        float bottom = -std::numeric_limits<float>::infinity();
+        for (int k = 0; k < num_keys_; ++k) {
+            const float half_width = keyboard.widths(k) / 2;
+            left = std::min(left, center_xs_[k] - half_width);
+            right = std::max(right, center_xs_[k] + half_width);
+            top = std::min(top, center_ys_[k] - half_key_height);
+            bottom = std::max(bottom, center_ys_[k] + half_key_height);
+        }
+        left -= key_width;
+        right += key_width;
+        top -= key_width;
+        bottom += key_width;
+        cell_size_ = std::max(key_width / kCellsPerKeyWidth,
+                              std::sqrt((right - left) * (bottom - top) / kMaxCells));
+        columns_ = std::max(1, static_cast<int>(std::ceil((right - left) / cell_size_)));
+        rows_ = std::max(1, static_cast<int>(std::ceil((bottom - top) / cell_size_)));
+        inverse_cell_size_ = 1 / cell_size_;
+        origin_x_ = left;
+        origin_y_ = top;
+
+        const int cell_count = rows_ * columns_;
+        cell_offsets_.reserve(cell_count + 1);
+        vector<std::pair<double, KeyId>> near_distance_sqs(num_keys_);
+        for (int row = 0; row < rows_; ++row) {
+            for (int column = 0; column < columns_; ++column) {
+                const double cell_left = origin_x_ + column * static_cast<double>(cell_size_);
+                const double cell_top = origin_y_ + row * static_cast<double>(cell_size_);
+                // The nearest key of any point in the cell is no farther than the
+                // smallest of the distances to the far corners.
+                double threshold = std::numeric_limits<double>::infinity();
+                for (int k = 0; k < num_keys_; ++k) {
+                    const std::pair<double, double> distance_sqs = RectDistanceSqs(
+                            center_xs_[k], center_ys_[k], cell_left, cell_top,
+                            cell_left + cell_size_, cell_top + cell_size_);
+                    near_distance_sqs[k] = std::make_pair(distance_sqs.first, k);
+                    threshold = std::min(threshold, distance_sqs.second);
+                }
+                threshold *= 1 + kThresholdSlack;
+                std::sort(near_distance_sqs.begin(), near_distance_sqs.end());
+
+                cell_offsets_.push_back(candidates_.size());
+                for (int k = 0; k < num_keys_ && near_distance_sqs[k].first <= threshold;
+                     ++k) {
+                    candidates_.push_back(near_distance_sqs[k].second);
+                }
+            }
+        }
+        cell_offsets_.push_back(candidates_.size());
+    }
+
+    int NearestKeyIndex::GetCell(const float x, const float y) const {
+        const float grid_x = (x - origin_x_) * inverse_cell_size_;
+        const float grid_y = (y - origin_y_) * inverse_cell_size_;
+        // Also false for NaN coordinates.
+        if (!(grid_x >= 0 && grid_x < columns_ && grid_y >= 0 && grid_y < rows_)) {
+            return -1;
+        }
+        return static_cast<int>(grid_y) * columns_ + static_cast<int>(grid_x);
+    }
+
+    KeyId NearestKeyIndex::NearestKey(const float x, const float y) const {
+        const int cell = GetCell(x, y);
+        const KeyId* keys = nullptr;
+        int count = num_keys_;
+        if (cell >= 0) {
+            keys = &candidates_[cell_offsets_[cell]];
+            count = cell_offsets_[cell + 1] - cell_offsets_[cell];
+            // Most cells are nearest to a single key everywhere.
+            if (count == 1) {
+                return keys[0];
+            }
+        }
+        float min_distance_sq = std::numeric_limits<float>::infinity();
+        KeyId nearest_key = Keyboard::kInvalidKeyId;
+        for (int i = 0; i < count; ++i) {
+            const KeyId key = keys != nullptr ? keys[i] : i;
+            const float dx = x - center_xs_[key];
+            const float dy = y - center_ys_[key];
+            const float distance_sq = dx * dx + dy * dy;
+            if (nearest_key == Keyboard::kInvalidKeyId || distance_sq < min_distance_sq ||
+                (distance_sq == min_distance_sq && key < nearest_key)) {
+                min_distance_sq = distance_sq;
+                nearest_key = key;
+            }
+        }
+        return nearest_key;
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,74 @@
+// Description:
+//   A spatial index of the key centers of a keyboard, which answers nearest-key
+//   queries by looking at a few candidate keys instead of scanning all of the
+//   keys.
+//
+//   The index is a uniform grid of cells, kCellsPerKeyWidth per most common key
+//   width, covering the keys and a margin of one key width around them. Each
+//   cell lists the keys that can be the nearest key of some point in the cell:
+//   a key whose distance to the cell is more than the smallest distance from
+//   any other key to the far corner of the cell can not be the nearest key
+//   anywhere in it. Points outside the grid fall back to scanning all of the
+//   keys, so the results are always exact.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_NEAREST_KEY_INDEX_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_NEAREST_KEY_INDEX_H_
+
+#include <vector>
+
+#include "../base/integral_types.h"
+#include "../base/macros.h"
+#include "keyboard.h"
+
+namespace keyboard {
+namespace decoder {
+
+    class NearestKeyIndex {
+    public:
+        // The number of grid cells per most common key width.
+        static constexpr int kCellsPerKeyWidth = 4;
+
+        // Indexes the key centers of the keyboard.
+        explicit NearestKeyIndex(const Keyboard& keyboard);
+
+        // Returns the key whose center is nearest to the point (x, y). Of several
+        // nearest keys, returns the first one.
+        KeyId NearestKey(float x, float y) const;
+
+        // The memory used by the index, in bytes.
+        int64 memory_bytes() const {
+            return static_cast<int64>(candidates_.size()) * sizeof(KeyId) +
+                   static_cast<int64>(cell_offsets_.size()) * sizeof(int);
+        }
+
+    private:
+        // Returns the index of the cell of the point (x, y), or -1 if the point
+        // is not covered by the grid.
+        int GetCell(float x, float y) const;
+
+        int num_keys_;
+        vector<float> center_xs_;
+        vector<float> center_ys_;
+
+        // The coordinates of the top left corner of the grid, the size of the
+        // cells (and its inverse) and the number of cells in each row and column.
+        float origin_x_;
+        float origin_y_;
+        float cell_size_;
+        float inverse_cell_size_;
+        int columns_;
+        int rows_;
+
+        // The candidate keys of each cell, ordered by their distance to the cell,
+        // are candidates_[cell_offsets_[cell]] to
+        // candidates_[cell_offsets_[cell + 1] - 1].
+        vector<KeyId> candidates_;
+        vector<int> cell_offsets_;
+
+        DISALLOW_COPY_AND_ASSIGN(NearestKeyIndex);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_NEAREST_KEY_INDEX_H_
@@ -76,6 +76,33 @@ namespace decoder {
         virtual LogProbFloat DecodedTermsConditionalLogProb(
                 const vector<Utf8StringPiece>& decoded_terms) ABSTRACT;
 
+        // Computes the conditional probabilities under this scorer of each of the
+        // candidate terms following the same sequence of decoded terms, i.e. of
+        // the last term of decoded_terms + {candidate}.
+        //
+        // Args:
+        //   decoded_terms - The sequence of terms that precede each candidate.  May
+        //                   be empty.
+        //   candidates    - The candidate terms to score.
+        //   logps         - Replaced with the conditional log probability under this
+        //                   language model of each candidate, in the same order.
+        //
+        // Implementations may override this method to share the lookup of the
+        // decoded terms between the candidates; the default implementation calls
+        // DecodedTermsConditionalLogProb for each candidate.
+        virtual void CandidatesConditionalLogProbs(
+                const vector<Utf8StringPiece>& decoded_terms,
+                const vector<Utf8StringPiece>& candidates,
+                vector<LogProbFloat>* logps) {
+            logps->clear();
+            vector<Utf8StringPiece> terms(decoded_terms);
+            terms.push_back(Utf8StringPiece());
+            for (const Utf8StringPiece& candidate : candidates) {
+                terms.back() = candidate;
+                logps->push_back(DecodedTermsConditionalLogProb(terms));
+            }
+        }
+
         // Computes up to the top max_predictions terms that most likely follow
         // decoded_terms under this scorer.
         //
@@ -58,6 +58,10 @@ namespace lm {
         LogProbFloat DecodedTermsConditionalLogProb(
                 const vector<Utf8StringPiece>& decoded_terms) override;
 
+        void CandidatesConditionalLogProbs(const vector<Utf8StringPiece>& decoded_terms,
+                                           const vector<Utf8StringPiece>& candidates,
+                                           vector<LogProbFloat>* logps) override;
+
         void PredictNextTerm(
                 const vector<Utf8StringPiece>& decoded_terms, const int max_predictions,
                 vector<pair<Utf8String, LogProbFloat>>* predictions) override;
@@ -70,6 +74,11 @@ namespace lm {
         // A boolean vector that indicates whether each of the constituent LMs
         // support next word predictions.
         vector<bool> supports_next_word_predictions_;
+
+        // The interpolated (non-log) probabilities of the candidates, and the log
+        // probabilities from one scorer, for CandidatesConditionalLogProbs.
+        vector<float> candidate_probs_;
+        vector<LogProbFloat> scorer_logps_;
     };
 
     LogProbFloat InterpolatedLmScorer::DecodedTermsLogProb(
@@ -103,6 +112,24 @@ namespace lm {
         return log(interpolated_prob);
     }
 
+    void InterpolatedLmScorer::CandidatesConditionalLogProbs(
+            const vector<Utf8StringPiece>& decoded_terms,
+            const vector<Utf8StringPiece>& candidates, vector<LogProbFloat>* logps) {
+        candidate_probs_.assign(candidates.size(), 0);
+        for (size_t i = 0; i < weighted_scorers_.size(); ++i) {
+            weighted_scorers_[i].first->CandidatesConditionalLogProbs(
+                    decoded_terms, candidates, &scorer_logps_);
+            const float weight = weighted_scorers_[i].second;
+            for (size_t j = 0; j < candidates.size(); ++j) {
+                candidate_probs_[j] += exp(scorer_logps_[j]) * weight;
+            }
+        }
+        logps->resize(candidates.size());
+        for (size_t j = 0; j < candidates.size(); ++j) {
+            (*logps)[j] = candidate_probs_[j] == 0 ? NEG_INF : log(candidate_probs_[j]);
+        }
+    }
+
     void InterpolatedLmScorer::PredictNextTerm(
             const vector<Utf8StringPiece>& decoded_terms, const int max_predictions,
             vector<pair<Utf8String, LogProbFloat>>* results) {
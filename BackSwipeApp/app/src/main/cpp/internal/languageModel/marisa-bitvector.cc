@@ -12,25 +12,38 @@ namespace louds {
     using marisa::grimoire::io::Writer;
 
     MarisaBitVector::MarisaBitVector()
-            : bit_vector_(new marisa::grimoire::vector::BitVector<32>) {}
+            : bit_vector_(new marisa::grimoire::vector::BitVector<32>),
+              rank_select_index_(RankSelectIndex::kMarisa) {}
 
     std::size_t MarisaBitVector::rank1(std::size_t i) const {
                 DCHECK_LT(i, bit_vector_->size());
+        if (poppy_index_ != nullptr) {
+            return poppy_index_->rank1(i);
+        }
         return bit_vector_->rank1(i);
     }
 
     std::size_t MarisaBitVector::rank0(std::size_t i) const {
                 DCHECK_LT(i, bit_vector_->size());
+        if (poppy_index_ != nullptr) {
+            return i - poppy_index_->rank1(i);
+        }
         return bit_vector_->rank0(i);
     }
 
     std::size_t MarisaBitVector::select1(std::size_t i) const {
                 DCHECK_LT(i, bit_vector_->size());
+        if (poppy_index_ != nullptr) {
+            return poppy_index_->select1(i);
+        }
         return bit_vector_->select1(i);
     }
 
     std::size_t MarisaBitVector::select0(std::size_t i) const {
                 DCHECK_LT(i, bit_vector_->size());
+        if (poppy_index_ != nullptr) {
+            return poppy_index_->select0(i);
+        }
         return bit_vector_->select0(i);
     }
 
@@ -45,10 +58,12 @@ namespace louds {
 
     void MarisaBitVector::map(MarisaMapper* mapper) {
         bit_vector_->map(*mapper->mapper());
+        BuildPoppyIndex();
     }
 
     void MarisaBitVector::read(MarisaReader* reader) {
         bit_vector_->read(*reader->reader());
+        BuildPoppyIndex();
     }
 
     void MarisaBitVector::write(MarisaWriter* writer) const {
@@ -58,6 +73,20 @@ namespace louds {
     void MarisaBitVector::build() {
         // Does not throw exceptions.
         bit_vector_->build(true /* enables_select0 */, true /* enables_select1 */);
+        BuildPoppyIndex();
+    }
+
+    void MarisaBitVector::set_rank_select_index(const RankSelectIndex index) {
+        rank_select_index_ = index;
+        BuildPoppyIndex();
+    }
+
+    void MarisaBitVector::BuildPoppyIndex() {
+        poppy_index_.reset();
+        if (rank_select_index_ == RankSelectIndex::kPoppy) {
+            poppy_index_.reset(new PoppyRankSelect(
+                    bit_vector_->units(), bit_vector_->num_units(), bit_vector_->size()));
+        }
     }
 
 }  // namespace louds
@@ -11,6 +11,7 @@
 
 #include "../base/integral_types.h"
 #include "marisa-io.h"
+#include "poppy-rank-select.h"
 // This must be before any headers in "third_party/marisa" to remove exceptions.
 #include "remove-marisa-exceptions.h"
 #include "marisa/bit-vector.h"
@@ -19,6 +20,17 @@ namespace keyboard {
 namespace lm {
 namespace louds {
 
+    // The index that a MarisaBitVector uses for rank and select. Both give the
+    // same results.
+    enum class RankSelectIndex {
+        // The marisa rank index and select samples, which are serialized with the
+        // bit vector.
+        kMarisa,
+        // A PoppyRankSelect, which is smaller and faster but always built in
+        // memory from the bits.
+        kPoppy,
+    };
+
     // A bit-vector that supports LOUDS operations for rank and select.
     class MarisaBitVector {
     public:
@@ -63,9 +75,30 @@ namespace louds {
         // Builds the rank and select indices for the bit vector.
         void build();
 
+        // Selects the index used for rank and select. The marisa index is always
+        // built, mapped or read, and written, so that the files do not depend on
+        // the selected index. The poppy index is built from the bits when it is
+        // selected, and rebuilt whenever the bit vector is built, mapped or read.
+        void set_rank_select_index(RankSelectIndex index);
+
+        RankSelectIndex rank_select_index() const { return rank_select_index_; }
+
+        // The memory used by the poppy index, in bytes, or 0 if it is not selected.
+        std::size_t poppy_index_memory_bytes() const {
+            return poppy_index_ != nullptr ? poppy_index_->memory_bytes() : 0;
+        }
+
     private:
+        // Builds the poppy index if it is selected.
+        void BuildPoppyIndex();
+
         // The underlying marisa BitVector
         std::unique_ptr<marisa::grimoire::vector::BitVector<32>> bit_vector_;
+
+        RankSelectIndex rank_select_index_;
+
+        // The poppy index of the bits of bit_vector_, if it is selected.
+        std::unique_ptr<PoppyRankSelect> poppy_index_;
     };
 
 }  // namespace louds
@@ -100,6 +100,14 @@ class BitVector {
   std::size_t size() const {
     return size_;
   }
+  // The units that store the bits: bit i is bit (i % T) of units()[i / T].
+  // Bits past the end of the vector are 0.
+  const Unit *units() const {
+    return units_.begin();
+  }
+  std::size_t num_units() const {
+    return units_.size();
+  }
   std::size_t total_size() const {
     return units_.total_size() + ranks_.total_size()
         + select0s_.total_size() + select1s_.total_size();
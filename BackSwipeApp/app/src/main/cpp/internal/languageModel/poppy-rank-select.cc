@@ -0,0 +1,184 @@
+#include "poppy-rank-select.h"
+
+#include <algorithm>
+
+#include "../base/logging.h"
+
+namespace keyboard {
+namespace lm {
+namespace louds {
+
+    namespace {
+
+        const uint64 kOnesStep4 = 0x1111111111111111ULL;
+        const uint64 kOnesStep8 = 0x0101010101010101ULL;
+        const uint64 kMsbsStep8 = 0x80ULL * kOnesStep8;
+
+        int PopCount(const uint64 x) { return __builtin_popcountll(x); }
+
+        // The position of the r-th 1 bit (0-indexed) of each byte value, for r
+        // less than the number of ones of the byte.
+        struct SelectInByteTable {
+            uint8 positions[256][8];
+
+            SelectInByteTable() {
+                for (int byte = 0; byte < 256; ++byte) {
+                    int r = 0;
+                    for (int bit = 0; bit < 8; ++bit) {
+                        positions[byte][bit] = 0;
+                    }
+                    for (int bit = 0; bit < 8; ++bit) {
+                        if (byte & (1 << bit)) {
+                            positions[byte][r++] = bit;
+                        }
+                    }
+                }
+            }
+        };
+
+        const SelectInByteTable kSelectInByte;
+
+        // Returns the position of the r-th 1 bit (0-indexed) of x, which must have
+        // more than r ones (Vigna, "Broadword Implementation of Rank/Select
+        // Queries", 2008).
+        int SelectInWord(const uint64 x, const int r) {
+            // Byte j of byte_sums is the number of ones in bytes 0 to j of x.
+            uint64 byte_sums = x - ((x & 0xA * kOnesStep4) >> 1);
+            byte_sums = (byte_sums & 3 * kOnesStep4) + ((byte_sums >> 2) & 3 * kOnesStep4);
+            byte_sums = (byte_sums + (byte_sums >> 4)) & 0x0F * kOnesStep8;
+            byte_sums *= kOnesStep8;
+            // The most significant bit of byte j is set iff byte j of byte_sums is
+            // at most r, so their number is the byte of the r-th one.
+            const uint64 leq =
+                    ((static_cast<uint64>(r) * kOnesStep8 | kMsbsStep8) - byte_sums) &
+                    kMsbsStep8;
+            const int byte_shift = PopCount(leq) * 8;
+            const int ones_before = static_cast<int>(((byte_sums << 8) >> byte_shift) & 0xFF);
+            return byte_shift +
+                   kSelectInByte.positions[(x >> byte_shift) & 0xFF][r - ones_before];
+        }
+
+    }  // namespace
+
+    PoppyRankSelect::PoppyRankSelect(const uint32* units, const std::size_t num_units,
+                                     const std::size_t size)
+            : units_(units), num_words_(num_units / 2) {
+        CHECK_EQ(num_units % 2, 0) << "The units must be whole 64-bit words";
+        CHECK_LE(size, num_words_ * 64);
+        const std::size_t num_superblocks =
+                (num_words_ + kWordsPerSuperblock - 1) / kWordsPerSuperblock;
+        superblocks_.reserve(num_superblocks + 1);
+        uint64 ones = 0;
+        for (std::size_t s = 0; s < num_superblocks; ++s) {
+            uint64 entry = ones;
+            for (int b = 0; b < 4; ++b) {
+                const std::size_t begin = s * kWordsPerSuperblock + b * kWordsPerBasicBlock;
+                const std::size_t end = std::min(begin + kWordsPerBasicBlock, num_words_);
+                uint64 count = 0;
+                for (std::size_t w = begin; w < end; ++w) {
+                    count += PopCount(word(w));
+                }
+                if (b < 3) {
+                    entry |= count << (32 + 10 * b);
+                }
+                ones += count;
+            }
+            superblocks_.push_back(entry);
+        }
+        CHECK_LE(ones, 0xFFFFFFFFULL);
+        superblocks_.push_back(ones);
+
+        for (std::size_t s = 0; s < num_superblocks; ++s) {
+            const std::size_t ones_end = SuperblockOnes(superblocks_[s + 1]);
+            const std::size_t zeros_end = (s + 1) * kBitsPerSuperblock - ones_end;
+            while (select1_samples_.size() * kSelectSampleRate < ones_end) {
+                select1_samples_.push_back(s);
+            }
+            while (select0_samples_.size() * kSelectSampleRate < zeros_end) {
+                select0_samples_.push_back(s);
+            }
+        }
+        select1_samples_.push_back(num_superblocks);
+        select0_samples_.push_back(num_superblocks);
+    }
+
+    std::size_t PoppyRankSelect::rank1(const std::size_t i) const {
+        const uint64 entry = superblocks_[i / kBitsPerSuperblock];
+        std::size_t rank = SuperblockOnes(entry);
+        const int basic_block = (i / kBitsPerBasicBlock) % 4;
+        for (int b = 0; b < basic_block; ++b) {
+            rank += BasicBlockOnes(entry, b);
+        }
+        const std::size_t last_word = i / 64;
+        for (std::size_t w = i / kBitsPerBasicBlock * kWordsPerBasicBlock; w < last_word;
+             ++w) {
+            rank += PopCount(word(w));
+        }
+        // The word of position i does not exist when i is the size of a vector of
+        // whole words.
+        if (i % 64 != 0) {
+            rank += PopCount(word(last_word) & ((1ULL << (i % 64)) - 1));
+        }
+        return rank;
+    }
+
+    std::size_t PoppyRankSelect::select1(const std::size_t i) const {
+        return Select<true>(i);
+    }
+
+    std::size_t PoppyRankSelect::select0(const std::size_t i) const {
+        return Select<false>(i);
+    }
+
+    template <bool kOnes>
+    std::size_t PoppyRankSelect::Select(const std::size_t i) const {
+        // The number of ones (or zeros) before superblock s.
+        const auto count_before = [this](const std::size_t s) {
+            const std::size_t ones = SuperblockOnes(superblocks_[s]);
+            return kOnes ? ones : s * kBitsPerSuperblock - ones;
+        };
+
+        // The superblock of the i-th bit is the last one with at most i bits
+        // before it, which is between the superblocks of the samples around i.
+        const std::vector<uint32>& samples = kOnes ? select1_samples_ : select0_samples_;
+        DCHECK_LT(i / kSelectSampleRate + 1, samples.size());
+        std::size_t low = samples[i / kSelectSampleRate];
+        std::size_t high = samples[i / kSelectSampleRate + 1];
+        while (low < high) {
+            const std::size_t middle = (low + high + 1) / 2;
+            if (count_before(middle) <= i) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+
+        // The basic block of the i-th bit is picked by comparing the rank with all
+        // of the counts before it, without a branch for each of them.
+        const uint64 entry = superblocks_[low];
+        std::size_t rank = i - count_before(low);
+        std::size_t block_counts[4] = {0, 0, 0, 0};
+        for (int b = 0; b < 3; ++b) {
+            const std::size_t ones = BasicBlockOnes(entry, b);
+            block_counts[b + 1] =
+                    block_counts[b] + (kOnes ? ones : kBitsPerBasicBlock - ones);
+        }
+        const int basic_block = (rank >= block_counts[1]) + (rank >= block_counts[2]) +
+                                (rank >= block_counts[3]);
+        rank -= block_counts[basic_block];
+
+        for (std::size_t w = low * kWordsPerSuperblock + basic_block * kWordsPerBasicBlock;;
+             ++w) {
+            DCHECK_LT(w, num_words_);
+            const uint64 x = kOnes ? word(w) : ~word(w);
+            const std::size_t count = PopCount(x);
+            if (rank < count) {
+                return w * 64 + SelectInWord(x, static_cast<int>(rank));
+            }
+            rank -= count;
+        }
+    }
+
+}  // namespace louds
+}  // namespace lm
+}  // namespace keyboard
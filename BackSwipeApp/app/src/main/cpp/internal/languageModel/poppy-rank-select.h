@@ -0,0 +1,113 @@
+// Description:
+//   A compact rank/select index over the bits of a MarisaBitVector, laid out
+//   like poppy (Zhou, Andersen and Kaminsky, "Space-Efficient, High-Performance
+//   Rank & Select Structures on Uncompressed Bit Sequences", 2013).
+//
+//   The bits are split into 2048-bit superblocks of four 512-bit (one cache
+//   line) basic blocks. A single 64-bit entry per superblock interleaves the
+//   number of ones before the superblock (32 bits) with the number of ones in
+//   each of its first three basic blocks (10 bits each), so that rank reads
+//   one entry and popcounts at most eight 64-bit words of one basic block.
+//   These entries add about 3% to the bits, and the select samples below
+//   another 3%, compared with about 19% for the rank index of marisa (12 bytes
+//   per 512 bits) plus 6% for its select samples.
+//
+//   Select looks up the superblock of every kSelectSampleRate-th one (or zero)
+//   to bound a binary search over the superblock entries, picks the basic
+//   block with the interleaved counts, popcounts its words and selects within
+//   the final word with broadword arithmetic and a table of the bytes.
+//
+//   The index is always built in memory from the bits, and is not part of the
+//   serialized bit vector, so that it works with any existing file.
+
+#ifndef INPUTMETHOD_KEYBOARD_LM_LOUDS_POPPY_RANK_SELECT_H_
+#define INPUTMETHOD_KEYBOARD_LM_LOUDS_POPPY_RANK_SELECT_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "../base/integral_types.h"
+#include "../base/macros.h"
+
+namespace keyboard {
+namespace lm {
+namespace louds {
+
+    class PoppyRankSelect {
+    public:
+        // The number of ones (or zeros) between two select samples.
+        static constexpr std::size_t kSelectSampleRate = 1024;
+
+        // Builds the index of a bit vector. Does not copy the bits, which must
+        // outlive the index.
+        //
+        // Args:
+        //   units - The bits in 32-bit units: bit i is bit (i % 32) of
+        //           units[i / 32]. The bits past the end of the vector must be 0.
+        //   num_units - The number of units, which must be even (i.e., the units
+        //               must be whole 64-bit words).
+        //   size - The number of bits in the vector.
+        PoppyRankSelect(const uint32* units, std::size_t num_units, std::size_t size);
+
+        // Returns the number of 1 bits before position i, for i <= size.
+        std::size_t rank1(std::size_t i) const;
+
+        // Returns the position of the i-th 1 bit (0-indexed).
+        std::size_t select1(std::size_t i) const;
+
+        // Returns the position of the i-th 0 bit (0-indexed).
+        std::size_t select0(std::size_t i) const;
+
+        // The memory used by the index, not including the bits, in bytes.
+        std::size_t memory_bytes() const {
+            return superblocks_.size() * sizeof(uint64) +
+                   (select0_samples_.size() + select1_samples_.size()) * sizeof(uint32);
+        }
+
+    private:
+        static constexpr std::size_t kWordsPerBasicBlock = 8;
+        static constexpr std::size_t kWordsPerSuperblock = 32;
+        static constexpr std::size_t kBitsPerBasicBlock = 64 * kWordsPerBasicBlock;
+        static constexpr std::size_t kBitsPerSuperblock = 64 * kWordsPerSuperblock;
+
+        // Returns the 64-bit word w of the bits.
+        uint64 word(const std::size_t w) const {
+            return static_cast<uint64>(units_[2 * w]) |
+                   (static_cast<uint64>(units_[2 * w + 1]) << 32);
+        }
+
+        // Returns the number of ones before the superblock of the entry.
+        static std::size_t SuperblockOnes(const uint64 entry) {
+            return static_cast<std::size_t>(entry & 0xFFFFFFFF);
+        }
+
+        // Returns the number of ones in basic block b < 3 of the superblock of the
+        // entry.
+        static std::size_t BasicBlockOnes(const uint64 entry, const int b) {
+            return static_cast<std::size_t>((entry >> (32 + 10 * b)) & 0x3FF);
+        }
+
+        // Returns the position of the i-th 1 bit (kOnes) or 0 bit (!kOnes).
+        template <bool kOnes>
+        std::size_t Select(std::size_t i) const;
+
+        const uint32* units_;
+        std::size_t num_words_;
+
+        // The entries of the superblocks, plus an entry past the last superblock
+        // whose count of preceding ones is the total.
+        std::vector<uint64> superblocks_;
+
+        // The superblock of every kSelectSampleRate-th 0 and 1 bit, plus the last
+        // entry of superblocks_.
+        std::vector<uint32> select0_samples_;
+        std::vector<uint32> select1_samples_;
+
+        DISALLOW_COPY_AND_ASSIGN(PoppyRankSelect);
+    };
+
+}  // namespace louds
+}  // namespace lm
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_LM_LOUDS_POPPY_RANK_SELECT_H_
@@ -0,0 +1,105 @@
+#include "lexicon-children-cache.h"
+
+#include <algorithm>
+#include <deque>
+#include <utility>
+
+#include "base/logging.h"
+
+namespace keyboard {
+namespace decoder {
+
+    int ExtractChildNodesByCodepoint(const CodepointNodeSpan& nodes,
+                                     vector<CodepointNode>* child_nodes) {
+        child_nodes->clear();
+        for (const CodepointNode& node : nodes) {
+            node.GetChildCodepoints(child_nodes);
+        }
+        // Combine all child nodes with the same character key into one group.
+        // This enables simultaneous traversal of multiple language models, and
+        // reduces the need to perform redundant alignments on common prefixes.
+        std::stable_sort(child_nodes->begin(), child_nodes->end(),
+                         [](const CodepointNode& a, const CodepointNode& b) {
+                             return a.codepoint() < b.codepoint();
+                         });
+        int group_count = 0;
+        for (size_t i = 0; i < child_nodes->size(); ++i) {
+            if (i == 0 || (*child_nodes)[i].codepoint() !=
+                          (*child_nodes)[i - 1].codepoint()) {
+                ++group_count;
+            }
+        }
+        return group_count;
+    }
+
+    void GroupChildNodesByCodepoint(const CodepointNode* child_nodes, const int count,
+                                    ChildGroup* groups) {
+        int group = -1;
+        for (int i = 0; i < count; ++i) {
+            if (i == 0 || child_nodes[i].codepoint() != child_nodes[i - 1].codepoint()) {
+                groups[++group] = {child_nodes[i].codepoint(),
+                                   CodepointNodeSpan(child_nodes + i, 0)};
+            }
+            const CodepointNodeSpan& span = groups[group].nodes;
+            groups[group].nodes = CodepointNodeSpan(span.begin(), span.size() + 1);
+        }
+    }
+
+    LexiconChildrenCache::LexiconChildrenCache(
+            const vector<const LexiconInterface*>& lexicons, const int max_depth,
+            const int max_nodes)
+            : entries_(), slots_(), slot_mask_(0), groups_(), nodes_() {
+        // The range of child nodes of each cached parent, in the order of entries_.
+        // The groups are only filled in once nodes_ is complete, since they point
+        // into it.
+        vector<std::pair<int, int>> node_ranges;
+        std::deque<std::pair<CodepointNode, int>> queue;
+        for (const auto* lexicon : lexicons) {
+            queue.emplace_back(CodepointNode::GetRootNode(lexicon), 0);
+        }
+        vector<CodepointNode> child_nodes;
+        while (!queue.empty()) {
+            const CodepointNode parent = queue.front().first;
+            const int depth = queue.front().second;
+            queue.pop_front();
+            if (depth >= max_depth) {
+                continue;
+            }
+            const int group_count = ExtractChildNodesByCodepoint(
+                    CodepointNodeSpan(&parent, 1), &child_nodes);
+            if (static_cast<int>(nodes_.size() + child_nodes.size()) > max_nodes) {
+                break;
+            }
+            entries_.push_back({parent.lexicon(), parent.GetNodeData(),
+                                static_cast<int32>(groups_.size()), group_count});
+            node_ranges.emplace_back(nodes_.size(), child_nodes.size());
+            groups_.resize(groups_.size() + group_count);
+            for (const CodepointNode& child : child_nodes) {
+                nodes_.push_back(child);
+                queue.emplace_back(child, depth + 1);
+            }
+        }
+        nodes_.shrink_to_fit();
+        groups_.shrink_to_fit();
+
+        int slot_count = 16;
+        while (slot_count < size() * 2) {
+            slot_count *= 2;
+        }
+        slots_.assign(slot_count, -1);
+        slot_mask_ = slot_count - 1;
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            const Entry& entry = entries_[i];
+            GroupChildNodesByCodepoint(nodes_.data() + node_ranges[i].first,
+                                       node_ranges[i].second,
+                                       groups_.data() + entry.group_start);
+            int slot = Hash(entry.lexicon, entry.node_id) & slot_mask_;
+            while (slots_[slot] >= 0) {
+                slot = (slot + 1) & slot_mask_;
+            }
+            slots_[slot] = i;
+        }
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
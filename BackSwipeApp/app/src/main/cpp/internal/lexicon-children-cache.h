@@ -0,0 +1,127 @@
+// Description:
+//   The child nodes of the top levels of the lexicon tries, grouped by codepoint.
+//   The same top-of-trie nodes (the root and the first few letters) are expanded
+//   by every decode, so their children are extracted once when the lexicons are
+//   loaded, and then shared read-only by all of the model's decoding sessions.
+//
+//   The children are stored in flat arrays, and indexed by an open-addressing
+//   table keyed by the parent's lexicon and node id.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_LEXICON_CHILDREN_CACHE_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_LEXICON_CHILDREN_CACHE_H_
+
+#include <vector>
+
+#include "base/hash128to64.h"
+#include "base/int128.h"
+#include "base/integral_types.h"
+#include "base/macros.h"
+#include "codepoint-node.h"
+#include "lexicon-interface.h"
+
+namespace keyboard {
+namespace decoder {
+
+    // The child nodes of a token for a single codepoint.
+    struct ChildGroup {
+        char32 code;
+        CodepointNodeSpan nodes;
+    };
+
+    // A non-owning view of a token's child groups, ordered by codepoint.
+    class ChildGroupSpan {
+    public:
+        ChildGroupSpan() : data_(nullptr), size_(0) {}
+
+        ChildGroupSpan(const ChildGroup* data, const int size)
+                : data_(data), size_(size) {}
+
+        const ChildGroup* begin() const { return data_; }
+        const ChildGroup* end() const { return data_ + size_; }
+        int size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+    private:
+        const ChildGroup* data_;
+        int size_;
+    };
+
+    // Replaces child_nodes with the children of the given nodes, sorted by
+    // codepoint. The sort is stable, so that the nodes for the same codepoint keep
+    // the order of their lexicons.
+    //
+    // Returns:
+    //   The number of distinct codepoints, i.e., of groups of child nodes.
+    int ExtractChildNodesByCodepoint(const CodepointNodeSpan& nodes,
+                                     vector<CodepointNode>* child_nodes);
+
+    // Groups the given child nodes (sorted by ExtractChildNodesByCodepoint) by
+    // codepoint. The groups reference the given array, and groups must have room
+    // for one group per distinct codepoint.
+    void GroupChildNodesByCodepoint(const CodepointNode* child_nodes, int count,
+                                    ChildGroup* groups);
+
+    class LexiconChildrenCache {
+    public:
+        // Extracts the children of the nodes in the top max_depth levels of the
+        // given lexicons (where the root is at depth 0), visiting the tries
+        // breadth-first until the cache holds max_nodes child nodes. The lexicons
+        // must outlive the cache.
+        LexiconChildrenCache(const vector<const LexiconInterface*>& lexicons,
+                             int max_depth, int max_nodes);
+
+        // Looks up the children of the given node. Returns false if they are not
+        // cached. This method is thread-safe.
+        bool Find(const CodepointNode& node, ChildGroupSpan* children) const {
+            if (slots_.empty()) {
+                return false;
+            }
+            const LexiconInterface* lexicon = node.lexicon();
+            const uint64 node_id = node.GetNodeData();
+            for (int slot = Hash(lexicon, node_id) & slot_mask_; slots_[slot] >= 0;
+                 slot = (slot + 1) & slot_mask_) {
+                const Entry& entry = entries_[slots_[slot]];
+                if (entry.node_id == node_id && entry.lexicon == lexicon) {
+                    *children = ChildGroupSpan(groups_.data() + entry.group_start,
+                                               entry.group_count);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // The number of cached parent nodes.
+        int size() const { return entries_.size(); }
+
+        // The number of cached child nodes.
+        int node_count() const { return nodes_.size(); }
+
+    private:
+        struct Entry {
+            const LexiconInterface* lexicon;
+            uint64 node_id;
+            int32 group_start;
+            int32 group_count;
+        };
+
+        static uint64 Hash(const LexiconInterface* lexicon, const uint64 node_id) {
+            return Hash128to64(uint128(reinterpret_cast<uintptr_t>(lexicon), node_id));
+        }
+
+        // The cached parents, and the slots of the table that indexes them (or -1 for
+        // empty slots).
+        vector<Entry> entries_;
+        vector<int32> slots_;
+        int slot_mask_;
+
+        // The child groups of all parents, and the child nodes they reference.
+        vector<ChildGroup> groups_;
+        vector<CodepointNode> nodes_;
+
+        DISALLOW_COPY_AND_ASSIGN(LexiconChildrenCache);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_LEXICON_CHILDREN_CACHE_H_
@@ -123,7 +123,8 @@ namespace decoder {
         // The result is normalized across all keyboard possibilities.
         static float PointToRangeDistance(const float x1, const float y1,
                                           const float x2, const float y2, const int index,
-                                          const vector<double> keyboard_range, const double keyboard_count) {
+                                          const vector<double>& keyboard_range,
+                                          const double keyboard_count) {
             double total = 0;
             // Use data collection results as the key centers
             if (index < mean_xs_.size()) {
@@ -0,0 +1,66 @@
+#include "score-histogram.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "base/logging.h"
+
+namespace keyboard {
+namespace decoder {
+
+    ScoreHistogram::ScoreHistogram(const float bucket_width, const int num_buckets)
+            : inverse_bucket_width_(1.0f / bucket_width),
+              num_buckets_(num_buckets),
+              counts_(num_buckets, 0),
+              first_bucket_(num_buckets),
+              last_bucket_(-1),
+              num_scores_below_range_(0),
+              size_(0),
+              bucket_scores_() {
+        CHECK_GT(bucket_width, 0);
+        CHECK_GT(num_buckets, 0);
+    }
+
+    void ScoreHistogram::Clear() {
+        if (first_bucket_ <= last_bucket_) {
+            std::fill(counts_.begin() + first_bucket_,
+                      counts_.begin() + last_bucket_ + 1, 0);
+        }
+        first_bucket_ = num_buckets_;
+        last_bucket_ = -1;
+        num_scores_below_range_ = 0;
+        size_ = 0;
+    }
+
+    float ScoreHistogram::NthBestScore(const int n, const std::vector<float>& scores) {
+        DCHECK_GE(n, 1);
+        DCHECK_LE(n, size_);
+        DCHECK_EQ(static_cast<int>(scores.size()), size_);
+
+        // Find the bucket of the n-th best score, and the number of better scores
+        // in the preceding buckets.
+        int nth_bucket = num_buckets_;
+        int num_better_scores = 0;
+        for (int bucket = first_bucket_; bucket <= last_bucket_; ++bucket) {
+            if (num_better_scores + counts_[bucket] >= n) {
+                nth_bucket = bucket;
+                break;
+            }
+            num_better_scores += counts_[bucket];
+        }
+
+        bucket_scores_.clear();
+        for (const float score : scores) {
+            if (Bucket(score) == nth_bucket) {
+                bucket_scores_.push_back(score);
+            }
+        }
+        const int rank = n - num_better_scores - 1;
+        DCHECK_LT(rank, static_cast<int>(bucket_scores_.size()));
+        std::nth_element(bucket_scores_.begin(), bucket_scores_.begin() + rank,
+                         bucket_scores_.end(), std::greater<float>());
+        return bucket_scores_[rank];
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,94 @@
+// Description:
+//   A histogram of token scores in fixed-width buckets, for finding the score
+//   of the n-th best token (e.g., the beam cutoff or the pruning threshold)
+//   without sorting all of the scores. The buckets locate the n-th best score,
+//   and only the scores that fall into the same bucket are ranked, so the
+//   result is exact. Only the range of buckets in use is scanned and cleared.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SCORE_HISTOGRAM_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SCORE_HISTOGRAM_H_
+
+#include <vector>
+
+#include "base/macros.h"
+
+namespace keyboard {
+namespace decoder {
+
+    class ScoreHistogram {
+    public:
+        // Creates a histogram of num_buckets buckets of the given width, covering
+        // the (log) scores in (-num_buckets * bucket_width, 0]. Higher scores are
+        // counted in the first bucket, and lower ones (including NEG_INF) after the
+        // last bucket.
+        ScoreHistogram(float bucket_width, int num_buckets);
+
+        // Removes all of the scores.
+        void Clear();
+
+        // Adds a score to the histogram.
+        void Add(const float score) {
+            const int bucket = Bucket(score);
+            ++size_;
+            if (bucket == num_buckets_) {
+                ++num_scores_below_range_;
+                return;
+            }
+            ++counts_[bucket];
+            if (bucket < first_bucket_) {
+                first_bucket_ = bucket;
+            }
+            if (bucket > last_bucket_) {
+                last_bucket_ = bucket;
+            }
+        }
+
+        // The number of scores added since the last Clear().
+        int size() const { return size_; }
+
+        // Returns the n-th best of the given scores (counting from 1), which must be
+        // the scores added to the histogram since the last Clear(), in any order.
+        //
+        // Args:
+        //   n: The rank of the score, in [1, size()].
+        //   scores: The scores in the histogram.
+        //
+        // Returns:
+        //   The same score as std::nth_element would select, after ranking only the
+        //   scores in the bucket of the n-th best score.
+        float NthBestScore(int n, const std::vector<float>& scores);
+
+    private:
+        // Returns the bucket of the given score. The buckets are ordered from the
+        // best scores to the worst, and num_buckets_ stands for the scores below
+        // the range of the histogram.
+        int Bucket(const float score) const {
+            if (!(score < 0)) {
+                return 0;
+            }
+            const float bucket = -score * inverse_bucket_width_;
+            return bucket < num_buckets_ ? static_cast<int>(bucket) : num_buckets_;
+        }
+
+        const float inverse_bucket_width_;
+        const int num_buckets_;
+
+        // The number of scores in each bucket, and the range of buckets that may
+        // be non-zero.
+        std::vector<int> counts_;
+        int first_bucket_;
+        int last_bucket_;
+
+        int num_scores_below_range_;
+        int size_;
+
+        // The scores in the bucket of the n-th best score, for ranking them.
+        std::vector<float> bucket_scores_;
+
+        DISALLOW_COPY_AND_ASSIGN(ScoreHistogram);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SCORE_HISTOGRAM_H_
@@ -0,0 +1,201 @@
+#include "score-kernels.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "keyboardSetting/keyboard.h"
+#include "math-utils.h"
+
+namespace keyboard {
+namespace decoder {
+namespace score_kernels {
+
+    using simd::Float4;
+    using simd::kLanes;
+
+    namespace {
+
+        // The scalar equivalent of the kernels, for the keys past the last
+        // whole vector. It evaluates the same expressions as the vector code.
+        inline float TransitScore(const float direction, const float ideal_direction,
+                                  const float direction_error_weight,
+                                  const float pause_score, const float corner_score) {
+            const float direction_error = std::min(
+                    PI / 4, MathUtils::GetAngleDiff(direction, ideal_direction));
+            const float direction_score =
+                    -sqr(direction_error) * direction_error_weight;
+            return direction_score + pause_score + corner_score;
+        }
+
+        inline float CenterDistance(const float x, const float y, const float center_x,
+                                    const float center_y, const float zero_radius_sq) {
+            const float dx = x - center_x;
+            const float dy = y - center_y;
+            const float distance_sq = dx * dx + dy * dy;
+            return distance_sq <= zero_radius_sq ? 0.0f : std::sqrt(distance_sq);
+        }
+
+    }  // namespace
+
+    void TransitScores(const float direction, const float* ideal_directions,
+                       const int num_keys, const float direction_error_weight,
+                       const float pause_score, const float corner_score,
+                       float* scores) {
+        const Float4 directions = simd::Set(direction);
+        const Float4 pi = simd::Set(PI);
+        const Float4 two_pi = simd::Set(2.0f * PI);
+        const Float4 max_error = simd::Set(PI / 4);
+        const Float4 weights = simd::Set(direction_error_weight);
+        const Float4 pause_scores = simd::Set(pause_score);
+        const Float4 corner_scores = simd::Set(corner_score);
+        int k = 0;
+        for (; k + kLanes <= num_keys; k += kLanes) {
+            // See MathUtils::GetAngleDiff.
+            const Float4 diff =
+                    simd::Abs(simd::Sub(directions, simd::Load(ideal_directions + k)));
+            const Float4 angle_diff = simd::Select(simd::LessEqual(pi, diff),
+                                                   simd::Sub(two_pi, diff), diff);
+            const Float4 error = simd::Min(max_error, angle_diff);
+            const Float4 direction_scores =
+                    simd::Mul(simd::Neg(simd::Mul(error, error)), weights);
+            simd::Store(simd::Add(simd::Add(direction_scores, pause_scores),
+                                  corner_scores),
+                        scores + k);
+        }
+        for (; k < num_keys; ++k) {
+            scores[k] = TransitScore(direction, ideal_directions[k],
+                                     direction_error_weight, pause_score,
+                                     corner_score);
+        }
+    }
+
+    void KeyCenters::Resize(const int keys, const int rows) {
+        num_keys = keys;
+        stride = simd::PaddedSize(keys);
+        num_rows = rows;
+        center_xs.resize(rows * stride);
+        center_ys.resize(rows * stride);
+        row_counts.resize(stride);
+        inverse_row_counts.resize(stride);
+        zero_radius_sqs.resize(stride);
+    }
+
+    void SetKeyCenters(const Keyboard& keyboard_layout,
+                       const bool is_three_decoder_enabled, KeyCenters* centers,
+                       vector<KeyId>* wide_keys) {
+        const int num_keys = keyboard_layout.num_keys();
+
+        // FOR INVISIBLE GESTURE KEYBOARD
+        // Unless the three decoder is enabled, the letter keys are aligned to a
+        // range of keyboard positions (see Keyboard::PointToKeyDistanceByRange).
+        const int keyboard_count = is_three_decoder_enabled ? 1 : 5;
+        vector<double> keyboard_range(keyboard_count);
+        double keyboard_q_center = keyboard_layout.center_ys(0);
+        double keyboard_range_step = 50; // from user study
+        for (int i = 0; i < keyboard_count; i++) {
+            keyboard_range[i] = keyboard_q_center + (i - 2) * keyboard_range_step;
+        }
+
+        centers->Resize(num_keys, keyboard_count);
+        const int stride = centers->stride;
+        wide_keys->clear();
+        // The keys with trained standard deviations and means (see MathUtils).
+        const int num_sd_keys = static_cast<int>(
+                std::min(MathUtils::sd_xs_.size(), MathUtils::sd_ys_.size()));
+        const int num_mean_keys = static_cast<int>(MathUtils::mean_xs_.size());
+        for (int k = 0; k < num_keys; ++k) {
+            const char key_code = keyboard_layout.GetKeyCode(k);
+            int row_count = 1;
+            // See MathUtils::DistanceStep. Its threshold divides and multiplies
+            // the squared distances by the standard deviations, which cancels out.
+            float zero_radius_sq = k < num_sd_keys ? 1.0f : -1.0f;
+            if (keyboard_layout.widths(k) > keyboard_layout.most_common_key_width() * 2) {
+                // The kernel does not handle the distances to the segments of wide
+                // keys, so these are updated separately.
+                wide_keys->push_back(k);
+            } else if (!is_three_decoder_enabled &&
+                       key_code <= (int) 'z' && key_code >= (int) 'a') {
+                if (k < num_mean_keys) {
+                    // See MathUtils::PointToRangeDistance.
+                    row_count = keyboard_count;
+                    for (int row = 0; row < keyboard_count; ++row) {
+                        centers->center_xs[row * stride + k] = MathUtils::mean_xs_[k];
+                        centers->center_ys[row * stride + k] =
+                                MathUtils::mean_ys_[k] + (keyboard_range[row] - 345);
+                    }
+                } else {
+                    // There are no key statistics, so the distance is 0.
+                    zero_radius_sq = std::numeric_limits<float>::infinity();
+                }
+            }
+            if (row_count == 1) {
+                // The kernel computes the distances to all of the rows, so these are
+                // filled with the key center, although only the first one is used.
+                for (int row = 0; row < keyboard_count; ++row) {
+                    centers->center_xs[row * stride + k] = keyboard_layout.center_xs(k);
+                    centers->center_ys[row * stride + k] = keyboard_layout.center_ys(k);
+                }
+            }
+            centers->row_counts[k] = row_count;
+            centers->inverse_row_counts[k] = 1.0f / row_count;
+            centers->zero_radius_sqs[k] = zero_radius_sq;
+        }
+    }
+
+    void AlignScores(const float x, const float y, const KeyCenters& centers,
+                     const float distance_weight, float* scores) {
+        const Float4 xs = simd::Set(x);
+        const Float4 ys = simd::Set(y);
+        const Float4 zeros = simd::Set(0.0f);
+        const Float4 weights = simd::Set(distance_weight);
+        const int num_keys = centers.num_keys;
+        int k = 0;
+        for (; k + kLanes <= num_keys; k += kLanes) {
+            const Float4 row_counts = simd::Load(centers.row_counts.data() + k);
+            const Float4 zero_radius_sqs =
+                    simd::Load(centers.zero_radius_sqs.data() + k);
+            Float4 total = zeros;
+            for (int row = 0; row < centers.num_rows; ++row) {
+                const int offset = row * centers.stride + k;
+                const Float4 dx =
+                        simd::Sub(xs, simd::Load(centers.center_xs.data() + offset));
+                const Float4 dy =
+                        simd::Sub(ys, simd::Load(centers.center_ys.data() + offset));
+                const Float4 distance_sqs =
+                        simd::Add(simd::Mul(dx, dx), simd::Mul(dy, dy));
+                const Float4 distances =
+                        simd::Select(simd::LessEqual(distance_sqs, zero_radius_sqs),
+                                     zeros, simd::Sqrt(distance_sqs));
+                total = simd::Add(total, simd::Select(
+                        simd::Less(simd::Set(row), row_counts), distances, zeros));
+            }
+            const Float4 distances = simd::Mul(
+                    total, simd::Load(centers.inverse_row_counts.data() + k));
+            const Float4 weighted_distances = simd::Mul(distances, weights);
+            simd::Store(simd::Neg(simd::Mul(weighted_distances, weighted_distances)),
+                        scores + k);
+        }
+        for (; k < num_keys; ++k) {
+            float total = 0;
+            for (int row = 0; row < centers.row_counts[k]; ++row) {
+                const int offset = row * centers.stride + k;
+                total += CenterDistance(x, y, centers.center_xs[offset],
+                                        centers.center_ys[offset],
+                                        centers.zero_radius_sqs[k]);
+            }
+            scores[k] = -sqr(total * centers.inverse_row_counts[k] * distance_weight);
+        }
+    }
+
+    void QuantizeScores(const float* scores, const int n, int16* quantized_scores) {
+        for (int k = 0; k < n; ++k) {
+            // Truncating after subtracting 0.5 rounds the (non-positive) scores
+            // to the nearest step.
+            const float steps = std::max(scores[k] * kInt16ScoreScale, -32768.0f);
+            quantized_scores[k] = static_cast<int16>(steps - 0.5f);
+        }
+    }
+
+}  // namespace score_kernels
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,93 @@
+// Description:
+//   Kernels for the spatial scores of a TouchSequence, which compute the scores
+//   of one touch point for all of the keys of the keyboard, four keys at a time
+//   (see simd.h). The per-key inputs are arrays indexed by key index.
+//
+//   The scores can also be stored as 16-bit fixed point numbers (see
+//   QuantizeScores), which halves the memory that the decoder reads them from.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SCORE_KERNELS_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SCORE_KERNELS_H_
+
+#include <vector>
+
+#include "base/integral_types.h"
+#include "keyboardSetting/keyboard.h"
+#include "simd.h"
+
+namespace keyboard {
+namespace decoder {
+namespace score_kernels {
+
+    // Computes the transit scores of a touch point from one key to each of the
+    // keys (see TouchSequence::transit_score), except for the score from the key
+    // to itself, which the caller has to set.
+    //
+    // Args:
+    //   direction              - The direction of the touch point.
+    //   ideal_directions       - The directions from the first key to each key.
+    //   num_keys               - The number of keys.
+    //   direction_error_weight - The weight of the squared direction error.
+    //   pause_score            - The score added for skipping a pause.
+    //   corner_score           - The score added for skipping a corner.
+    //   scores                 - Populated with the num_keys scores.
+    void TransitScores(float direction, const float* ideal_directions,
+                       int num_keys, float direction_error_weight,
+                       float pause_score, float corner_score, float* scores);
+
+    // The centers of the keys for AlignScores. The distance from a point to a
+    // key is the mean of its distances to the first row_counts[k] centers of
+    // the key, which are stored in consecutive rows of stride floats. A distance
+    // to a center whose square is at most zero_radius_sqs[k] counts as 0.
+    struct KeyCenters {
+        int num_keys = 0;
+        int stride = 0;
+        int num_rows = 0;
+        simd::AlignedFloatArray center_xs;
+        simd::AlignedFloatArray center_ys;
+        simd::AlignedFloatArray row_counts;
+        simd::AlignedFloatArray inverse_row_counts;
+        simd::AlignedFloatArray zero_radius_sqs;
+
+        // Sets the size of the centers, which need to be filled in afterwards.
+        void Resize(int keys, int rows);
+    };
+
+    // Sets the centers of the keys of the keyboard for AlignScores, as the
+    // decoder aligns them with or without the three decoder. The distances to
+    // keys wider than twice the most common key width are not handled by the
+    // kernel (see Keyboard::PointToKeyDistanceByIndex), so these keys are
+    // returned in wide_keys instead.
+    void SetKeyCenters(const Keyboard& keyboard_layout,
+                       bool is_three_decoder_enabled, KeyCenters* centers,
+                       vector<KeyId>* wide_keys);
+
+    // Computes the alignment scores of a touch point for each key, as
+    // -sqr(distance * distance_weight).
+    //
+    // Args:
+    //   x, y            - The coordinates of the touch point.
+    //   centers         - The centers of the keys.
+    //   distance_weight - The weight of the distance.
+    //   scores          - Populated with the centers.num_keys scores.
+    void AlignScores(float x, float y, const KeyCenters& centers,
+                     float distance_weight, float* scores);
+
+    // The number of steps per unit of score of the 16-bit fixed point scores.
+    static constexpr float kInt16ScoreScale = 1024.0f;
+
+    // Converts scores (which are never positive) to 16-bit fixed point, rounding
+    // them to the nearest multiple of 1 / kInt16ScoreScale. Scores below
+    // -32768 / kInt16ScoreScale (i.e., -32) are clamped.
+    void QuantizeScores(const float* scores, int n, int16* quantized_scores);
+
+    // Returns the score of a 16-bit fixed point score.
+    inline float WidenScore(const int16 quantized_score) {
+        return quantized_score * (1.0f / kInt16ScoreScale);
+    }
+
+}  // namespace score_kernels
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SCORE_KERNELS_H_
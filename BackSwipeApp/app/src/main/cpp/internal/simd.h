@@ -0,0 +1,215 @@
+// Description:
+//   A minimal portable layer over 4-wide float vectors, for the kernels that
+//   compute the spatial scores of a touch sequence (see score-kernels.h). It
+//   maps to NEON on ARM and to SSE2 on x86, which every Android ABI of these
+//   architectures provides, and falls back to plain scalar code elsewhere.
+//
+//   Only the operations that the kernels need are provided. All of them are
+//   rounded exactly like the corresponding scalar float operations, so the
+//   kernels give the same results as scalar code evaluating the same
+//   expressions (as long as the compiler does not contract them into fused
+//   multiply-adds).
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SIMD_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SIMD_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "base/logging.h"
+#include "base/macros.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define KEYBOARD_DECODER_SIMD_NEON 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define KEYBOARD_DECODER_SIMD_SSE2 1
+#endif
+
+namespace keyboard {
+namespace decoder {
+namespace simd {
+
+    // The number of floats in a vector.
+    static constexpr int kLanes = 4;
+
+    // The alignment (in bytes) of the arrays that the kernels write, which is a
+    // cache line on the supported CPUs.
+    static constexpr int kAlignment = 64;
+
+    // Returns size rounded up to a whole number of aligned blocks of floats.
+    inline int PaddedSize(const int size) {
+        const int block = kAlignment / sizeof(float);
+        return (size + block - 1) / block * block;
+    }
+
+    // An array of trivially copyable values aligned to kAlignment bytes, which
+    // keeps its capacity (and so its memory) when it is shrunk, for reusing it
+    // across decodes.
+    template <typename T>
+    class AlignedArray {
+    public:
+        AlignedArray() : data_(nullptr), size_(0), capacity_(0) {}
+        ~AlignedArray() { free(data_); }
+
+        // Resizes the array, keeping the first min(size, size()) values. New
+        // values are not initialized.
+        void resize(const int size) {
+            if (size > capacity_) {
+                const int capacity = std::max(size, 2 * capacity_);
+                void* data = nullptr;
+                CHECK_EQ(posix_memalign(&data, kAlignment, capacity * sizeof(T)), 0);
+                if (size_ > 0) {
+                    memcpy(data, data_, size_ * sizeof(T));
+                }
+                free(data_);
+                data_ = static_cast<T*>(data);
+                capacity_ = capacity;
+            }
+            size_ = size;
+        }
+
+        int size() const { return size_; }
+        T* data() { return data_; }
+        const T* data() const { return data_; }
+        T& operator[](const int i) { return data_[i]; }
+        const T& operator[](const int i) const { return data_[i]; }
+
+    private:
+        T* data_;
+        int size_;
+        int capacity_;
+
+        DISALLOW_COPY_AND_ASSIGN(AlignedArray);
+    };
+
+    typedef AlignedArray<float> AlignedFloatArray;
+
+#if defined(KEYBOARD_DECODER_SIMD_NEON)
+
+    typedef float32x4_t Float4;
+    typedef uint32x4_t Mask4;
+
+    inline Float4 Set(const float value) { return vdupq_n_f32(value); }
+    inline Float4 Load(const float* values) { return vld1q_f32(values); }
+    inline void Store(const Float4 v, float* values) { vst1q_f32(values, v); }
+    inline Float4 Add(const Float4 a, const Float4 b) { return vaddq_f32(a, b); }
+    inline Float4 Sub(const Float4 a, const Float4 b) { return vsubq_f32(a, b); }
+    inline Float4 Mul(const Float4 a, const Float4 b) { return vmulq_f32(a, b); }
+    inline Float4 Neg(const Float4 a) { return vnegq_f32(a); }
+    inline Float4 Abs(const Float4 a) { return vabsq_f32(a); }
+    inline Mask4 Less(const Float4 a, const Float4 b) { return vcltq_f32(a, b); }
+    inline Mask4 LessEqual(const Float4 a, const Float4 b) { return vcleq_f32(a, b); }
+    // Returns the lanes of a where the mask is set, and those of b elsewhere.
+    inline Float4 Select(const Mask4 mask, const Float4 a, const Float4 b) {
+        return vbslq_f32(mask, a, b);
+    }
+    inline Float4 Sqrt(const Float4 a) {
+#if defined(__aarch64__)
+        return vsqrtq_f32(a);
+#else
+        // ARMv7 NEON only has a reciprocal square root estimate, which is not
+        // rounded like sqrt.
+        float values[kLanes];
+        vst1q_f32(values, a);
+        for (int i = 0; i < kLanes; ++i) {
+            values[i] = std::sqrt(values[i]);
+        }
+        return vld1q_f32(values);
+#endif
+    }
+
+#elif defined(KEYBOARD_DECODER_SIMD_SSE2)
+
+    typedef __m128 Float4;
+    typedef __m128 Mask4;
+
+    inline Float4 Set(const float value) { return _mm_set1_ps(value); }
+    inline Float4 Load(const float* values) { return _mm_loadu_ps(values); }
+    inline void Store(const Float4 v, float* values) { _mm_storeu_ps(values, v); }
+    inline Float4 Add(const Float4 a, const Float4 b) { return _mm_add_ps(a, b); }
+    inline Float4 Sub(const Float4 a, const Float4 b) { return _mm_sub_ps(a, b); }
+    inline Float4 Mul(const Float4 a, const Float4 b) { return _mm_mul_ps(a, b); }
+    inline Float4 Neg(const Float4 a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    inline Float4 Abs(const Float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    inline Mask4 Less(const Float4 a, const Float4 b) { return _mm_cmplt_ps(a, b); }
+    inline Mask4 LessEqual(const Float4 a, const Float4 b) { return _mm_cmple_ps(a, b); }
+    // Returns the lanes of a where the mask is set, and those of b elsewhere.
+    inline Float4 Select(const Mask4 mask, const Float4 a, const Float4 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+    inline Float4 Sqrt(const Float4 a) { return _mm_sqrt_ps(a); }
+
+#else
+
+    struct Float4 {
+        float v[kLanes];
+    };
+    struct Mask4 {
+        bool v[kLanes];
+    };
+
+    inline Float4 Set(const float value) {
+        return Float4{{value, value, value, value}};
+    }
+    inline Float4 Load(const float* values) {
+        return Float4{{values[0], values[1], values[2], values[3]}};
+    }
+    inline void Store(const Float4 a, float* values) {
+        for (int i = 0; i < kLanes; ++i) values[i] = a.v[i];
+    }
+#define KEYBOARD_DECODER_SIMD_LANEWISE(expression) \
+    Float4 result;                                 \
+    for (int i = 0; i < kLanes; ++i) {             \
+        result.v[i] = (expression);                \
+    }                                              \
+    return result
+    inline Float4 Add(const Float4 a, const Float4 b) {
+        KEYBOARD_DECODER_SIMD_LANEWISE(a.v[i] + b.v[i]);
+    }
+    inline Float4 Sub(const Float4 a, const Float4 b) {
+        KEYBOARD_DECODER_SIMD_LANEWISE(a.v[i] - b.v[i]);
+    }
+    inline Float4 Mul(const Float4 a, const Float4 b) {
+        KEYBOARD_DECODER_SIMD_LANEWISE(a.v[i] * b.v[i]);
+    }
+    inline Float4 Neg(const Float4 a) { KEYBOARD_DECODER_SIMD_LANEWISE(-a.v[i]); }
+    inline Float4 Abs(const Float4 a) {
+        KEYBOARD_DECODER_SIMD_LANEWISE(std::fabs(a.v[i]));
+    }
+    inline Float4 Sqrt(const Float4 a) {
+        KEYBOARD_DECODER_SIMD_LANEWISE(std::sqrt(a.v[i]));
+    }
+    // Returns the lanes of a where the mask is set, and those of b elsewhere.
+    inline Float4 Select(const Mask4 mask, const Float4 a, const Float4 b) {
+        KEYBOARD_DECODER_SIMD_LANEWISE(mask.v[i] ? a.v[i] : b.v[i]);
+    }
+#undef KEYBOARD_DECODER_SIMD_LANEWISE
+    inline Mask4 Less(const Float4 a, const Float4 b) {
+        Mask4 result;
+        for (int i = 0; i < kLanes; ++i) result.v[i] = a.v[i] < b.v[i];
+        return result;
+    }
+    inline Mask4 LessEqual(const Float4 a, const Float4 b) {
+        Mask4 result;
+        for (int i = 0; i < kLanes; ++i) result.v[i] = a.v[i] <= b.v[i];
+        return result;
+    }
+
+#endif
+
+    // Returns the lower of the lanes of a and b, like std::min(a, b) (i.e., a if
+    // they are equal).
+    inline Float4 Min(const Float4 a, const Float4 b) {
+        return Select(Less(b, a), b, a);
+    }
+
+}  // namespace simd
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_SIMD_H_
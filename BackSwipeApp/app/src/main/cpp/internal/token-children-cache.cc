@@ -0,0 +1,118 @@
+#include "token-children-cache.h"
+
+#include <algorithm>
+
+namespace keyboard {
+namespace decoder {
+
+    TokenChildrenCache::TokenChildrenCache(DecoderArena* arena,
+                                           const LexiconChildrenCache* shared_cache)
+            : arena_(arena),
+              shared_cache_(shared_cache),
+              entries_(),
+              slots_(),
+              slot_mask_(0),
+              generation_(1),
+              child_nodes_(),
+              stats_() {
+        Rehash(kMinSlotCount);
+    }
+
+    ChildGroupSpan ExtractChildGroups(const CodepointNodeSpan& nodes,
+                                      DecoderArena* arena,
+                                      vector<CodepointNode>* child_nodes) {
+        const int group_count = ExtractChildNodesByCodepoint(nodes, child_nodes);
+        CodepointNode* nodes_copy = arena->NewArray<CodepointNode>(child_nodes->size());
+        std::copy(child_nodes->begin(), child_nodes->end(), nodes_copy);
+        ChildGroup* groups = arena->NewArray<ChildGroup>(group_count);
+        GroupChildNodesByCodepoint(nodes_copy, child_nodes->size(), groups);
+        return ChildGroupSpan(groups, group_count);
+    }
+
+    int TokenChildrenCache::GetChildrenId(const CodepointNodeSpan& nodes) {
+        DCHECK(!nodes.empty());
+        const LexiconInterface* lexicon = nodes[0].lexicon();
+        const uint64 node_id = nodes[0].GetNodeData();
+        const int slot = FindSlot(lexicon, node_id);
+        if (slots_[slot].generation == generation_) {
+            ++stats_.session_hits;
+            return slots_[slot].id;
+        }
+        return AddEntry(slot, lexicon, node_id, ExtractChildren(nodes));
+    }
+
+    bool TokenChildrenCache::Find(const CodepointNodeSpan& nodes,
+                                  ChildGroupSpan* children) const {
+        DCHECK(!nodes.empty());
+        const int slot = FindSlot(nodes[0].lexicon(), nodes[0].GetNodeData());
+        if (slots_[slot].generation != generation_) {
+            return false;
+        }
+        *children = entries_[slots_[slot].id].children;
+        return true;
+    }
+
+    int TokenChildrenCache::AddChildren(const CodepointNodeSpan& nodes,
+                                        const ChildGroupSpan& children) {
+        DCHECK(!nodes.empty());
+        const LexiconInterface* lexicon = nodes[0].lexicon();
+        const uint64 node_id = nodes[0].GetNodeData();
+        const int slot = FindSlot(lexicon, node_id);
+        if (slots_[slot].generation == generation_) {
+            return slots_[slot].id;
+        }
+        return AddEntry(slot, lexicon, node_id, children);
+    }
+
+    int TokenChildrenCache::FindSlot(const LexiconInterface* lexicon,
+                                     const uint64 node_id) const {
+        int slot = Hash(lexicon, node_id) & slot_mask_;
+        for (; slots_[slot].generation == generation_;
+               slot = (slot + 1) & slot_mask_) {
+            const Entry& entry = entries_[slots_[slot].id];
+            if (entry.node_id == node_id && entry.lexicon == lexicon) {
+                break;
+            }
+        }
+        return slot;
+    }
+
+    int TokenChildrenCache::AddEntry(const int slot,
+                                     const LexiconInterface* lexicon,
+                                     const uint64 node_id,
+                                     const ChildGroupSpan& children) {
+        const int id = entries_.size();
+        entries_.push_back({lexicon, node_id, children});
+        slots_[slot] = {generation_, id};
+        if (entries_.size() * 2 > slots_.size()) {
+            Rehash(slots_.size() * 2);
+        }
+        return id;
+    }
+
+    ChildGroupSpan TokenChildrenCache::ExtractChildren(const CodepointNodeSpan& nodes) {
+        ChildGroupSpan children;
+        if (shared_cache_ != nullptr && nodes.size() == 1 &&
+            shared_cache_->Find(nodes[0], &children)) {
+            ++stats_.shared_hits;
+            return children;
+        }
+        ++stats_.misses;
+        return ExtractChildGroups(nodes, arena_, &child_nodes_);
+    }
+
+    void TokenChildrenCache::Rehash(const int slot_count) {
+        slots_.assign(slot_count, {0, 0});
+        slot_mask_ = slot_count - 1;
+        generation_ = 1;
+        for (size_t id = 0; id < entries_.size(); ++id) {
+            int slot = Hash(entries_[id].lexicon, entries_[id].node_id) & slot_mask_;
+            while (slots_[slot].generation == generation_) {
+                slot = (slot + 1) & slot_mask_;
+            }
+            slots_[slot] = {generation_, static_cast<int32>(id)};
+        }
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,169 @@
+// Description:
+//   The child nodes of the tokens expanded during a decode, grouped by their
+//   codepoint. Tokens reference their children by an id into this cache, which
+//   keeps the tokens trivially copyable and lets every token (and every copy of
+//   a token) with the same lexicon nodes share a single extraction.
+//
+//   The cache is owned by a single decoding session and cleared between decodes,
+//   together with the session's DecoderArena that holds the children. Children
+//   in the model's shared LexiconChildrenCache are referenced rather than
+//   extracted.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_TOKEN_CHILDREN_CACHE_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_TOKEN_CHILDREN_CACHE_H_
+
+#include <vector>
+
+#include "base/hash128to64.h"
+#include "base/int128.h"
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/macros.h"
+#include "codepoint-node.h"
+#include "decoder-arena.h"
+#include "lexicon-children-cache.h"
+
+namespace keyboard {
+namespace decoder {
+
+    // Extracts the children of the given (non-empty) nodes from the lexicons into
+    // the given arena, using child_nodes as scratch space. The returned span is
+    // valid until the arena is reset.
+    ChildGroupSpan ExtractChildGroups(const CodepointNodeSpan& nodes,
+                                      DecoderArena* arena,
+                                      vector<CodepointNode>* child_nodes);
+
+    class TokenChildrenCache {
+    public:
+        // Counters for monitoring the cache. These are cumulative (i.e., not reset
+        // by Clear()) until ResetStats() is called.
+        struct Stats {
+            // The number of lookups for children already cached by the session.
+            uint64 session_hits = 0;
+            // The number of lookups served by the shared LexiconChildrenCache.
+            uint64 shared_hits = 0;
+            // The number of lookups that had to extract the children from the
+            // lexicons.
+            uint64 misses = 0;
+
+            void Add(const Stats& stats) {
+                session_hits += stats.session_hits;
+                shared_hits += stats.shared_hits;
+                misses += stats.misses;
+            }
+        };
+
+        // Creates an empty cache that allocates the children from the given arena,
+        // and first looks for them in the given shared cache (if not null). Both
+        // must outlive the cache. The arena must not be reset without also clearing
+        // the cache.
+        TokenChildrenCache(DecoderArena* arena,
+                           const LexiconChildrenCache* shared_cache);
+
+        // Returns the id of the children of the given (non-empty) nodes, extracting
+        // them if this is the first request for these nodes since the last
+        // Clear(). The id is only valid until the next call to Clear().
+        int GetChildrenId(const CodepointNodeSpan& nodes);
+
+        // Looks up the children of the given nodes without extracting them. Returns
+        // false if they have not been extracted since the last Clear(). Like
+        // children(), this may be called from several threads at once, as long as
+        // the cache is not modified in the meantime.
+        bool Find(const CodepointNodeSpan& nodes, ChildGroupSpan* children) const;
+
+        // Returns the id of the children of the given nodes, which have been
+        // extracted elsewhere (e.g., by a thread expanding part of the beam). If the
+        // cache already holds children for the nodes, the given ones are ignored.
+        // Otherwise they must remain valid until the next call to Clear().
+        int AddChildren(const CodepointNodeSpan& nodes,
+                        const ChildGroupSpan& children);
+
+        // Returns the children for the given id. The returned span and the node
+        // spans it contains remain valid until the next call to Clear(), even if
+        // more children are extracted in the meantime.
+        ChildGroupSpan children(const int id) const {
+            DCHECK_GE(id, 0);
+            DCHECK_LT(id, static_cast<int>(entries_.size()));
+            return entries_[id].children;
+        }
+
+        // The number of extracted children since the last Clear().
+        int size() const { return entries_.size(); }
+
+        // Removes all children in O(1), keeping the id table for reuse.
+        void Clear() {
+            entries_.clear();
+            if (++generation_ == 0) {
+                for (auto& slot : slots_) {
+                    slot.generation = 0;
+                }
+                generation_ = 1;
+            }
+        }
+
+        const Stats& stats() const { return stats_; }
+        void ResetStats() { stats_ = Stats(); }
+
+        // Adds the counters of lookups done outside of the cache (e.g., by a thread
+        // expanding part of the beam with Find).
+        void AddStats(const Stats& stats) { stats_.Add(stats); }
+
+    private:
+        struct Entry {
+            // The first node of the token, which uniquely identifies the token's
+            // nodes, since the remaining nodes (if any) are for the same prefix in
+            // the other lexicons.
+            const LexiconInterface* lexicon;
+            uint64 node_id;
+            ChildGroupSpan children;
+        };
+
+        // A slot of the open-addressing table that maps nodes to entries.
+        struct Slot {
+            // The slot is empty unless this matches generation_.
+            uint32 generation;
+            int32 id;
+        };
+
+        static constexpr int kMinSlotCount = 64;
+
+        static uint64 Hash(const LexiconInterface* lexicon, const uint64 node_id) {
+            return Hash128to64(uint128(reinterpret_cast<uintptr_t>(lexicon), node_id));
+        }
+
+        // Returns the slot of the given node, or the empty slot where it belongs.
+        int FindSlot(const LexiconInterface* lexicon, uint64 node_id) const;
+
+        // Adds an entry for the given node in the given empty slot, and returns its
+        // id.
+        int AddEntry(int slot, const LexiconInterface* lexicon, uint64 node_id,
+                     const ChildGroupSpan& children);
+
+        // Extracts the children of the given nodes into the arena.
+        ChildGroupSpan ExtractChildren(const CodepointNodeSpan& nodes);
+
+        // Rebuilds the slot array with the given (power of two) slot count.
+        void Rehash(int slot_count);
+
+        DecoderArena* const arena_;
+        const LexiconChildrenCache* const shared_cache_;
+
+        // The children, indexed by id.
+        std::vector<Entry> entries_;
+
+        std::vector<Slot> slots_;
+        int slot_mask_;
+        uint32 generation_;
+
+        // Scratch space for extracting the children of a token.
+        std::vector<CodepointNode> child_nodes_;
+
+        Stats stats_;
+
+        DISALLOW_COPY_AND_ASSIGN(TokenChildrenCache);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_TOKEN_CHILDREN_CACHE_H_
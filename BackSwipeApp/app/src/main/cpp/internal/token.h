@@ -8,9 +8,8 @@
 #ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_TOKEN_H_
 #define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_TOKEN_H_
 
-#include <map>
-#include <memory>
-#include <vector>
+#include <algorithm>
+#include <type_traits>
 
 #include "base/integral_types.h"
 #include "alignment.h"
@@ -18,6 +17,7 @@
 #include "keyboardSetting/keyboard.h"
 #include "DecoderParams.h"
 #include "base/constants.h"
+#include "base/logging.h"
 
 namespace keyboard {
 namespace decoder {
@@ -28,74 +28,62 @@ namespace decoder {
     // likelihood) for a given search position (node) in the prefix trie. Tokens can
     // be "passed" to connected child nodes (i.e., possible next letters), which
     // also advances the alignment of the gesture to the new character.
+    //
+    // Tokens are copied very frequently during decoding (into the search space, the
+    // beams and the results), so they are kept trivially copyable and within a
+    // single cache line: the lexicon nodes are stored inline, the two alignments
+    // are stored as plain fields, and the children are referenced by an id into
+    // the decoding session's TokenChildrenCache.
     class Token {
     public:
+        // The maximum number of lexicon nodes in a token, i.e., the number of
+        // lexicons that can be decoded simultaneously.
+        static constexpr int kMaxNodes = 1;
+
+        // The children_id of a token whose children have not been extracted yet.
+        static constexpr int32 kNoChildren = -1;
+
         // Default constructor. Note that a token created by this constructor is not
         // usable since it does not reference any lexical nodes. Requires a call to
         // InitializeAsRoot, InitializeAsChild, or InitializeAsNextTerm.
         Token()
                 : nodes_(),
-                  aligned_key_(-1),
-                  prev_aligned_key_(-1),
-                  omitted_key_(-1),
+                  cur_align_score_(0),
+                  cur_transit_score_(0),
+                  next_align_score_(0),
+                  next_transit_score_(0),
                   prefix_lm_score_(0),
                   prev_lm_score_(0),
                   word_history_id_(-1),
-                  cur_alignment_(),
-                  next_alignment_(),
-                  children_(nullptr) {}
+                  children_id_(kNoChildren),
+                  cur_index_(-1),
+                  next_index_(-1),
+                  aligned_key_(-1),
+                  prev_aligned_key_(-1) {}
 
         // Create a token for the given nodes, copy properties from the parent
         // node, and set the aligned key to the given key id.
-        Token(const vector<CodepointNode>& nodes, const Token& parent,
+        Token(const CodepointNodeSpan& nodes, const Token& parent,
               const int aligned_key, const DecoderParams& params)
-                : nodes_(nodes),
-                  aligned_key_(aligned_key),
-                  prev_aligned_key_(parent.prev_aligned_key_),
-                  omitted_key_(parent.omitted_key_),
-                  prefix_lm_score_(parent.prefix_lm_score_),
-                  prev_lm_score_(parent.prev_lm_score_),
-                  word_history_id_(parent.word_history_id_),
-                  cur_alignment_(parent.cur_alignment_),
-                  next_alignment_(parent.next_alignment_),
-                  children_(nullptr) {
+                : Token(parent) {
+            set_nodes(nodes);
+            aligned_key_ = aligned_key;
+            children_id_ = kNoChildren;
             UpdatePrefixLmScore(params);
         }
 
-        // Copy constructor.
-        Token(const Token& token)
-                : nodes_(token.nodes_),
-                  aligned_key_(token.aligned_key_),
-                  prev_aligned_key_(token.prev_aligned_key_),
-                  omitted_key_(token.omitted_key_),
-                  prefix_lm_score_(token.prefix_lm_score_),
-                  prev_lm_score_(token.prev_lm_score_),
-                  word_history_id_(token.word_history_id_),
-                  cur_alignment_(token.cur_alignment_),
-                  next_alignment_(token.next_alignment_),
-                  children_(token.children_) {}
-
         // Initializes the token as the root of the lexical trie, with no key, empty
-        // scores, and empty alignments. If the given children is not nullptr, the
-        // token will use it instead of extracting children from nodes.
-        void InitializeAsRoot(
-                const vector<CodepointNode>& nodes, const DecoderParams& params) {
-            nodes_ = nodes;
-            aligned_key_ = -1;
-            prev_aligned_key_ = -1;
-            omitted_key_ = -1;
-            prefix_lm_score_ = 0;
-            prev_lm_score_ = 0;
-            word_history_id_ = -1;
-            cur_alignment_.Clear();
-            next_alignment_.Clear();
-            children_ = nullptr;
+        // scores, and empty alignments.
+        void InitializeAsRoot(const CodepointNodeSpan& nodes,
+                              const DecoderParams& params) {
+            *this = Token();
+            set_nodes(nodes);
             UpdatePrefixLmScore(params);
         }
 
         // Initialize this token as a lexical child of the parent token.
         // Copies properties from the parent node.
-        void InitializeAsChild(const vector<CodepointNode>& nodes,
+        void InitializeAsChild(const CodepointNodeSpan& nodes,
                                const Token& parent, const int aligned_key,
                                const DecoderParams& params);
 
@@ -129,19 +117,25 @@ namespace decoder {
             // If the alignment of this expansion is better than existing alignment, we
             // need to update token to new alignment. Otherwise, we can skip this
             // expansion.
-            if (next_alignment_.BestScore() < parent.next_alignment_.BestScore()) {
-                next_alignment_ = parent.next_alignment_;
+            if (next_alignment().BestScore() < parent.next_alignment().BestScore()) {
+                set_next_alignment(parent.next_alignment());
             }
 
-            if (cur_alignment_.BestScore() <= parent.cur_alignment_.BestScore()) {
-                cur_alignment_ = parent.cur_alignment_;
+            if (alignment().BestScore() <= parent.alignment().BestScore()) {
+                set_alignment(parent.alignment());
                 return true;
             }
             return false;
         }
 
         // The nodes represented by this token.
-        const vector<CodepointNode>* nodes() const { return &nodes_; }
+        CodepointNodeSpan nodes() const {
+            int size = 0;
+            while (size < kMaxNodes && nodes_[size].lexicon() != nullptr) {
+                ++size;
+            }
+            return CodepointNodeSpan(nodes_, size);
+        }
 
         // The last key aligned by this token, referenced by key index (see
         // Keyboard::GetKeyIndex).
@@ -153,48 +147,42 @@ namespace decoder {
         // Keyboard::GetKeyIndex).
         int prev_aligned_key() const { return prev_aligned_key_; }
 
-        // The recently omitted code (if any). This is used to handle transpositions,
-        // where the user types keys out of order.
-        int omitted_key() const { return omitted_key_; }
-
-        void set_omitted_key(KeyId key) { omitted_key_ = key; }
+        // The id of this token's children in the decoding session's
+        // TokenChildrenCache, or kNoChildren if they have not been extracted yet.
+        // Copies of a token share the same children.
+        int children_id() const { return children_id_; }
 
-        // Returns the child nodes for all of the nodes in this Token, mapped by
-        // their codepoints.
-        const map<char32, vector<CodepointNode>>& children() {
-            ExtractChildrenIfNeeded();
-            return *children_;
-        }
-
-        // Extract the child nodes for this token if it hasn't been done yet.
-        void ExtractChildrenIfNeeded();
+        void set_children_id(const int children_id) { children_id_ = children_id; }
 
         // The index in the touch sequence for the current alignment.
-        int index() const { return cur_alignment_.index(); }
+        int index() const { return cur_index_; }
 
-        int next_index() const { return next_alignment_.index(); }
+        int next_index() const { return next_index_; }
 
         // The total score for the token for ranking the search beam.
         float TotalScore() const { return spatial_score() + lm_score(); }
 
         // The next index score for the token for ranking the search beam.
         float NextTotalScore() const {
-            return next_alignment_.BestScore() + lm_score();
+            return next_alignment().BestScore() + lm_score();
         }
 
         // The align score for the token for ranking the search beam.
-        float align_score() const { return cur_alignment_.align_score(); }
+        float align_score() const { return cur_align_score_; }
 
         // Sets the align score for the token for ranking the search beam.
         void set_align_score(float score) {
-            cur_alignment_ = {cur_alignment_.index(), score, NEG_INF};
+            cur_align_score_ = score;
+            cur_transit_score_ = NEG_INF;
         }
 
         // The transit score for the token for ranking the search beam.
-        float transit_score() const { return cur_alignment_.transit_score(); }
+        float transit_score() const { return cur_transit_score_; }
 
         // The spatial score for the token for ranking the search beam.
-        float spatial_score() const { return cur_alignment_.BestScore(); }
+        float spatial_score() const {
+            return std::max(cur_align_score_, cur_transit_score_);
+        }
 
         // The lm score of the token.
         float lm_score() const { return prev_lm_score() + prefix_lm_score(); }
@@ -205,21 +193,34 @@ namespace decoder {
 
         // Adds an arbitrary spatial score adjustment to the current alignment.
         // This is used, for example, to penalize certain types of corrections.
-        void AddScore(float score) { cur_alignment_.AddScore(score); }
+        void AddScore(float score) {
+            cur_align_score_ += score;
+            cur_transit_score_ += score;
+        }
 
-        // Returns a const pointer to the current alignment.
-        const Alignment* alignment() const { return &cur_alignment_; }
+        // Returns the current alignment.
+        Alignment alignment() const {
+            return {cur_index_, cur_align_score_, cur_transit_score_};
+        }
 
-        // Returns a mutable pointer to the current alignment.
-        Alignment* mutable_alignment() { return &cur_alignment_; }
+        // Returns the best next alignment. This will replace the current alignment
+        // when the decoding advances to the next touch point.
+        Alignment next_alignment() const {
+            return {next_index_, next_align_score_, next_transit_score_};
+        }
 
-        // Returns a const pointer to the best next alignment. This will replace
-        // the current alignment when the decoding advances to the next touch
-        // point.
-        const Alignment* next_alignment() const { return &next_alignment_; }
+        // Sets the best next alignment.
+        void set_next_alignment(const Alignment& alignment) {
+            next_index_ = alignment.index();
+            next_align_score_ = alignment.align_score();
+            next_transit_score_ = alignment.transit_score();
+        }
 
-        // Returns a mutable pointer to the best next alignment.
-        Alignment* mutable_next_alignment() { return &next_alignment_; }
+        // Sets the key the token is in transit from, i.e., the key of the token
+        // whose alignment the next alignment continues.
+        void set_prev_aligned_key(KeyId prev_aligned_key) {
+            prev_aligned_key_ = prev_aligned_key;
+        }
 
         // The sum of the language model (e.g., n-gram) scores for the previous
         // decoded terms, if any.
@@ -231,14 +232,15 @@ namespace decoder {
         // Replace the current alignment with the next alignment and clear the next
         // alignment's scores.
         void AdvanceToNextAlignment() {
-            cur_alignment_ = next_alignment_;
-            next_alignment_.InvalidateScore();
+            set_alignment(next_alignment());
+            InvalidateNextScores();
         }
 
         // Invalidate the scores for this token.
         void InvalidateScores() {
-            cur_alignment_.InvalidateScore();
-            next_alignment_.InvalidateScore();
+            cur_align_score_ = NEG_INF;
+            cur_transit_score_ = NEG_INF;
+            InvalidateNextScores();
         }
 
         bool has_prev_terms() const { return word_history_id_ >= 0; }
@@ -248,20 +250,26 @@ namespace decoder {
         // multiple lexicons), this method takes the maximum. The prefix logp is then
         // weighted by the prefix_lm_weight from the params.
         void UpdatePrefixLmScore(const DecoderParams& params) {
-            prefix_lm_score_ = NEG_INF;
-            for (const CodepointNode& node : nodes_) {
+            prefix_lm_score_ = PrefixLmScore(nodes(), params);
+        }
+
+        // Returns the prefix lm score of a token at the given lexicon nodes.
+        static float PrefixLmScore(const CodepointNodeSpan& nodes,
+                                   const DecoderParams& params) {
+            float prefix_lm_score = NEG_INF;
+            for (const CodepointNode& node : nodes) {
                 const float score = node.PrefixLogProb();
-                if (score > prefix_lm_score_) {
-                    prefix_lm_score_ = score;
+                if (score > prefix_lm_score) {
+                    prefix_lm_score = score;
                 }
             }
-            prefix_lm_score_ = prefix_lm_score_ * params.prefix_lm_weight;
+            return prefix_lm_score * params.prefix_lm_weight;
         }
 
         // Returns whether or not this token is at a terminal (i.e., at least one
         // of the lexicon nodes is at the end of a complete term).
         bool IsTerminal() const {
-            for (const CodepointNode& node : nodes_) {
+            for (const CodepointNode& node : nodes()) {
                 if (node.IsEndOfTerm()) {
                     return true;
                 }
@@ -272,30 +280,53 @@ namespace decoder {
     protected:
         // The following are protected instead of private to allow exposing them for
         // testing purposes.
-        void set_prev_aligned_key(KeyId prev_aligned_key) {
-            prev_aligned_key_ = prev_aligned_key;
+        void set_alignment(const Alignment& alignment) {
+            cur_index_ = alignment.index();
+            cur_align_score_ = alignment.align_score();
+            cur_transit_score_ = alignment.transit_score();
+        }
+
+        void InvalidateNextScores() {
+            next_align_score_ = NEG_INF;
+            next_transit_score_ = NEG_INF;
+        }
+
+        // Copies the given nodes into the inline node array. Unused entries are
+        // left with a null lexicon.
+        void set_nodes(const CodepointNodeSpan& nodes) {
+            DCHECK_LE(nodes.size(), kMaxNodes);
+            for (int i = 0; i < kMaxNodes; ++i) {
+                nodes_[i] = i < nodes.size() ? nodes[i] : CodepointNode();
+            }
         }
 
         // These variables are documented in the comments for their accessor methods
-        vector<CodepointNode> nodes_;
+        CodepointNode nodes_[kMaxNodes];
 
-        KeyId aligned_key_;
-        KeyId prev_aligned_key_;
-        KeyId omitted_key_;
+        // The current and next alignments. These are stored field by field rather
+        // than as two Alignments, which would add 8 bytes of padding.
+        float cur_align_score_;
+        float cur_transit_score_;
+        float next_align_score_;
+        float next_transit_score_;
 
         float prefix_lm_score_;
         float prev_lm_score_;
 
-        int word_history_id_;
+        int32 word_history_id_;
+        int32 children_id_;
 
-        Alignment cur_alignment_;
-        Alignment next_alignment_;
+        int16 cur_index_;
+        int16 next_index_;
 
-        // Use a shared_ptr because the children map can be shared among multiple
-        // tokens.
-        std::shared_ptr<map<char32, vector<CodepointNode>>> children_;
+        KeyId aligned_key_;
+        KeyId prev_aligned_key_;
     };
 
+    static_assert(std::is_trivially_copyable<Token>::value,
+                  "Token must be trivially copyable.");
+    static_assert(sizeof(Token) <= 64, "Token must fit into a cache line.");
+
 // Orders Tokens by expected end_of_alignment score, returns true if the left
 // token has a greater expected end_of_input score than the right one.
     struct TokenGreater {
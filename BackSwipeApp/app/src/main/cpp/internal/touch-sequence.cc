@@ -1,12 +1,14 @@
 #include "touch-sequence.h"
 
 #include <algorithm>
+#include <limits>
 
 #include "base/stringprintf.h"
 #include "keyboardSetting/keyboard.h"
 #include "base/latinime-charconverter.h"
 #include "math-utils.h"
 #include "DecoderParams.h"
+#include "align-score-grid.h"
 //#include "inputmethod/keyboard/decoder/proto/touch-points.pb.h"
 #include "base/constants.h"
 
@@ -15,21 +17,43 @@ namespace decoder {
 
     using base::StringPrintf;
 
-    TouchSequence::TouchSequence(const vector<int>& xs, vector<int>& ys, vector<int>& times, const int pointer_id,
+    TouchSequence::TouchSequence(const vector<int>& xs, const vector<int>& ys,
+                                 const vector<int>& times, const int pointer_id,
                                  const float gesture_sample_dist)
             : is_gesture_(true),
               pointer_id_(pointer_id),
-              last_update_size_(0) {
+              last_update_size_(0),
+              resampled_size_(0),
+              is_resampling_(false),
+              num_keys_(0),
+              key_stride_(0),
+              use_int16_scores_(false),
+              align_score_grid_(nullptr),
+              keyboard_(nullptr),
+              transit_row_capacity_(0),
+              computed_transit_scores_(0),
+              transit_score_entries_(0) {
+        ExtendTouchPoints(xs, ys, times, /* is_final = */ true, gesture_sample_dist);
+    }
+
+    void TouchSequence::ExtendTouchPoints(const vector<int>& xs,
+                                          const vector<int>& ys,
+                                          const vector<int>& times,
+                                          const bool is_final,
+                                          const float gesture_sample_dist) {
         const float sample_dist = is_gesture_ ? gesture_sample_dist : 0.0;
+        const bool is_first_batch = xs_.empty();
         for (int i = 0; i < xs.size(); ++i) {
             TouchAction action = TOUCH_MOVE;
-            if(i == 0){
+            if (i == 0 && is_first_batch) {
                 action = TOUCH_DOWN;
-            }else if(i == xs.size() - 1){
+            } else if (is_final && i == xs.size() - 1) {
                 action = TOUCH_UP;
             }
-            AddPoint(action, xs[i], ys[i],
-                         times[i], sample_dist);
+            AddPoint(action, xs[i], ys[i], times[i], sample_dist);
+        }
+        if (is_final && xs.empty() && !actions_.empty()) {
+            actions_.back() = TOUCH_UP;
         }
     }
 
@@ -78,6 +102,33 @@ namespace decoder {
 //        }
 //    }
 
+    void TouchSequence::Clear() {
+        actions_.clear();
+        xs_.clear();
+        ys_.clear();
+        times_.clear();
+        lengths_.clear();
+        nearest_keys_.clear();
+        curvatures_.clear();
+        directions_.clear();
+        durations_.clear();
+        is_corners_.clear();
+        is_pauses_.clear();
+        tapped_codes_.clear();
+        transit_score_terms_.clear();
+        // The matrices keep their memory, and their rows are reset by the next
+        // UpdateProperties.
+        align_scores_.resize(0);
+        align_scores_16_.resize(0);
+        transit_scores_.resize(0);
+        transit_scores_16_.resize(0);
+        last_update_size_ = 0;
+        resampled_size_ = 0;
+        is_resampling_ = false;
+        computed_transit_scores_.store(0, std::memory_order_relaxed);
+        transit_score_entries_ = 0;
+    }
+
     void TouchSequence::AddPoint(const int action, const float x, const float y,
                                  const int time, const float sample_dist) {
         float length = 0;
@@ -105,6 +156,59 @@ namespace decoder {
         lengths_.push_back(length);
     }
 
+    int TouchSequence::ResamplePoints(const DecoderParams& params,
+                                      const float key_width) {
+        // The last point of a gesture in progress is only resampled once another
+        // point follows it, since AddPoint may still move it to the up event.
+        const int point_count = xs_.size();
+        const int end = IsMidGesture() ? point_count - 1 : point_count;
+        is_resampling_ = params.use_adaptive_resampling;
+        if (!is_resampling_ || end <= resampled_size_) {
+            resampled_size_ = std::max(resampled_size_, end);
+            return point_count;
+        }
+        const float max_distance = params.max_resample_distance_in_key_widths * key_width;
+        const float max_turn_angle = params.max_resample_turn_angle;
+        const float max_interval = params.max_resample_interval_in_millis;
+
+        // The kept points are compacted in place: point i is moved to kept, after
+        // dropping the previous kept point if the gesture goes straight through it
+        // from the kept point before it (the first point is never dropped).
+        int kept = resampled_size_;
+        int first_dropped = point_count;
+        for (int i = resampled_size_; i < point_count; ++i) {
+            if (i < end && kept >= 2) {
+                const int prev = kept - 2;
+                const int last = kept - 1;
+                const float turn_angle = MathUtils::GetAngleDiff(
+                        PointAngle(prev, last),
+                        MathUtils::GetAngle(xs_[last], ys_[last], xs_[i], ys_[i]));
+                if (turn_angle <= max_turn_angle &&
+                    MathUtils::Distance(xs_[prev], ys_[prev], xs_[i], ys_[i]) <=
+                    max_distance &&
+                    times_[i] - times_[prev] <= max_interval) {
+                    --kept;
+                    first_dropped = std::min(first_dropped, kept);
+                }
+            }
+            if (kept != i) {
+                actions_[kept] = actions_[i];
+                xs_[kept] = xs_[i];
+                ys_[kept] = ys_[i];
+                times_[kept] = times_[i];
+                lengths_[kept] = lengths_[i];
+            }
+            ++kept;
+        }
+        resampled_size_ = end - (point_count - kept);
+        actions_.resize(kept);
+        xs_.resize(kept);
+        ys_.resize(kept);
+        times_.resize(kept);
+        lengths_.resize(kept);
+        return first_dropped;
+    }
+
     float TouchSequence::PointDistance(const int i, const int j) const {
         return MathUtils::Distance(xs_[i], ys_[i], xs_[j], ys_[j]);
     }
@@ -138,14 +242,15 @@ namespace decoder {
     }
 
     bool TouchSequence::IsMidGesture() const {
-        return is_gesture_ && !actions_.empty();
-//        return is_gesture_ && !actions_.empty() &&
-//               actions_.back() != TouchPoint::ACTION_UP;
+        return is_gesture_ && !actions_.empty() && actions_.back() != TOUCH_UP;
     }
 
     void TouchSequence::UpdateProperties(const Keyboard& keyboard,
                                          const DecoderParams& params,
                                          bool is_three_decoder_enabled) {
+        const int first_dropped_index =
+                is_gesture_ ? ResamplePoints(params, keyboard.most_common_key_width())
+                            : xs_.size();
         const int point_count = xs_.size();
 
         nearest_keys_.resize(point_count);
@@ -155,174 +260,241 @@ namespace decoder {
         is_corners_.resize(point_count);
         is_pauses_.resize(point_count);
         num_keys_ = keyboard.num_keys();
-
-        const int start_index = std::max(0, last_update_size_ - kPointsToRecompute);
-        for (int i = start_index; i < point_count; ++i) {
-            nearest_keys_[i] = keyboard.GetNearestKeyCode(xs_[i], ys_[i]);
+        key_stride_ = simd::PaddedSize(num_keys_);
+        if (params.use_int16_spatial_scores != use_int16_scores_) {
+            // The scores of all of the points are stored in the other matrices.
+            use_int16_scores_ = params.use_int16_spatial_scores;
+            last_update_size_ = 0;
         }
-
-        if (is_gesture_) {
-            UpdateGestureGeometry(start_index, keyboard, params);
-            UpdateGestureScores(keyboard, params);
-        }
-
-        UpdateAlignScores(keyboard, params, is_three_decoder_enabled);
-        last_update_size_ = point_count;
-    }
-
-    void TouchSequence::UpdateGestureGeometry(const int start_index,
-                                              const Keyboard& keyboard_layout,
-                                              const DecoderParams& params) {
-        const int point_count = xs_.size();
-        if (point_count < 2) {
-            return;
-        }
-        const float corner_curvature =
-                params.min_curvature_for_corner;
-        const float pause_duration =
-                params.pause_duration_in_millis;
-
-        // Compute directions
-        for (int i = std::max(1, start_index); i < point_count - 1; ++i) {
-            directions_[i] = PointAngle(i - 1, i + 1);
-        }
-        directions_[0] = directions_[1];
-        directions_[point_count - 1] = directions_[point_count - 2];
-        // Compute curvatures
-        for (int i = std::max(1, start_index); i < point_count - 1; ++i) {
-            curvatures_[i] =
-                    MathUtils::GetAngleDiff(directions_[i - 1], directions_[i + 1]);
-        }
-        // Compute durations
-        for (int i = std::max(1, start_index); i < point_count - 1; ++i) {
-            durations_[i] = (times_[i + 1] - times_[i - 1]);
-        }
-        // Find pauses and corners
-        for (int i = std::max(2, start_index); i < point_count - 1; ++i) {
-            is_pauses_[i] = durations_[i] >= pause_duration &&
-                            durations_[i] > durations_[i - 1] &&
-                            durations_[i] >= durations_[i + 1];
-            is_corners_[i] = curvatures_[i] >= corner_curvature &&
-                             curvatures_[i] > curvatures_[i - 1] &&
-                             curvatures_[i] >= curvatures_[i + 1];
-        }
-    }
-
-    //TODO: calculate spatial (transit, align) scores for gesture input.
-    void TouchSequence::UpdateGestureScores(const Keyboard& keyboard_layout,
-                                            const DecoderParams& params) {
-        const float key_sigma = params.key_error_sigma;
-        const float direction_sigma = params.direction_error_sigma;
+        ResizeScoreMatrices(keyboard);
+        score_kernels::SetKeyCenters(keyboard, is_three_decoder_enabled,
+                                     &key_centers_, &wide_keys_);
+        // The grid has the same wide keys as the centers without the three
+        // decoder.
+        align_score_grid_ = params.use_align_score_grid && !is_three_decoder_enabled
+                            ? keyboard.align_score_grid()
+                            : nullptr;
+
+        const float corner_curvature = params.min_curvature_for_corner;
+        const float pause_duration = params.pause_duration_in_millis;
         const float skip_pause_score = params.skip_pause_score;
         const float skip_corner_score = params.skip_corner_score;
-        const float key_width = keyboard_layout.most_common_key_width();
-        const int num_keys = keyboard_layout.num_keys();
-        const int point_count = xs_.size();
-
-        transit_scores_.resize(point_count);
-        align_scores_.resize(point_count);
-
-        const int start_index = std::max(0, last_update_size_ - kPointsToRecompute);
+        const float key_width = keyboard.most_common_key_width();
 
         // These variables are defined to accelerate the calculation process.
-        const int transit_score_count = num_keys * num_keys;
-        const float root_direction_error_weight = sqr(1 / direction_sigma);
+        const float root_direction_error_weight =
+                sqr(1 / params.direction_error_sigma);
         const float direction_error_weight_scale =
                 root_direction_error_weight / key_width;
+        const float spatial_model_weight = .7f;
+        const float distance_weight =
+                spatial_model_weight / (key_width * params.key_error_sigma);
 
-        for (int i = start_index; i < point_count; ++i) {
-            const float direction_error_weight =
-                    (i == 0)
-                    ? root_direction_error_weight
-                    : (lengths_[i] - lengths_[i - 1]) * direction_error_weight_scale;
-            transit_scores_[i].resize(transit_score_count);
-            const float pause_score = is_pauses_[i] ? skip_pause_score : 0.0;
-            const float corner_score =
-                    is_corners_[i] ? curvatures_[i] * skip_corner_score : 0.0;
-            for (int k1 = 0; k1 < num_keys; ++k1) {
-                for (int k2 = 0; k2 < num_keys; ++k2) {
-                    if (k1 != k2) {
-                        const float ideal_direction =
-                                keyboard_layout.KeyToKeyDirectionByIndex(k1, k2);
-                        const float direction_error = std::min(
-                                PI / 4, MathUtils::GetAngleDiff(directions_[i], ideal_direction));
-                        const float direction_score =
-                                -sqr(direction_error) * direction_error_weight;
-                        set_transit_score(i, k1, k2,
-                                          direction_score + pause_score + corner_score);
-                    }
-                }
+        // Dropping a point also changes the properties of the kPointsToRecompute
+        // points before it.
+        const int start_index = std::max(
+                0, std::min(last_update_size_, first_dropped_index) - kPointsToRecompute);
+        if (is_three_decoder_enabled) {
+            for (int i = 0; i < start_index; ++i) {
+                UpdateAlignScores(i, keyboard, distance_weight);
             }
         }
 
-        // FOR INVISIBLE GESTURE KEYBOARD
-        const float spatial_model_weight = .7f;
-        const float distance_weight = 1 * spatial_model_weight / (key_width * key_sigma);
-        for (int i = start_index; i < point_count; ++i) {
-            align_scores_[i].resize(num_keys);
-            const float x = xs_[i];
-            const float y = ys_[i];
-            for (int k1 = 0; k1 < num_keys; ++k1) {
-                const char key_code = keyboard_layout.GetKeyCode(k1);
-                const float score =
-                        -sqr(keyboard_layout.PointToKeyDistanceByIndex(x, y, k1) *
-                             distance_weight);
-                set_align_score(i, k1, score);
+        // The properties of a point are updated in a single sweep over the
+        // updated points. Since the geometry of a point depends on its neighbors,
+        // each property is computed one point behind the properties it depends on:
+        // at point i, the sweep computes the nearest key, alignment scores,
+        // direction and duration of point i, the curvature of point i - 1 (from the
+        // directions of points i - 2 and i), and the pause, corner and transit
+        // score terms of point i - 2 (from the curvatures and durations of points
+        // i - 3 to i - 1). The curvatures and durations of the first and last
+        // points, and their pauses and corners, are not defined.
+        const int last = point_count - 1;
+        for (int i = start_index; i <= last + 2; ++i) {
+            if (i <= last) {
+                nearest_keys_[i] = keyboard.GetNearestKeyCode(xs_[i], ys_[i]);
+                UpdateAlignScores(i, keyboard, distance_weight);
+            }
+            if (!is_gesture_) {
+                continue;
+            }
+
+            // Directions and durations.
+            if (i >= 1 && i < last) {
+                directions_[i] = PointAngle(i - 1, i + 1);
+                durations_[i] = (times_[i + 1] - times_[i - 1]);
+                if (i == 1) {
+                    directions_[0] = directions_[1];
+                }
+            }
+            if (i == last && last >= 1) {
+                if (last == 1) {
+                    directions_[0] = directions_[1];
+                }
+                directions_[last] = directions_[last - 1];
+                // The last point may have taken the place of a dropped point (see
+                // ResamplePoints), whose properties are not defined for it.
+                curvatures_[last] = 0;
+                durations_[last] = 0;
+                is_corners_[last] = false;
+                is_pauses_[last] = false;
+            }
+
+            // Curvatures.
+            const int curvature_index = i - 1;
+            if (curvature_index >= std::max(1, start_index) && curvature_index < last) {
+                curvatures_[curvature_index] =
+                        MathUtils::GetAngleDiff(directions_[curvature_index - 1],
+                                                directions_[curvature_index + 1]);
+            }
+
+            // Pauses, corners and transit score terms.
+            const int j = i - 2;
+            if (j >= std::max(2, start_index) && j < last) {
+                is_pauses_[j] = durations_[j] >= pause_duration &&
+                                durations_[j] > durations_[j - 1] &&
+                                durations_[j] >= durations_[j + 1];
+                is_corners_[j] = curvatures_[j] >= corner_curvature &&
+                                 curvatures_[j] > curvatures_[j - 1] &&
+                                 curvatures_[j] >= curvatures_[j + 1];
+            }
+            if (j >= start_index && j <= last) {
+                // Only the terms that are shared by all key pairs are computed
+                // here. The transit scores of the point are computed by
+                // ComputeTransitScore when they are first read.
+                TransitScoreTerms& terms = transit_score_terms_[j];
+                terms.direction_error_weight =
+                        (j == 0)
+                        ? root_direction_error_weight
+                        : (lengths_[j] - lengths_[j - 1]) * direction_error_weight_scale;
+                terms.pause_score = is_pauses_[j] ? skip_pause_score : 0.0;
+                terms.corner_score =
+                        is_corners_[j] ? curvatures_[j] * skip_corner_score : 0.0;
+                for (int row = j * num_keys_; row < (j + 1) * num_keys_; ++row) {
+                    transit_row_states_[row].store(kTransitRowNotComputed,
+                                                   std::memory_order_relaxed);
+                }
+                transit_score_entries_ += num_keys_ * num_keys_;
             }
         }
+        last_update_size_ = point_count;
     }
 
-    void TouchSequence::UpdateAlignScores(const Keyboard& keyboard_layout,
-                                          const DecoderParams& params,
-                                          bool is_three_decoder_enabled) {
-        const float key_sigma = is_gesture_
-                                ? params.key_error_sigma
-                                : params.key_error_sigma;
-        const float key_width = keyboard_layout.most_common_key_width();
-        const int num_keys = keyboard_layout.num_keys();
+    void TouchSequence::ResizeScoreMatrices(const Keyboard& keyboard_layout) {
         const int point_count = xs_.size();
+        if (use_int16_scores_) {
+            align_scores_16_.resize(point_count * key_stride_);
+            float_scores_.resize(key_stride_);
+        } else {
+            align_scores_.resize(point_count * key_stride_);
+        }
+        if (!is_gesture_) {
+            return;
+        }
 
-        align_scores_.resize(point_count);
+        keyboard_ = &keyboard_layout;
+        transit_score_terms_.resize(point_count);
 
-        int start_index = std::max(0, last_update_size_ - kPointsToRecompute);
-        if (is_three_decoder_enabled) {
-            start_index = 0;
+        // Each point has a row of transit scores for each first key.
+        const int row_count = point_count * num_keys_;
+        if (use_int16_scores_) {
+            transit_scores_16_.resize(row_count * key_stride_);
+        } else {
+            transit_scores_.resize(row_count * key_stride_);
         }
-
-        const float spatial_model_weight = .7f;
-        const float distance_weight = spatial_model_weight / (key_width * key_sigma);
-
-        double keyboard_count = 5;
-        vector<double> keyboard_range(keyboard_count);
-        double keyboard_q_center = keyboard_layout.center_ys(0);
-        double keyboard_range_step = 50; // from user study
-        for (int i = 0; i < keyboard_count; i++) {
-            keyboard_range[i] = keyboard_q_center + (i - 2) * keyboard_range_step;
+        if (row_count > transit_row_capacity_) {
+            const int capacity = std::max(row_count, 2 * transit_row_capacity_);
+            std::unique_ptr<std::atomic<uint8>[]> states(
+                    new std::atomic<uint8>[capacity]);
+            for (int row = 0; row < capacity; ++row) {
+                states[row].store(
+                        row < transit_row_capacity_
+                        ? transit_row_states_[row].load(std::memory_order_relaxed)
+                        : kTransitRowNotComputed,
+                        std::memory_order_relaxed);
+            }
+            transit_row_states_ = std::move(states);
+            transit_row_capacity_ = capacity;
         }
+    }
 
-        for (int i = start_index; i < point_count; ++i) {
-            align_scores_[i].resize(num_keys);
-            const float x = xs_[i];
-            const float y = ys_[i];
-            for (int k = 0; k < num_keys; ++k) {
-                const char key_code = keyboard_layout.GetKeyCode(k);
-                float score;
-                // FOR INVISIBLE GESTURE KEYBOARD
-                if (is_three_decoder_enabled) {
-                    score = -sqr(keyboard_layout.PointToKeyDistanceByIndex(x, y, k) *
-                                         distance_weight);
-                    set_align_score(i, k, score);
-                } else {
-                    if ((key_code <= (int) 'z' && key_code >= (int) 'a')) {
-                        score = -sqr(keyboard_layout.PointToKeyDistanceByRange(x, y, k, keyboard_range, keyboard_count) *
-                                     distance_weight);
-                    } else {
-                        score = -sqr(keyboard_layout.PointToKeyDistanceByIndex(x, y, k) *
-                                     distance_weight);
-                    }
-                    set_align_score(i, k, score);
-                }
+    float TouchSequence::ComputeTransitScore(const int i, const KeyId key_1,
+                                             const KeyId key_2) const {
+        const TransitScoreTerms& terms = transit_score_terms_[i];
+        const float* ideal_directions = keyboard_->KeyToKeyDirectionsByIndex(key_1);
+        const int row = i * num_keys_ + key_1;
+        const int offset = row * key_stride_;
+        uint8 state = kTransitRowNotComputed;
+        if (!transit_row_states_[row].compare_exchange_strong(
+                state, kTransitRowComputing, std::memory_order_acquire)) {
+            if (state == kTransitRowComputed) {
+                return stored_transit_score(offset + key_2);
+            }
+            // Another thread is computing the row, so this only computes the
+            // requested score, in the same way.
+            float score = 0;
+            if (key_1 != key_2) {
+                score_kernels::TransitScores(directions_[i], ideal_directions + key_2,
+                                             /* num_keys = */ 1,
+                                             terms.direction_error_weight,
+                                             terms.pause_score, terms.corner_score,
+                                             &score);
             }
+            if (use_int16_scores_) {
+                int16 quantized_score;
+                score_kernels::QuantizeScores(&score, 1, &quantized_score);
+                score = score_kernels::WidenScore(quantized_score);
+            }
+            return score;
+        }
+        if (use_int16_scores_) {
+            // Since this may run on several threads, the float scores are kept on
+            // the stack, and converted a block of keys at a time.
+            static constexpr int kBlockSize = 64;
+            float scores[kBlockSize];
+            for (int k = 0; k < num_keys_; k += kBlockSize) {
+                const int block_size = std::min(kBlockSize, num_keys_ - k);
+                score_kernels::TransitScores(directions_[i], ideal_directions + k,
+                                             block_size, terms.direction_error_weight,
+                                             terms.pause_score, terms.corner_score,
+                                             scores);
+                score_kernels::QuantizeScores(scores, block_size,
+                                              &transit_scores_16_[offset + k]);
+            }
+            // The transit score between a key and itself is not defined, and is 0.
+            transit_scores_16_[offset + key_1] = 0;
+        } else {
+            float* scores = &transit_scores_[offset];
+            score_kernels::TransitScores(directions_[i], ideal_directions, num_keys_,
+                                         terms.direction_error_weight,
+                                         terms.pause_score, terms.corner_score, scores);
+            // The transit score between a key and itself is not defined, and is 0.
+            scores[key_1] = 0;
+        }
+        transit_row_states_[row].store(kTransitRowComputed, std::memory_order_release);
+        computed_transit_scores_.fetch_add(num_keys_, std::memory_order_relaxed);
+        return stored_transit_score(offset + key_2);
+    }
+
+    void TouchSequence::UpdateAlignScores(const int i,
+                                          const Keyboard& keyboard_layout,
+                                          const float distance_weight) {
+        const float x = xs_[i];
+        const float y = ys_[i];
+        float* scores = use_int16_scores_ ? float_scores_.data()
+                                          : &align_scores_[i * key_stride_];
+        if (align_score_grid_ != nullptr && align_score_grid_->Contains(x, y)) {
+            align_score_grid_->AlignScores(x, y, distance_weight, scores);
+        } else {
+            score_kernels::AlignScores(x, y, key_centers_, distance_weight, scores);
+        }
+        for (const KeyId key : wide_keys_) {
+            scores[key] = -sqr(keyboard_layout.PointToKeyDistanceByIndex(x, y, key) *
+                               distance_weight);
+        }
+        if (use_int16_scores_) {
+            score_kernels::QuantizeScores(scores, num_keys_,
+                                          &align_scores_16_[i * key_stride_]);
         }
     }
 
@@ -7,21 +7,34 @@
 //   decoding, such as directions, curvatures, locations of pauses and corners,
 //   etc.
 //
-//   In addition, this class pre-computes two scores used in decoding:
+//   In addition, this class computes two scores used in decoding:
 //   - Alignment scores between each point and each key
-//     (calculated based on squared Euclidean error)
+//     (calculated based on squared Euclidean error), which are pre-computed
 //   - In-transit scores between each point and each pair of keys
-//     (calculated based on the squared direction error)
+//     (calculated based on the squared direction error), which are computed
+//     on first use, since the decoder only reads the few key pairs that its
+//     tokens are in transit between
+//   Both are computed for all of the keys of a point (or a point and a first
+//   key) at once by the vectorized kernels in score-kernels.h, and stored in
+//   flat, cache-line aligned matrices that are kept across Clear(). With
+//   DecoderParams::use_int16_spatial_scores, the matrices store 16-bit fixed
+//   point scores, which are widened to floats when they are read.
 
 #ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_TOUCH_SEQUENCE_H_
 #define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_TOUCH_SEQUENCE_H_
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "base/integral_types.h"
 #include "base/logging.h"
 #include "keyboardSetting/keyboard.h"
 #include "DecoderParams.h"
+#include "score-kernels.h"
+#include "simd.h"
 //#include "testing/production_stub/public/gunit_prod.h"
 
 namespace keyboard {
@@ -32,6 +45,19 @@ namespace decoder {
     class TouchSequence {
     public:
         enum TouchAction {TOUCH_DOWN, TOUCH_MOVE, TOUCH_UP};
+
+        // Counters for the transit scores of the touch sequence. These are
+        // cumulative over the updates of the sequence.
+        struct TransitScoreStats {
+            // The number of transit scores (point and key pair) that were invalidated
+            // by the updates, i.e. the number that pre-computing would have computed.
+            int64 entries = 0;
+            // The number of transit scores computed. These are computed for all of
+            // the second keys of a point and first key at once, when any of them
+            // is first read.
+            int64 computed = 0;
+        };
+
 // The number of training points to recompute per update, since some of the
         // metrics calculated (like direction and curvature) depend on future points.
         static constexpr int kPointsToRecompute = 3;
@@ -41,9 +67,19 @@ namespace decoder {
                 : is_gesture_(is_gesture),
                   pointer_id_(0),
                   last_update_size_(0),
-                  num_keys_(0) {}
-
-        TouchSequence(const vector<int> &xs, vector<int> &ys, vector<int> &times,
+                  resampled_size_(0),
+                  is_resampling_(false),
+                  num_keys_(0),
+                  key_stride_(0),
+                  use_int16_scores_(false),
+                  align_score_grid_(nullptr),
+                  keyboard_(nullptr),
+                  transit_row_capacity_(0),
+                  computed_transit_scores_(0),
+                  transit_score_entries_(0) {}
+
+        TouchSequence(const vector<int> &xs, const vector<int> &ys,
+                      const vector<int> &times,
                       const int pointer_id,
                       const float gesture_sample_dist);
 //        // Create a TouchSequence from the input TouchData. If the input is a gesture,
@@ -60,6 +96,18 @@ namespace decoder {
 //        void ExtendTouchPoints(const TouchData& touch_data, const int start_index,
 //                               const float gesture_sample_dist);
 
+        // Extends the TouchSequence by appending the given points. The first point
+        // of an empty sequence is treated as the touch down event. If is_final is
+        // true, the last point is treated as the touch up event (or, if no points
+        // are given, the last point already in the sequence).
+        void ExtendTouchPoints(const vector<int>& xs, const vector<int>& ys,
+                               const vector<int>& times, const bool is_final,
+                               const float gesture_sample_dist);
+
+        // Removes all of the points, to reuse the sequence (and the memory of its
+        // score matrices) for another gesture.
+        void Clear();
+
         // Adds a point to the TouchSequence. The new point will only be added if it
         // its distance to the previous point is greater than sample_dist.
         void AddPoint(const int action, const float x, const float y, const int time,
@@ -67,7 +115,12 @@ namespace decoder {
 
         // Update the geometric properties of this TouchSequence. Note that if the
         // touch sequence was previously updated and then extended, this method only
-        // needs to update the newly added points.
+        // needs to update the newly added points (and the last kPointsToRecompute
+        // points before them), in a single pass over the points that computes their
+        // geometry, alignment scores and transit score terms. With
+        // DecoderParams::use_adaptive_resampling, the points of a gesture that
+        // were added since the last update are resampled first (see
+        // ResamplePoints).
         // These properties are used during the decoding process, and some depend on
         // the keyboard and params.
         void UpdateProperties(const Keyboard& keyboard, const DecoderParams& params,
@@ -142,7 +195,9 @@ namespace decoder {
 
         // Returns the likelihood that point [i] in the gesture is in-transit between
         // the key indices key_1 and key_2 on the keyboard (see
-        // Keyboard::GetKeyIndex).
+        // Keyboard::GetKeyIndex). The scores from key_1 to all keys are computed
+        // on the first call for the point and key_1. This may be called from
+        // several threads at once, but not concurrently with UpdateProperties.
         inline float transit_score(const int i, const KeyId key_1,
                                    const KeyId key_2) const {
                     DCHECK_GE(i, 0);
@@ -151,7 +206,20 @@ namespace decoder {
                     DCHECK_LT(key_1, num_keys_);
                     DCHECK_GE(key_2, 0);
                     DCHECK_LT(key_2, num_keys_);
-            return transit_scores_[i][key_2 * num_keys_ + key_1];
+            const int row = i * num_keys_ + key_1;
+            if (transit_row_states_[row].load(std::memory_order_acquire) ==
+                kTransitRowComputed) {
+                return stored_transit_score(row * key_stride_ + key_2);
+            }
+            return ComputeTransitScore(i, key_1, key_2);
+        }
+
+        // Returns the counters for the transit scores.
+        TransitScoreStats transit_score_stats() const {
+            TransitScoreStats stats;
+            stats.entries = transit_score_entries_;
+            stats.computed = computed_transit_scores_.load(std::memory_order_relaxed);
+            return stats;
         }
 
         // Returns likelihood that point [i] in the touch sequence represents a tap or
@@ -161,39 +229,66 @@ namespace decoder {
                     DCHECK_LT(i, size());
                     DCHECK_GE(key, 0);
                     DCHECK_LT(key, num_keys_);
-            return align_scores_[i][key];
+            const int index = i * key_stride_ + key;
+            return use_int16_scores_ ? score_kernels::WidenScore(align_scores_16_[index])
+                                     : align_scores_[index];
         }
 
         // Returns whether the touch sequence ends at the middle of a gesture (before
         // reaching the final up event).
         bool IsMidGesture() const;
 
-    private:
-        void UpdateGestureGeometry(const int start_index,
-                                   const Keyboard& keyboard_layout,
-                                   const DecoderParams& params);
-
-        // Updates the pre-computed transit scores between each point and each pair of
-        // keys on the keyboard. See transit_score(...) for more details.
-        void UpdateGestureScores(const Keyboard& keyboard_layout,
-                                 const DecoderParams& params);
-
-        // Updates the pre-computed alignment scores between each point and each key.
-        // See align_score(...) for more details.
-        void UpdateAlignScores(const Keyboard& keyboard_layout,
-                               const DecoderParams& params,
-                               bool is_three_decoder_enabled);
-
-        inline void set_transit_score(const int i, const int key_index_1,
-                                      const int key_index_2, const float value) {
-            transit_scores_[i][key_index_2 * num_keys_ + key_index_1] = value;
+        // Returns the number of leading points whose properties will not change
+        // when more points are added. While a gesture is in progress, the last
+        // kPointsToRecompute points are still subject to recomputation (as well as
+        // the kPointsToRecompute points before the last resampled point, which may
+        // still be dropped, see ResamplePoints); once the up event has been added,
+        // all points are stable.
+        int StablePointCount() const {
+            if (!IsMidGesture()) {
+                return size();
+            }
+            const int end = is_resampling_ ? std::min(size(), resampled_size_ - 1)
+                                           : size();
+            return std::max(0, end - kPointsToRecompute);
         }
 
-        inline void set_align_score(const int i, const int key_index,
-                                    const float value) {
-            align_scores_[i][key_index] = value;
+    private:
+        // Drops the points of a gesture that the gesture goes straight through
+        // (see DecoderParams::use_adaptive_resampling). Each point is resampled
+        // once, in order, when it is followed by another point (or is the up
+        // event): if the point before it can be dropped in favor of it, it takes
+        // its place. Only the last resampled point of the previous update (or a
+        // later one) can be dropped, and StablePointCount holds back the points
+        // whose properties that changes, so a gesture is resampled and decoded
+        // the same way however its points are split between the updates. Does
+        // nothing but mark the points as resampled if the option is disabled.
+        //
+        // Returns:
+        //   The index of the first dropped point, or size() if none were dropped.
+        int ResamplePoints(const DecoderParams& params, float key_width);
+
+        // Resizes the score matrices (and the transit score terms) for the current
+        // points, keeping the scores of the points that are not updated.
+        void ResizeScoreMatrices(const Keyboard& keyboard_layout);
+
+        // Computes and stores the transit scores of the given point from key_1 to
+        // all keys, unless another thread is already doing so, and returns the
+        // score to key_2.
+        float ComputeTransitScore(int i, KeyId key_1, KeyId key_2) const;
+
+        // Returns the transit score at the given index of the transit score matrix.
+        float stored_transit_score(const int index) const {
+            return use_int16_scores_
+                   ? score_kernels::WidenScore(transit_scores_16_[index])
+                   : transit_scores_[index];
         }
 
+        // Updates the pre-computed alignment scores between the i-th point and each
+        // key. See align_score(...) for more details.
+        void UpdateAlignScores(int i, const Keyboard& keyboard_layout,
+                               float distance_weight);
+
         const bool is_gesture_;
 
         int pointer_id_;
@@ -201,8 +296,21 @@ namespace decoder {
         // The size of the touch_sequence when its properties were last updated.
         int last_update_size_;
 
+        // The number of leading points that have been resampled, and whether the
+        // last update resampled them adaptively.
+        int resampled_size_;
+        bool is_resampling_;
+
         int num_keys_;
 
+        // The stride of the rows of the score matrices, i.e. num_keys_ rounded up
+        // to a whole number of cache lines.
+        int key_stride_;
+
+        // Whether the score matrices store 16-bit fixed point scores (in the *_16_
+        // matrices) instead of floats.
+        bool use_int16_scores_;
+
         vector<int> actions_;
         vector<float> xs_;
         vector<float> ys_;
@@ -217,8 +325,53 @@ namespace decoder {
         vector<bool> is_corners_;
         vector<bool> is_pauses_;
 
-        vector<vector<float>> align_scores_;
-        vector<vector<float>> transit_scores_;
+        // The alignment scores of each point, in rows of key_stride_ floats.
+        simd::AlignedFloatArray align_scores_;
+        simd::AlignedArray<int16> align_scores_16_;
+
+        // The float scores of a point, for converting them to 16-bit scores.
+        simd::AlignedFloatArray float_scores_;
+
+        // The centers of the keys for the alignment scores, and the keys whose
+        // distances the kernel does not handle (see score_kernels::SetKeyCenters).
+        score_kernels::KeyCenters key_centers_;
+        vector<KeyId> wide_keys_;
+
+        // The grid to interpolate the alignment scores from instead, if any.
+        const AlignScoreGrid* align_score_grid_;
+
+        // The states of the rows of transit scores.
+        static constexpr uint8 kTransitRowNotComputed = 0;
+        static constexpr uint8 kTransitRowComputing = 1;
+        static constexpr uint8 kTransitRowComputed = 2;
+
+        // The terms of the transit score of each point that do not depend on the
+        // key pair (see UpdateProperties).
+        struct TransitScoreTerms {
+            float direction_error_weight;
+            float pause_score;
+            float corner_score;
+        };
+
+        // The keyboard of the last update, whose key-to-key directions are used to
+        // compute the transit scores. It must outlive the reads of the scores.
+        const Keyboard* keyboard_;
+
+        vector<TransitScoreTerms> transit_score_terms_;
+
+        // The transit scores of each point, in a row of key_stride_ floats for
+        // each first key, i.e. the score of point i from key_1 to key_2 is at
+        // (i * num_keys_ + key_1) * key_stride_ + key_2. The rows are computed on
+        // first use, and since the beam may be expanded by several threads at
+        // once, the state of each row is atomic: the thread that claims a row
+        // publishes it with a release store, and the others compute their scores
+        // on their own until then.
+        mutable simd::AlignedFloatArray transit_scores_;
+        mutable simd::AlignedArray<int16> transit_scores_16_;
+        std::unique_ptr<std::atomic<uint8>[]> transit_row_states_;
+        int transit_row_capacity_;
+        mutable std::atomic<int64> computed_transit_scores_;
+        int64 transit_score_entries_;
 
         vector<char32> tapped_codes_;
     };
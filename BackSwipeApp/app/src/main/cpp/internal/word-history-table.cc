@@ -0,0 +1,69 @@
+#include "word-history-table.h"
+
+#include <algorithm>
+
+namespace keyboard {
+namespace decoder {
+
+    WordHistoryTable::WordHistoryTable()
+            : term_ids_(), terms_(), nodes_(), history_ids_(), free_ids_(), epoch_(1) {}
+
+    int WordHistoryTable::InternTerm(const Utf8String& term) {
+        const auto inserted = term_ids_.insert({term, static_cast<int>(terms_.size())});
+        if (inserted.second) {
+            terms_.push_back(&inserted.first->first);
+        }
+        return inserted.first->second;
+    }
+
+    int WordHistoryTable::GetOrAdd(const int parent_id, const int term_id) {
+        DCHECK_GE(term_id, 0);
+        const auto inserted = history_ids_.insert({Key(parent_id, term_id), 0});
+        if (!inserted.second) {
+            return inserted.first->second;
+        }
+        const Node new_node = {parent_id, term_id, length(parent_id) + 1, 0, true};
+        int id;
+        if (!free_ids_.empty()) {
+            id = free_ids_.back();
+            free_ids_.pop_back();
+            nodes_[id] = new_node;
+        } else {
+            id = nodes_.size();
+            nodes_.push_back(new_node);
+        }
+        inserted.first->second = id;
+        return id;
+    }
+
+    void WordHistoryTable::GetTermIds(int history_id, std::vector<int>* term_ids) const {
+        const size_t start = term_ids->size();
+        term_ids->resize(start + length(history_id));
+        for (size_t i = term_ids->size(); i > start; --i) {
+            const Node& history = node(history_id);
+            (*term_ids)[i - 1] = history.term_id;
+            history_id = history.parent_id;
+        }
+    }
+
+    void WordHistoryTable::Sweep() {
+        for (size_t id = 0; id < nodes_.size(); ++id) {
+            Node& history = nodes_[id];
+            if (history.live && history.mark != epoch_) {
+                history.live = false;
+                history_ids_.erase(Key(history.parent_id, history.term_id));
+                free_ids_.push_back(id);
+            }
+        }
+    }
+
+    void WordHistoryTable::Clear() {
+        term_ids_.clear();
+        terms_.clear();
+        nodes_.clear();
+        history_ids_.clear();
+        free_ids_.clear();
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
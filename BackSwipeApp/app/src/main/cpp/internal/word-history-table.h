@@ -0,0 +1,132 @@
+// Description:
+//   The word histories (i.e., sequences of previously decoded terms) of the
+//   tokens in a decoding session. Histories are hash-consed into a trie: each
+//   history is a (parent history, term) node, so appending a term to a history
+//   and looking up an existing history are O(1), and all histories that share a
+//   prefix share its nodes. Terms are interned and referenced by id.
+//
+//   Unused histories are garbage collected with mark bits: BeginMark() starts a
+//   new mark phase, Mark() marks the histories (and their ancestors) that are
+//   still referenced, and Sweep() frees the rest, whose ids are then reused.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_WORD_HISTORY_TABLE_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_WORD_HISTORY_TABLE_H_
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/macros.h"
+
+namespace keyboard {
+namespace decoder {
+
+    class WordHistoryTable {
+    public:
+        // The id of the empty history, i.e., of tokens in the first term.
+        static constexpr int kNoHistory = -1;
+
+        WordHistoryTable();
+
+        // Returns the id of the given term, adding it to the table if needed.
+        int InternTerm(const Utf8String& term);
+
+        // Returns the term for the given id. The reference is valid until Clear().
+        const Utf8String& term(const int term_id) const {
+            DCHECK_GE(term_id, 0);
+            DCHECK_LT(term_id, static_cast<int>(terms_.size()));
+            return *terms_[term_id];
+        }
+
+        // Returns the id of the history formed by appending the given term to the
+        // given parent history (or kNoHistory), adding it if needed.
+        int GetOrAdd(int parent_id, int term_id);
+
+        // Appends the term ids of the given history (if any) to term_ids, from the
+        // oldest to the most recent term.
+        void GetTermIds(int history_id, std::vector<int>* term_ids) const;
+
+        // The number of terms in the given history.
+        int length(const int history_id) const {
+            return history_id == kNoHistory ? 0 : node(history_id).length;
+        }
+
+        // Starts a new garbage collection phase, in which all histories are
+        // unmarked.
+        void BeginMark() {
+            if (++epoch_ == 0) {
+                for (auto& node : nodes_) {
+                    node.mark = 0;
+                }
+                epoch_ = 1;
+            }
+        }
+
+        // Marks the given history and all of its ancestors as referenced.
+        void Mark(int history_id) {
+            while (history_id != kNoHistory && nodes_[history_id].mark != epoch_) {
+                nodes_[history_id].mark = epoch_;
+                history_id = nodes_[history_id].parent_id;
+            }
+        }
+
+        // Frees all live histories that have not been marked since the last call to
+        // BeginMark().
+        void Sweep();
+
+        // The number of live histories.
+        int size() const { return nodes_.size() - free_ids_.size(); }
+
+        // Removes all histories and terms.
+        void Clear();
+
+    private:
+        struct Node {
+            int32 parent_id;
+            int32 term_id;
+            int32 length;
+            // The epoch in which the node was last marked.
+            uint32 mark;
+            // Whether the node is in use (i.e., not on the free list).
+            bool live;
+        };
+
+        static uint64 Key(const int parent_id, const int term_id) {
+            return (static_cast<uint64>(static_cast<uint32>(parent_id)) << 32) |
+                   static_cast<uint32>(term_id);
+        }
+
+        const Node& node(const int history_id) const {
+            DCHECK_GE(history_id, 0);
+            DCHECK_LT(history_id, static_cast<int>(nodes_.size()));
+            DCHECK(nodes_[history_id].live) << "No word history found for id "
+                                            << history_id;
+            return nodes_[history_id];
+        }
+
+        // The interned terms and their ids. terms_ points to the keys of term_ids_,
+        // which are stable since unordered_map never moves its elements.
+        std::unordered_map<Utf8String, int> term_ids_;
+        std::vector<const Utf8String*> terms_;
+
+        // The history nodes, indexed by id, and the ids of the live nodes by their
+        // (parent_id, term_id) key.
+        std::vector<Node> nodes_;
+        std::unordered_map<uint64, int32> history_ids_;
+
+        // The ids of the freed nodes, to be reused by GetOrAdd.
+        std::vector<int32> free_ids_;
+
+        // The current mark epoch.
+        uint32 epoch_;
+
+        DISALLOW_COPY_AND_ASSIGN(WordHistoryTable);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_WORD_HISTORY_TABLE_H_
@@ -0,0 +1,89 @@
+#include "worker-pool.h"
+
+#include "base/logging.h"
+
+namespace keyboard {
+namespace decoder {
+
+    WorkerPool::WorkerPool(const int num_threads)
+            : threads_(),
+              mutex_(),
+              work_available_(),
+              work_done_(),
+              task_(nullptr),
+              num_tasks_(0),
+              next_task_(0),
+              pending_tasks_(0),
+              batch_(0),
+              stopping_(false) {
+        CHECK_GE(num_threads, 1);
+        threads_.reserve(num_threads - 1);
+        for (int i = 1; i < num_threads; ++i) {
+            threads_.emplace_back(&WorkerPool::ThreadLoop, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::Run(const int num_tasks,
+                         const std::function<void(int)>& task) {
+        if (num_tasks <= 0) {
+            return;
+        }
+        if (threads_.empty() || num_tasks == 1) {
+            for (int i = 0; i < num_tasks; ++i) {
+                task(i);
+            }
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        DCHECK(task_ == nullptr) << "WorkerPool::Run is not reentrant.";
+        task_ = &task;
+        num_tasks_ = num_tasks;
+        next_task_ = 0;
+        pending_tasks_ = num_tasks;
+        ++batch_;
+        work_available_.notify_all();
+        RunTasks(&lock);
+        work_done_.wait(lock, [this] { return pending_tasks_ == 0; });
+        task_ = nullptr;
+    }
+
+    void WorkerPool::ThreadLoop() {
+        uint64 last_batch = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_available_.wait(
+                    lock, [&] { return stopping_ || batch_ != last_batch; });
+            if (stopping_) {
+                return;
+            }
+            last_batch = batch_;
+            RunTasks(&lock);
+        }
+    }
+
+    void WorkerPool::RunTasks(std::unique_lock<std::mutex>* lock) {
+        while (task_ != nullptr && next_task_ < num_tasks_) {
+            const int index = next_task_++;
+            const std::function<void(int)>& task = *task_;
+            lock->unlock();
+            task(index);
+            lock->lock();
+            if (--pending_tasks_ == 0) {
+                work_done_.notify_all();
+            }
+        }
+    }
+
+}  // namespace decoder
+}  // namespace keyboard
@@ -0,0 +1,72 @@
+// Description:
+//   A small fork-join thread pool for splitting the decoder's work across cores.
+//   Run() hands out a fixed number of tasks to the pool's threads (including the
+//   calling thread), and blocks until all of them are done. The threads are
+//   started once and parked between calls, so that per-frame work can be
+//   dispatched without creating threads.
+
+#ifndef INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_WORKER_POOL_H_
+#define INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/macros.h"
+
+namespace keyboard {
+namespace decoder {
+
+    class WorkerPool {
+    public:
+        // Creates a pool of num_threads threads, i.e. the calling thread and
+        // num_threads - 1 background threads.
+        explicit WorkerPool(int num_threads);
+
+        ~WorkerPool();
+
+        // The number of threads that run tasks, including the calling thread.
+        int num_threads() const { return threads_.size() + 1; }
+
+        // Runs task(i) for every i in [0, num_tasks), and returns when all of the
+        // calls have returned. The calls run concurrently, in no particular order
+        // and on any of the pool's threads. Run() must not be called concurrently,
+        // nor from within a task.
+        void Run(int num_tasks, const std::function<void(int)>& task);
+
+    private:
+        // The loop of the background threads.
+        void ThreadLoop();
+
+        // Runs the tasks of the current batch until there are none left.
+        // Must be called with mutex_ held, which is released while running tasks.
+        void RunTasks(std::unique_lock<std::mutex>* lock);
+
+        std::vector<std::thread> threads_;
+
+        std::mutex mutex_;
+        // Signalled when a new batch of tasks is available, or when stopping.
+        std::condition_variable work_available_;
+        // Signalled when the last task of the current batch is done.
+        std::condition_variable work_done_;
+
+        // The current batch. Guarded by mutex_.
+        const std::function<void(int)>* task_;
+        int num_tasks_;
+        int next_task_;
+        int pending_tasks_;
+        // Incremented for every batch, so that the background threads can tell a
+        // new batch from the one they have already worked on.
+        uint64 batch_;
+        bool stopping_;
+
+        DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+    };
+
+}  // namespace decoder
+}  // namespace keyboard
+
+#endif  // INPUTMETHOD_KEYBOARD_DECODER_INTERNAL_WORKER_POOL_H_
@@ -21,6 +21,8 @@ public class DecoderTools {
                                                   final byte[] filePath, final long offset, final long length);
     public static native void deleteDecoderNative();
     public static native DecoderResults decodeGesture(int[] xs, int[] ys, int[] times, int points_count, final byte[] prevWord);
+    public static native void startGesture(final byte[] prevWord);
+    public static native DecoderResults extendGesture(int[] xs, int[] ys, int[] times, int points_count, boolean isFinal);
 
     static native void setKeyboardLayoutNative(final long ptr, final int keyCount,
                                                final int mostCommonKeyWidth, final int mostCommonKeyHeight, final int keyboardWidth,